@@ -9,11 +9,12 @@
 
 #include "APS.h"
 
-APS::APS() :  isOpen{false}, deviceID_{-1}, handle_{nullptr}, channels_(4), samplingRate_{-1}, writeQueue_(0),
-				streaming_{false}, mymutex_{std::unique_ptr<std::mutex>(new std::mutex())} {}
+APS::APS() :  isOpen{false}, deviceID_{-1}, transport_{new FTDITransport()}, uploader_{new UploadEngine(*transport_)}, channels_(4), registerCheckInterval_{0}, bitUpdatesSinceCheck_{0}, registerCheckDeferred_{false}, samplingRate_{-1},
+				streaming_{false}, mymutex_{std::unique_ptr<std::mutex>(new std::mutex())}, updateDepth_{0}, pendingWaveforms_(), pendingLL_() {}
 
 APS::APS(int deviceID, string deviceSerial) :  isOpen{false}, deviceID_{deviceID}, deviceSerial_{deviceSerial},
-		handle_{nullptr}, samplingRate_{-1}, writeQueue_(0), streaming_{false}, mymutex_{std::unique_ptr<std::mutex>(new std::mutex())} {
+		transport_{FTDI::make_transport(deviceSerial)}, uploader_{new UploadEngine(*transport_)}, registerCheckInterval_{0}, bitUpdatesSinceCheck_{0}, registerCheckDeferred_{false}, samplingRate_{-1}, streaming_{false}, mymutex_{std::unique_ptr<std::mutex>(new std::mutex())},
+		updateDepth_{0}, pendingWaveforms_(), pendingLL_() {
 			channels_.reserve(4);
 			myBankBouncerThreads_.reserve(4);
 			for(size_t ct=0; ct<4; ct++){
@@ -22,10 +23,13 @@ APS::APS(int deviceID, string deviceSerial) :  isOpen{false}, deviceID_{deviceID
 			}
 			checksums_[FPGA1] = CheckSum();
 			checksums_[FPGA2] = CheckSum();
+			shadowRegs_[FPGA1] = vector<ShadowRegister>(NUM_SHADOW_REGS, ShadowRegister{0, false});
+			shadowRegs_[FPGA2] = vector<ShadowRegister>(NUM_SHADOW_REGS, ShadowRegister{0, false});
 };
 
-APS::APS(APS && other) : isOpen{other.isOpen}, deviceID_{other.deviceID_}, deviceSerial_{other.deviceSerial_}, handle_{other.handle_}, samplingRate_{other.samplingRate_},
-		writeQueue_{std::move(other.writeQueue_)}, streaming_{other.streaming_.load()}, mymutex_{std::move(other.mymutex_)}{
+APS::APS(APS && other) : isOpen{other.isOpen}, deviceID_{other.deviceID_}, deviceSerial_{other.deviceSerial_}, transport_{std::move(other.transport_)}, uploader_{std::move(other.uploader_)}, uploadCache_(std::move(other.uploadCache_)),
+		shadowRegs_{std::move(other.shadowRegs_)}, registerCheckInterval_{other.registerCheckInterval_}, bitUpdatesSinceCheck_{other.bitUpdatesSinceCheck_}, registerCheckDeferred_{other.registerCheckDeferred_}, samplingRate_{other.samplingRate_},
+		streaming_{other.streaming_.load()}, mymutex_{std::move(other.mymutex_)}, updateDepth_{other.updateDepth_}{
 	channels_.reserve(4);
 	myBankBouncerThreads_.reserve(4);
 	for(size_t ct=0; ct<4; ct++){
@@ -34,6 +38,8 @@ APS::APS(APS && other) : isOpen{other.isOpen}, deviceID_{other.deviceID_}, devic
 	}
 	checksums_[FPGA1] = other.checksums_[FPGA1];
 	checksums_[FPGA2] = other.checksums_[FPGA2];
+	std::copy(other.pendingWaveforms_, other.pendingWaveforms_ + 4, pendingWaveforms_);
+	std::copy(other.pendingLL_, other.pendingLL_ + 2, pendingLL_);
 };
 
 
@@ -42,10 +48,13 @@ APS::~APS() = default;
 int APS::connect(){
 	if (!isOpen) {
 		int success = 0;
-		success = FTDI::connect(deviceID_, handle_);
+		success = transport_->connect(deviceID_);
 		if (success == 0) {
 			LOG(plog::info) << "Opened connection to device " << deviceID_ << " (Serial: " << deviceSerial_ << ")";
 			isOpen = true;
+			//Someone else may have changed the registers or memory since we last looked
+			invalidate_shadow(ALL_FPGAS);
+			uploadCache_.invalidate(ALL_FPGAS);
 		}
 		// TODO: restore state information from file
 		return success;
@@ -58,7 +67,7 @@ int APS::connect(){
 int APS::disconnect(){
 	if (isOpen){
 		int success = 0;
-		success = FTDI::disconnect(handle_);
+		success = transport_->disconnect();
 		if (success == 0) {
 			LOG(plog::info) << "Closed connection to device " << deviceID_ << " (Serial: " << deviceSerial_ << ")";
 			isOpen = false;
@@ -80,6 +89,7 @@ int APS::init(const string & bitFile, const bool & forceReload){
 	 * Initializes the APS into its default ready state. Attempts to figure out if programming is necessary
 	 * by looking at the current bitfile version and the PLL status.
 	 */
+	TRACE_SPAN("APS::init", "init", deviceID_);
 
 	if (forceReload || read_bitFile_version(ALL_FPGAS) != FIRMWARE_VERSION || !read_PLL_status(ALL_FPGAS)) {
 		LOG(plog::info) << "Resetting instrument";
@@ -126,11 +136,14 @@ int APS::init(const string & bitFile, const bool & forceReload){
 }
 
 int APS::reset(const FPGASELECT & fpga) const {
-	return FPGA::reset(handle_, fpga);
+	invalidate_shadow(fpga);
+	uploadCache_.invalidate(fpga);
+	return FPGA::reset(*transport_, fpga);
 }
 
 
 int APS::setup_DACs() const{
+	TRACE_SPAN("APS::setup_DACs", "init", deviceID_);
 	//Call the setup function for each DAC
 	for(int dac=0; dac<4; dac++){
 		setup_DAC(dac);
@@ -143,34 +156,25 @@ int APS::program_FPGA(const string & bitFile, const FPGASELECT & chipSelect, con
 	 * @param chipSelect which FPGA to write to (FPGA1, FPGA2, BOTH_FGPAS)
 	 * @param expectedVersion - checks whether version register matches this value after programming. -1 = skip the check
 	 */
+	TRACE_SPAN("APS::program_FPGA", "init", deviceID_);
+	//Reconfiguring clears the waveform and link list memory
+	uploadCache_.invalidate(chipSelect);
 
-	//Open the bitfile
-	LOG(plog::debug) << "Opening bitfile: " << bitFile;
-	std::ifstream FID (bitFile, std::ios::in|std::ios::binary);
-	//Get the size
-	if (!FID.is_open()){
-		LOG(plog::error) << "Unable to open bitfile: " << bitFile;
-		throw runtime_error("Unable to open bitfile.");
+	//Bitfiles are read and framed for the wire once and shared between devices and re-inits
+	auto image = BitfileCache::get(bitFile, chipSelect);
+	if (!image) {
+		throw FileError("Unable to open bitfile.");
 	}
 
-	//Copy over the file data to the data vector
-	//The default istreambuf_iterator constructor returns the "end-of-stream" iterator.
-	vector<UCHAR> fileData((std::istreambuf_iterator<char>(FID)), std::istreambuf_iterator<char>());
-	ULONG numBytes = fileData.size();
-	LOG(plog::debug) << "Read " << numBytes << " bytes from bitfile";
-
 	//Pass of the data to a lower-level function to actually push it to the FPGA
-	int bytesProgrammed = FPGA::program_FPGA(handle_, fileData, chipSelect);
+	invalidate_shadow(chipSelect);
+	int bytesProgrammed = FPGA::program_FPGA(*transport_, *image, FPGA::PROGRAM_BULK);
 
 	if (bytesProgrammed > 0 && expectedVersion != -1) {
-		// Read Bit File Version
-		int version;
-		bool ok = false;
-		for (int ct = 0; ct < 20 && !ok; ct++) {
-			version =  APS::read_bitFile_version(chipSelect);
-			if (version == expectedVersion) ok = true;
-			usleep(1000); // if doesn't match, wait a bit and try again
-		}
+		// Read Bit File Version; give it up to 20ms to match
+		bool ok = FPGA::poll_until([&](){
+			return APS::read_bitFile_version(chipSelect) == expectedVersion;
+		}, 20);
 		if (!ok) return -11;
 	}
 
@@ -186,22 +190,23 @@ int APS::read_bitFile_version(const FPGASELECT & chipSelect) const {
 	switch (chipSelect) {
 	case FPGA1:
 	case FPGA2:
-		version = FPGA::read_FPGA(handle_, FPGA_ADDR_VERSION, chipSelect);
+		version = FPGA::read_FPGA(*transport_, FPGA_ADDR_VERSION, chipSelect);
 		version &= 0x1FF; // First 9 bits hold version
 		LOG(plog::debug) << "Bitfile version for FPGA " << chipSelect << " is "  << myhex << version;
 		break;
 	case ALL_FPGAS:
-		version = FPGA::read_FPGA(handle_, FPGA_ADDR_VERSION, FPGA1);
-		version &= 0x1FF; // First 9 bits hold version
+	{
+		WordVec versions = FPGA::read_FPGA_batch(*transport_, {FPGA::RegAddr(FPGA_ADDR_VERSION, FPGA1), FPGA::RegAddr(FPGA_ADDR_VERSION, FPGA2)});
+		version = versions[0] & 0x1FF; // First 9 bits hold version
 		LOG(plog::debug) << "Bitfile version for FPGA 1 is "  << myhex << version;
-		version2 = FPGA::read_FPGA(handle_, FPGA_ADDR_VERSION, FPGA2);
-		version2 &= 0x1FF; // First 9 bits hold version
+		version2 = versions[1] & 0x1FF; // First 9 bits hold version
 		LOG(plog::debug) << "Bitfile version for FPGA 2 is "  << myhex << version2;
 			if (version != version2) {
 			LOG(plog::error) << "Bitfile versions are not the same on the two FPGAs: " << version << " and " << version2;
 			return -1;
 		}
 		break;
+	}
 	default:
 		LOG(plog::error) << "Unknown chipSelect value in APS::read_bitfile_version: " << chipSelect;
 		return -1;
@@ -211,6 +216,9 @@ int APS::read_bitFile_version(const FPGASELECT & chipSelect) const {
 }
 
 int APS::set_sampleRate(const int & freq){
+	TRACE_SPAN("APS::set_sampleRate", "init", deviceID_);
+	//The PLL sync test reads back from the hardware so it can't wait for a commit
+	ImmediateGuard immediate(*this);
 	if (samplingRate_ != freq){
 		//Set PLL frequency for each fpga
 		APS::set_PLL_freq(FPGA1, freq);
@@ -238,6 +246,7 @@ int APS::get_sampleRate() const{
 }
 
 int APS::clear_channel_data() {
+	TRACE_SPAN("APS::clear_channel_data", "init", deviceID_);
 	LOG(plog::info) << "Clearing all channel data for APS " << deviceID_;
 	for (auto & ch : channels_) {
 		ch.clear_data();
@@ -258,6 +267,8 @@ int APS::load_sequence_file(const string & seqFile){
 	/*
 	 * Load a sequence file from an aps1 binary file
 	 */
+	//Clearing the channels and loading them again goes out in one flush; unchanged memory is skipped by the upload cache
+	UpdateGuard update(*this);
 	try {
 		LOG(plog::info) << "Opening sequence file: " << seqFile;
 		// Read the header information
@@ -307,7 +318,7 @@ int APS::load_sequence_file(const string & seqFile){
 					if (status != 0) return status;
 					//If the length is less than can fit on the chip then write it to the device
 					if (channels_[chanct].LLBank_.length < MAX_LL_LENGTH){
-						write_LL_data_IQ(dac2fpga(chanct), 0, 0, channels_[chanct].LLBank_.length, true );
+						upload_LL_data_IQ(dac2fpga(chanct));
 					}
 				} else {
 					throw runtime_error("Haven't yet implementated read_state");
@@ -315,7 +326,7 @@ int APS::load_sequence_file(const string & seqFile){
 			}
 		}
 		set_miniLL_repeat(static_cast<USHORT>(miniLLRepeat));
-		return 0;
+		return update.commit();
 	}
 	catch (...) {
 		return -1;
@@ -323,6 +334,271 @@ int APS::load_sequence_file(const string & seqFile){
 	return 0;
 }
 
+int APS::set_waveform(const int & dac, const float * data, const size_t & numPts){
+	int status = channels_[dac].set_waveform(data, numPts);
+	if (status < 0) return status;
+	return upload_waveform(dac, 0, channels_[dac].waveform_size(), true);
+}
+
+int APS::set_waveform(const int & dac, const short * data, const size_t & numPts){
+	int status = channels_[dac].set_waveform(data, numPts);
+	if (status < 0) return status;
+	return upload_waveform(dac, 0, channels_[dac].waveform_size(), true);
+}
+
+int APS::set_waveform_segment(const int & dac, const size_t & startSample, const float * data, const size_t & numPts){
+	return update_waveform_segment(dac, startSample, data, numPts);
+}
+
+int APS::set_waveform_segment(const int & dac, const size_t & startSample, const short * data, const size_t & numPts){
+	return update_waveform_segment(dac, startSample, data, numPts);
+}
+
+template <typename T>
+int APS::update_waveform_segment(const int & dac, const size_t & startSample, const T * data, const size_t & numPts){
+	const size_t oldLength = channels_[dac].waveform_size();
+	int status = channels_[dac].set_waveform_segment(startSample, data, numPts);
+	if (status < 0) return status;
+
+	//Only the WF_MODULUS aligned span covering the change and any new padding goes out.
+	//A segment past the end grows the waveform (and zero pads any gap) so the length register changes too.
+	const size_t newLength = channels_[dac].waveform_size();
+	size_t spanStart = (std::min(startSample, oldLength) / WF_MODULUS) * WF_MODULUS;
+	size_t spanStop = std::max(((startSample + numPts + WF_MODULUS - 1) / WF_MODULUS) * WF_MODULUS, newLength > oldLength ? newLength : 0);
+	spanStop = std::min(spanStop, newLength);
+	return upload_waveform(dac, spanStart, spanStop, newLength != oldLength);
+}
+
+int APS::add_pulse(const int & dac, const string & name, const float * data, const size_t & numPts, WaveformLibrary::Pulse & pulse){
+	return place_pulse(dac, name, data, numPts, pulse);
+}
+
+int APS::add_pulse(const int & dac, const string & name, const short * data, const size_t & numPts, WaveformLibrary::Pulse & pulse){
+	return place_pulse(dac, name, data, numPts, pulse);
+}
+
+template <typename T>
+int APS::place_pulse(const int & dac, const string & name, const T * data, const size_t & numPts, WaveformLibrary::Pulse & pulse){
+	if (dac < 0 || dac > 3) return -1;
+	WaveformLibrary & library = channels_[dac].library_;
+	//Put back if the upload fails so the library still describes what was there
+	const WaveformLibrary savedLibrary = library;
+	std::unique_ptr<Channel> savedChannel;
+	vector<WaveformLibrary::Move> moves;
+	int status = library.place(name, numPts, pulse);
+	//Fragmented but with enough room in total (counting the old slot of a pulse being resized): close the gaps and try again
+	if (status == -2) {
+		WaveformLibrary::Pulse previous;
+		const bool resizing = library.find(name, previous);
+		const size_t available = library.free_samples() + (resizing ? previous.span : 0);
+		if (available >= WF_MODULUS * ((numPts + WF_MODULUS - 1) / WF_MODULUS)) {
+			LOG(plog::info) << "Compacting the waveform library of channel " << dac << " to fit pulse " << name;
+			//Compacting moves samples all over the channel; keep a copy to go back to
+			savedChannel.reset(new Channel(channels_[dac]));
+			if (resizing) library.remove(name);
+			moves = library.compact();
+			for (auto & move : moves) {
+				channels_[dac].move_samples(move.from, move.to, move.span);
+			}
+			status = library.place(name, numPts, pulse);
+		}
+	}
+	if (status < 0) {
+		LOG(plog::error) << "No room for pulse " << name << " (" << numPts << " samples) on channel " << dac
+			<< ": " << library.free_samples() << " samples free";
+		if (savedChannel) channels_[dac] = *savedChannel;
+		library = savedLibrary;
+		return status;
+	}
+	LOG(plog::debug) << "Placed pulse " << name << " on channel " << dac << " at " << pulse.start;
+
+	//Clear what a longer pulse in the same slot left in the padding, then write the pulse and upload the span it
+	//changed, which after a compaction runs from the first moved pulse
+	channels_[dac].zero_samples(pulse.start + numPts, pulse.start + pulse.span);
+	const size_t oldLength = channels_[dac].waveform_size();
+	status = channels_[dac].set_waveform_segment(pulse.start, data, numPts);
+	if (status >= 0) {
+		const size_t newLength = channels_[dac].waveform_size();
+		size_t spanStart = moves.empty() ? pulse.start : std::min(pulse.start, moves.front().to);
+		spanStart = (std::min(spanStart, oldLength) / WF_MODULUS) * WF_MODULUS;
+		size_t spanStop = std::max(pulse.start + pulse.span, moves.empty() ? size_t(0) : library.high_water());
+		spanStop = std::min(std::max(spanStop, newLength > oldLength ? newLength : 0), newLength);
+		status = upload_waveform(dac, spanStart, spanStop, newLength != oldLength);
+	}
+	if (status < 0) {
+		LOG(plog::error) << "Upload of pulse " << name << " on channel " << dac << " failed; the waveform library is left as it was";
+		if (savedChannel) channels_[dac] = *savedChannel;
+		library = savedLibrary;
+		return status;
+	}
+	return moves.empty() ? 0 : 1;
+}
+
+int APS::remove_pulse(const int & dac, const string & name){
+	if (dac < 0 || dac > 3) return -1;
+	//The samples stay in memory until something else is placed there
+	return channels_[dac].library_.remove(name);
+}
+
+int APS::find_pulse(const int & dac, const string & name, WaveformLibrary::Pulse & pulse) const{
+	if (dac < 0 || dac > 3) return -1;
+	return channels_[dac].library_.find(name, pulse) ? 0 : -1;
+}
+
+int APS::compact_waveform_library(const int & dac){
+	if (dac < 0 || dac > 3) return -1;
+	vector<WaveformLibrary::Move> moves = channels_[dac].library_.compact();
+	if (moves.empty()) return 0;
+	for (auto & move : moves) {
+		channels_[dac].move_samples(move.from, move.to, move.span);
+	}
+	//Moves only go down and in address order so one span from the first new address covers them all
+	const size_t stop = std::min(channels_[dac].library_.high_water(), channels_[dac].waveform_size());
+	int status = upload_waveform(dac, moves.front().to, stop, false);
+	if (status < 0) return status;
+	return int(moves.size());
+}
+
+int APS::upload_waveform(const int & dac, const size_t & start, const size_t & stop, const bool & writeLength){
+	if (updateDepth_ > 0) {
+		//Merge with whatever else changed on the channel since begin_update
+		PendingWaveform & pending = pendingWaveforms_[dac];
+		if (pending.stop > pending.start) {
+			pending.start = std::min(pending.start, start);
+			pending.stop = std::max(pending.stop, stop);
+		}
+		else {
+			pending.start = start;
+			pending.stop = stop;
+		}
+		pending.length = pending.length || writeLength;
+		return 0;
+	}
+	return write_waveform_span(dac, start, stop, writeLength);
+}
+
+bool APS::broadcast_waveform(const int & dac, const PendingWaveform & first, const PendingWaveform & second){
+	//Same span, same length register and the same prepared samples on both FPGAs
+	const int partner = dac + 2;
+	const size_t numPts = channels_[dac].waveform_size();
+	if (first.start != second.start || first.stop != second.stop || first.length != second.length
+			|| numPts != channels_[partner].waveform_size()) {
+		return false;
+	}
+	if (!first.length && first.stop <= first.start) return false;
+	if (first.stop > first.start) {
+		channels_[dac].prep_waveform(prepBuffers_[dac], first.start, first.stop);
+		channels_[partner].prep_waveform(prepBuffers_[partner], first.start, first.stop);
+		if (prepBuffers_[dac] != prepBuffers_[partner]) return false;
+	}
+	LOG(plog::debug) << "Broadcasting waveform update for DACs " << dac << " and " << partner;
+	if (first.length) {
+		write_waveform_length(dac, numPts, true);
+	}
+	if (first.stop > first.start) {
+		write_waveform_segment(dac, first.start, prepBuffers_[dac].data(), prepBuffers_[dac].size(), true);
+	}
+	return true;
+}
+
+int APS::write_waveform_span(const int & dac, const size_t & start, const size_t & stop, const bool & writeLength){
+	if (writeLength) {
+		int status = write_waveform_length(dac, channels_[dac].waveform_size());
+		if (status < 0) return status;
+	}
+	if (stop <= start) return 0;
+	channels_[dac].prep_waveform(prepBuffers_[dac], start, stop);
+	return write_waveform_segment(dac, start, prepBuffers_[dac].data(), prepBuffers_[dac].size());
+}
+
+int APS::begin_update(){
+	//The streaming threads refill link list memory with writes that have to go out right away
+	for (auto & bouncer : myBankBouncerThreads_) {
+		if (bouncer.isRunning()) {
+			LOG(plog::error) << "Unable to begin an update while link lists are streaming";
+			return -1;
+		}
+	}
+	updateDepth_++;
+	return 0;
+}
+
+int APS::commit(){
+	if (updateDepth_ == 0) {
+		LOG(plog::error) << "commit without a matching begin_update";
+		return -1;
+	}
+	//Nested updates go out with the outermost commit
+	if (updateDepth_ > 1) {
+		updateDepth_--;
+		return 0;
+	}
+
+	//Queue the merged waveform spans (flushes are still deferred here), then send everything at once
+	int status = 0;
+	PendingWaveform pending[4];
+	for (int dac = 0; dac < 4; dac++) {
+		pending[dac] = pendingWaveforms_[dac];
+		pendingWaveforms_[dac] = PendingWaveform{0, 0, false};
+		//The channel may have been cleared or shortened since
+		pending[dac].stop = std::min(pending[dac].stop, channels_[dac].waveform_size());
+	}
+	//DAC 0 and 2 (and 1 and 3) are the same channel on the two FPGAs; identical updates go out once to both
+	for (int dac = 0; dac < 2; dac++) {
+		if (broadcast_waveform(dac, pending[dac], pending[dac+2])) {
+			pending[dac] = pending[dac+2] = PendingWaveform{0, 0, false};
+		}
+	}
+	for (int dac = 0; dac < 4; dac++) {
+		int tmpStatus = write_waveform_span(dac, pending[dac].start, pending[dac].stop, pending[dac].length);
+		if (tmpStatus < 0) status = tmpStatus;
+	}
+
+	//Likewise the IQ link lists of the two FPGAs
+	const bool pendingLL[2] = {pendingLL_[0], pendingLL_[1]};
+	pendingLL_[0] = pendingLL_[1] = false;
+	const LLBank & bank1 = channels_[0].LLBank_, & bank2 = channels_[2].LLBank_;
+	if (pendingLL[0] && pendingLL[1] && bank1.same_data(bank2)) {
+		if (bank1.length > 0 && bank1.length < MAX_LL_LENGTH) {
+			write_LL_data_IQ(ALL_FPGAS, 0, 0, bank1.length, true);
+		}
+	}
+	else {
+		for (auto fpga : {FPGA1, FPGA2}) {
+			const LLBank & bank = channels_[fpga == FPGA1 ? 0 : 2].LLBank_;
+			if (pendingLL[fpga - FPGA1] && bank.length > 0 && bank.length < MAX_LL_LENGTH) {
+				write_LL_data_IQ(fpga, 0, 0, bank.length, true);
+			}
+		}
+	}
+	updateDepth_ = 0;
+	const bool checkRegisters = registerCheckDeferred_;
+	registerCheckDeferred_ = false;
+	if (flush() < 0) return -1;
+	if (checkRegisters) check_registers();
+	return status;
+}
+
+int APS::abandon_update(){
+	if (updateDepth_ == 0) return 0;
+	LOG(plog::warning) << "Abandoning the update of " << deviceSerial_ << "; nothing queued since begin_update is sent";
+	updateDepth_ = 0;
+	for (int dac = 0; dac < 4; dac++) {
+		pendingWaveforms_[dac] = PendingWaveform{0, 0, false};
+	}
+	pendingLL_[0] = pendingLL_[1] = false;
+	registerCheckDeferred_ = false;
+	uploader_->discard();
+	uploadCache_.drop_staged();
+	//The shadow registers already took the dropped writes
+	invalidate_shadow(ALL_FPGAS);
+	return 0;
+}
+
+bool APS::in_update() const{
+	return updateDepth_ > 0;
+}
+
 int APS::set_channel_enabled(const int & dac, const bool & enable){
 	return channels_[dac].set_enabled(enable);
 }
@@ -335,8 +611,8 @@ int APS::set_channel_offset(const int & dac, const float & offset){
 	//Update the waveform in driver
 	channels_[dac].set_offset(offset);
 	//Write to device if necessary
-	if (!channels_[dac].waveform_.empty()){
-		write_waveform(dac, channels_[dac].prep_waveform());
+	if (channels_[dac].waveform_size() != 0){
+		upload_waveform(dac, 0, channels_[dac].waveform_size(), false);
 	}
 
 	//Update TAZ register
@@ -351,8 +627,8 @@ float APS::get_channel_offset(const int & dac) const{
 
 int APS::set_channel_scale(const int & dac, const float & scale){
 	channels_[dac].set_scale(scale);
-	if (!channels_[dac].waveform_.empty()){
-		write_waveform(dac, channels_[dac].prep_waveform());
+	if (channels_[dac].waveform_size() != 0){
+		upload_waveform(dac, 0, channels_[dac].waveform_size(), false);
 	}
 	return 0;
 }
@@ -366,10 +642,10 @@ int APS::set_trigger_source(const TRIGGERSOURCE & triggerSource){
 	int returnVal;
 	switch (triggerSource){
 	case INTERNAL:
-		returnVal = FPGA::clear_bit(handle_, ALL_FPGAS, FPGA_ADDR_CSR, CSRMSK_CHA_TRIGSRC);
+		returnVal = clear_bit(ALL_FPGAS, FPGA_ADDR_CSR, CSRMSK_CHA_TRIGSRC);
 		break;
 	case EXTERNAL:
-		returnVal = FPGA::set_bit(handle_, ALL_FPGAS, FPGA_ADDR_CSR, CSRMSK_CHA_TRIGSRC);
+		returnVal = set_bit(ALL_FPGAS, FPGA_ADDR_CSR, CSRMSK_CHA_TRIGSRC);
 		break;
 	default:
 		returnVal = -1;
@@ -379,7 +655,7 @@ int APS::set_trigger_source(const TRIGGERSOURCE & triggerSource){
 }
 
 TRIGGERSOURCE APS::get_trigger_source() const{
-	int regVal = FPGA::read_FPGA(handle_, FPGA_ADDR_CSR, FPGA1);
+	int regVal = FPGA::read_FPGA(*transport_, FPGA_ADDR_CSR, FPGA1);
 	return TRIGGERSOURCE((regVal & CSRMSK_CHA_TRIGSRC) == CSRMSK_CHA_TRIGSRC ? 1 : 0);
 }
 
@@ -401,19 +677,25 @@ int APS::set_trigger_interval(const double & interval){
 double APS::get_trigger_interval() const{
 
 	//Trigger interval is 32bits wide so have to split up into two 16bit words reads
-	int upperWord = FPGA::read_FPGA(handle_, FPGA_ADDR_TRIG_INTERVAL, FPGA1);
-	int lowerWord = FPGA::read_FPGA(handle_, FPGA_ADDR_TRIG_INTERVAL+1, FPGA1);
+	WordVec words = FPGA::read_FPGA_batch(*transport_, {FPGA::RegAddr(FPGA_ADDR_TRIG_INTERVAL, FPGA1), FPGA::RegAddr(FPGA_ADDR_TRIG_INTERVAL+1, FPGA1)});
+	int upperWord = words[0];
+	int lowerWord = words[1];
 
 	//Put it back together and covert from clock cycles to time (note: trigger interval is zero indexed and has a dead state)
 	return static_cast<double>((upperWord << 16) + lowerWord + 2)/(0.25*samplingRate_*1e6);
 }
 
 int APS::set_miniLL_repeat(const USHORT & miniLLRepeat){
-	return FPGA::write_FPGA(handle_, FPGA_ADDR_LL_REPEAT, miniLLRepeat, ALL_FPGAS);
+	return write(ALL_FPGAS, FPGA_ADDR_LL_REPEAT, miniLLRepeat);
 }
 
 
 int APS::run() {
+	//Releasing the state machines would go out ahead of the waveforms and link lists the update holds
+	if (updateDepth_ > 0) {
+		LOG(plog::error) << "Unable to run inside an update; commit or abandon it first";
+		return -1;
+	}
 	//Depending on how the channels are enabled, trigger the appropriate FPGA's
 	vector<bool> channelsEnabled;
 	bool allChannels = true;
@@ -439,22 +721,26 @@ int APS::run() {
 	LOG(plog::debug) << "Releasing state machine....";
 	//If all channels are enabled then trigger together
 	if (allChannels) {
-		FPGA::set_bit(handle_, ALL_FPGAS, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN );
+		set_bit(ALL_FPGAS, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN );
 	}
 	else {
 		if (channelsEnabled[0] || channelsEnabled[1]) {
-			FPGA::set_bit(handle_, FPGA1, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN );
+			set_bit(FPGA1, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN );
 		}
 		if (channelsEnabled[2] || channelsEnabled[3]) {
-			FPGA::set_bit(handle_, FPGA2, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN );
+			set_bit(FPGA2, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN );
 		}
 	}
-	LOG(plog::debug) << "Current CSR: " << FPGA::read_FPGA(handle_, 0, FPGA1);
+	LOG(plog::debug) << "Current CSR: " << FPGA::read_FPGA(*transport_, 0, FPGA1);
 	mymutex_->unlock();
 	return 0;
 }
 
 int APS::stop() {
+	if (updateDepth_ > 0) {
+		LOG(plog::error) << "Unable to stop inside an update; commit or abandon it first";
+		return -1;
+	}
 
 	// stop all channels
 	for (int chanct = 0; chanct < 4; ++chanct) {
@@ -472,8 +758,8 @@ int APS::stop() {
 	usleep(1000);
 
 	//Put the state machines back in reset
-	FPGA::clear_bit(handle_, FPGA1, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN);
-	FPGA::clear_bit(handle_, FPGA2, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN);
+	clear_bit(FPGA1, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN);
+	clear_bit(FPGA2, FPGA_ADDR_CSR, CSRMSK_CHA_SMRSTN);
 
 	// restore trigger state
 	set_trigger_interval(curTriggerInt);
@@ -517,9 +803,9 @@ int APS::set_run_mode(const int & dac, const RUN_MODE & mode) {
 	//Set the run mode bit
 	LOG(plog::info) << "Setting Run Mode ==> DAC: " << dac << " Mode: " << mode;
 	if (mode) {
-	  FPGA::set_bit(handle_, fpga, FPGA_ADDR_CSR, dacModeMask);
+	  set_bit(fpga, FPGA_ADDR_CSR, dacModeMask);
 	} else {
-	  FPGA::clear_bit(handle_, fpga, FPGA_ADDR_CSR, dacModeMask);
+	  clear_bit(fpga, FPGA_ADDR_CSR, dacModeMask);
 	}
 
 	return 0;
@@ -555,9 +841,9 @@ int APS::set_repeat_mode(const int & dac, const bool & mode) {
 	//Set or clear the mode bit
 	LOG(plog::info) << "Setting repeat mode ==> DAC: " << dac << " Mode: " << mode;
 	if (mode) {
-		  FPGA::set_bit(handle_, fpga, FPGA_ADDR_CSR, dacModeMask);
+		  set_bit(fpga, FPGA_ADDR_CSR, dacModeMask);
 	} else {
-		  FPGA::clear_bit(handle_, fpga, FPGA_ADDR_CSR, dacModeMask);
+		  clear_bit(fpga, FPGA_ADDR_CSR, dacModeMask);
 	}
 
 	return 0;
@@ -581,7 +867,7 @@ int APS::set_LLData_IQ(const FPGASELECT & fpga, const WordVec & addr, const Word
 
 	//If we can fit it on then do so
 	if (addr.size() < MAX_LL_LENGTH){
-		write_LL_data_IQ(fpga, 0, 0, addr.size(), true );
+		upload_LL_data_IQ(fpga);
 	}
 
 	return 0;
@@ -605,43 +891,266 @@ int APS::write(const FPGASELECT & fpga, const unsigned int & addr, const vector<
 	 * addr = valid memory address to start to write to
 	 * data = vector<WORD> data
 	 * queue = false - write immediately, true - add write command to output queue
+	 *
+	 * Everything goes through the one output queue so writes reach the device in the order they were made:
+	 * an immediate write sends whatever was queued before it along with it. Between begin_update and commit
+	 * nothing is sent, immediate writes included; they go out with the commit.
 	 */
 
-	//Pack the data
-	vector<UCHAR> dataPacket = FPGA::format(fpga, addr, data);
+	if (!queue && updateDepth_ > 0) {
+		LOG(plog::debug) << "Write to " << myhex << addr << " held for the commit of the current update";
+	}
+
+	//Memory that already holds these words needs no upload; the layout of link list words isn't known here so
+	//take one per entry, which covers at least the memory written
+	if (upload_cached(fpga, addr, data.data(), data.size(), 1)) {
+		if (!queue) {
+			flush();
+		}
+		return 0;
+	}
 
 	//Update the software checksums
-	//Address checksum is defined as lower word of address
-	checksums_[fpga].address += addr & 0xFFFF;
-	for(auto tmpData : data)
-		checksums_[fpga].data += tmpData;
-
-	//Push into queue or write to FPGA
-	auto offsets = FPGA::computeCmdByteOffsets(data.size());
-	if (queue) {
-		//Calculate offsets of command bytes
-		for (auto tmpOffset : offsets){
-			offsetQueue_.push_back(tmpOffset + writeQueue_.size());
+	add_to_checksums(fpga, addr, data.data(), data.size());
+
+	update_shadow(fpga, addr, data.data(), data.size());
+
+	//Queue the words; they are encoded on flush while earlier chunks are on the wire
+	uploader_->queue(fpga, addr, data);
+
+	//Write to FPGA now if we are not queuing
+	if (!queue) {
+		flush();
+	}
+
+	return 0;
+}
+
+
+
+/*
+ * Shadow registers
+ */
+
+//Whether the host keeps a copy of a register
+static bool is_shadowed(const ULONG & addr) {
+	return ((addr & 0xF0000000) == FPGA_BANKSEL_CSR) && (addr < ULONG(NUM_SHADOW_REGS));
+}
+
+static vector<FPGASELECT> fpga_list(const FPGASELECT & fpga) {
+	switch (fpga) {
+	case FPGA1:
+	case FPGA2:
+		return {fpga};
+	case ALL_FPGAS:
+		return {FPGA1, FPGA2};
+	default:
+		return {};
+	}
+}
+
+int APS::set_bit(const FPGASELECT & fpga, const ULONG & addr, const USHORT & mask) {
+	return update_bits(fpga, addr, mask, mask);
+}
+
+int APS::clear_bit(const FPGASELECT & fpga, const ULONG & addr, const USHORT & mask) {
+	return update_bits(fpga, addr, mask, 0);
+}
+
+int APS::update_bits(const FPGASELECT & fpga, const ULONG & addr, const USHORT & mask, const USHORT & bits) {
+	/* Set the masked bits of a register to bits. For shadowed registers the current value
+	 * comes from the host copy so this is a single write to the device.
+	 */
+	if (!is_shadowed(addr)) {
+		return bits ? FPGA::set_bit(*transport_, fpga, addr, mask) : FPGA::clear_bit(*transport_, fpga, addr, mask);
+	}
+	vector<FPGASELECT> fpgas = fpga_list(fpga);
+	if (fpgas.empty()) return -1;
+
+	load_shadow(fpga, addr);
+	vector<USHORT> newValues;
+	for (auto tmpFPGA : fpgas) {
+		newValues.push_back((shadowRegs_[tmpFPGA][addr].value & ~mask) | (bits & mask));
+	}
+	LOG(plog::debug) << "Addr: " << myhex << addr << " Current State: " << shadowRegs_[fpgas[0]][addr].value << " Mask: " << mask << " Writing: " << newValues[0];
+
+	//The two FPGAs usually agree so one write does both
+	if (newValues.size() == 1 || newValues[0] == newValues[1]) {
+		write(fpga, addr, newValues[0]);
+	}
+	else {
+		for (size_t ct = 0; ct < fpgas.size(); ct++) {
+			write(fpgas[ct], addr, newValues[ct]);
 		}
-		for (auto tmpByte : dataPacket){
-			writeQueue_.push_back(tmpByte);
+	}
+
+	plog::Severity consoleSv = plog::get<CONSOLE_LOG>()->getMaxSeverity();
+	plog::Severity fileSv = plog::get<FILE_LOG>()->getMaxSeverity();
+
+	// verify write
+	bool verify = (consoleSv >= plog::debug) || (fileSv >= plog::debug);
+	verify = verify || (registerCheckInterval_ > 0 && ++bitUpdatesSinceCheck_ >= registerCheckInterval_);
+	if (verify) {
+		//Inside an update the write is only queued so the hardware still holds the old value; check after the commit
+		if (updateDepth_ > 0) registerCheckDeferred_ = true;
+		else check_registers();
+	}
+
+	return 0;
+}
+
+void APS::load_shadow(const FPGASELECT & fpga, const ULONG & addr) {
+	//Fetch any copies we don't have yet in one round trip
+	vector<FPGA::RegAddr> regs;
+	for (auto tmpFPGA : fpga_list(fpga)) {
+		if (!shadowRegs_[tmpFPGA][addr].valid) {
+			regs.push_back(FPGA::RegAddr(addr, tmpFPGA));
 		}
 	}
-	else{
-		FPGA::write_block(handle_, dataPacket, offsets);
+	if (regs.empty()) return;
+
+	WordVec values = FPGA::read_FPGA_batch(*transport_, regs);
+	for (size_t ct = 0; ct < regs.size(); ct++) {
+		shadowRegs_[regs[ct].second][addr] = ShadowRegister{values[ct], true};
 	}
+}
+
+void APS::update_shadow(const FPGASELECT & fpga, const ULONG & addr, const USHORT * data, const size_t & numWords) {
+	for (size_t ct = 0; ct < numWords && is_shadowed(addr + ct); ct++) {
+		for (auto tmpFPGA : fpga_list(fpga)) {
+			shadowRegs_[tmpFPGA][addr + ct] = ShadowRegister{data[ct], true};
+		}
+	}
+}
 
+void APS::invalidate_shadow(const FPGASELECT & fpga) const {
+	for (auto tmpFPGA : fpga_list(fpga)) {
+		for (auto & reg : shadowRegs_[tmpFPGA]) {
+			reg.valid = false;
+		}
+	}
+}
+
+int APS::resync_registers() {
+	//Refresh every shadow register from the hardware
+	vector<FPGA::RegAddr> regs;
+	for (auto fpga : {FPGA1, FPGA2}) {
+		for (ULONG addr = 0; addr < ULONG(NUM_SHADOW_REGS); addr++) {
+			regs.push_back(FPGA::RegAddr(FPGA_BANKSEL_CSR | addr, fpga));
+		}
+	}
+	WordVec values = FPGA::read_FPGA_batch(*transport_, regs);
+	for (size_t ct = 0; ct < regs.size(); ct++) {
+		shadowRegs_[regs[ct].second][regs[ct].first] = ShadowRegister{values[ct], true};
+	}
+	bitUpdatesSinceCheck_ = 0;
 	return 0;
 }
 
+int APS::set_register_check_interval(const int & interval) {
+	registerCheckInterval_ = std::max(interval, 0);
+	bitUpdatesSinceCheck_ = 0;
+	return 0;
+}
 
+int APS::set_transfer_size(const int & transferSize) {
+	if (transferSize < int(USB_MIN_TRANSFER_SIZE) || transferSize > int(USB_MAX_TRANSFER_SIZE)) {
+		LOG(plog::error) << "Transfer size " << transferSize << " is outside " << USB_MIN_TRANSFER_SIZE << " to " << USB_MAX_TRANSFER_SIZE << " bytes";
+		return -1;
+	}
+	int status = transport_->set_transfer_size(transferSize);
+	uploader_->set_transfer_size(transferSize);
+	return status;
+}
+
+int APS::get_transfer_size() const {
+	return transport_->get_transfer_size();
+}
+
+int APS::set_transfer_profile(const int & profile) {
+	if (profile < PROFILE_INTERACTIVE || profile > PROFILE_STREAMING_POLL) {
+		LOG(plog::error) << "Unknown transfer profile " << profile;
+		return -1;
+	}
+	return transport_->set_profile(TRANSFER_PROFILE(profile));
+}
+
+int APS::get_transfer_profile() const {
+	return transport_->get_profile();
+}
+
+int APS::get_io_stats(const int & op, uint64_t * values, const int & numValues) const {
+	if (op < 0 || op >= NUM_IO_OPS || numValues < 0) return -1;
+	return transport_->io_stats().get(IO_OP(op), values, numValues);
+}
+
+int APS::reset_io_stats() {
+	transport_->io_stats().reset();
+	return 0;
+}
+
+int APS::clear_upload_cache() {
+	uploadCache_.invalidate(ALL_FPGAS);
+	return 0;
+}
+
+bool APS::upload_cached(const FPGASELECT & fpga, const ULONG & addr, const USHORT * data, const size_t & numWords, const size_t & entryWords) {
+	if (!UploadCache::cacheable(addr)) return false;
+	auto start = IOStats::clock::now();
+	bool hit = uploadCache_.check_and_stage(fpga, addr, data, numWords, entryWords);
+	transport_->io_stats().record(hit ? IO_CACHE_HIT : IO_CACHE_MISS, 2*numWords, start);
+	return hit;
+}
+
+bool APS::check_registers() {
+	//Compare the known shadow registers with the hardware and take the hardware values where they differ
+	vector<FPGA::RegAddr> regs;
+	for (auto fpga : {FPGA1, FPGA2}) {
+		for (ULONG addr = 0; addr < ULONG(NUM_SHADOW_REGS); addr++) {
+			if (shadowRegs_[fpga][addr].valid) {
+				regs.push_back(FPGA::RegAddr(addr, fpga));
+			}
+		}
+	}
+	bitUpdatesSinceCheck_ = 0;
+	if (regs.empty()) return true;
+
+	bool match = true;
+	WordVec values = FPGA::read_FPGA_batch(*transport_, regs);
+	for (size_t ct = 0; ct < regs.size(); ct++) {
+		ShadowRegister & reg = shadowRegs_[regs[ct].second][regs[ct].first];
+		if (reg.value != values[ct]) {
+			LOG(plog::error) << "Shadow register mismatch on FPGA " << regs[ct].second << " addr " << myhex << regs[ct].first
+				<< ": expected " << reg.value << " read " << values[ct];
+			reg.value = values[ct];
+			match = false;
+		}
+	}
+	return match;
+}
 
 int APS::flush() {
+	//Between begin_update and commit everything stays queued for the commit
+	if (updateDepth_ > 0) return 0;
+	TRACE_SPAN("APS::flush", "usb", deviceID_);
 	// flush write queue to USB interface
-	int bytesWritten = FPGA::write_block(handle_, writeQueue_, offsetQueue_);
+	//Uploads spanning more than one transfer go out under the bulk profile so long writes do not time out
+	std::unique_ptr<ProfileGuard> bulk;
+	if (2*uploader_->queued_words() > transport_->get_transfer_size()) {
+		bulk.reset(new ProfileGuard(*transport_, PROFILE_BULK_UPLOAD));
+	}
+	auto start = IOStats::clock::now();
+	const int numBytes = int(uploader_->queued_bytes());
+	int bytesWritten = uploader_->flush();
+	transport_->io_stats().record(IO_FLUSH, bytesWritten, start);
 	LOG(plog::debug) << "Flushed " << bytesWritten << " bytes to device";
-	writeQueue_.clear();
-	offsetQueue_.clear();
+	//The upload cache only takes the new memory contents once they are all on the device
+	if (bytesWritten != numBytes) {
+		LOG(plog::error) << "Flushed " << bytesWritten << " of " << numBytes << " queued bytes";
+		uploadCache_.drop_staged();
+		return -1;
+	}
+	uploadCache_.commit_staged();
 	return bytesWritten;
 }
 
@@ -649,39 +1158,40 @@ int APS::flush() {
 int APS::reset_status_ctrl() {
 	// sets Status/CTRL register to default state when running (OSCEN enabled)
 	UCHAR WriteByte = APS_OSCEN_BIT;
-	return FPGA::write_register(handle_, APS_STATUS_CTRL, 0, INVALID_FPGA, &WriteByte);
+	return FPGA::write_register(*transport_, APS_STATUS_CTRL, 0, INVALID_FPGA, &WriteByte);
 }
 
 
 int APS::clear_status_ctrl() {
 	// clears Status/CTRL register. This is the required state to program the VCXO
 	UCHAR writeByte = 0;
-	return FPGA::write_register(handle_, APS_STATUS_CTRL, 0, INVALID_FPGA, &writeByte);
+	return FPGA::write_register(*transport_, APS_STATUS_CTRL, 0, INVALID_FPGA, &writeByte);
 }
 
 UCHAR APS::read_status_ctrl() const {
 	UCHAR readByte = 0xFF;
-	FPGA::read_register(handle_, APS_STATUS_CTRL, 0, INVALID_FPGA, &readByte);
+	FPGA::read_register(*transport_, APS_STATUS_CTRL, 0, INVALID_FPGA, &readByte);
 	return readByte;
 }
 
 int APS::enable_oscillator() {
 	UCHAR mask = APS_OSCEN_BIT;
 	UCHAR status = 0;
-	FPGA::read_register(handle_, APS_STATUS_CTRL, 0, INVALID_FPGA, &status);
+	FPGA::read_register(*transport_, APS_STATUS_CTRL, 0, INVALID_FPGA, &status);
 	status |= mask;
-	return FPGA::write_register(handle_, APS_STATUS_CTRL, 0, INVALID_FPGA, &status);
+	return FPGA::write_register(*transport_, APS_STATUS_CTRL, 0, INVALID_FPGA, &status);
 }
 
 int APS::disable_oscillator() {
 	UCHAR mask = APS_OSCEN_BIT;
 	UCHAR status = 0;
-	FPGA::read_register(handle_, APS_STATUS_CTRL, 0, INVALID_FPGA, &status);
+	FPGA::read_register(*transport_, APS_STATUS_CTRL, 0, INVALID_FPGA, &status);
 	status &= ~mask;
-	return FPGA::write_register(handle_, APS_STATUS_CTRL, 0, INVALID_FPGA, &status);
+	return FPGA::write_register(*transport_, APS_STATUS_CTRL, 0, INVALID_FPGA, &status);
 }
 
 int APS::setup_PLL() {
+	TRACE_SPAN("APS::setup_PLL", "init", deviceID_);
 	// set the on-board PLL to its default state (two 1.2 GHz outputs, and one 300 MHz output)
 	LOG(plog::info) << "Setting up PLL";
 
@@ -717,10 +1227,10 @@ int APS::setup_PLL() {
 	};
 
 
-	// Go through the routine
-	for (auto tmpPair : PLL_Routine){
-		FPGA::write_SPI(handle_, APS_PLL_SPI, tmpPair.first, {tmpPair.second});
-	}
+	// Go through the routine in one transfer
+	FPGA::SPIBatch batch;
+	batch.write(APS_PLL_SPI, PLL_Routine);
+	batch.send(*transport_);
 
 	//Record that sampling rate has been set to 1200
 	samplingRate_ = 1200;
@@ -774,7 +1284,7 @@ int APS::set_PLL_freq(const FPGASELECT & fpga, const int & freq) {
 
 	// Disable DDRs
 	int ddr_mask = CSRMSK_CHA_DDR | CSRMSK_CHB_DDR;
-	FPGA::clear_bit(handle_, fpga, FPGA_ADDR_CSR, ddr_mask);
+	clear_bit(fpga, FPGA_ADDR_CSR, ddr_mask);
 	// disable DAC FIFOs
 	for (int dac = 0; dac < 4; dac++)
 		disable_DAC_FIFO(dac);
@@ -785,13 +1295,13 @@ int APS::set_PLL_freq(const FPGASELECT & fpga, const int & freq) {
 		{pllBypassAddr, pllBypassVal},
 		{0x232, 0x1} // Update registers
 	};
-	// Go through the routine
-	for (auto tmpPair : PLL_Routine){
-		FPGA::write_SPI(handle_, APS_PLL_SPI, tmpPair.first, {tmpPair.second});
-	}
+	// Go through the routine in one transfer
+	FPGA::SPIBatch batch;
+	batch.write(APS_PLL_SPI, PLL_Routine);
+	batch.send(*transport_);
 
 	// Enable DDRs
-	FPGA::set_bit(handle_, fpga, FPGA_ADDR_CSR, ddr_mask);
+	set_bit(fpga, FPGA_ADDR_CSR, ddr_mask);
 	// Enable DAC FIFOs
 	// for (int dac = 0; dac < 4; dac++)
 	// 	enable_DAC_FIFO(dac);
@@ -819,6 +1329,7 @@ int APS::test_PLL_sync(const FPGASELECT & fpga, const int & numRetries /* see he
 	 *         fpga (1 or 2)
 	 *         numRetries - number of times to restart the test if the global sync test fails (step 5)
 	 */
+	TRACE_SPAN("APS::test_PLL_sync", "init", deviceID_);
 
 	// Test for DAC clock phase match
 	bool inSync, globalSync;
@@ -856,7 +1367,7 @@ int APS::test_PLL_sync(const FPGASELECT & fpga, const int & numRetries /* see he
 		disable_DAC_FIFO(dac);
 	// Disable DDRs
 	int ddr_mask = CSRMSK_CHA_DDR | CSRMSK_CHB_DDR;
-	FPGA::clear_bit(handle_, fpga, FPGA_ADDR_CSR, ddr_mask);
+	clear_bit(fpga, FPGA_ADDR_CSR, ddr_mask);
 
 	//A little helper function to wait for the PLL's to lock and reset if necessary
 	auto wait_PLL_relock = [this, &fpga, &pllResetBit](bool resetPLL, const int & regAddress, const vector<int> & pllBits) -> bool {
@@ -867,7 +1378,7 @@ int APS::test_PLL_sync(const FPGASELECT & fpga, const int & numRetries /* see he
 			inSync = (APS::read_PLL_status(fpga, regAddress, pllBits) == 1);
 			//If we aren't locked then reset for the next try by clearing the PLL reset bits
 			if (resetPLL) {
-				FPGA::clear_bit(handle_, fpga, FPGA_ADDR_CSR, pllResetBit);
+				clear_bit(fpga, FPGA_ADDR_CSR, pllResetBit);
 			}
 			//Otherwise just wait
 			else{
@@ -892,16 +1403,15 @@ int APS::test_PLL_sync(const FPGASELECT & fpga, const int & numRetries /* see he
 	// start by testing for a 600 MHz XOR always low
 
 	//First a little helper function to update the PLL registers
-	auto update_PLL_register = [this] (){
+	auto update_PLL_register = [] (FPGA::SPIBatch & batch){
 		ULONG address = 0x232;
 		UCHAR data = 0x1;
-		FPGA::write_SPI(handle_, APS_PLL_SPI, address, {data});
+		batch.write(APS_PLL_SPI, address, data);
 	};
 
-	auto read_DLL_phase = [this, &fpga] (int addr) {
+	auto DLL_phase = [] (double phase) {
 		// The phase register holds a 9-bit value [0, 511] representing the phase shift.
 		// We convert his value to phase in degrees in the range (-180, 180]
-		double phase = FPGA::read_FPGA(handle_, addr, fpga);
 		if (phase > 256) {
 			phase -= 512;
 		}
@@ -909,24 +1419,33 @@ int APS::test_PLL_sync(const FPGASELECT & fpga, const int & numRetries /* see he
 		return phase;
 	};
 
+	auto read_DLL_phase = [this, &fpga, &DLL_phase] (int addr) {
+		return DLL_phase(FPGA::read_FPGA(*transport_, addr, fpga));
+	};
+
+	static const int xorCounts = 20, lowCutoff = 5, lowPhaseCutoff = 45, highPhaseCutoff = 135;
+
+	//The XOR counts and both DAC phases in one round trip
+	vector<FPGA::RegAddr> phaseTestRegs(xorCounts, FPGA::RegAddr(FPGA_ADDR_PLL_STATUS, fpga));
+	phaseTestRegs.push_back(FPGA::RegAddr(FPGA_ADDR_A_PHASE, fpga));
+	phaseTestRegs.push_back(FPGA::RegAddr(FPGA_ADDR_B_PHASE, fpga));
+
 	LOG(plog::info) << "Testing for DAC clock phase sync";
 	//Loop over number of tries
-	static const int xorCounts = 20, lowCutoff = 5, lowPhaseCutoff = 45, highPhaseCutoff = 135;
 	for (int ct = 0; ct < MAX_PHASE_TEST_CNT; ct++) {
 		//Reset the counts
 		xorFlagCnts = 0;
 		dac02Reset = 0;
 		dac13Reset = 0;
 
-		//Take twenty counts of the the xor data
+		//Take twenty counts of the the xor data and read the DACA and DACB phases
+		WordVec phaseTestData = FPGA::read_FPGA_batch(*transport_, phaseTestRegs);
 		for(int xorct = 0; xorct < xorCounts; xorct++) {
-			pllBit = FPGA::read_FPGA(handle_, FPGA_ADDR_PLL_STATUS, fpga);
+			pllBit = phaseTestData[xorct];
 			xorFlagCnts += (pllBit >> PLL_GLOBAL_XOR_BIT) & 0x1;
 		}
-
-		// read DACA and DACB phases
-		a_phase = read_DLL_phase(FPGA_ADDR_A_PHASE);
-		b_phase = read_DLL_phase(FPGA_ADDR_B_PHASE);
+		a_phase = DLL_phase(phaseTestData[xorCounts]);
+		b_phase = DLL_phase(phaseTestData[xorCounts+1]);
 
 		LOG(plog::debug) << "DAC A Phase: " << a_phase << ", DAC B Phase: " << b_phase;
 
@@ -944,29 +1463,31 @@ int APS::test_PLL_sync(const FPGASELECT & fpga, const int & numRetries /* see he
 		else {
 			// 600 MHz clocks out of phase, reset DAC clocks that are 90/270 degrees out of phase with reference
 			LOG(plog::debug) << "DAC clocks out of phase; resetting, XOR counts: " << xorFlagCnts;
+			FPGA::SPIBatch batch;
 			writeByte = 0x2; //disable clock outputs
 			//If ChA is +/-90 degrees out of phase then reset it
 			if (abs(a_phase) >= lowPhaseCutoff && abs(a_phase) <= highPhaseCutoff) {
 				dac02Reset = 1;
-				FPGA::write_SPI(handle_, APS_PLL_SPI, pllEnableAddr, {writeByte});
+				batch.write(APS_PLL_SPI, pllEnableAddr, writeByte);
 			}
 			//If ChB is +/-90 degrees out of phase then reset it
 			if (abs(b_phase) >= lowPhaseCutoff && abs(b_phase) <= highPhaseCutoff) {
 				dac13Reset = 1;
-				FPGA::write_SPI(handle_, APS_PLL_SPI, pllEnableAddr2, {writeByte});
+				batch.write(APS_PLL_SPI, pllEnableAddr2, writeByte);
 			}
 			//Actually update things
-			update_PLL_register();
+			update_PLL_register(batch);
 			writeByte = 0x0; // enable clock outputs
 			if (dac02Reset)
-				FPGA::write_SPI(handle_, APS_PLL_SPI, pllEnableAddr, {writeByte});
+				batch.write(APS_PLL_SPI, pllEnableAddr, writeByte);
 			if (dac13Reset)
-				FPGA::write_SPI(handle_, APS_PLL_SPI, pllEnableAddr2, {writeByte});
-			update_PLL_register();
+				batch.write(APS_PLL_SPI, pllEnableAddr2, writeByte);
+			update_PLL_register(batch);
+			batch.send(*transport_);
 
 			// reset FPGA PLLs
-			FPGA::set_bit(handle_, fpga, FPGA_ADDR_CSR, pllResetBit);
-			FPGA::clear_bit(handle_, fpga, FPGA_ADDR_CSR, pllResetBit);
+			set_bit(fpga, FPGA_ADDR_CSR, pllResetBit);
+			clear_bit(fpga, FPGA_ADDR_CSR, pllResetBit);
 
 			// wait for the PLL to relock
 			inSync = wait_PLL_relock(false, FPGA_ADDR_PLL_STATUS, PLL_LOCK_TEST);
@@ -997,8 +1518,8 @@ int APS::test_PLL_sync(const FPGASELECT & fpga, const int & numRetries /* see he
 				globalSync = false;
 
 				// reset a single channel PLL
-				FPGA::set_bit(handle_, fpga, FPGA_ADDR_CSR, PLL_RESET[ch]);
-				FPGA::clear_bit(handle_, fpga, FPGA_ADDR_CSR, PLL_RESET[ch]);
+				set_bit(fpga, FPGA_ADDR_CSR, PLL_RESET[ch]);
+				clear_bit(fpga, FPGA_ADDR_CSR, PLL_RESET[ch]);
 
 				// wait for lock
 				LOG(plog::debug) << "Waiting for relock of PLL " << ch << " by looking at bit " << PLL_LOCK_TEST[ch];
@@ -1015,23 +1536,25 @@ int APS::test_PLL_sync(const FPGASELECT & fpga, const int & numRetries /* see he
 		if (numRetries > 0) {
 			LOG(plog::debug) << "Sync failed; retrying.";
 			// restart both DAC clocks and try again
+			FPGA::SPIBatch batch;
 			writeByte = 0x2;
-			FPGA::write_SPI(handle_, APS_PLL_SPI, pllEnableAddr, {writeByte});
-			FPGA::write_SPI(handle_, APS_PLL_SPI, pllEnableAddr2, {writeByte});
-			update_PLL_register();
+			batch.write(APS_PLL_SPI, pllEnableAddr, writeByte);
+			batch.write(APS_PLL_SPI, pllEnableAddr2, writeByte);
+			update_PLL_register(batch);
 			writeByte = 0x0;
-			FPGA::write_SPI(handle_, APS_PLL_SPI, pllEnableAddr, {writeByte});
-			FPGA::write_SPI(handle_, APS_PLL_SPI, pllEnableAddr2, {writeByte});
-			update_PLL_register();
+			batch.write(APS_PLL_SPI, pllEnableAddr, writeByte);
+			batch.write(APS_PLL_SPI, pllEnableAddr2, writeByte);
+			update_PLL_register(batch);
+			batch.send(*transport_);
 
-			FPGA::set_bit(handle_, fpga, FPGA_ADDR_CSR, pllResetBit);
-			FPGA::clear_bit(handle_, fpga, FPGA_ADDR_CSR, pllResetBit);
+			set_bit(fpga, FPGA_ADDR_CSR, pllResetBit);
+			clear_bit(fpga, FPGA_ADDR_CSR, pllResetBit);
 
 			//Try again by recursively calling the same function
 			return test_PLL_sync(fpga, numRetries - 1);
 		} else {
 			// we failed, but enable DDRs to get a usable state
-			FPGA::set_bit(handle_, fpga, FPGA_ADDR_CSR, ddr_mask);
+			set_bit(fpga, FPGA_ADDR_CSR, ddr_mask);
 			// enable DAC FIFOs
 			//for (int dac = 0; dac < 4; dac++)
 				//enable_DAC_FIFO(dac);
@@ -1043,7 +1566,7 @@ int APS::test_PLL_sync(const FPGASELECT & fpga, const int & numRetries /* see he
 
 
 	// Enable DDRs
-	FPGA::set_bit(handle_, fpga, FPGA_ADDR_CSR, ddr_mask);
+	set_bit(fpga, FPGA_ADDR_CSR, ddr_mask);
 	// enable DAC FIFOs
 	//for (int dac = 0; dac < 4; dac++)
 		//enable_DAC_FIFO(dac);
@@ -1063,10 +1586,10 @@ int APS::read_PLL_status(const FPGASELECT & fpga, const int & regAddr /*check he
 
 	int pllStatus = 1;
 
-//	pll_bit = FPGA::read_FPGA(handle_, FPGA_ADDR_SYNC_REGREAD | FPGA_OFF_VERSION, fpga); // latched to USB clock (has version 0x020)
-//	pll_bit = FPGA::read_FPGA(handle_, FPGA_ADDR_REGREAD | FPGA_OFF_VERSION, fpga); // latched to 200 MHz PLL (has version 0x010)
+//	pll_bit = FPGA::read_FPGA(*transport_, FPGA_ADDR_SYNC_REGREAD | FPGA_OFF_VERSION, fpga); // latched to USB clock (has version 0x020)
+//	pll_bit = FPGA::read_FPGA(*transport_, FPGA_ADDR_REGREAD | FPGA_OFF_VERSION, fpga); // latched to 200 MHz PLL (has version 0x010)
 
-	ULONG pllRegister = FPGA::read_FPGA(handle_, regAddr, fpga);
+	ULONG pllRegister = FPGA::read_FPGA(*transport_, regAddr, fpga);
 
 	//Check each of the clocks in series
 	for(int tmpBit : pllLockBits){
@@ -1078,7 +1601,7 @@ int APS::read_PLL_status(const FPGASELECT & fpga, const int & regAddr /*check he
 
 int APS::read_PLL_chip_status() const {
 	UCHAR status;
-	FPGA::read_SPI(handle_, APS_PLL_SPI, 0x1F, &status);
+	FPGA::read_SPI(*transport_, APS_PLL_SPI, 0x1F, &status);
 	return status;
 }
 
@@ -1105,8 +1628,14 @@ int APS::get_PLL_freq(const FPGASELECT & fpga) const {
 		return -1;
 	}
 
-	FPGA::read_SPI(handle_, APS_PLL_SPI, pll_cycles_addr, &pll_cycles_val);
-	FPGA::read_SPI(handle_, APS_PLL_SPI, pll_bypass_addr, &pll_bypass_val);
+	FPGA::SPIBatch batch;
+	batch.read(APS_PLL_SPI, pll_cycles_addr);
+	batch.read(APS_PLL_SPI, pll_bypass_addr);
+	vector<UCHAR> readData;
+	batch.send(*transport_, &readData);
+	if (readData.size() != 2) return -3;
+	pll_cycles_val = readData[0];
+	pll_bypass_val = readData[1];
 
 	// select frequency based on pll cycles setting
 	// the values here should match the reverse lookup in FGPA::set_PLL_freq
@@ -1131,6 +1660,7 @@ int APS::get_PLL_freq(const FPGASELECT & fpga) const {
 
 
 int APS::setup_VCXO() {
+	TRACE_SPAN("APS::setup_VCXO", "init", deviceID_);
 	// Write the standard VCXO setup
 
 	LOG(plog::info) << "Setting up VCX0";
@@ -1145,8 +1675,10 @@ int APS::setup_VCXO() {
 	if (disable_oscillator() != 1)
 		return -1;
 
-	FPGA::write_SPI(handle_, APS_VCXO_SPI, 0, Reg00Bytes);
-	FPGA::write_SPI(handle_, APS_VCXO_SPI, 0, Reg01Bytes);
+	FPGA::SPIBatch batch;
+	batch.write(APS_VCXO_SPI, 0, Reg00Bytes);
+	batch.write(APS_VCXO_SPI, 0, Reg01Bytes);
+	batch.send(*transport_);
 
 	// enable the oscillator
 	if (enable_oscillator() != 1)
@@ -1161,6 +1693,7 @@ int APS::setup_DAC(const int & dac) const
  * inputs: dac = 0, 1, 2, or 3
  */
 {
+	TRACE_SPAN("APS::setup_DAC", "init", deviceID_);
 	BYTE data;
 	BYTE SD, MSD, MHD;
 	BYTE edgeMSD, edgeMHD;
@@ -1181,39 +1714,43 @@ int APS::setup_DAC(const int & dac) const
 
 	// Step 0: write control clock divider register to 5 (divide by 128)
 	data = 5;
-	FPGA::write_SPI(handle_, APS_DAC_SPI, controllerClockAddr, {data});
+	FPGA::write_SPI(*transport_, APS_DAC_SPI, controllerClockAddr, {data});
 
 	disable_DAC_FIFO(dac);
 
 	// Step 1: calibrate and set the LVDS controller.
 	// Ensure that surveilance and auto modes are off
 	// get initial states of registers
-	FPGA::read_SPI(handle_, APS_DAC_SPI, interruptAddr, &data);
-	LOG(plog::debug) <<  "Reg: " << myhex << int(interruptAddr & 0x1F) << " Val: " << int(data & 0xFF);
-	FPGA::read_SPI(handle_, APS_DAC_SPI, msdMhdAddr, &data);
-	LOG(plog::debug) <<  "Reg: " << myhex << int(msdMhdAddr & 0x1F) << " Val: " << int(data & 0xFF);
-	FPGA::read_SPI(handle_, APS_DAC_SPI, sdAddr, &data);
-	LOG(plog::debug) <<  "Reg: " << myhex << int(sdAddr & 0x1F) << " Val: " << int(data & 0xFF);
-	FPGA::read_SPI(handle_, APS_DAC_SPI, controllerAddr, &data);
-	LOG(plog::debug) <<  "Reg: " << myhex << int(controllerAddr & 0x1F) << " Val: " << int(data & 0xFF);
-	data = 0;
-	FPGA::write_SPI(handle_, APS_DAC_SPI, controllerAddr, {data});
+	FPGA::SPIBatch batch;
+	const vector<ULONG> initialRegs = {interruptAddr, msdMhdAddr, sdAddr, controllerAddr};
+	for (auto addr : initialRegs) {
+		batch.read(APS_DAC_SPI, addr);
+	}
+	vector<UCHAR> readData;
+	batch.send(*transport_, &readData);
+	for (size_t ct = 0; ct < readData.size(); ct++) {
+		LOG(plog::debug) <<  "Reg: " << myhex << int(initialRegs[ct] & 0x1F) << " Val: " << int(readData[ct] & 0xFF);
+	}
 
 	// Slide the data valid window left (with MSD) and check for the interrupt
 	SD = 0;  //(sample delay nibble, stored in Reg. 5, bits 7:4)
 	MSD = 0; //(setup delay nibble, stored in Reg. 4, bits 7:4)
 	MHD = 0; //(hold delay nibble,  stored in Reg. 4, bits 3:0)
+	data = 0;
+	batch.write(APS_DAC_SPI, controllerAddr, data);
 	data = SD << 4;
-	FPGA::write_SPI(handle_, APS_DAC_SPI, sdAddr, {data});
+	batch.write(APS_DAC_SPI, sdAddr, data);
 
 	for (MSD = 0; MSD < 16; MSD++) {
 		LOG(plog::debug) <<  "Setting MSD: " << int(MSD);
 		data = (MSD << 4) | MHD;
-		FPGA::write_SPI(handle_, APS_DAC_SPI, msdMhdAddr, {data});
+		batch.write(APS_DAC_SPI, msdMhdAddr, data);
 		LOG(plog::debug) <<  "Write Reg: " << myhex << int(msdMhdAddr & 0x1F) << " Val: " << int(data & 0xFF);
-		//FPGA::read_SPI(handle_, APS_DAC_SPI, msd_mhd_addr, &data);
+		//FPGA::read_SPI(*transport_, APS_DAC_SPI, msd_mhd_addr, &data);
 		//dlog(DEBUG_VERBOSE2, "Read reg 0x%x, value 0x%x\n", msd_mhd_addr & 0x1F, data & 0xFF);
-		FPGA::read_SPI(handle_, APS_DAC_SPI, sdAddr, &data);
+		batch.read(APS_DAC_SPI, sdAddr);
+		batch.send(*transport_, &readData);
+		data = readData.empty() ? 0 : readData[0];
 		LOG(plog::debug) <<  "Read Reg: " << myhex << int(sdAddr & 0x1F) << " Val: " << int(data & 0xFF);
 		bool check = data & 1;
 		LOG(plog::debug) << "Check: " << check;
@@ -1228,8 +1765,10 @@ int APS::setup_DAC(const int & dac) const
 	for (MHD = 0; MHD < 16; MHD++) {
 		LOG(plog::debug) <<  "Setting MHD: " << int(MHD);
 		data = (MSD << 4) | MHD;
-		FPGA::write_SPI(handle_,  APS_DAC_SPI, msdMhdAddr, {data});
-		FPGA::read_SPI(handle_, APS_DAC_SPI, sdAddr, &data);
+		batch.write(APS_DAC_SPI, msdMhdAddr, data);
+		batch.read(APS_DAC_SPI, sdAddr);
+		batch.send(*transport_, &readData);
+		data = readData.empty() ? 0 : readData[0];
 		LOG(plog::debug) << "Read: " << myhex << int(data & 0xFF);
 		bool check = data & 1;
 		LOG(plog::debug) << "Check: " << check;
@@ -1244,10 +1783,11 @@ int APS::setup_DAC(const int & dac) const
 	// Clear MSD and MHD
 	MHD = 0;
 	data = (MSD << 4) | MHD;
-	FPGA::write_SPI(handle_, APS_DAC_SPI, msdMhdAddr, {data});
+	batch.write(APS_DAC_SPI, msdMhdAddr, data);
 	// Set the optimal sample delay (SD)
 	data = SD << 4;
-	FPGA::write_SPI(handle_, APS_DAC_SPI, sdAddr, {data});
+	batch.write(APS_DAC_SPI, sdAddr, data);
+	batch.send(*transport_);
 
 	// AD9376 data sheet advises us to enable surveilance and auto modes, but this
 	// has introduced output glitches in limited testing
@@ -1255,7 +1795,7 @@ int APS::setup_DAC(const int & dac) const
 	/*int filter_length = 12;
 	int threshold = 1;
 	data = (1 << 7) | (1 << 6) | (filter_length << 2) | (threshold & 0x3);
-	FPGA::write_SPI(handle_, APS_DAC_SPI, controller_addr, &data);
+	FPGA::write_SPI(*transport_, APS_DAC_SPI, controller_addr, &data);
 	*/
 
 	// turn on SYNC FIFO
@@ -1270,10 +1810,10 @@ int APS::enable_DAC_FIFO(const int & dac) const {
 	ULONG fifoStatusAddr = 0x7 | (dac << 5);
 	LOG(plog::debug) << "Enabling DAC " << dac << " FIFO";
 	// set sync bit (Reg 0, bit 2)
-	FPGA::read_SPI(handle_, APS_DAC_SPI, syncAddr, &data);
-	int status = FPGA::write_SPI(handle_, APS_DAC_SPI, syncAddr, {UCHAR(data | (1 << 2))} );
+	FPGA::read_SPI(*transport_, APS_DAC_SPI, syncAddr, &data);
+	int status = FPGA::write_SPI(*transport_, APS_DAC_SPI, syncAddr, {UCHAR(data | (1 << 2))} );
 	// read back FIFO phase to ensure we are in a safe zone
-	FPGA::read_SPI(handle_, APS_DAC_SPI, fifoStatusAddr, &data);
+	FPGA::read_SPI(*transport_, APS_DAC_SPI, fifoStatusAddr, &data);
 	// phase (FIFOSTAT) is in bits <6:4>
 	LOG(plog::debug) << "Read: " << myhex << int(data & 0xFF);
 	LOG(plog::debug) << "FIFO phase = " << ((data & 0x70) >> 4);
@@ -1286,17 +1826,25 @@ int APS::disable_DAC_FIFO(const int & dac) const {
 	ULONG syncAddr = 0x0 | (dac << 5);
 	LOG(plog::debug) << "Disable DAC " << dac << " FIFO";
 	// clear sync bit
-	FPGA::read_SPI(handle_, APS_DAC_SPI, syncAddr, &data);
+	FPGA::read_SPI(*transport_, APS_DAC_SPI, syncAddr, &data);
 	mask = (0x1 << 2);
-	return FPGA::write_SPI(handle_, APS_DAC_SPI, syncAddr, {UCHAR(data & ~mask)} );
+	return FPGA::write_SPI(*transport_, APS_DAC_SPI, syncAddr, {UCHAR(data & ~mask)} );
+}
+
+void APS::add_to_checksums(const FPGASELECT & fpga, const ULONG & addr, const USHORT * data, const size_t & numWords){
+	for (auto tmpFPGA : fpga_list(fpga)) {
+		checksums_[tmpFPGA].address += addr & 0xFFFF;
+		for (size_t ct = 0; ct < numWords; ct++)
+			checksums_[tmpFPGA].data += data[ct];
+	}
 }
 
 int APS::reset_checksums(const FPGASELECT & fpga){
 	//TODO: make work
 	// Clears address and data checksum registers on the associated FPGA(s)
 	// write to registers to clear them
-//	FPGA::write_FPGA(handle_, FPGA_OFF_DATA_CHECKSUM, 0, fpga);
-//	FPGA::write_FPGA(handle_, FPGA_OFF_ADDR_CHECKSUM, 0, fpga);
+//	FPGA::write_FPGA(*transport_, FPGA_OFF_DATA_CHECKSUM, 0, fpga);
+//	FPGA::write_FPGA(*transport_, FPGA_OFF_ADDR_CHECKSUM, 0, fpga);
 //	//Reset the software side too
 //	checksums_[fpga].address = 0;
 //	checksums_[fpga].data = 0;
@@ -1313,8 +1861,8 @@ bool APS::verify_checksums(const FPGASELECT & fpga){
 //		return false;
 //	}
 //
-//	checksumAddrFPGA = FPGA::read_FPGA(handle_, FPGA_ADDR_REGREAD | FPGA_OFF_ADDR_CHECKSUM, fpga);
-//	checksumDataFPGA = FPGA::read_FPGA(handle_, FPGA_ADDR_REGREAD | FPGA_OFF_DATA_CHECKSUM, fpga);
+//	checksumAddrFPGA = FPGA::read_FPGA(*transport_, FPGA_ADDR_REGREAD | FPGA_OFF_ADDR_CHECKSUM, fpga);
+//	checksumDataFPGA = FPGA::read_FPGA(*transport_, FPGA_ADDR_REGREAD | FPGA_OFF_DATA_CHECKSUM, fpga);
 //
 //	LOG(plog::info) << "Checksum Address (hardware =? software): " << myhex << checksumAddrFPGA << " =? "
 //			<< checksums_[fpga].address << " Data: " << checksumDataFPGA << " =? "
@@ -1355,35 +1903,48 @@ int APS::set_offset_register(const int & dac, const float & offset) {
 	scaledOffset = WORD(offset * MAX_WF_AMP);
 	LOG(plog::info) << "Setting DAC " << dac << "  zero register to " << scaledOffset;
 
-	FPGA::write_FPGA(handle_, zeroRegisterAddr, scaledOffset, fpga);
+	write(fpga, zeroRegisterAddr, scaledOffset);
 
 	return 0;
 }
 
-int APS::write_waveform(const int & dac, const vector<short> & wfData) {
+int APS::write_waveform(const int & dac, const short * wfData, const size_t & numPts) {
 	/*Write waveform data to FPGA memory
 	 * dac = channel (0-3)
-	 * wfData = signed short waveform data
+	 * wfData = signed short waveform data; encoded straight from this buffer so it must not change until the flush below
+	 * numPts = number of samples
 	 */
+	int status = write_waveform_length(dac, numPts);
+	if (status < 0) return status;
+	return write_waveform_segment(dac, 0, wfData, numPts);
+}
 
-	ULONG tmpData, wfLength;
-	int sizeReg, startAddr;
-	//We assume the Channel object has properly formated the waveform
-	// setup register addressing based on DAC
+//Waveform length and memory start registers for a DAC
+static int waveform_registers(const int & dac, int & sizeReg, int & startAddr) {
 	switch(dac) {
 		case 0:
 		case 2:
 			sizeReg   = FPGA_ADDR_CHA_WF_LENGTH;
 			startAddr =  FPGA_BANKSEL_WF_CHA;
-			break;
+			return 0;
 		case 1:
 		case 3:
 			sizeReg   = FPGA_ADDR_CHB_WF_LENGTH;
 			startAddr =  FPGA_BANKSEL_WF_CHB;
-			break;
+			return 0;
 		default:
 			return -2;
 	}
+}
+
+int APS::write_waveform_length(const int & dac, const size_t & numPts, const bool & broadcast) {
+	ULONG tmpData, wfLength;
+	int sizeReg, startAddr;
+	//We assume the Channel object has properly formated the waveform
+	// setup register addressing based on DAC
+	if (waveform_registers(dac, sizeReg, startAddr) < 0) {
+		return -2;
+	}
 
 	auto fpga = dac2fpga(dac);
 	if (fpga == INVALID_FPGA) {
@@ -1391,33 +1952,66 @@ int APS::write_waveform(const int & dac, const vector<short> & wfData) {
 	}
 
 	//Waveform length used by FPGA must be an integer multiple of WF_MODULUS and is 0 counted
-	wfLength = wfData.size() / WF_MODULUS - 1;
-	LOG(plog::info) << "Loading Waveform length " << wfData.size() << " (FPGA count = " << wfLength << " ) into FPGA  " << fpga << " DAC " << dac;
+	wfLength = numPts / WF_MODULUS - 1;
+	LOG(plog::info) << "Loading Waveform length " << numPts << " (FPGA count = " << wfLength << " ) into FPGA  " << fpga << " DAC " << dac;
 
 	//Write the waveform parameters
-	FPGA::write_FPGA(handle_, sizeReg, wfLength, fpga);
+	write(broadcast ? ALL_FPGAS : fpga, sizeReg, USHORT(wfLength));
 
   plog::Severity consoleSv = plog::get<CONSOLE_LOG>()->getMaxSeverity();
   plog::Severity fileSv = plog::get<FILE_LOG>()->getMaxSeverity();
 
-	if ((consoleSv >= plog::debug) || (fileSv >= plog::debug)) {
+	//Nothing has gone out yet inside an update
+	if (((consoleSv >= plog::debug) || (fileSv >= plog::debug)) && updateDepth_ == 0) {
 		//Double check it took
-		tmpData = FPGA::read_FPGA(handle_, sizeReg, fpga);
+		tmpData = FPGA::read_FPGA(*transport_, sizeReg, fpga);
 		LOG(plog::debug) << "Size set to: " << tmpData;
-		LOG(plog::debug) << "Loading waveform at " << myhex << startAddr;
 	}
+	return 0;
+}
+
+int APS::write_waveform_segment(const int & dac, const size_t & offset, const short * wfData, const size_t & numPts, const bool & broadcast) {
+	/*Write waveform data to part of the FPGA waveform memory
+	 * dac = channel (0-3); with broadcast the same memory of both FPGAs (DAC 0 and 2 or DAC 1 and 3)
+	 * offset = first sample to write; a multiple of WF_MODULUS
+	 * wfData = signed short waveform data; encoded straight from this buffer so it must not change until the flush below
+	 * numPts = number of samples
+	 */
+	int sizeReg, startAddr;
+	if (waveform_registers(dac, sizeReg, startAddr) < 0) {
+		return -2;
+	}
+	startAddr += offset;
+
+	FPGASELECT fpga = dac2fpga(dac);
+	if (fpga == INVALID_FPGA) {
+		return -1;
+	}
+	if (broadcast) fpga = ALL_FPGAS;
+
+	const USHORT * wfWords = reinterpret_cast<const USHORT *>(wfData);
+	if (upload_cached(fpga, startAddr, wfWords, numPts, 1)) {
+		return 0;
+	}
+
+  plog::Severity consoleSv = plog::get<CONSOLE_LOG>()->getMaxSeverity();
+  plog::Severity fileSv = plog::get<FILE_LOG>()->getMaxSeverity();
+	//Inside an update the flush below is deferred so there is nothing to check yet; checksums are read back one FPGA at a time
+	const bool checkSums = ((consoleSv >= plog::debug) || (fileSv >= plog::debug)) && updateDepth_ == 0 && fpga != ALL_FPGAS;
 
 	//Reset the checksums
-	if ((consoleSv >= plog::debug) || (fileSv >= plog::debug)) {
+	if (checkSums) {
+		LOG(plog::debug) << "Loading waveform at " << myhex << startAddr;
 		reset_checksums(fpga);
 	}
 
-	//Format the data and add to write queue
-	write(fpga, startAddr, vector<USHORT>(wfData.begin(), wfData.end()), true);
-	flush();
+	//Queue the samples in place rather than through write() so they are only read once more, by the encoder
+	add_to_checksums(fpga, startAddr, wfWords, numPts);
+	uploader_->queue_view(fpga, startAddr, wfWords, numPts);
+	if (flush() < 0) return -1;
 
 	//Verify the checksums
-	if ((consoleSv >= plog::debug) || (fileSv >= plog::debug)) {
+	if (checkSums) {
 		if (!verify_checksums(fpga)){
 			LOG(plog::error) << "Checksums didn't match after writing waveform data";
 			return -2;
@@ -1427,12 +2021,24 @@ int APS::write_waveform(const int & dac, const vector<short> & wfData) {
 }
 
 
+int APS::upload_LL_data_IQ(const FPGASELECT & fpga){
+	//Inside an update wait for commit, which sends matching link lists for both FPGAs as one broadcast
+	if (updateDepth_ > 0) {
+		pendingLL_[fpga - FPGA1] = true;
+		return 0;
+	}
+	const LLBank & bank = channels_[fpga == FPGA1 ? 0 : 2].LLBank_;
+	return write_LL_data_IQ(fpga, 0, 0, bank.length, true);
+}
+
 int APS::write_LL_data_IQ(const FPGASELECT & fpga, const ULONG & startAddr, const size_t & startIdx, const size_t & stopIdx, const bool & writeLengthFlag ){
 
 	//We store the IQ linklist data in channels 1 and 3
 	int dataChan;
 	switch(fpga){
 		case FPGA1:
+		//Only when both FPGAs hold the same link list
+		case ALL_FPGAS:
 			dataChan = 0;
 			break;
 		case FPGA2:
@@ -1453,22 +2059,20 @@ int APS::write_LL_data_IQ(const FPGASELECT & fpga, const ULONG & startAddr, cons
 
 	LOG(plog::debug) << "Writing LL Data for Channel: " << dataChan << "; Length: " << entriesToWrite;
 
-	WordVec writeData;
+	const LLBank & bank = channels_[dataChan].LLBank_;
+	//Whole bank uploads go through the upload cache; streaming refills always differ from what they overwrite
+	const bool cache = writeLengthFlag;
 
 	//Sort out whether we'll have to wrap around the top of the memory
 	if ( (startAddr+entriesToWrite) > MAX_LL_LENGTH){
-		//Pull out the first segment
-		size_t tmpStopIdx = ((MAX_LL_LENGTH-startAddr) + startIdx)%channels_[dataChan].LLBank_.length;
-		writeData = channels_[dataChan].LLBank_.get_packed_data(startIdx, tmpStopIdx);
-		//queue it
-		write(fpga, FPGA_BANKSEL_LL_CHA | startAddr, writeData, true);
+		//Queue the first segment
+		size_t tmpStopIdx = ((MAX_LL_LENGTH-startAddr) + startIdx)%bank.length;
+		write_LL_spans(fpga, FPGA_BANKSEL_LL_CHA | startAddr, bank.get_packed_data(startIdx, tmpStopIdx), bank.entry_words(), cache);
 		//the second segment is written to the top of the memory (startAddr = 0)
-		writeData = channels_[dataChan].LLBank_.get_packed_data(tmpStopIdx, stopIdx);
-		write(fpga, FPGA_BANKSEL_LL_CHA | 0, writeData, true);
+		write_LL_spans(fpga, FPGA_BANKSEL_LL_CHA | 0, bank.get_packed_data(tmpStopIdx, stopIdx), bank.entry_words(), cache);
 	}
 	else{
-		writeData = channels_[dataChan].LLBank_.get_packed_data(startIdx, stopIdx);
-		write(fpga, FPGA_BANKSEL_LL_CHA | startAddr, writeData, true);
+		write_LL_spans(fpga, FPGA_BANKSEL_LL_CHA | startAddr, bank.get_packed_data(startIdx, stopIdx), bank.entry_words(), cache);
 	}
 
 	//If necessary write the LL length register
@@ -1482,6 +2086,34 @@ int APS::write_LL_data_IQ(const FPGASELECT & fpga, const ULONG & startAddr, cons
 	return 0;
 }
 
+int APS::write_LL_spans(const FPGASELECT & fpga, const ULONG & addr, const LLBank::PackedSpans & spans, const size_t & entryWords, const bool & cache){
+	//The second run (the head of the bank after a wrap) follows the first in link list memory, which is addressed by entry
+	ULONG runAddr = addr;
+	for (auto & run : {spans.first, spans.second}) {
+		if (run.size == 0) continue;
+		if (cache) {
+			if (upload_cached(fpga, runAddr, run.data, run.size, entryWords)) {
+				runAddr += ULONG(run.size / entryWords);
+				continue;
+			}
+		}
+		else {
+			uploadCache_.invalidate(fpga, runAddr, run.size, entryWords);
+		}
+		add_to_checksums(fpga, runAddr, run.data, run.size);
+		//Encoded straight from the bank when the flush follows before it can change; an update holds the
+		//flush back until commit, by which time the bank may have been replaced, so that takes a copy
+		if (updateDepth_ == 0) {
+			uploader_->queue_view(fpga, runAddr, run.data, run.size);
+		}
+		else {
+			uploader_->queue(fpga, runAddr, run.data, run.size);
+		}
+		runAddr += ULONG(run.size / entryWords);
+	}
+	return 0;
+}
+
 //int APS::write_LL_data(const int & dac, const int & bankNum, const int & targetBank) {
 	/*
 	 * write_LL_data
@@ -1566,7 +2198,7 @@ int APS::read_LL_addr(const FPGASELECT & fpga){
 	/*
 	 * Read the currently playing LL address
 	 */
-	return FPGA::read_FPGA(handle_, FPGA_ADDR_CHA_LL_CURADDR, fpga);
+	return FPGA::read_FPGA(*transport_, FPGA_ADDR_CHA_LL_CURADDR, fpga);
 }
 
 int APS::read_LL_addr(const int & dac){
@@ -1586,7 +2218,7 @@ int APS::read_LL_addr(const int & dac){
 	default:
 		return -1;
 	}
-	return FPGA::read_FPGA(handle_, fpgaAddr, dac2fpga(dac));
+	return FPGA::read_FPGA(*transport_, fpgaAddr, dac2fpga(dac));
 }
 
 
@@ -1594,7 +2226,7 @@ int APS::read_miniLL_startAddr(const FPGASELECT & fpga){
 	/*
 	 * Read the start of the currently playing miniLL
 	 */
-	return FPGA::read_FPGA(handle_, FPGA_ADDR_CHA_MINILLSTART, fpga);
+	return FPGA::read_FPGA(*transport_, FPGA_ADDR_CHA_MINILLSTART, fpga);
 }
 
 int APS::save_state_file(string & stateFile){
@@ -1693,7 +2325,7 @@ void BankBouncerThread::run(){
 	//Write the LL length to the max
 	LOG(plog::debug) << "Writing Link List Length: " << myhex << MAX_LL_LENGTH << " at address: " << FPGA_ADDR_CHA_LL_LENGTH;
 	myAPS_->write(fpga, FPGA_ADDR_CHA_LL_LENGTH, MAX_LL_LENGTH-1, false);
-	LOG(plog::debug) << "LL Length Register: " << FPGA::read_FPGA(myAPS_->handle_, FPGA_ADDR_CHA_LL_LENGTH, FPGA1);
+	LOG(plog::debug) << "LL Length Register: " << FPGA::read_FPGA(*myAPS_->transport_, FPGA_ADDR_CHA_LL_LENGTH, FPGA1);
 
 	// Fill sequence memory
 	myAPS_->write_LL_data_IQ(fpga, 0, 0, MAX_LL_LENGTH, false);
@@ -1712,9 +2344,14 @@ void BankBouncerThread::run(){
 
 	//Now loop while streaming
 	while(running_) {
-		//Poll for current hardware address
+		//Poll for current hardware address; only the poll wants the shortest latency timer, the refills and
+		//anything else on the transport keep their own profile
 		myAPS_->mymutex_->lock();
-		curAddrHW = myAPS_->read_miniLL_startAddr(fpga);
+		{
+			TRACE_SPAN("stream poll", "streaming", myAPS_->deviceID_);
+			ProfileGuard poll(*myAPS_->transport_, PROFILE_STREAMING_POLL);
+			curAddrHW = myAPS_->read_miniLL_startAddr(fpga);
+		}
 		myAPS_->mymutex_->unlock();
 		LOG(plog::debug) << "Device ID: " << myAPS_->deviceID_ << " Current LL Addr: " << curAddrHW;
 
@@ -1726,7 +2363,12 @@ void BankBouncerThread::run(){
 			size_t startMiniLL = (lastMiniLL+1)%curLLBank->numMiniLLs;
 			USHORT curWriteAddrHW = nextWriteAddrHW;
 			myAPS_->mymutex_->lock();
+			TRACE_SPAN("stream refill", "streaming", myAPS_->deviceID_);
+			IOStats & ioStats = myAPS_->transport_->io_stats();
+			auto start = IOStats::clock::now();
+			uint64_t bytesBefore = ioStats.bytes(IO_FLUSH);
 			myAPS_->write_LL_data_IQ(fpga, USHORT(curWriteAddrHW), curLLBank->miniLLStartIdx[startMiniLL] , curLLBank->miniLLStartIdx[nextMiniLL], false);
+			ioStats.record(IO_STREAM_REFILL, ioStats.bytes(IO_FLUSH) - bytesBefore, start);
 			myAPS_->mymutex_->unlock();
 			//Update where we want to write to next
 			nextWriteAddrHW = mymod(nextWriteAddrHW + mymod(curLLBank->miniLLStartIdx[nextMiniLL] - curLLBank->miniLLStartIdx[startMiniLL], curLLBank->length), MAX_LL_LENGTH);
@@ -10,6 +10,12 @@
 #ifndef APS_H_
 #define APS_H_
 
+//Thrown by init when the bitfile can not be read, so callers can tell a missing file from other failures
+class FileError : public runtime_error {
+public:
+	FileError(const string & what) : runtime_error(what) {}
+};
+
 class APS {
 
 
@@ -57,9 +63,36 @@ public:
 
 	template <typename T>
 	int set_waveform(const int & dac, const vector<T> & data){
-		channels_[dac].set_waveform(data);
-		return write_waveform(dac, channels_[dac].prep_waveform());
+		return set_waveform(dac, data.data(), data.size());
 	}
+	int set_waveform(const int &, const float *, const size_t &);
+	int set_waveform(const int &, const short *, const size_t &);
+	//Overwrite part of a channel's waveform starting at a sample; only the WF_MODULUS aligned span around it is written
+	int set_waveform_segment(const int &, const size_t &, const float *, const size_t &);
+	int set_waveform_segment(const int &, const size_t &, const short *, const size_t &);
+
+	//Named pulses packed into a channel's waveform memory by its WaveformLibrary. add_pulse places (or replaces) a
+	//pulse and uploads only its samples; the Pulse gives the address and count for link list entries. Returns 1 if
+	//the library had to be compacted to make room, which moves other pulses: look their addresses up again. If the
+	//upload fails the library and the channel's samples are put back as they were, compaction included.
+	//Loading a whole waveform with set_waveform drops the library; pulses added after it go past its samples.
+	int add_pulse(const int &, const string &, const float *, const size_t &, WaveformLibrary::Pulse &);
+	int add_pulse(const int &, const string &, const short *, const size_t &, WaveformLibrary::Pulse &);
+	int remove_pulse(const int &, const string &);
+	int find_pulse(const int &, const string &, WaveformLibrary::Pulse &) const;
+	//Close the gaps between pulses; the number of pulses moved
+	int compact_waveform_library(const int &);
+
+	//Between begin_update and commit writes are only queued and waveform uploads are merged per channel, then
+	//commit sends everything in one flush. Updates nest. Reads still go to the hardware and see none of it.
+	//Identical waveform updates for DAC 0 and 2 (or 1 and 3) and identical IQ link lists for both FPGAs go out once to both.
+	//abandon_update drops everything queued since the outermost begin_update instead; the device keeps what it had
+	//while the channels keep the new host copies. There is no update while link lists stream, and run and stop
+	//are refused inside one.
+	int begin_update();
+	int commit();
+	int abandon_update();
+	bool in_update() const;
 
 	int set_run_mode(const int &, const RUN_MODE &);
 	int set_repeat_mode(const int &, const bool &);
@@ -74,6 +107,25 @@ public:
 
 	int read_PLL_chip_status() const;
 
+	//Shadow copies of the write-mostly registers
+	int resync_registers();
+	int set_register_check_interval(const int &);
+
+	//Largest USB write for block uploads (bytes)
+	int set_transfer_size(const int &);
+	int get_transfer_size() const;
+
+	//Driver latency/timeout profile used outside of bulk uploads and streaming address polls (TRANSFER_PROFILE)
+	int set_transfer_profile(const int &);
+	int get_transfer_profile() const;
+
+	//USB traffic counters for an IO_OP: count, bytes, total time (ns) then the IOStats latency histogram
+	int get_io_stats(const int &, uint64_t *, const int &) const;
+	int reset_io_stats();
+
+	//Forget what waveform and link list memory holds so the next uploads all go out (IO_CACHE_HIT/MISS count the skipped ones)
+	int clear_upload_cache();
+
 	//The owning APSRack needs access to some private members
 	friend class APSRack;
 	friend class BankBouncerThread;
@@ -89,12 +141,24 @@ private:
 
 	int deviceID_;
 	string deviceSerial_;
-	FT_HANDLE handle_;
+	//USB link to the unit (real or simulated)
+	std::unique_ptr<Transport> transport_;
+	//Queued block writes go out through here; declared after the transport it writes to
+	std::unique_ptr<UploadEngine> uploader_;
 	vector<Channel> channels_;
+	//Prepared DAC counts for each channel's waveform upload; encoded in place and kept to avoid reallocating
+	vector<short> prepBuffers_[4];
 	map<FPGASELECT, CheckSum> checksums_;
+	//Hashes of what was last written to each region of waveform and link list memory
+	mutable UploadCache uploadCache_;
+	//Host copies of the write-mostly CSR bank registers so bit updates don't need a read first
+	mutable map<FPGASELECT, vector<ShadowRegister>> shadowRegs_;
+	//Compare the shadow registers to the hardware every this many bit updates (0 = never)
+	int registerCheckInterval_;
+	int bitUpdatesSinceCheck_;
+	//A check came due during begin_update and waits for the commit to send the writes
+	bool registerCheckDeferred_;
 	int samplingRate_;
-	vector<UCHAR> writeQueue_;
-	vector<size_t> offsetQueue_;
 	vector<BankBouncerThread> myBankBouncerThreads_;
 	//Flag for whether streaming is up and running
 	std::atomic<bool> streaming_;
@@ -102,10 +166,62 @@ private:
 	//Since mutexs are non-copyable and non-movable we use an unique_ptr
 	std::unique_ptr<std::mutex> mymutex_;
 
+	//Nesting depth of begin_update
+	int updateDepth_;
+	//Waveform samples [start, stop) and length registers for each channel waiting for commit
+	struct PendingWaveform {
+		size_t start;
+		size_t stop;
+		bool length;
+	};
+	PendingWaveform pendingWaveforms_[4];
+	//IQ link lists of FPGA1 and FPGA2 waiting for commit
+	bool pendingLL_[2];
+
+	//Sends anything queued and suspends an update for steps that need round trips to the hardware
+	class ImmediateGuard {
+	public:
+		ImmediateGuard(APS & aps) : aps_(aps), depth_{aps.updateDepth_} {
+			if (depth_ > 0) {
+				aps_.updateDepth_ = 0;
+				aps_.flush();
+			}
+		}
+		~ImmediateGuard() {if (depth_ > 0) aps_.updateDepth_ = depth_;}
+	private:
+		APS & aps_;
+		int depth_;
+	};
+
+	//begin_update for the lifetime of a scope; abandoned unless committed, so error paths send nothing
+	class UpdateGuard {
+	public:
+		UpdateGuard(APS & aps) : aps_(aps), committed_{false} {aps_.begin_update();}
+		~UpdateGuard() {if (!committed_) aps_.abandon_update();}
+		int commit() {
+			committed_ = true;
+			return aps_.commit();
+		}
+	private:
+		APS & aps_;
+		bool committed_;
+	};
+
+	//Immediate writes (queue = false) flush everything queued before them, except inside an update
 	int write(const FPGASELECT & fpga, const unsigned int & addr, const USHORT & data, const bool & queue = false);
 	int write(const FPGASELECT & fpga, const unsigned int & addr, const vector<USHORT> & data, const bool & queue = false);
 
 	int flush();
+	//Whether the memory already holds these words; counted in the IO_CACHE_HIT/MISS stats
+	bool upload_cached(const FPGASELECT &, const ULONG &, const USHORT *, const size_t &, const size_t & entryWords);
+
+	int set_bit(const FPGASELECT &, const ULONG &, const USHORT &);
+	int clear_bit(const FPGASELECT &, const ULONG &, const USHORT &);
+	int update_bits(const FPGASELECT &, const ULONG &, const USHORT &, const USHORT &);
+	void load_shadow(const FPGASELECT &, const ULONG &);
+	void update_shadow(const FPGASELECT &, const ULONG &, const USHORT *, const size_t &);
+	void invalidate_shadow(const FPGASELECT &) const;
+	bool check_registers();
 	int reset_status_ctrl();
 	int clear_status_ctrl();
 	UCHAR read_status_ctrl() const;
@@ -130,10 +246,24 @@ private:
 
 	int reset_checksums(const FPGASELECT &);
 	bool verify_checksums(const FPGASELECT &);
+	//Address checksum is the lower word of the start address; a broadcast adds to both FPGAs
+	void add_to_checksums(const FPGASELECT &, const ULONG &, const USHORT *, const size_t &);
 
-	int write_waveform(const int &, const vector<short> &);
+	int write_waveform(const int &, const short *, const size_t &);
+	//broadcast writes the DAC's registers or memory on both FPGAs at once with ALL_FPGAS
+	int write_waveform_length(const int &, const size_t &, const bool & broadcast = false);
+	int write_waveform_segment(const int &, const size_t &, const short *, const size_t &, const bool & broadcast = false);
+	template <typename T>
+	int update_waveform_segment(const int &, const size_t &, const T *, const size_t &);
+	template <typename T>
+	int place_pulse(const int &, const string &, const T *, const size_t &, WaveformLibrary::Pulse &);
+	int upload_waveform(const int &, const size_t &, const size_t &, const bool &);
+	int write_waveform_span(const int &, const size_t &, const size_t &, const bool &);
+	bool broadcast_waveform(const int &, const PendingWaveform &, const PendingWaveform &);
 
 	int write_LL_data_IQ(const FPGASELECT &, const ULONG &, const size_t &, const size_t &, const bool &);
+	int upload_LL_data_IQ(const FPGASELECT &);
+	int write_LL_spans(const FPGASELECT &, const ULONG &, const LLBank::PackedSpans &, const size_t &, const bool &);
 	int set_LL_data_IQ(const FPGASELECT &, const WordVec &, const WordVec &, const WordVec &, const WordVec &, const WordVec &);
 	int stream_LL_data(const int);
 	int read_LL_addr(const FPGASELECT &);
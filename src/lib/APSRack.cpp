@@ -23,9 +23,52 @@ int APSRack::initAPS(const int & deviceID, const string & bitFile, const bool &
 	return APSs_[deviceID].init(bitFile, forceReload);
 }
 
+//Initialize all the connected units at once: each has its own USB link so they run in parallel
+vector<InitResult> APSRack::init_all(const string & bitFile, const bool & forceReload){
+	vector<InitResult> results(APSs_.size());
+	vector<std::thread> initThreads;
+
+	for (size_t ct = 0; ct < APSs_.size(); ct++) {
+		InitResult & result = results[ct];
+		result.deviceID = ct;
+		result.serial = deviceSerials_[ct];
+		result.connected = APSs_[ct].isOpen;
+		result.status = 0;
+		result.fileError = false;
+		result.initTime = 0;
+		if (!result.connected) continue;
+
+		initThreads.emplace_back([this, ct, &result, &bitFile, forceReload](){
+			auto start = std::chrono::steady_clock::now();
+			try {
+				result.status = APSs_[ct].init(bitFile, forceReload);
+			} catch (FileError & e) {
+				result.status = -1;
+				result.fileError = true;
+				result.error = e.what();
+			} catch (std::exception & e) {
+				result.status = -1;
+				result.error = e.what();
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			result.initTime = elapsed.count();
+		});
+	}
+
+	for (auto & initThread : initThreads) {
+		initThread.join();
+	}
+
+	for (auto & result : results) {
+		if (!result.connected) continue;
+		LOG(plog::info) << "Init of " << result.serial << " finished in " << result.initTime << " s with status " << result.status
+				<< (result.error.empty() ? "" : ": ") << result.error;
+	}
+	return results;
+}
+
 int APSRack::get_num_devices()  {
-	int numDevices;
-	FT_ListDevices(&numDevices, NULL, FT_LIST_NUMBER_ONLY);
+	int numDevices = FTDI::get_num_devices();
 	if (numDevices_ != numDevices) {
 		update_device_enumeration();
 	}
@@ -175,6 +218,18 @@ int APSRack::get_sampleRate(const int & deviceID) const{
 	return APSs_[deviceID].get_sampleRate();
 }
 
+int APSRack::begin_update(const int & deviceID) {
+	return APSs_[deviceID].begin_update();
+}
+
+int APSRack::commit(const int & deviceID) {
+	return APSs_[deviceID].commit();
+}
+
+int APSRack::abandon_update(const int & deviceID) {
+	return APSs_[deviceID].abandon_update();
+}
+
 int APSRack::set_run_mode(const int & deviceID, const int & dac, const RUN_MODE & mode){
 	return APSs_[deviceID].set_run_mode(dac, mode);
 }
@@ -256,6 +311,54 @@ int APSRack::read_PLL_chip_status(const int & deviceID) const {
 	return APSs_[deviceID].read_PLL_chip_status();
 }
 
+int APSRack::resync_registers(const int & deviceID) {
+	return APSs_[deviceID].resync_registers();
+}
+
+int APSRack::set_register_check_interval(const int & deviceID, const int & interval) {
+	return APSs_[deviceID].set_register_check_interval(interval);
+}
+
+int APSRack::set_transfer_size(const int & deviceID, const int & transferSize) {
+	return APSs_[deviceID].set_transfer_size(transferSize);
+}
+
+int APSRack::get_transfer_size(const int & deviceID) const {
+	return APSs_[deviceID].get_transfer_size();
+}
+
+int APSRack::set_transfer_profile(const int & deviceID, const int & profile) {
+	return APSs_[deviceID].set_transfer_profile(profile);
+}
+
+int APSRack::get_transfer_profile(const int & deviceID) const {
+	return APSs_[deviceID].get_transfer_profile();
+}
+
+int APSRack::get_io_stats(const int & deviceID, const int & op, uint64_t * values, const int & numValues) const {
+	return APSs_[deviceID].get_io_stats(op, values, numValues);
+}
+
+int APSRack::reset_io_stats(const int & deviceID) {
+	return APSs_[deviceID].reset_io_stats();
+}
+
+int APSRack::remove_pulse(const int & deviceID, const int & dac, const string & name) {
+	return APSs_[deviceID].remove_pulse(dac, name);
+}
+
+int APSRack::find_pulse(const int & deviceID, const int & dac, const string & name, WaveformLibrary::Pulse & pulse) const {
+	return APSs_[deviceID].find_pulse(dac, name, pulse);
+}
+
+int APSRack::compact_waveform_library(const int & deviceID, const int & dac) {
+	return APSs_[deviceID].compact_waveform_library(dac);
+}
+
+int APSRack::clear_upload_cache(const int & deviceID) {
+	return APSs_[deviceID].clear_upload_cache();
+}
+
 int APSRack::save_state_files(){
 	// loop through available APS Units and save state
 	for(unsigned int apsct = 0; apsct < APSs_.size(); apsct++) {
@@ -318,7 +421,10 @@ int APSRack::read_bulk_state_file(string & stateFile){
 
 int APSRack::raw_write(int deviceID, int numBytes, UCHAR* data){
 	DWORD bytesWritten;
-	FT_Write(APSs_[deviceID].handle_, data, numBytes, &bytesWritten);
+	//Raw commands can write anywhere so nothing cached about the memory or the registers holds any more
+	APSs_[deviceID].clear_upload_cache();
+	APSs_[deviceID].invalidate_shadow(ALL_FPGAS);
+	APSs_[deviceID].transport_->write(data, numBytes, &bytesWritten);
 	return int(bytesWritten);
 }
 
@@ -330,16 +436,16 @@ int APSRack::raw_read(int deviceID, FPGASELECT fpga) {
 
 	//Send the read command byte
 	UCHAR commandPacket = 0x80 | Command | (fpga<<2) | transferSize;
-    FT_Write(APSs_[deviceID].handle_, &commandPacket, 1, &bytesWritten);
+    APSs_[deviceID].transport_->write(&commandPacket, 1, &bytesWritten);
 
 	//Look for the data
-	FT_Read(APSs_[deviceID].handle_, dataBuffer, 2, &bytesRead);
+	APSs_[deviceID].transport_->read(dataBuffer, 2, &bytesRead);
 	LOG(plog::verbose) << "Read " << bytesRead << " bytes with value" << myhex << ((dataBuffer[0] << 8) | dataBuffer[1]);
 	return int((dataBuffer[0] << 8) | dataBuffer[1]);
 }
 
 int APSRack::read_register(int deviceID, FPGASELECT fpga, int addr){
-	return FPGA::read_FPGA(APSs_[deviceID].handle_, addr, fpga);
+	return FPGA::read_FPGA(*APSs_[deviceID].transport_, addr, fpga);
 }
 
 int APSRack::enable_oscillator(int deviceID) {
@@ -11,6 +11,17 @@
 #define APSRACK_H_
 
 
+//Outcome of initializing one unit in APSRack::init_all
+struct InitResult {
+	int deviceID;
+	string serial;
+	bool connected; //units that are not connected are skipped
+	int status; //from APS::init, or -1 if it threw
+	bool fileError; //the init threw because the bitfile could not be read
+	double initTime; //seconds
+	string error; //message of any exception thrown during the init
+};
+
 class APSRack {
 public:
 	APSRack();
@@ -19,6 +30,8 @@ public:
 
 	int init();
 	int initAPS(const int &, const string &, const bool &);
+	//Initialize all connected units concurrently, one thread per unit
+	vector<InitResult> init_all(const string &, const bool &);
 	int connect(const int &);
 	int connect(const string &);
 	int disconnect(const int &);
@@ -60,10 +73,26 @@ public:
 
 	//Pass through both short and float waveforms
 	template <typename T>
-	int set_waveform(const int & deviceID, const int & dac, const vector<T> & data){
-		return APSs_[deviceID].set_waveform(dac, data);
+	int set_waveform(const int & deviceID, const int & dac, const T * data, const size_t & numPts){
+		return APSs_[deviceID].set_waveform(dac, data, numPts);
+	}
+	template <typename T>
+	int set_waveform_segment(const int & deviceID, const int & dac, const size_t & startSample, const T * data, const size_t & numPts){
+		return APSs_[deviceID].set_waveform_segment(dac, startSample, data, numPts);
 	}
 
+	template <typename T>
+	int add_pulse(const int & deviceID, const int & dac, const string & name, const T * data, const size_t & numPts, WaveformLibrary::Pulse & pulse){
+		return APSs_[deviceID].add_pulse(dac, name, data, numPts, pulse);
+	}
+	int remove_pulse(const int &, const int &, const string &);
+	int find_pulse(const int &, const int &, const string &, WaveformLibrary::Pulse &) const;
+	int compact_waveform_library(const int &, const int &);
+
+	int begin_update(const int &);
+	int commit(const int &);
+	int abandon_update(const int &);
+
 	int set_run_mode(const int &, const int &, const RUN_MODE &);
 	int set_repeat_mode(const int &, const int &, const bool & mode);
 
@@ -74,6 +103,16 @@ public:
 
 	int read_PLL_chip_status(const int &) const;
 
+	int resync_registers(const int &);
+	int set_register_check_interval(const int &, const int &);
+	int set_transfer_size(const int &, const int &);
+	int get_transfer_size(const int &) const;
+	int set_transfer_profile(const int &, const int &);
+	int get_transfer_profile(const int &) const;
+	int get_io_stats(const int &, const int &, uint64_t *, const int &) const;
+	int reset_io_stats(const int &);
+	int clear_upload_cache(const int &);
+
 	int save_state_files();
 	int read_state_files();
 	int save_bulk_state_file(string & );
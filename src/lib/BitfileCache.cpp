@@ -0,0 +1,83 @@
+/*
+ * BitfileCache.cpp
+ */
+
+#include "BitfileCache.h"
+
+#include <sys/stat.h>
+
+std::mutex BitfileCache::mutex_;
+map<std::pair<string, FPGASELECT>, std::shared_ptr<BitfileCache::Entry>> BitfileCache::entries_;
+std::atomic<size_t> BitfileCache::numLoads_{0};
+std::atomic<size_t> BitfileCache::numHits_{0};
+
+namespace {
+
+//Modification time in nanoseconds; Windows' stat only keeps seconds
+long long mod_time(const struct stat & fileInfo) {
+#if defined(_WIN32)
+	return static_cast<long long>(fileInfo.st_mtime) * 1000000000LL;
+#elif defined(__APPLE__)
+	return static_cast<long long>(fileInfo.st_mtimespec.tv_sec) * 1000000000LL + fileInfo.st_mtimespec.tv_nsec;
+#else
+	return static_cast<long long>(fileInfo.st_mtim.tv_sec) * 1000000000LL + fileInfo.st_mtim.tv_nsec;
+#endif
+}
+
+} //end anonymous namespace
+
+std::shared_ptr<const FPGA::BitfileImage> BitfileCache::get(const string & bitFile, const FPGASELECT & chipSelect) {
+	struct stat fileInfo;
+	if (stat(bitFile.c_str(), &fileInfo) != 0) {
+		LOG(plog::error) << "Unable to open bitfile: " << bitFile;
+		return nullptr;
+	}
+	const long long modTime = mod_time(fileInfo);
+	const long long fileSize = static_cast<long long>(fileInfo.st_size);
+
+	std::shared_ptr<Entry> entry;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::shared_ptr<Entry> & slot = entries_[std::make_pair(bitFile, chipSelect)];
+		if (!slot) slot = std::make_shared<Entry>();
+		entry = slot;
+	}
+
+	//Hold the entry's lock while loading so concurrent requests for the same file only read it once
+	std::lock_guard<std::mutex> lock(entry->mutex);
+	if (entry->image && entry->modTime == modTime && entry->fileSize == fileSize) {
+		numHits_++;
+		return entry->image;
+	}
+
+	LOG(plog::debug) << "Opening bitfile: " << bitFile;
+	std::ifstream FID (bitFile, std::ios::in|std::ios::binary);
+	if (!FID.is_open()){
+		LOG(plog::error) << "Unable to open bitfile: " << bitFile;
+		return nullptr;
+	}
+
+	//Copy over the file data to the data vector
+	//The default istreambuf_iterator constructor returns the "end-of-stream" iterator.
+	vector<UCHAR> fileData((std::istreambuf_iterator<char>(FID)), std::istreambuf_iterator<char>());
+	LOG(plog::debug) << "Read " << fileData.size() << " bytes from bitfile";
+
+	entry->image = std::make_shared<const FPGA::BitfileImage>(FPGA::frame_bitfile(fileData, chipSelect));
+	entry->modTime = modTime;
+	entry->fileSize = fileSize;
+	numLoads_++;
+	return entry->image;
+}
+
+void BitfileCache::clear() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	entries_.clear();
+}
+
+size_t BitfileCache::num_loads() {
+	return numLoads_;
+}
+
+size_t BitfileCache::num_hits() {
+	return numHits_;
+}
@@ -0,0 +1,43 @@
+/*
+ * BitfileCache.h
+ *
+ * Process wide cache of FPGA bitfiles already bit reversed, padded and framed for the wire
+ * (see FPGA::frame_bitfile) so programming a rack reads and transforms each file once.
+ * Entries are keyed by path and chip select and reloaded when the file's modification
+ * time (to the nanosecond where the platform keeps it) or size changes. Each entry has its
+ * own lock so different files load in parallel while requests for the same one wait for it.
+ */
+
+#include "headings.h"
+
+#ifndef BITFILECACHE_H_
+#define BITFILECACHE_H_
+
+class BitfileCache {
+public:
+	//Framed image of the bitfile for the chip select; nullptr if the file can not be read
+	static std::shared_ptr<const FPGA::BitfileImage> get(const string &, const FPGASELECT &);
+
+	//Drop all entries
+	static void clear();
+
+	//Number of times a file was read from disk and framed / served from the cache
+	static size_t num_loads();
+	static size_t num_hits();
+
+private:
+	struct Entry {
+		std::mutex mutex;
+		long long modTime;
+		long long fileSize;
+		std::shared_ptr<const FPGA::BitfileImage> image;
+	};
+
+	//Only guards the map; loading holds the entry's lock
+	static std::mutex mutex_;
+	static map<std::pair<string, FPGASELECT>, std::shared_ptr<Entry>> entries_;
+	static std::atomic<size_t> numLoads_;
+	static std::atomic<size_t> numHits_;
+};
+
+#endif /* BITFILECACHE_H_ */
@@ -0,0 +1,51 @@
+/*
+ * CPUFeatures.cpp
+ *
+ * Runtime checks for the instruction sets the vector kernels use.
+ */
+
+#include "CPUFeatures.h"
+
+#ifdef SIMD_X86
+
+bool CPUFeatures::has_sse2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] >> 26) & 1;
+#else
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool CPUFeatures::has_ssse3() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] >> 9) & 1;
+#else
+	return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+bool CPUFeatures::has_avx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	//Need the OS to save the YMM registers too
+	bool osxsave = (info[2] >> 27) & 1;
+	if (!osxsave || ((_xgetbv(0) & 0x6) != 0x6)) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] >> 5) & 1;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#else
+
+bool CPUFeatures::has_sse2() {return false;}
+bool CPUFeatures::has_ssse3() {return false;}
+bool CPUFeatures::has_avx2() {return false;}
+
+#endif /* SIMD_X86 */
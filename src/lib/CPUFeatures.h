@@ -0,0 +1,74 @@
+/*
+ * CPUFeatures.h
+ *
+ * Runtime CPU feature checks and kernel selection shared by the vectorized inner loops
+ * (WordPacking.cpp, WaveformPrep.cpp). Each family of interchangeable kernels is looked up
+ * by an enum and the best one the CPU supports is used until another is picked.
+ */
+
+#include "headings.h"
+
+#ifndef CPUFEATURES_H_
+#define CPUFEATURES_H_
+
+//Which instruction sets the vector kernels can be built for; SIMD_TARGET lets GCC/clang
+//compile a single function for an instruction set beyond the build's baseline
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#define SIMD_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define SIMD_X86
+#include <intrin.h>
+#include <immintrin.h>
+#define SIMD_TARGET(x)
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace CPUFeatures {
+	//All false off x86; NEON is part of the aarch64 baseline and needs no check
+	bool has_sse2();
+	bool has_ssse3();
+	bool has_avx2();
+}
+
+//The kernel in use for one family. The lookup gives a kernel's function or nullptr if this CPU can not run it.
+template <typename Kernel, typename Function>
+class KernelDispatch {
+public:
+	typedef Function (*Lookup)(const Kernel &);
+
+	//Starts on the first supported kernel in order of preference, else the fallback
+	KernelDispatch(Lookup lookup, std::initializer_list<Kernel> preferred, const Kernel & fallback) :
+		lookup_(lookup), kernel_{fallback}, function_{lookup(fallback)} {
+		for (const Kernel & kernel : preferred) {
+			if (Function function = lookup(kernel)) {
+				kernel_ = kernel;
+				function_ = function;
+				break;
+			}
+		}
+	}
+
+	Function function() const {return function_.load(std::memory_order_relaxed);}
+	Kernel kernel() const {return Kernel(kernel_.load());}
+	bool supported(const Kernel & kernel) const {return lookup_(kernel) != nullptr;}
+
+	//False and unchanged if the kernel is not supported
+	bool select(const Kernel & kernel) {
+		Function function = lookup_(kernel);
+		if (!function) return false;
+		function_ = function;
+		kernel_ = kernel;
+		return true;
+	}
+
+private:
+	Lookup lookup_;
+	std::atomic<int> kernel_;
+	std::atomic<Function> function_;
+};
+
+#endif /* CPUFEATURES_H_ */
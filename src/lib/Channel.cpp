@@ -8,9 +8,9 @@
 #include "headings.h"
 #include "Channel.h"
 
-Channel::Channel() : number{-1}, offset_{0.0}, scale_{1.0}, enabled_{false}, waveform_(0), trigDelay_{0}{}
+Channel::Channel() : number{-1}, offset_{0.0}, scale_{1.0}, enabled_{false}, waveform_(0), intWaveform_(0), isInt_{false}, trigDelay_{0}{}
 
-Channel::Channel( int number) : number{number}, offset_{0.0}, scale_{1.0}, enabled_{false}, waveform_(0), trigDelay_{0}{}
+Channel::Channel( int number) : number{number}, offset_{0.0}, scale_{1.0}, enabled_{false}, waveform_(0), intWaveform_(0), isInt_{false}, trigDelay_{0}{}
 
 Channel::~Channel() {
 	// TODO Auto-generated destructor stub
@@ -46,62 +46,189 @@ float Channel::get_scale() const{
 
 
 int Channel::set_waveform(const vector<float> & data) {
-	//Check whether we need to resize the waveform vector
-	if (data.size() > size_t(MAX_WF_LENGTH)){
-		LOG(plog::error) << "Tried to update waveform to longer than max allowed: " << data.size();
-		return -1;
+	return set_waveform(data.data(), data.size());
+}
+
+int Channel::set_waveform(const vector<short> & data) {
+	return set_waveform(data.data(), data.size());
+}
+
+static bool length_allowed(const size_t & numPts) {
+	if (numPts > size_t(MAX_WF_LENGTH)){
+		LOG(plog::error) << "Tried to update waveform to longer than max allowed: " << numPts;
+		return false;
 	}
+	return true;
+}
 
-	//Copy over the waveform data
-	//Waveform length must be a integer multiple of WF_MODULUS so resize to that
-	waveform_.resize(size_t(WF_MODULUS*ceil(float(data.size())/WF_MODULUS)), 0);
-	std::copy(data.begin(), data.end(), waveform_.begin());
+size_t Channel::waveform_size() const{
+	return isInt_ ? intWaveform_.size() : waveform_.size();
+}
 
-	return 0;
+bool Channel::holds_int() const{
+	return isInt_;
 }
 
-int Channel::set_waveform(const vector<short> & data) {
+int Channel::resize_waveform(const size_t & numPts) {
 	//Check whether we need to resize the waveform vector
-	if (data.size() > size_t(MAX_WF_LENGTH)){
-		LOG(plog::error) << "Tried to update waveform to longer than max allowed: " << data.size();
-		return -1;
+	if (!length_allowed(numPts)) return -1;
+	//Waveform length must be a integer multiple of WF_MODULUS so resize to that
+	const size_t paddedLength = size_t(WF_MODULUS*ceil(float(numPts)/WF_MODULUS));
+	if (isInt_) {
+		intWaveform_.resize(paddedLength);
+	} else {
+		waveform_.resize(paddedLength);
 	}
+	return 0;
+}
 
-	//Copy over the waveform data and convert to scaled floats
-	//Waveform length must be a integer multiple of WF_MODULUS so resize to that
-	waveform_.resize(size_t(WF_MODULUS*ceil(float(data.size())/WF_MODULUS)), 0);
-	for(size_t ct=0; ct<data.size(); ct++){
-		waveform_[ct] = float(data[ct])/MAX_WF_AMP;
+void Channel::convert_to_float() {
+	//Float samples landing in an int16 waveform: move it over to floats once
+	waveform_.resize(intWaveform_.size());
+	for(size_t ct=0; ct<intWaveform_.size(); ct++){
+		waveform_[ct] = float(intWaveform_[ct])/MAX_WF_AMP;
 	}
+	vector<short>().swap(intWaveform_);
+	isInt_ = false;
+}
+
+int Channel::set_waveform(const float * data, const size_t & numPts) {
+	if (!length_allowed(numPts)) return -1;
+	//The new samples replace every pulse and hold their memory
+	library_.reserve(numPts);
+	//Release the int16 samples
+	vector<short>().swap(intWaveform_);
+	isInt_ = false;
+	resize_waveform(numPts);
+
+	//Copy over the waveform data
+	std::copy(data, data + numPts, waveform_.begin());
+	std::fill(waveform_.begin() + numPts, waveform_.end(), 0);
+
 	return 0;
 }
 
-vector<short> Channel::prep_waveform() const{
-	//Apply the scale,offset and covert to integer format
-	vector<short> prepVec(waveform_.size());
-	for(size_t ct=0; ct<prepVec.size(); ct++){
-		prepVec[ct] = short(MAX_WF_AMP*(scale_*waveform_[ct]+offset_));
+int Channel::set_waveform(const short * data, const size_t & numPts) {
+	if (!length_allowed(numPts)) return -1;
+	//The new samples replace every pulse and hold their memory
+	library_.reserve(numPts);
+	//Keep the DAC counts as they are and release the floats
+	vector<float>().swap(waveform_);
+	isInt_ = true;
+	resize_waveform(numPts);
+
+	std::copy(data, data + numPts, intWaveform_.begin());
+	std::fill(intWaveform_.begin() + numPts, intWaveform_.end(), 0);
+	return 0;
+}
+
+int Channel::set_waveform_segment(const size_t & startSample, const float * data, const size_t & numPts) {
+	if (!length_allowed(startSample + numPts)) return -1;
+	if (isInt_) convert_to_float();
+	const size_t oldLength = waveform_.size();
+	if (startSample + numPts > oldLength) {
+		resize_waveform(startSample + numPts);
+		//Clear the old padding, any gap and the new padding
+		std::fill(waveform_.begin() + std::min(oldLength, startSample), waveform_.end(), 0);
 	}
+	std::copy(data, data + numPts, waveform_.begin() + startSample);
+	return 0;
+}
 
-	//Clip to the max and min values allowed
-	if (*max_element(prepVec.begin(), prepVec.end()) > MAX_WF_AMP){
-		LOG(plog::warning) << "Waveform element too positive; clipping to max";
-		for(short & tmpVal : prepVec){
-			if (tmpVal > MAX_WF_AMP) tmpVal = MAX_WF_AMP;
+int Channel::set_waveform_segment(const size_t & startSample, const short * data, const size_t & numPts) {
+	if (!length_allowed(startSample + numPts)) return -1;
+	//An empty channel takes on the representation of its first segment
+	if (waveform_size() == 0) isInt_ = true;
+	const size_t oldLength = waveform_size();
+	if (startSample + numPts > oldLength) {
+		resize_waveform(startSample + numPts);
+		if (isInt_) {
+			std::fill(intWaveform_.begin() + std::min(oldLength, startSample), intWaveform_.end(), 0);
+		} else {
+			std::fill(waveform_.begin() + std::min(oldLength, startSample), waveform_.end(), 0);
 		}
 	}
-	if (*min_element(prepVec.begin(), prepVec.end()) < -MAX_WF_AMP){
-		LOG(plog::warning) << "Waveform element too negative; clipping to max";
-		for(short & tmpVal : prepVec){
-			if (tmpVal < -MAX_WF_AMP) tmpVal = -MAX_WF_AMP;
+	if (isInt_) {
+		std::copy(data, data + numPts, intWaveform_.begin() + startSample);
+	} else {
+		for(size_t ct=0; ct<numPts; ct++){
+			waveform_[startSample + ct] = float(data[ct])/MAX_WF_AMP;
 		}
 	}
+	return 0;
+}
+
+void Channel::move_samples(const size_t & from, const size_t & to, const size_t & numPts) {
+	//Library compaction only moves pulses down so a forward copy is safe
+	if (isInt_) {
+		std::copy(intWaveform_.begin() + from, intWaveform_.begin() + from + numPts, intWaveform_.begin() + to);
+	} else {
+		std::copy(waveform_.begin() + from, waveform_.begin() + from + numPts, waveform_.begin() + to);
+	}
+}
+
+void Channel::zero_samples(const size_t & start, const size_t & stop) {
+	const size_t end = std::min(stop, waveform_size());
+	if (start >= end) return;
+	if (isInt_) {
+		std::fill(intWaveform_.begin() + start, intWaveform_.begin() + end, 0);
+	} else {
+		std::fill(waveform_.begin() + start, waveform_.begin() + end, 0);
+	}
+}
+
+vector<short> Channel::prep_waveform() const{
+	vector<short> prepVec;
+	prep_waveform(prepVec);
 	return prepVec;
 }
 
+void Channel::prep_waveform(vector<short> & prepVec) const{
+	prep_waveform(prepVec, 0, waveform_size());
+}
+
+void Channel::prep_waveform(vector<short> & prepVec, const size_t & start, const size_t & stop) const{
+	prepVec.resize(stop - start);
+	if (!isInt_) {
+		//Apply the scale, offset, truncate to integer format and clip to the values allowed in one pass
+		log_clips(WaveformPrep::prep_samples(waveform_.data() + start, prepVec.size(), scale_, offset_, prepVec.data()), prepVec.size());
+		return;
+	}
+	if (scale_ == 1.0 && offset_ == 0.0) {
+		//Identity transform: the DAC counts only need saturating
+		log_clips(WaveformPrep::clip_samples(intWaveform_.data() + start, prepVec.size(), prepVec.data()), prepVec.size());
+		return;
+	}
+	//Scaled int16 samples go through float a stack sized chunk at a time
+	static const size_t CHUNK = 1024;
+	float chunk[CHUNK];
+	WaveformPrep::ClipCounts clips = {0, 0};
+	for (size_t chunkStart = 0; chunkStart < prepVec.size(); chunkStart += CHUNK) {
+		const size_t numPts = std::min(CHUNK, prepVec.size() - chunkStart);
+		const short * data = intWaveform_.data() + start + chunkStart;
+		for (size_t ct = 0; ct < numPts; ct++) {
+			chunk[ct] = float(data[ct])/MAX_WF_AMP;
+		}
+		WaveformPrep::ClipCounts chunkClips = WaveformPrep::prep_samples(chunk, numPts, scale_, offset_, prepVec.data() + chunkStart);
+		clips.high += chunkClips.high;
+		clips.low += chunkClips.low;
+	}
+	log_clips(clips, prepVec.size());
+}
+
+void Channel::log_clips(const WaveformPrep::ClipCounts & clips, const size_t & numPts) const{
+	if (clips.high || clips.low) {
+		LOG(plog::warning) << "Channel " << number << ": clipped " << clips.high << " waveform element(s) too positive and "
+			<< clips.low << " too negative of " << numPts;
+	}
+}
+
 int Channel::clear_data() {
 	LLBank_.clear();
 	waveform_.clear();
+	intWaveform_.clear();
+	isInt_ = false;
+	library_.clear();
 	return 0;
 }
 
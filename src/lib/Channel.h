@@ -10,6 +10,23 @@
 #ifndef CHANNEL_H_
 #define CHANNEL_H_
 
+//Fused scale, offset, truncate, saturate and clip count kernels for prep_waveform (see WaveformPrep.cpp)
+namespace WaveformPrep {
+	typedef enum {PREP_SCALAR=0, PREP_SSE2, PREP_AVX2, PREP_NEON} PREP_KERNEL;
+	//Samples clipped at +MAX_WF_AMP and -MAX_WF_AMP
+	struct ClipCounts {
+		size_t high;
+		size_t low;
+	};
+	ClipCounts prep_samples(const float *, const size_t &, const float &, const float &, short *);
+	//Saturate samples already in DAC counts
+	ClipCounts clip_samples(const short *, const size_t &, short *);
+	int set_prep_kernel(const PREP_KERNEL &);
+	PREP_KERNEL get_prep_kernel();
+	bool prep_kernel_supported(const PREP_KERNEL &);
+	const char * prep_kernel_name(const PREP_KERNEL &);
+}
+
 class Channel {
 public:
 	Channel();
@@ -26,7 +43,21 @@ public:
 
 	int set_waveform(const vector<float> &);
 	int set_waveform(const vector<short> &);
+	int set_waveform(const float *, const size_t &);
+	int set_waveform(const short *, const size_t &);
+	//Overwrite samples from a start sample on, growing (and zero padding) the waveform if they run past its end
+	int set_waveform_segment(const size_t &, const float *, const size_t &);
+	int set_waveform_segment(const size_t &, const short *, const size_t &);
+	//Scaled, offset and truncated to DAC counts; samples outside +/-MAX_WF_AMP are clipped with one warning
 	vector<short> prep_waveform() const;
+	//As above into a buffer kept by the caller so repeated uploads don't allocate
+	void prep_waveform(vector<short> &) const;
+	//Only the samples from start up to stop
+	void prep_waveform(vector<short> &, const size_t &, const size_t &) const;
+	//Padded length in samples of whichever representation is held
+	size_t waveform_size() const;
+	//True when the waveform is held as int16 DAC counts
+	bool holds_int() const;
 
 	int clear_data();
 
@@ -37,10 +68,22 @@ public:
 	friend class BankBouncerThread;
 
 private:
+	void log_clips(const WaveformPrep::ClipCounts &, const size_t &) const;
+	int resize_waveform(const size_t &);
+	void convert_to_float();
+	//For the waveform library: copy samples within the waveform and zero a span
+	void move_samples(const size_t &, const size_t &, const size_t &);
+	void zero_samples(const size_t &, const size_t &);
+
 	float offset_;
 	float scale_;
 	bool enabled_;
+	//The waveform is kept as it was given: int16 DAC counts in intWaveform_ or floats in waveform_, only one is ever filled
 	vector<float> waveform_;
+	vector<short> intWaveform_;
+	bool isInt_;
+	//Named pulses placed in the waveform; a whole new waveform replaces them and holds the memory it covers
+	WaveformLibrary library_;
 	LLBank LLBank_;
 	int trigDelay_;
 };
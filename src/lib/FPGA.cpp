@@ -27,11 +27,86 @@ static const UCHAR BitReverse[256] =
 		0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF
 };
 
+// Each byte expanded into the 8 SPI bit-bytes (MSB first) that go out over USB, packed into
+// a 64-bit word so a byte serializes with a single 8-byte copy. The first bit-byte has to
+// land at the lowest address so the packing depends on the host byte order.
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define SPI_BIT_SHIFT(k) (8*(7-(k)))
+#else
+#define SPI_BIT_SHIFT(k) (8*(k))
+#endif
+
+static constexpr uint64_t spi_expand_byte(const unsigned & byte, const int & k = 0) {
+	return (k == 8) ? 0 : ((uint64_t((byte >> (7-k)) & 1) << SPI_BIT_SHIFT(k)) | spi_expand_byte(byte, k+1));
+}
+
+#define SPI_EXPAND4(n) spi_expand_byte(n), spi_expand_byte(n+1), spi_expand_byte(n+2), spi_expand_byte(n+3)
+#define SPI_EXPAND16(n) SPI_EXPAND4(n), SPI_EXPAND4(n+4), SPI_EXPAND4(n+8), SPI_EXPAND4(n+12)
+#define SPI_EXPAND64(n) SPI_EXPAND16(n), SPI_EXPAND16(n+16), SPI_EXPAND16(n+32), SPI_EXPAND16(n+48)
+
+static constexpr uint64_t SPIBitExpand[256] = {
+		SPI_EXPAND64(0), SPI_EXPAND64(64), SPI_EXPAND64(128), SPI_EXPAND64(192)
+};
+
+static_assert(SPIBitExpand[0x80] == (uint64_t(1) << SPI_BIT_SHIFT(0)), "SPI bit expansion table is out of order");
+static_assert(SPIBitExpand[0x01] == (uint64_t(1) << SPI_BIT_SHIFT(7)), "SPI bit expansion table is out of order");
+
+#undef SPI_EXPAND64
+#undef SPI_EXPAND16
+#undef SPI_EXPAND4
+#undef SPI_BIT_SHIFT
+
+//Longest VCXO command write_SPI/read_SPI serialize on the stack
+static const size_t SPI_MAX_STACK_BYTES = 4;
+
+//Upper bound on the serialized length of one SPI command with numBytes of data
+static inline size_t spi_max_length(const size_t & numBytes) {
+	// command byte, 2 address + 1 data byte for the PLL or the raw VCXO bytes, and the read-out command
+	return 2 + 8*std::max<size_t>(3, numBytes);
+}
+
+static size_t serialize_SPI_command(ULONG, const ULONG &, const UCHAR *, const size_t &, const bool &, UCHAR *);
+
 
 
 
 
-int FPGA::program_FPGA(FT_HANDLE deviceHandle, vector<UCHAR> bitFileData, const FPGASELECT & chipSelect) {
+//Configuration data goes out in 61 byte CONF_DATA packets; bulk mode puts this many in one USB write
+static const size_t CONF_BLOCKSIZE = 61;
+static const size_t CONF_FRAMES_PER_TRANSFER = 1024;
+//How long a status register read waits for its reply before retrying (ms)
+static const ULONG REGISTER_READ_TIMEOUT = 100;
+
+FPGA::BitfileImage FPGA::frame_bitfile(const vector<UCHAR> & bitFileData, const FPGASELECT & chipSelect) {
+	/* The data goes out bit reversed in CONF_DATA packets of 61 bytes, since that is the most
+	 * that fits in a single USB packet, with the last one zero padded.
+	 */
+	BitfileImage image;
+	image.chipSelect = chipSelect;
+	image.numBytes = bitFileData.size();
+	const size_t numFrames = (bitFileData.size() + CONF_BLOCKSIZE - 1) / CONF_BLOCKSIZE;
+	image.frames.assign(numFrames * (CONF_BLOCKSIZE+1), 0);
+
+	const UCHAR confCmd = APS_CONF_DATA | (chipSelect << 2);
+	for (size_t framect = 0; framect < numFrames; framect++) {
+		UCHAR * frame = &image.frames[framect * (CONF_BLOCKSIZE+1)];
+		*frame++ = confCmd;
+		const size_t start = framect * CONF_BLOCKSIZE;
+		const size_t numBytes = std::min(CONF_BLOCKSIZE, bitFileData.size() - start);
+		for (size_t ct = 0; ct < numBytes; ct++) {
+			frame[ct] = BitReverse[bitFileData[start + ct]];
+		}
+	}
+	return image;
+}
+
+int FPGA::program_FPGA(Transport & deviceHandle, const vector<UCHAR> & bitFileData, const FPGASELECT & chipSelect, const PROGRAM_MODE & mode) {
+	return program_FPGA(deviceHandle, frame_bitfile(bitFileData, chipSelect), mode);
+}
+
+int FPGA::program_FPGA(Transport & deviceHandle, const BitfileImage & image, const PROGRAM_MODE & mode) {
+
+	const FPGASELECT & chipSelect = image.chipSelect;
 
 	// To configure the FPGAs, you initialize them, send the byte stream, and
 	// then wait for the DONE flag to be asserted.
@@ -97,69 +172,69 @@ int FPGA::program_FPGA(FT_HANDLE deviceHandle, vector<UCHAR> bitFileData, const
 	if (!ok) return -4;
 
 	//Steps 3 and 4
-	for(int ct = 0, ok = 0; ct < maxAttemptCnt && ok == 0; ct++) {
-		LOG(plog::debug) << "Attempt: "  << ct+1;
-
-		// Set *ALL* Program and Reset Bits
-		writeByte = (APS_PGM_BITS | APS_FRST_BITS) & 0xF;
-		LOG(plog::debug) << "Write 2: " << myhex << int(writeByte);
-		if(FPGA::write_register(deviceHandle, APS_CONF_STAT, 0, INVALID_FPGA, &writeByte) != 1)return(-5);
-
-		// sleep to allow init to take place
-		// if the sleep is left out the next test might fail
-		usleep(1000);
-
-		// Read the Status to see that INITN is deasserted in response to PROGRAMN deassertion
-		if(FPGA::read_register(deviceHandle, APS_CONF_STAT, 0, INVALID_FPGA, &readByte) != 1) return(-6);
+	// Set *ALL* Program and Reset Bits
+	writeByte = (APS_PGM_BITS | APS_FRST_BITS) & 0xF;
+	LOG(plog::debug) << "Write 2: " << myhex << int(writeByte);
+	if(FPGA::write_register(deviceHandle, APS_CONF_STAT, 0, INVALID_FPGA, &writeByte) != 1)return(-5);
+
+	// Read the Status until INITN is deasserted in response to PROGRAMN deassertion;
+	// give init the same maxAttemptCnt ms the separate 1ms attempts used to add up to
+	bool readFailed = false;
+	ok = poll_until([&](){
+		readFailed = (FPGA::read_register(deviceHandle, APS_CONF_STAT, 0, INVALID_FPGA, &readByte) != 1);
 		LOG(plog::debug) << "Read 3: "  << myhex << int(readByte);
-
-		// verify Init Mask is high
-		if((readByte & InitMask) == InitMask) ok = 1;
-	}
+		return readFailed || (readByte & InitMask) == InitMask;
+	}, maxAttemptCnt);
+	if (readFailed) return(-6);
 	if (!ok) return -7;
 
 	// Step 5
 
-	// Bit reverse the data
-	for(UCHAR & tmpVal : bitFileData)
-		tmpVal = BitReverse[tmpVal];
-
-	static const int BLOCKSIZE = 61;
-
 	// At this point, the selected FPGA is ready to receive configuration bytes.
-	// Write out all of the bytes in groups of 61 bytes, since that is the most that
-	// can be written in a single USB packet.
-
-	for(auto dataIter=bitFileData.begin(); dataIter < bitFileData.end(); dataIter += BLOCKSIZE) {
-		// Write a full buffer if not at the end of the input data
-		if(dataIter + BLOCKSIZE < bitFileData.end()) {
-			if(FPGA::write_register(deviceHandle, APS_CONF_DATA, 0, chipSelect, &*dataIter) != BLOCKSIZE)  // Defaults to 61 bytes for CONF_DATA
+	const size_t frameSize = CONF_BLOCKSIZE + 1;
+	const size_t numFrames = image.frames.size() / frameSize;
+
+	if (mode == PROGRAM_PER_PACKET) {
+		// One USB write per packet
+		for (size_t framect = 0; framect < numFrames; framect++) {
+			UCHAR * frame = const_cast<UCHAR *>(&image.frames[framect * frameSize + 1]);
+			if(FPGA::write_register(deviceHandle, APS_CONF_DATA, 0, chipSelect, frame) != CONF_BLOCKSIZE)  // Defaults to 61 bytes for CONF_DATA
 				return(-8);
 		}
-		else {
-			// Create a zero padded final buffer
-			vector<UCHAR> lastBuffer(BLOCKSIZE, 0);
-			std::copy(dataIter, bitFileData.end(), lastBuffer.begin());
-
-			// Write out the last buffer
-			if(FPGA::write_register(deviceHandle, APS_CONF_DATA, 0, chipSelect, &lastBuffer.front()) != BLOCKSIZE)  // Defaults to 61 bytes for CONF_DATA
+	}
+	else {
+		// The framed image goes out as is, many packets to a USB write; only these long writes need the bulk profile
+		ProfileGuard bulk(deviceHandle, PROFILE_BULK_UPLOAD);
+		for (size_t framect = 0; framect < numFrames; framect += CONF_FRAMES_PER_TRANSFER) {
+			DWORD transferLength = std::min(CONF_FRAMES_PER_TRANSFER, numFrames - framect) * frameSize, bytesWritten = 0;
+			UCHAR * transferStart = const_cast<UCHAR *>(&image.frames[framect * frameSize]);
+			FT_STATUS ftStatus = deviceHandle.write(transferStart, transferLength, &bytesWritten);
+			if (!FT_SUCCESS(ftStatus) || bytesWritten != transferLength) {
+				LOG(plog::error) << "FPGA::program_FPGA: bulk write of configuration data failed with status = " << ftStatus << "; bytes written = " << bytesWritten;
 				return(-9);
+			}
 		}
 	}
 
-	int numBytesProgrammed = bitFileData.size();
+	int numBytesProgrammed = image.numBytes;
 
-	// check done bits
-	ok = false;
-	for(int ct = 0; ct < maxAttemptCnt && !ok; ct++) {
-		if(FPGA::read_register(deviceHandle, APS_CONF_STAT, 1, INVALID_FPGA, &readByte) != 1) return(-3);
+	// check done bits; give them up to maxAttemptCnt ms to come up
+	ok = poll_until([&](){
+		readFailed = (FPGA::read_register(deviceHandle, APS_CONF_STAT, 1, INVALID_FPGA, &readByte) != 1);
 		LOG(plog::debug) << "Read 4: " << myhex << int(readByte) << " (looking for " << int(DoneMask) << " HIGH)";
-		if ((readByte & DoneMask) == DoneMask) ok = true;
-		usleep(1000); // if done has not set wait a bit
+		return readFailed || (readByte & DoneMask) == DoneMask;
+	}, maxAttemptCnt);
+	if (readFailed) return(-3);
+
+	if (!ok) {
+		// INIT going low while DONE is still low flags a configuration (CRC) error
+		if ((readByte & InitMask) != InitMask) {
+			LOG(plog::error) << "FPGA INIT bits dropped during configuration: " << myhex << int(readByte);
+			return -10;
+		}
+		LOG(plog::warning) << "FPGAs did not set DONE bits after programming, attempting to continue.";
 	}
 
-	if (!ok) {LOG(plog::warning) << "FPGAs did not set DONE bits after programming, attempting to continue.";}
-
 
 	LOG(plog::debug) << "Done programming FPGA";
 
@@ -173,7 +248,7 @@ int FPGA::program_FPGA(FT_HANDLE deviceHandle, vector<UCHAR> bitFileData, const
 	return numBytesProgrammed;
 }
 
-int FPGA::reset(FT_HANDLE deviceHandle, const FPGASELECT & fpga) {
+int FPGA::reset(Transport & deviceHandle, const FPGASELECT & fpga) {
 	LOG(plog::debug) << "Resetting FPGA " << fpga;
 	UCHAR RstMask=0;
 	if((fpga == FPGA1) || (fpga == ALL_FPGAS)){
@@ -195,7 +270,7 @@ int FPGA::reset(FT_HANDLE deviceHandle, const FPGASELECT & fpga) {
 }
 
 int FPGA::read_register(
-		FT_HANDLE deviceHandle,
+		Transport & deviceHandle,
 		const ULONG & Command, // APS_FPGA_IO, APS_FPGA_ADDR, APS_CONF_DATA, APS_CONF_STAT, or APS_STATUS_CTRL
 		const ULONG & transferSize,    // Transfer size, 0, 1, 2, or 3 for 1, 2, 4, or 8 bytes.  Ignored for Config cycles
 		const FPGASELECT & chipSelect,     // Select bits to drive FPGA selects for I/O or Config
@@ -232,17 +307,24 @@ int FPGA::read_register(
 
 		//Write the commmand
 		if (repeats > 0) {LOG(plog::debug) << "Retry USB Write " << repeats;}
-		ftStatus = FT_Write(deviceHandle, &commandPacket, 1, &bytesWritten);
+		ftStatus = deviceHandle.write(&commandPacket, 1, &bytesWritten);
 
 		if (!FT_SUCCESS(ftStatus) || bytesWritten != 1) {
 			LOG(plog::debug) << "FPGA::read_register: Error writing to USB with status = " << ftStatus << "; bytes written = " << bytesWritten << "; repeat count = " << repeats;
 			continue;
 		}
 
-		usleep(100);
+		//Wait for the reply to arrive rather than a fixed delay
+		DWORD rxBytes = 0;
+		ftStatus = deviceHandle.wait_for_rx(packetLength, REGISTER_READ_TIMEOUT, &rxBytes);
+		if (!FT_SUCCESS(ftStatus) || rxBytes < packetLength) {
+			LOG(plog::debug) << "FPGA::read_register: Timed out waiting for the reply with status = " << ftStatus << "; bytes waiting = " << rxBytes << "; repeat count = " << repeats;
+			bytesRead = 0;
+			continue;
+		}
 
 		//Read the result
-		ftStatus = FT_Read(deviceHandle, Data, packetLength, &bytesRead);
+		ftStatus = deviceHandle.read(Data, packetLength, &bytesRead);
 		if (repeats > 0) {LOG(plog::debug) << "Retry USB Read " << repeats;}
 		if (!FT_SUCCESS(ftStatus) || bytesRead != packetLength) {
 			LOG(plog::debug) << "FPGA::read_register: Error reading from USB with status = " << ftStatus << "; bytes read = " << bytesRead << "; repeat count = " << repeats;
@@ -261,7 +343,7 @@ int FPGA::read_register(
 
 
 int FPGA::write_register(
-		FT_HANDLE deviceHandle,
+		Transport & deviceHandle,
 		const ULONG & Command, // APS_FPGA_IO, APS_FPGA_ADDR, APS_CONF_DATA, APS_CONF_STAT, or APS_STATUS_CTRL
 		const ULONG & transferSize,    // Transfer size, 0, 1, 2, or 3 for 1, 2, 4, or 8 bytes.  Ignored for Config cycles
 		const FPGASELECT & chipSelect,     // Select bits to drive FPGA selects for I/O or Config
@@ -307,7 +389,7 @@ int FPGA::write_register(
 
 	for (repeats = 0; repeats < max_repeats; repeats++) {
 		if (repeats > 0) {LOG(plog::debug) << "Repeat Write " << repeats;}
-		ftStatus = FT_Write(deviceHandle, &dataPacket[0], packetLength+1, &bytesWritten);
+		ftStatus = deviceHandle.write(&dataPacket[0], packetLength+1, &bytesWritten);
 		if (FT_SUCCESS(ftStatus)) break;
 	}
 
@@ -320,48 +402,66 @@ int FPGA::write_register(
 }
 
 
-USHORT FPGA::read_FPGA(FT_HANDLE deviceHandle, const ULONG & addr, FPGASELECT chipSelect)
+USHORT FPGA::read_FPGA(Transport & deviceHandle, const ULONG & addr, FPGASELECT chipSelect)
 {
+	return read_FPGA_batch(deviceHandle, {RegAddr(addr, chipSelect)})[0];
+}
 
-	if (chipSelect == ALL_FPGAS) chipSelect = FPGA1; // can only read from one FPGA at a time, assume we want data from FPGA 1
-
-	//Write the address with the read bit high
-	write_FPGA(deviceHandle, FPGA_ADDR_REGREAD | addr, vector<USHORT>(0), chipSelect );
+WordVec FPGA::read_FPGA_batch(Transport & deviceHandle, const vector<RegAddr> & regs)
+/*
+ * Description : Reads a set of registers with one USB write and one read. Each register
+ * 				 costs the address write with the read bit high followed by a 2 byte read
+ * 				 command and the FPGA returns the data in order.
+ * Returns : the register values; reads that fail come back as 0xBADD
+ *
+ ********************************************************************/
+{
+	WordVec results(regs.size(), 0xBADD);
+
+	//Keep the read data within the USB chip FIFO
+	static const size_t MAX_BATCH_READS = 128;
+	static const size_t BYTES_PER_READ = 6;
+	vector<UCHAR> packet(BYTES_PER_READ*std::min(regs.size(), MAX_BATCH_READS));
+	vector<UCHAR> readData(2*std::min(regs.size(), MAX_BATCH_READS));
+
+	for (size_t batchStart = 0; batchStart < regs.size(); batchStart += MAX_BATCH_READS) {
+		size_t numReads = std::min(regs.size() - batchStart, MAX_BATCH_READS);
+		UCHAR * curByte = packet.data();
+		for (size_t ct = batchStart; ct < batchStart + numReads; ct++) {
+			// can only read from one FPGA at a time, assume we want data from FPGA 1
+			FPGASELECT chipSelect = (regs[ct].second == ALL_FPGAS) ? FPGA1 : regs[ct].second;
+			//Write the address with the read bit high
+			curByte += format(chipSelect, FPGA_ADDR_REGREAD | regs[ct].first, nullptr, 0, curByte, nullptr);
+			//Then clock out the data with a read command byte for 2 bytes
+			*curByte++ = 0x80 | APS_FPGA_IO | (chipSelect<<2) | 1;
+		}
 
-	//Now clock out the data by writing a read command byte
-	// Start all packets with a APS Command Byte with the R/W = 1 for read for 2 bytes
-	UCHAR commandPacket = 0x80 | APS_FPGA_IO | (chipSelect<<2) | 1;
-	DWORD bytesWritten, bytesRead;
-	FT_STATUS ftStatus;
-	ftStatus = FT_Write(deviceHandle, &commandPacket, 1, &bytesWritten);
-	if (!FT_SUCCESS(ftStatus) || bytesWritten != 1){
-		LOG(plog::debug) << "FPGA::read_register: Error writing to USB with status = " << ftStatus << "; bytes written = " << bytesWritten;
-	}
+		DWORD bytesWritten = 0, bytesRead = 0;
+		FT_STATUS ftStatus = deviceHandle.write(packet.data(), numReads*BYTES_PER_READ, &bytesWritten);
+		if (!FT_SUCCESS(ftStatus) || bytesWritten != numReads*BYTES_PER_READ){
+			LOG(plog::debug) << "FPGA::read_FPGA_batch: Error writing to USB with status = " << ftStatus << "; bytes written = " << bytesWritten;
+		}
 
-	//Now read the data
-	UCHAR readData[2];
-	//Put some data to make sure they're updated
-	readData[0] = 0xBA;
-	readData[1] = 0xDD;
+		ftStatus = deviceHandle.read(readData.data(), 2*numReads, &bytesRead);
+		if (!FT_SUCCESS(ftStatus) || bytesRead != 2*numReads){
+			LOG(plog::debug) << "FPGA::read_FPGA_batch: Error reading from USB with status = " << ftStatus << "; bytes read = " << bytesRead;
+		}
 
-	ftStatus = FT_Read(deviceHandle, readData, 2, &bytesRead);
-	if (!FT_SUCCESS(ftStatus) || bytesRead != 2){
-		LOG(plog::debug) << "FPGA::read_register: Error reading from USB with status = " << ftStatus << "; bytes read = " << bytesRead;
+		for (size_t ct = 0; ct < bytesRead/2; ct++) {
+			results[batchStart + ct] = (readData[2*ct] << 8) | readData[2*ct+1];
+			LOG(plog::debug) << "Reading address " << myhex << regs[batchStart + ct].first << " with data " << results[batchStart + ct];
+		}
 	}
 
-	USHORT data = (readData[0] << 8) | readData[1];
-
-	LOG(plog::debug) << "Reading address " << myhex << addr << " with data " << data;
-
-	return data;
+	return results;
 }
 
-int FPGA::write_FPGA(FT_HANDLE deviceHandle, const unsigned int & addr, const USHORT & data, const FPGASELECT & fpga){
+int FPGA::write_FPGA(Transport & deviceHandle, const unsigned int & addr, const USHORT & data, const FPGASELECT & fpga){
 	//Create a vector and pass on
 	return write_FPGA(deviceHandle, addr, vector<USHORT>(1, data), fpga );
 }
 
-int FPGA::write_FPGA(FT_HANDLE deviceHandle, const unsigned int & addr, const vector<USHORT> & data, const FPGASELECT & fpga)
+int FPGA::write_FPGA(Transport & deviceHandle, const unsigned int & addr, const vector<USHORT> & data, const FPGASELECT & fpga)
 /********************************************************************
  *
  * Function Name : Write_FPGA()
@@ -375,20 +475,15 @@ int FPGA::write_FPGA(FT_HANDLE deviceHandle, const unsigned int & addr, const ve
  ********************************************************************/
 {
 
-	//Format for the block write
-	vector<UCHAR> dataPacket = format(fpga, addr, data);
-	vector<size_t> offsets = computeCmdByteOffsets(data.size());
 	if (data.size() > 0) {
 		LOG(plog::debug) << "Writing " << data.size() << " words at starting address: " << myhex << addr << " with Data[0]: " << data[0];
 	}
 
 	//Write to device
-	return write_block(deviceHandle, dataPacket, offsets);
-
-	return 0;
+	return write_block(deviceHandle, fpga, addr, data.data(), data.size());
 }
 
-int FPGA::write_FPGA(FT_HANDLE deviceHandle, const unsigned int & addr, const vector<USHORT> & data, const FPGASELECT & fpga, map<FPGASELECT, CheckSum> & checksums)
+int FPGA::write_FPGA(Transport & deviceHandle, const unsigned int & addr, const vector<USHORT> & data, const FPGASELECT & fpga, map<FPGASELECT, CheckSum> & checksums)
 /********************************************************************
  *
  * Function Name : APS_WriteFPGA()
@@ -424,35 +519,36 @@ int FPGA::write_FPGA(FT_HANDLE deviceHandle, const unsigned int & addr, const ve
 	return bytesWritten;
 }
 
-int FPGA::write_block(FT_HANDLE deviceHandle, vector<UCHAR> & dataPackets, const vector<size_t> & offsets){
-
-	// seems to break with writes longer than 64kB so split on that
-	ULONG bytesWritten=0, tmpBytesWritten=0;
-	auto curIdx = dataPackets.begin();
-	const int maxWriteLength = 65536;
-	while (std::distance(curIdx, dataPackets.end()) > 0){
-		if (std::distance(curIdx,dataPackets.end()) > maxWriteLength){
-			//Find the last command byte where the data packet will fit under 64kB.
-			auto breakPt = std::lower_bound(offsets.begin(), offsets.end(), std::distance(curIdx,dataPackets.begin()) + maxWriteLength);
-			DWORD ptsToWrite = *(breakPt-1) - std::distance(curIdx,dataPackets.begin());
-			FT_Write(deviceHandle, &(*curIdx), ptsToWrite, &tmpBytesWritten);
-			bytesWritten += tmpBytesWritten;
-			std::advance(curIdx, ptsToWrite);
-		}
-		else{
-			FT_Write(deviceHandle, &(*curIdx), std::distance(curIdx,dataPackets.end()), &tmpBytesWritten);
-			bytesWritten += tmpBytesWritten;
-			curIdx = dataPackets.end();
+int FPGA::write_block(Transport & deviceHandle, const FPGASELECT & fpga, const unsigned int & addr, const USHORT * data, const size_t & numWords){
+	/* Encode a block write straight into transfer sized pieces that end on command byte
+	 * boundaries and send each one. Returns the number of bytes written.
+	 */
+	const size_t bufferSize = std::min(format_length(numWords), std::max(deviceHandle.get_transfer_size(), BlockEncoder::MIN_BUFFER));
+	UCHAR * transferBuffer = deviceHandle.write_buffer(bufferSize);
+	BlockEncoder encoder(fpga, addr, data, numWords);
+	ULONG bytesWritten = 0;
+	while (!encoder.done()) {
+		DWORD transferLength = encoder.encode(transferBuffer, bufferSize), tmpBytesWritten = 0;
+		FT_STATUS ftStatus = deviceHandle.write(transferBuffer, transferLength, &tmpBytesWritten);
+		if (!FT_SUCCESS(ftStatus) || tmpBytesWritten != transferLength) {
+			LOG(plog::error) << "FPGA::write_block: write of " << transferLength << " bytes failed with status = " << ftStatus;
 		}
+		bytesWritten += tmpBytesWritten;
 	}
 	return(bytesWritten);
 }
 
-vector<UCHAR> FPGA::format(const FPGASELECT & fpga, const unsigned int & addr, const vector<USHORT> & data){
+size_t FPGA::format(const FPGASELECT & fpga, const unsigned int & addr, const USHORT * data, const size_t & numWords,
+		UCHAR * dataPacket, size_t * offsets, const size_t & offsetBase /* see header for default */){
 /* Helper function to format data for the FGPA in block mode:
  * 	command byte followed by 4 bytes address
  * 	command byte followed by 2 bytes data length
  * 	n bytes data
+ *
+ * 	The packet is written straight into dataPacket which must hold at least format_length(numWords) bytes.
+ * 	If offsets is not null the position of every command byte (shifted by offsetBase) is recorded
+ * 	alongside; it must hold at least num_cmd_bytes(numWords) entries.
+ * 	Returns the number of bytes written.
  */
 
 	//Some constants
@@ -462,113 +558,144 @@ vector<UCHAR> FPGA::format(const FPGASELECT & fpga, const unsigned int & addr, c
 	const UCHAR write8Bytes = APS_FPGA_IO | fpgaSelectMask | 3;
 	const UCHAR writeAddress = APS_FPGA_ADDR | fpgaSelectMask | 2;
 
-	//We return a vector of bytes to write
-	vector<UCHAR> dataPacket(0);
-	if (data.size() > 0) {
-		dataPacket.reserve(5 + 3 + 2*data.size() + data.size()/3 + data.size()%3 );
-	}
-	else{
-		dataPacket.reserve(5);
-	}
+	UCHAR * curByte = dataPacket;
+
+	//Record the position of a command byte and push it on
+	auto push_cmd = [&](const UCHAR & cmd) {
+		if (offsets) {
+			*offsets++ = offsetBase + (curByte - dataPacket);
+		}
+		*curByte++ = cmd;
+	};
 
 	//First push on the address
 	//4Byte command byte with address line high
-	dataPacket.push_back(writeAddress);
+	push_cmd(writeAddress);
 
 	// 4 bytes of address
-	dataPacket.push_back((addr >> 24) & LSB_MASK);
-	dataPacket.push_back((addr >> 16) & LSB_MASK);
-	dataPacket.push_back((addr >> 8) & LSB_MASK);
-	dataPacket.push_back(addr & LSB_MASK);
+	*curByte++ = (addr >> 24) & LSB_MASK;
+	*curByte++ = (addr >> 16) & LSB_MASK;
+	*curByte++ = (addr >> 8) & LSB_MASK;
+	*curByte++ = addr & LSB_MASK;
 
 	//Now push on the number of points data if necessary
-	if (data.size() > 0){
+	if (numWords > 0){
 		// command byte
-		dataPacket.push_back(write2Bytes);
+		push_cmd(write2Bytes);
 
 		//
-		dataPacket.push_back((data.size() >> 8) & LSB_MASK);
-		dataPacket.push_back(data.size() & LSB_MASK);
-
-		// push on data
-		int ptsRemaining = data.size();
-		int ptsToWrite = 0;
-		int wfIndex = 0;
-		while (ptsRemaining > 0) {
-			switch (ptsRemaining) {
-			case 1:
-				ptsToWrite = 1;
-				dataPacket.push_back(write2Bytes);
-				break;
-			case 2:
-			case 3:
-				ptsToWrite = 2;
-				dataPacket.push_back(write4Bytes);
-				break;
-			default: // 4 or more
-				ptsToWrite = 4;
-				dataPacket.push_back(write8Bytes);
-				break;
+		*curByte++ = (numWords >> 8) & LSB_MASK;
+		*curByte++ = numWords & LSB_MASK;
+
+		// push on data in groups of four words: a fixed 9 byte pattern that the packing kernel handles in bulk
+		const USHORT * curWord = data;
+		const size_t numGroups = numWords/4;
+		if (offsets) {
+			for (size_t ct = 0; ct < numGroups; ct++) {
+				*offsets++ = offsetBase + (curByte - dataPacket) + 9*ct;
 			}
+		}
+		pack_word_groups(curWord, numGroups, write8Bytes, curByte);
+		curWord += 4*numGroups;
+		curByte += 9*numGroups;
 
-			for (int ct = 0; ct < ptsToWrite; ct++, wfIndex++ ) {
-				dataPacket.push_back((data[wfIndex] >> 8) & LSB_MASK);
-				dataPacket.push_back(data[wfIndex] & LSB_MASK);
+		// and then the remaining 1-3 words
+		size_t ptsRemaining = numWords % 4;
+		while (ptsRemaining > 0) {
+			size_t ptsToWrite = (ptsRemaining == 1) ? 1 : 2;
+			push_cmd((ptsToWrite == 1) ? write2Bytes : write4Bytes);
+			for (size_t ct = 0; ct < ptsToWrite; ct++, curWord++) {
+				*curByte++ = (*curWord >> 8) & LSB_MASK;
+				*curByte++ = *curWord & LSB_MASK;
 			}
 			ptsRemaining -= ptsToWrite;
 		}
 	}
-	return dataPacket;
+	return curByte - dataPacket;
 }
 
-vector<size_t> FPGA::computeCmdByteOffsets(const size_t & dataLength){
-/* Helper function to find CMD byte offsets in a data vector formatted for sending to the FPGA. */
+const size_t FPGA::BlockEncoder::MIN_BUFFER;
 
+FPGA::BlockEncoder::BlockEncoder(const FPGASELECT & fpga, const unsigned int & addr, const USHORT * data, const size_t & numWords) :
+		fpga_{fpga}, addr_{addr}, data_{data}, numWords_{numWords}, wordsDone_{0}, headerDone_{false} {}
 
-	//We return a vector of bytes to write
-	vector<size_t> offsets(0);
-	if (dataLength > 0) {
-		offsets.reserve(2 + dataLength/3 + dataLength%3 );
-	}
-	else{
-		offsets.reserve(1);
-	}
-
-	// first byte is always a CMD byte
-	offsets.push_back(0);
+bool FPGA::BlockEncoder::done() const {
+	return headerDone_ && (wordsDone_ == numWords_);
+}
 
-	if (dataLength > 0){
-		// data count CMD
-		offsets.push_back(5);
+size_t FPGA::BlockEncoder::encode(UCHAR * dest, const size_t & maxBytes) {
+	/* Same layout as FPGA::format: address and count commands, groups of 4 words and then the 1-3 word tail.
+	 * Each piece is only emitted if it fits completely.
+	 */
+	const UCHAR fpgaSelectMask = fpga_ << 2;
+	UCHAR * curByte = dest;
+	UCHAR * endByte = dest + maxBytes;
+
+	if (!headerDone_) {
+		const size_t headerLength = (numWords_ > 0) ? 8 : 5;
+		if (maxBytes < headerLength) return 0;
+		*curByte++ = APS_FPGA_ADDR | fpgaSelectMask | 2;
+		*curByte++ = (addr_ >> 24) & LSB_MASK;
+		*curByte++ = (addr_ >> 16) & LSB_MASK;
+		*curByte++ = (addr_ >> 8) & LSB_MASK;
+		*curByte++ = addr_ & LSB_MASK;
+		if (numWords_ > 0) {
+			*curByte++ = APS_FPGA_IO | fpgaSelectMask | 1;
+			*curByte++ = (numWords_ >> 8) & LSB_MASK;
+			*curByte++ = numWords_ & LSB_MASK;
+		}
+		headerDone_ = true;
+	}
 
-		// current index starts after data count bytes
-		int currentIdx = 8;
-		int ptsRemaining = dataLength;
-		int ptsToWrite=0;
-		while (ptsRemaining > 0) {
-			switch (ptsRemaining) {
-			case 1:
-				ptsToWrite = 1;
-				break;
-			case 2:
-			case 3:
-				ptsToWrite = 2;
-				break;
-			default: // 4 or more
-				ptsToWrite = 4;
-				break;
+	// as many groups of four words as fit
+	const size_t groupsRemaining = (numWords_ - wordsDone_) / 4;
+	const size_t numGroups = std::min(groupsRemaining, static_cast<size_t>(endByte - curByte) / 9);
+	pack_word_groups(data_ + wordsDone_, numGroups, APS_FPGA_IO | fpgaSelectMask | 3, curByte);
+	wordsDone_ += 4*numGroups;
+	curByte += 9*numGroups;
+
+	// the remaining 1-3 words once all the groups are out
+	const size_t ptsRemaining = numWords_ - wordsDone_;
+	if (ptsRemaining > 0 && ptsRemaining < 4) {
+		const size_t tailLength = (ptsRemaining == 1) ? 3 : ((ptsRemaining == 2) ? 5 : 8);
+		if (static_cast<size_t>(endByte - curByte) >= tailLength) {
+			for (size_t ptsLeft = ptsRemaining; ptsLeft > 0; ) {
+				size_t ptsToWrite = (ptsLeft == 1) ? 1 : 2;
+				*curByte++ = APS_FPGA_IO | fpgaSelectMask | ((ptsToWrite == 1) ? 1 : 2);
+				for (size_t ct = 0; ct < ptsToWrite; ct++, wordsDone_++) {
+					*curByte++ = (data_[wordsDone_] >> 8) & LSB_MASK;
+					*curByte++ = data_[wordsDone_] & LSB_MASK;
+				}
+				ptsLeft -= ptsToWrite;
 			}
-			offsets.push_back(currentIdx);
-			ptsRemaining -= ptsToWrite;
-			currentIdx += 1+2*ptsToWrite;
 		}
 	}
-	return offsets;
+	return curByte - dest;
+}
+
+size_t FPGA::num_cmd_bytes(const size_t & numWords){
+/* Number of command bytes FPGA::format emits for a block of numWords words. */
+	if (numWords == 0) {
+		//Just the address
+		return 1;
+	}
+	// address, data count and then one per 4 words with 3 remaining words needing a 2+1 split
+	size_t remainder = numWords % 4;
+	return 2 + numWords/4 + ((remainder == 0) ? 0 : ((remainder == 3) ? 2 : 1));
+}
+
+size_t FPGA::format_length(const size_t & numWords){
+/* Number of bytes FPGA::format emits for a block of numWords words. */
+	if (numWords == 0) {
+		return 5;
+	}
+	// address and data count command bytes are already included in the command byte count
+	return num_cmd_bytes(numWords) + 4 + 2 + 2*numWords;
 }
 
 int FPGA::write_SPI
 (
-		FT_HANDLE deviceHandle,
+		Transport & deviceHandle,
 		ULONG Command,   // APS_DAC_SPI, APS_PLL_SPI, or APS_VCXO_SPI
 		const ULONG & Address,   // SPI register address.  Ignored for VCXO since address embedded in the data
 		const vector<UCHAR> & Data      // Data bytes to be written.  1 for DAC, 1 for PLL, or 4 for VCXO.  LS Byte first.
@@ -577,137 +704,221 @@ int FPGA::write_SPI
  *
  * Function Name : APS_WriteSPI()
  * Description :
- *      Write data to the selected chip via SPI.  The length of the data depends on the chip.
- *      The DAC requires 2 bytes, the PLL requires 3 bytes, and the VCXO requires 4 bytes.
- *      The format of the data bytes can be found in the data sheets for the chips.
- *      Note that the "data" defines an SPI command with R/W bit, a register address, and any write data.
- *      The values for the Command parameter are in aps.h
+ *      Write data to the selected chip via SPI.  See SPIBatch::add for the data formats.
  *      Returns the number of bytes written
  *
- *      DAC Data Format for first byte: R/W N1 N0 A4 A3 A2 A1 A0
- *      RW = 0 for write, N = 00 for 1 byte transfer.  A = 5-bit register address
- *      Note that DAC channel specified by Address<6:5>, since only Address<4:0> select DAC registers.
- *
- *      PLL Data format for first two bytes: R/W W1 W0 A12 A11 A10 A9 A8 A7 A6 A5 A4 A3 A2 A1 A0
- *      RW = 0 for write, W = 00 for 1 byte transfer.  A = 13-bit register address
- *
- *      VCXO data format: 32-bit value, with the address embedded in D<1:0>.  Bytes stored MS byte first.
- *      Note that this is not the order of the bytes in a 32 bit integer on little-endian CPUs
- *
- * Inputs :
- *                Command -  APS_DAC_SPI, APS_PLL_SPI, or APS_VCXO_SPI
- *               Address    -  SPI register address.  Ignored for VCXO since address embedded in the data
- *                *Data      -  Data bytes to be written.  1 for DAC, 1 for PLL, or 4 for VCXO.  LS Byte first.
- *
- * Returns : 0 on success <0 on failure
- *
  ********************************************************************/
 {
-	FT_STATUS ftStatus;
-	vector<UCHAR> dataPacket(0);
-	DWORD bytesWritten;
-	vector<UCHAR> byteBuffer(0);
-
-	switch(Command & APS_CMD)
-	{
-	case APS_DAC_SPI:
-		byteBuffer.push_back(Address & 0x1F);  // R/W = 0 for write, N = 00 for 1 Byte, A<4:0> = Address
-		byteBuffer.push_back(Data[0]);
-		Command |= ((Address & 0x60)>>3);  // Take bits above register address as DAC channel select
-		break;
-	case APS_PLL_SPI:
-		byteBuffer.push_back((Address>>8) & 0x1F); // R/W = 0 for write, W = 00 for 1 Byte, A<12:8>
-		byteBuffer.push_back(Address & 0xFF);  // A<7:0>
-		byteBuffer.push_back(Data[0]);
-		break;
-	case APS_VCXO_SPI:
-		// Copy out data bytes to be in MS Byte first order
-		byteBuffer = Data;
-		break;
-	default:
-		// Ignore unsupported commands
-		return(0);
+	if (Data.empty()) return 0;
+	if (Data.size() > SPI_MAX_STACK_BYTES) {
+		SPIBatch batch;
+		batch.write(Command, Address, Data);
+		return batch.send(deviceHandle);
 	}
 
-	// Start all packets with a APS Command Byte with the R/W= 0 for write
-	// Note that command byte from DAC has the SEL bits for the desired DAC set
-	dataPacket.push_back(Command);
-
-	// Serialize the data into bit 0 of the packet bytes
-	for(size_t ct = 0; ct < 8*byteBuffer.size(); ct++)
-		dataPacket.push_back( (byteBuffer[ct/8]>>(7-(ct%8))) & 1 );
-
-	ftStatus = FT_Write(deviceHandle, &dataPacket[0], dataPacket.size(), &bytesWritten);
-	if (!FT_SUCCESS(ftStatus)) {LOG(plog::error) << "Write SPI command failed";}
+	UCHAR packet[2 + 8*SPI_MAX_STACK_BYTES];
+	size_t packetLength = serialize_SPI_command(Command, Address, Data.data(), Data.size(), false, packet);
+	if (packetLength == 0) return 0;
 
+	auto start = IOStats::clock::now();
+	DWORD bytesWritten = 0;
+	FT_STATUS ftStatus = deviceHandle.write(packet, packetLength, &bytesWritten);
+	if (!FT_SUCCESS(ftStatus) || bytesWritten != packetLength) {LOG(plog::error) << "Write SPI command failed";}
+	deviceHandle.io_stats().record(IO_SPI, bytesWritten, start);
 	return bytesWritten;
 }
 
 
 int FPGA::read_SPI
 (
-		FT_HANDLE deviceHandle,
+		Transport & deviceHandle,
 		ULONG Command,   // APS_DAC_SPI, APS_PLL_SPI, or APS_VCXO_SPI
 		const ULONG & Address,   // SPI register address.  Ignored for VCXO since address embedded in the data
 		UCHAR *Data      // Destination for the returned data byte.  Only single byte reads supported.
 )
 
 {
-	FT_STATUS ftStatus;
-	vector<UCHAR> dataPacket(0);
-	DWORD bytesWritten, bytesRead;
-	vector<UCHAR> byteBuffer(0);
+	// Note that the VCXO is not readable
+	if ((Command & APS_CMD) == APS_VCXO_SPI) {
+		LOG(plog::error) << "The VCXO can not be read over SPI";
+		return 0;
+	}
+
+	UCHAR packet[2 + 8*SPI_MAX_STACK_BYTES];
+	const UCHAR dummy = 0;
+	size_t packetLength = serialize_SPI_command(Command, Address, &dummy, 1, true, packet);
+	if (packetLength == 0) return 0;
+
+	auto start = IOStats::clock::now();
+	DWORD bytesWritten = 0, bytesRead = 0;
+	FT_STATUS ftStatus = deviceHandle.write(packet, packetLength, &bytesWritten);
+	if (!FT_SUCCESS(ftStatus) || bytesWritten != packetLength) {LOG(plog::error) << "Write SPI command failed";}
+	ftStatus = deviceHandle.read(Data, 1, &bytesRead);
+	deviceHandle.io_stats().record(IO_SPI, bytesWritten + bytesRead, start);
+	if (!FT_SUCCESS(ftStatus) || bytesRead != 1) {
+		LOG(plog::error) << "Read SPI command failed";
+		return 0;
+	}
+	return 1;
+}
+
+size_t FPGA::serialize_SPI_bits(const UCHAR * src, const size_t & numBytes, UCHAR * dest) {
+	/* Table driven version of the per bit shift and mask: every source byte becomes 8 bytes
+	 * holding its bits in bit 0, MSB first. Returns the number of bytes written.
+	 */
+	for (size_t ct = 0; ct < numBytes; ct++, dest += 8) {
+		std::memcpy(dest, &SPIBitExpand[src[ct]], 8);
+	}
+	return 8*numBytes;
+}
+
+FPGA::SPIBatch::SPIBatch() : numCommands_{0}, numReads_{0} {}
+
+void FPGA::SPIBatch::write(const ULONG & command, const ULONG & address, const UCHAR & data) {
+	add(command, address, &data, 1, false);
+}
+
+void FPGA::SPIBatch::write(const ULONG & command, const ULONG & address, const vector<UCHAR> & data) {
+	if (data.empty()) return;
+	add(command, address, data.data(), data.size(), false);
+}
 
+void FPGA::SPIBatch::write(const ULONG & command, const vector<PLLAddrData> & routine) {
+	for (auto tmpPair : routine) {
+		add(command, tmpPair.first, &tmpPair.second, 1, false);
+	}
+}
 
-	// Create a 1 byte read command at the specified address of the specified device
+void FPGA::SPIBatch::read(const ULONG & command, const ULONG & address) {
 	// Note that the VCXO is not readable
-	switch(Command & APS_CMD)
+	if ((command & APS_CMD) == APS_VCXO_SPI) {
+		LOG(plog::error) << "The VCXO can not be read over SPI";
+		return;
+	}
+	UCHAR dummy = 0;
+	add(command, address, &dummy, 1, true);
+}
+
+static size_t serialize_SPI_command(ULONG command, const ULONG & address, const UCHAR * data, const size_t & numBytes, const bool & isRead, UCHAR * dest)
+/********************************************************************
+ *
+ *      Serialize an SPI command for the selected chip into dest, which must hold spi_max_length bytes.
+ *      Returns the number of bytes used or 0 for an unsupported chip.
+ *      The length of the data depends on the chip.
+ *      The DAC requires 2 bytes, the PLL requires 3 bytes, and the VCXO requires 4 bytes.
+ *      The format of the data bytes can be found in the data sheets for the chips.
+ *      Note that the "data" defines an SPI command with R/W bit, a register address, and any write data.
+ *
+ *      DAC Data Format for first byte: R/W N1 N0 A4 A3 A2 A1 A0
+ *      RW = 0 for write, N = 00 for 1 byte transfer.  A = 5-bit register address
+ *      Note that DAC channel specified by Address<6:5>, since only Address<4:0> select DAC registers.
+ *
+ *      PLL Data format for first two bytes: R/W W1 W0 A12 A11 A10 A9 A8 A7 A6 A5 A4 A3 A2 A1 A0
+ *      RW = 0 for write, W = 00 for 1 byte transfer.  A = 13-bit register address
+ *
+ *      VCXO data format: 32-bit value, with the address embedded in D<1:0>.  Bytes stored MS byte first.
+ *      Note that this is not the order of the bytes in a 32 bit integer on little-endian CPUs
+ *
+ *      A read is followed by the command byte with R/W = 1 which clocks the 8 bits read
+ *      out of the I/O FPGA SerData register.
+ *
+ ********************************************************************/
+{
+	const UCHAR readBit = isRead ? 0x80 : 0;
+	UCHAR header[3];
+	const UCHAR * byteBuffer = header;
+	size_t numSerialBytes = 0;
+
+	switch(command & APS_CMD)
 	{
 	case APS_DAC_SPI:
-		byteBuffer.push_back(0x80 | (Address & 0x1F));  // R/W = 1 for read, N = 00 for 1 Byte, A<4:0> = Address
-		byteBuffer.push_back(Data[0]);
-		Command |= ((Address & 0x60)>>3);  // Take bits above register address as DAC channel select
+		header[0] = readBit | (address & 0x1F);  // N = 00 for 1 Byte, A<4:0> = Address
+		header[1] = data[0];
+		numSerialBytes = 2;
+		command |= ((address & 0x60)>>3);  // Take bits above register address as DAC channel select
 		break;
 	case APS_PLL_SPI:
-		byteBuffer.push_back(0x80 | ((Address>>8) & 0x1F)); // R/W = 1 for read, W = 00 for 1 Byte, A<12:8>
-		byteBuffer.push_back(Address & 0xFF);  // A<7:0>
-		byteBuffer.push_back(Data[0]);
+		header[0] = readBit | ((address>>8) & 0x1F); // W = 00 for 1 Byte, A<12:8>
+		header[1] = address & 0xFF;  // A<7:0>
+		header[2] = data[0];
+		numSerialBytes = 3;
+		break;
+	case APS_VCXO_SPI:
+		// Data bytes are already in MS Byte first order
+		byteBuffer = data;
+		numSerialBytes = numBytes;
 		break;
 	default:
 		// Ignore unsupported commands
-		return(0);
+		LOG(plog::error) << "Unsupported SPI command " << myhex << command;
+		return 0;
 	}
 
 	// Start all packets with a APS Command Byte with the R/W= 0 for write
 	// Note that command byte from DAC has the SEL bits for the desired DAC set
-	dataPacket.push_back(Command);
+	UCHAR * curByte = dest;
+	*curByte++ = command;
 
 	// Serialize the data into bit 0 of the packet bytes
-	for(size_t ct = 0; ct < 8*byteBuffer.size(); ct++)
-		dataPacket.push_back( (byteBuffer[ct/8]>>(7-(ct%8))) & 1 );
-
+	curByte += FPGA::serialize_SPI_bits(byteBuffer, numSerialBytes, curByte);
 
-	// Write the SPI command.  This stores the last 8 SPI read bits in the I/O FPGA SerData register
-	ftStatus = FT_Write(deviceHandle, &dataPacket[0], dataPacket.size(), &bytesWritten);
-	if (!FT_SUCCESS(ftStatus)) {LOG(plog::error) << "Write SPI command failed";}
+	// Clock out data from SPI device with a dummy write to the same device
+	if (isRead) {
+		*curByte++ = command | 0x80;
+	}
+	return curByte - dest;
+}
 
-	dataPacket[0] |= 0x80;  // Convert the Command Byte into a read
+void FPGA::SPIBatch::add(ULONG command, const ULONG & address, const UCHAR * data, const size_t & numBytes, const bool & isRead) {
+	/* Serialize straight onto the end of the packet; the packet keeps its capacity across sends. */
+	size_t curSize = packet_.size();
+	packet_.resize(curSize + spi_max_length(numBytes));
+	size_t packetLength = serialize_SPI_command(command, address, data, numBytes, isRead, packet_.data() + curSize);
+	packet_.resize(curSize + packetLength);
+	if (packetLength == 0) return;
 
-	// Clock out data from SPI device with a dummy write to the same device
-	ftStatus = FT_Write(deviceHandle, &dataPacket[0], 1, &bytesWritten);
-	if (!FT_SUCCESS(ftStatus)) {LOG(plog::error) << "Write SPI command failed";}
+	if (isRead) numReads_++;
+	numCommands_++;
+}
 
+size_t FPGA::SPIBatch::size() const {
+	return numCommands_;
+}
 
-	// Read the one byte of serial data from the SerData register
-	ftStatus = FT_Read(deviceHandle, Data, 1, &bytesRead);
-	if (!FT_SUCCESS(ftStatus)) {LOG(plog::error) << "Read SPI command failed";}
+void FPGA::SPIBatch::clear() {
+	packet_.clear();
+	numCommands_ = 0;
+	numReads_ = 0;
+}
 
-	return(bytesRead);
+int FPGA::SPIBatch::send(Transport & deviceHandle, vector<UCHAR> * readData) {
+	/* Send all the commands in a single USB write and collect the read bytes (in order) with a single read.
+	 * Returns the number of bytes written.
+	 */
+	if (packet_.empty()) return 0;
+
+	auto start = IOStats::clock::now();
+	DWORD bytesWritten = 0, bytesRead = 0;
+	FT_STATUS ftStatus = deviceHandle.write(packet_.data(), packet_.size(), &bytesWritten);
+	if (!FT_SUCCESS(ftStatus) || bytesWritten != packet_.size()) {LOG(plog::error) << "Write SPI command failed";}
+
+	if (numReads_ > 0) {
+		//Read straight into the caller's buffer when there is one
+		vector<UCHAR> tmpData;
+		vector<UCHAR> & dest = readData ? *readData : tmpData;
+		dest.resize(numReads_);
+		ftStatus = deviceHandle.read(dest.data(), numReads_, &bytesRead);
+		if (!FT_SUCCESS(ftStatus) || bytesRead != numReads_) {LOG(plog::error) << "Read SPI command failed";}
+		dest.resize(bytesRead);
+	}
+	deviceHandle.io_stats().record(IO_SPI, bytesWritten + bytesRead, start);
 
+	clear();
+	return bytesWritten;
 }
 
 
-int FPGA::clear_bit(FT_HANDLE deviceHandle, const FPGASELECT & fpga, const int & addr, const int & mask)
+int FPGA::clear_bit(Transport & deviceHandle, const FPGASELECT & fpga, const int & addr, const int & mask)
 /*
  * Description : Clears Bit in FPGA register
  * Returns : 0
@@ -739,7 +950,7 @@ int FPGA::clear_bit(FT_HANDLE deviceHandle, const FPGASELECT & fpga, const int &
 }
 
 
-int FPGA::set_bit(FT_HANDLE deviceHandle, const FPGASELECT & fpga, const int & addr, const int & mask)
+int FPGA::set_bit(Transport & deviceHandle, const FPGASELECT & fpga, const int & addr, const int & mask)
 /*
  * Description : Sets Bit in FPGA register
  * Returns : 0
@@ -770,13 +981,14 @@ int FPGA::set_bit(FT_HANDLE deviceHandle, const FPGASELECT & fpga, const int & a
 
 }
 
-int FPGA::check_cur_state(FT_HANDLE deviceHandle, const FPGASELECT & fpga, const int & addr) {
+int FPGA::check_cur_state(Transport & deviceHandle, const FPGASELECT & fpga, const int & addr) {
 	int currentState, currentState2;
 	if (fpga != ALL_FPGAS) {
 		currentState = FPGA::read_FPGA(deviceHandle, addr, fpga);
-	} else{ // read the two FPGAs serially
-		currentState = FPGA::read_FPGA(deviceHandle, addr, FPGA1);
-		currentState2 = FPGA::read_FPGA(deviceHandle, addr, FPGA2);
+	} else{ // read both FPGAs in one batched round trip
+		WordVec states = FPGA::read_FPGA_batch(deviceHandle, {RegAddr(addr, FPGA1), RegAddr(addr, FPGA2)});
+		currentState = states[0];
+		currentState2 = states[1];
 		if (currentState != currentState2) {
 			// note the mismatch in the log file but continue on using FPGA1's data
 			LOG(plog::error) << "FPGA::check_cur_state: FPGA registers don't match. Addr: " << myhex << addr << " FPGA1: " << currentState << " FPGA2: " << currentState2;
@@ -15,29 +15,111 @@
 
 namespace FPGA {
 
-int program_FPGA(FT_HANDLE, vector<UCHAR>, const FPGASELECT &);
-int reset(FT_HANDLE, const FPGASELECT &);
-
-int read_register(FT_HANDLE, const ULONG &, const ULONG &, const FPGASELECT &, UCHAR *);
-int write_register(FT_HANDLE, const ULONG &, const ULONG &, const FPGASELECT &, UCHAR *);
-
-int read_SPI(FT_HANDLE, ULONG, const ULONG &, UCHAR *);
-int write_SPI(FT_HANDLE, ULONG, const ULONG &, const vector<UCHAR> &);
-
-int clear_bit(FT_HANDLE, const FPGASELECT &, const int &, const int &);
-int set_bit(FT_HANDLE, const FPGASELECT &, const int &, const int &);
-
-USHORT read_FPGA(FT_HANDLE, const ULONG &, FPGASELECT);
-
-int write_FPGA(FT_HANDLE, const unsigned int &, const USHORT &, const FPGASELECT &);
-int write_FPGA(FT_HANDLE, const unsigned int &, const WordVec &, const FPGASELECT &);
-int write_FPGA(FT_HANDLE, const unsigned int &, const WordVec &, const FPGASELECT &, map<FPGASELECT, CheckSum> &);
-
-int write_block(FT_HANDLE, vector<UCHAR> &, const vector<size_t> &);
-vector<UCHAR> format(const FPGASELECT &, const unsigned int &, const WordVec &);
-vector<size_t> computeCmdByteOffsets(const size_t &);
-
-int check_cur_state(FT_HANDLE, const FPGASELECT &, const int &);
+//Bitfile programming either one USB write per 61 byte configuration packet or many packets per write
+typedef enum {PROGRAM_PER_PACKET=0, PROGRAM_BULK} PROGRAM_MODE;
+//A bitfile bit reversed, zero padded and framed into back to back CONF_DATA command byte + 61 byte packets
+struct BitfileImage {
+	vector<UCHAR> frames;
+	size_t numBytes; //bitfile length before padding
+	FPGASELECT chipSelect;
+};
+BitfileImage frame_bitfile(const vector<UCHAR> &, const FPGASELECT &);
+int program_FPGA(Transport &, const vector<UCHAR> &, const FPGASELECT &, const PROGRAM_MODE & mode = PROGRAM_BULK);
+int program_FPGA(Transport &, const BitfileImage &, const PROGRAM_MODE & mode = PROGRAM_BULK);
+int reset(Transport &, const FPGASELECT &);
+
+//Repeat a status check until it passes or the timeout (ms) runs out. The first check is immediate
+//and later ones back off from 50us to 1ms so quick state changes are seen without a fixed sleep.
+template <typename F>
+bool poll_until(F check, const int & timeout) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	std::chrono::microseconds backoff(50);
+	while (!check()) {
+		if (std::chrono::steady_clock::now() >= deadline) return false;
+		std::this_thread::sleep_for(backoff);
+		backoff = std::min(2*backoff, std::chrono::microseconds(1000));
+	}
+	return true;
+}
+
+int read_register(Transport &, const ULONG &, const ULONG &, const FPGASELECT &, UCHAR *);
+int write_register(Transport &, const ULONG &, const ULONG &, const FPGASELECT &, UCHAR *);
+
+int read_SPI(Transport &, ULONG, const ULONG &, UCHAR *);
+int write_SPI(Transport &, ULONG, const ULONG &, const vector<UCHAR> &);
+//Expand bytes MSB first into one USB byte per bit (bit in the LSB); dest needs 8 bytes per source byte
+size_t serialize_SPI_bits(const UCHAR *, const size_t &, UCHAR *);
+
+//Collects SPI writes and reads for the PLL, DACs and VCXO and sends them in one USB transfer
+class SPIBatch {
+public:
+	SPIBatch();
+
+	//Commands are APS_DAC_SPI, APS_PLL_SPI or APS_VCXO_SPI; DAC addresses carry the DAC in bits 6:5
+	void write(const ULONG &, const ULONG &, const UCHAR &);
+	void write(const ULONG &, const ULONG &, const vector<UCHAR> &);
+	void write(const ULONG &, const vector<PLLAddrData> &);
+	//Read data comes back from send in the order the reads were added
+	void read(const ULONG &, const ULONG &);
+
+	size_t size() const;
+	void clear();
+	int send(Transport &, vector<UCHAR> * readData = nullptr);
+
+private:
+	vector<UCHAR> packet_;
+	size_t numCommands_;
+	size_t numReads_;
+	void add(ULONG, const ULONG &, const UCHAR *, const size_t &, const bool &);
+};
+
+int clear_bit(Transport &, const FPGASELECT &, const int &, const int &);
+int set_bit(Transport &, const FPGASELECT &, const int &, const int &);
+
+USHORT read_FPGA(Transport &, const ULONG &, FPGASELECT);
+//Register reads batched into a single USB round trip: (address, FPGA) pairs
+typedef std::pair<ULONG, FPGASELECT> RegAddr;
+WordVec read_FPGA_batch(Transport &, const vector<RegAddr> &);
+
+int write_FPGA(Transport &, const unsigned int &, const USHORT &, const FPGASELECT &);
+int write_FPGA(Transport &, const unsigned int &, const WordVec &, const FPGASELECT &);
+int write_FPGA(Transport &, const unsigned int &, const WordVec &, const FPGASELECT &, map<FPGASELECT, CheckSum> &);
+
+//Block write split into transfers of at most the transport's transfer size
+int write_block(Transport &, const FPGASELECT &, const unsigned int &, const USHORT *, const size_t &);
+size_t format(const FPGASELECT &, const unsigned int &, const USHORT *, const size_t &, UCHAR *, size_t *, const size_t & offsetBase = 0);
+size_t format_length(const size_t &);
+size_t num_cmd_bytes(const size_t &);
+
+//Resumable version of format: emits the same bytes in pieces that end on command byte boundaries
+//so a block can be spread across fixed size transfer buffers. The data must outlive the encoder.
+class BlockEncoder {
+public:
+	BlockEncoder(const FPGASELECT &, const unsigned int &, const USHORT *, const size_t &);
+
+	//Encode as much as fits in the buffer (at least MIN_BUFFER bytes to make progress); returns the number of bytes written
+	size_t encode(UCHAR *, const size_t &);
+	static const size_t MIN_BUFFER = 9;
+	bool done() const;
+
+private:
+	FPGASELECT fpga_;
+	unsigned int addr_;
+	const USHORT * data_;
+	size_t numWords_;
+	size_t wordsDone_;
+	bool headerDone_;
+};
+
+//Word packing kernels for the 4-word groups of a block write (see WordPacking.cpp)
+typedef enum {PACK_SCALAR=0, PACK_SSSE3, PACK_AVX2, PACK_NEON} PACK_KERNEL;
+void pack_word_groups(const USHORT *, const size_t &, const UCHAR &, UCHAR *);
+int set_pack_kernel(const PACK_KERNEL &);
+PACK_KERNEL get_pack_kernel();
+bool pack_kernel_supported(const PACK_KERNEL &);
+const char * pack_kernel_name(const PACK_KERNEL &);
+
+int check_cur_state(Transport &, const FPGASELECT &, const int &);
 
 } //end namespace FPGA
 
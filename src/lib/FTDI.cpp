@@ -7,9 +7,21 @@
 
 #include "headings.h"
 
-void FTDI::get_device_serials(vector<string> & deviceSerials) {
+static const string SIM_SERIAL_PREFIX = "SIM";
 
-	deviceSerials.clear();
+//Number of simulated units to list after the real ones, defaults to the APS_SIMULATED_DEVICES environment variable
+static int numSimulatedDevices = getenv("APS_SIMULATED_DEVICES") ? atoi(getenv("APS_SIMULATED_DEVICES")) : 0;
+
+//Add the simulated unit serials on the end of the device list
+static void add_simulated_serials(vector<string> & deviceSerials) {
+	for (int simct = 0; (simct < numSimulatedDevices) && (deviceSerials.size() < size_t(MAX_APS_DEVICES)); simct++) {
+		deviceSerials.push_back(SIM_SERIAL_PREFIX + std::to_string(simct));
+		LOG(plog::debug) << "Added simulated device " << deviceSerials.back() << " to device list.";
+	}
+}
+
+//Serials of the units the D2XX driver can see
+static void get_ftdi_serials(vector<string> & deviceSerials) {
 
 	//Use the FTDI driver to get serial numbers (from "Simple" example)
 
@@ -57,6 +69,37 @@ void FTDI::get_device_serials(vector<string> & deviceSerials) {
 	}
 }
 
+void FTDI::get_device_serials(vector<string> & deviceSerials) {
+	deviceSerials.clear();
+	get_ftdi_serials(deviceSerials);
+	add_simulated_serials(deviceSerials);
+}
+
+int FTDI::get_num_devices() {
+	int numDevices = 0;
+	FT_ListDevices(&numDevices, NULL, FT_LIST_NUMBER_ONLY);
+	return std::min(numDevices + numSimulatedDevices, MAX_APS_DEVICES);
+}
+
+void FTDI::set_num_simulated_devices(const int & numDevices) {
+	numSimulatedDevices = std::max(numDevices, 0);
+}
+
+int FTDI::get_num_simulated_devices() {
+	return numSimulatedDevices;
+}
+
+bool FTDI::is_simulated(const string & deviceSerial) {
+	return deviceSerial.compare(0, SIM_SERIAL_PREFIX.size(), SIM_SERIAL_PREFIX) == 0;
+}
+
+std::unique_ptr<Transport> FTDI::make_transport(const string & deviceSerial) {
+	if (is_simulated(deviceSerial)) {
+		return std::unique_ptr<Transport>(new SimAPS());
+	}
+	return std::unique_ptr<Transport>(new FTDITransport());
+}
+
 int FTDI::connect(const int & deviceID, FT_HANDLE & deviceHandle) {
 
 	FT_STATUS ftStatus;
@@ -68,13 +111,14 @@ int FTDI::connect(const int & deviceID, FT_HANDLE & deviceHandle) {
 	}
 	else{
 		LOG(plog::debug) << "Opened connection to " << deviceID;
-		ftStatus = FT_SetTimeouts(deviceHandle, APS_READTIMEOUT,APS_WRITETIMEOUT);
+		//Start from the interactive profile; the transport switches profiles from here on
+		const TransferProfile & profile = Transport::profile_settings(PROFILE_INTERACTIVE);
+		ftStatus = FT_SetTimeouts(deviceHandle, profile.readTimeout, profile.writeTimeout);
 		if(!FT_SUCCESS(ftStatus)) {
 			LOG(plog::error) << "Unable to set USB timeouts for device " << deviceID;
 			return -1;
 		}
-		//Since we are polling a few bytes at a time on the device we can shorten up the latency
-		ftStatus = FT_SetLatencyTimer(deviceHandle, 2);
+		ftStatus = FT_SetLatencyTimer(deviceHandle, profile.latencyTimer);
 		if(!FT_SUCCESS(ftStatus)) {
 			LOG(plog::error) << "Unable to set latency for device " << deviceID;
 			return -1;
@@ -131,3 +175,144 @@ int FTDI::isOpen(const int & deviceID) {
 	}
 	return -3;
 }
+
+FTDITransport::FTDITransport() : handle_{nullptr}, rxEventEnabled_{false} {
+#ifdef _WIN32
+	rxEvent_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+	pthread_mutex_init(&rxEvent_.eMutex, NULL);
+	pthread_cond_init(&rxEvent_.eCondVar, NULL);
+#endif
+}
+
+FTDITransport::~FTDITransport() {
+	if (handle_) {
+		disconnect();
+	}
+#ifdef _WIN32
+	CloseHandle(rxEvent_);
+#else
+	pthread_cond_destroy(&rxEvent_.eCondVar);
+	pthread_mutex_destroy(&rxEvent_.eMutex);
+#endif
+}
+
+int FTDITransport::connect(const int & deviceID) {
+	int success = FTDI::connect(deviceID, handle_);
+	if (success == 0) {
+		set_transfer_size(transferSize_);
+		apply_active_profile();
+		enable_rx_event();
+	}
+	return success;
+}
+
+int FTDITransport::enable_rx_event() {
+#ifdef _WIN32
+	FT_STATUS ftStatus = FT_SetEventNotification(handle_, FT_EVENT_RXCHAR, rxEvent_);
+#else
+	FT_STATUS ftStatus = FT_SetEventNotification(handle_, FT_EVENT_RXCHAR, static_cast<PVOID>(&rxEvent_));
+#endif
+	rxEventEnabled_ = FT_SUCCESS(ftStatus);
+	if (!rxEventEnabled_) {
+		LOG(plog::warning) << "Unable to set up receive notification; polling the queue status instead. FT_STATUS is " << ftStatus;
+		return -1;
+	}
+	return 0;
+}
+
+int FTDITransport::apply_profile(const TransferProfile & profile) {
+	if (!handle_) return 0;
+	FT_STATUS ftStatus = FT_SetLatencyTimer(handle_, profile.latencyTimer);
+	if (FT_SUCCESS(ftStatus)) {
+		ftStatus = FT_SetTimeouts(handle_, profile.readTimeout, profile.writeTimeout);
+	}
+	if (!FT_SUCCESS(ftStatus)) {
+		LOG(plog::warning) << "Unable to apply the " << profile.name << " transfer profile; FT_STATUS is " << ftStatus;
+		return -1;
+	}
+	return 0;
+}
+
+int FTDITransport::set_transfer_size(const size_t & transferSize) {
+	transferSize_ = transferSize;
+	if (!handle_) return 0;
+	// The driver takes multiples of 64 bytes up to 64kB; larger writes are split by the driver
+	DWORD usbTransferSize = std::min(USB_DEFAULT_TRANSFER_SIZE, std::max(USB_MIN_TRANSFER_SIZE, transferSize & ~size_t(63)));
+	FT_STATUS ftStatus = FT_SetUSBParameters(handle_, usbTransferSize, usbTransferSize);
+	if (!FT_SUCCESS(ftStatus)) {
+		LOG(plog::warning) << "Unable to set the USB transfer size to " << usbTransferSize << "; FT_STATUS is " << ftStatus;
+		return -1;
+	}
+	LOG(plog::debug) << "USB transfer size set to " << usbTransferSize;
+	return 0;
+}
+
+int FTDITransport::disconnect() {
+	int success = FTDI::disconnect(handle_);
+	if (success == 0) {
+		handle_ = nullptr;
+		rxEventEnabled_ = false;
+	}
+	return success;
+}
+
+FT_STATUS FTDITransport::write(UCHAR * data, const DWORD & numBytes, DWORD * bytesWritten) {
+	auto start = IOStats::clock::now();
+	FT_STATUS ftStatus = FT_Write(handle_, data, numBytes, bytesWritten);
+	ioStats_.record(IO_WRITE, *bytesWritten, start);
+	return ftStatus;
+}
+
+FT_STATUS FTDITransport::read(UCHAR * data, const DWORD & numBytes, DWORD * bytesRead) {
+	auto start = IOStats::clock::now();
+	FT_STATUS ftStatus = FT_Read(handle_, data, numBytes, bytesRead);
+	ioStats_.record(IO_READ, *bytesRead, start);
+	return ftStatus;
+}
+
+FT_STATUS FTDITransport::get_queue_status(DWORD * rxBytes) {
+	return FT_GetQueueStatus(handle_, rxBytes);
+}
+
+FT_STATUS FTDITransport::wait_for_rx(const DWORD & numBytes, const ULONG & timeout, DWORD * rxBytes) {
+	if (!rxEventEnabled_) {
+		return Transport::wait_for_rx(numBytes, timeout, rxBytes);
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	FT_STATUS ftStatus;
+#ifdef _WIN32
+	//Auto-reset event: checking the queue after each wake-up covers characters that arrived before the wait
+	while (true) {
+		ftStatus = FT_GetQueueStatus(handle_, rxBytes);
+		if (!FT_SUCCESS(ftStatus) || *rxBytes >= numBytes) break;
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0) break;
+		if (WaitForSingleObject(rxEvent_, static_cast<DWORD>(remaining)) == WAIT_TIMEOUT) {
+			ftStatus = FT_GetQueueStatus(handle_, rxBytes);
+			break;
+		}
+	}
+#else
+	//The driver signals with the event mutex held so checking the queue under it cannot miss a wake-up
+	pthread_mutex_lock(&rxEvent_.eMutex);
+	while (true) {
+		ftStatus = FT_GetQueueStatus(handle_, rxBytes);
+		if (!FT_SUCCESS(ftStatus) || *rxBytes >= numBytes) break;
+		auto remaining = deadline - std::chrono::steady_clock::now();
+		if (remaining <= std::chrono::steady_clock::duration::zero()) break;
+		struct timespec wakeTime;
+		clock_gettime(CLOCK_REALTIME, &wakeTime);
+		long long nsec = wakeTime.tv_nsec + std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count();
+		wakeTime.tv_sec += nsec / 1000000000;
+		wakeTime.tv_nsec = nsec % 1000000000;
+		if (pthread_cond_timedwait(&rxEvent_.eCondVar, &rxEvent_.eMutex, &wakeTime) == ETIMEDOUT) {
+			ftStatus = FT_GetQueueStatus(handle_, rxBytes);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&rxEvent_.eMutex);
+#endif
+	return ftStatus;
+}
@@ -16,13 +16,58 @@
 namespace FTDI {
 
 	void get_device_serials(vector<string> &);
+	int get_num_devices();
 
 	int connect(const int &, FT_HANDLE &);
 	int disconnect(FT_HANDLE &);
 
 	int isOpen(const int &);
+
+	//Simulated units are listed after the real ones with serials starting with SIM_SERIAL_PREFIX
+	void set_num_simulated_devices(const int &);
+	int get_num_simulated_devices();
+	bool is_simulated(const string &);
+	std::unique_ptr<Transport> make_transport(const string &);
 }
 
+//Transport through the D2XX driver
+class FTDITransport : public Transport {
+public:
+	FTDITransport();
+	~FTDITransport();
+
+	int connect(const int &);
+	int disconnect();
+
+	FT_STATUS write(UCHAR *, const DWORD &, DWORD *);
+	FT_STATUS read(UCHAR *, const DWORD &, DWORD *);
+
+	FT_STATUS get_queue_status(DWORD *);
+	//Waits on the driver's receive character event
+	FT_STATUS wait_for_rx(const DWORD &, const ULONG &, DWORD *);
+
+	//Also sets the driver's USB transfer size (FT_SetUSBParameters) when connected
+	int set_transfer_size(const size_t &);
+
+protected:
+	int apply_profile(const TransferProfile &);
+
+private:
+	FTDITransport(const FTDITransport&) = delete;
+	FTDITransport& operator=(const FTDITransport&) = delete;
+
+	FT_HANDLE handle_;
+
+	//Signalled by the driver when characters arrive
+#ifdef _WIN32
+	HANDLE rxEvent_;
+#else
+	EVENT_HANDLE rxEvent_;
+#endif
+	bool rxEventEnabled_;
+	int enable_rx_event();
+};
+
 
 
 #endif /* FTDI_H_ */
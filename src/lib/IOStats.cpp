@@ -0,0 +1,77 @@
+/*
+ * IOStats.cpp
+ */
+
+#include "IOStats.h"
+
+const size_t IOStats::NUM_BUCKETS;
+const size_t IOStats::NUM_VALUES;
+
+IOStats::IOStats() {
+	reset();
+}
+
+size_t IOStats::bucket_index(const uint64_t & ns) {
+	uint64_t us = ns / 1000;
+	size_t idx = 0;
+	while (us > 0 && idx < NUM_BUCKETS-1) {
+		us >>= 1;
+		idx++;
+	}
+	return idx;
+}
+
+void IOStats::record(const IO_OP & op, const size_t & numBytes, const uint64_t & ns) {
+	Counters & counters = counters_[op];
+	counters.count.fetch_add(1, std::memory_order_relaxed);
+	counters.bytes.fetch_add(numBytes, std::memory_order_relaxed);
+	counters.nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+	counters.histogram[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t IOStats::count(const IO_OP & op) const {
+	return counters_[op].count.load(std::memory_order_relaxed);
+}
+
+uint64_t IOStats::bytes(const IO_OP & op) const {
+	return counters_[op].bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t IOStats::nanoseconds(const IO_OP & op) const {
+	return counters_[op].nanoseconds.load(std::memory_order_relaxed);
+}
+
+uint64_t IOStats::bucket(const IO_OP & op, const size_t & idx) const {
+	return counters_[op].histogram[idx].load(std::memory_order_relaxed);
+}
+
+size_t IOStats::get(const IO_OP & op, uint64_t * values, const size_t & numValues) const {
+	size_t numCopied = std::min(numValues, NUM_VALUES);
+	for (size_t ct = 0; ct < numCopied; ct++) {
+		switch (ct) {
+		case 0:
+			values[ct] = count(op);
+			break;
+		case 1:
+			values[ct] = bytes(op);
+			break;
+		case 2:
+			values[ct] = nanoseconds(op);
+			break;
+		default:
+			values[ct] = bucket(op, ct-3);
+		}
+	}
+	return numCopied;
+}
+
+void IOStats::reset() {
+	for (auto & counters : counters_) {
+		counters.count.store(0, std::memory_order_relaxed);
+		counters.bytes.store(0, std::memory_order_relaxed);
+		counters.nanoseconds.store(0, std::memory_order_relaxed);
+		for (auto & bucket : counters.histogram) {
+			bucket.store(0, std::memory_order_relaxed);
+		}
+	}
+}
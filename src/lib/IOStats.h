@@ -0,0 +1,55 @@
+/*
+ * IOStats.h
+ *
+ * Counters for the traffic on one USB link: per kind of operation the number of operations,
+ * bytes moved, total time and a histogram of latencies in power of two microsecond buckets.
+ * Recording is a handful of relaxed atomic adds so it stays on in normal running; readers
+ * get each counter exactly but not a consistent snapshot across counters.
+ */
+
+#include "headings.h"
+
+#ifndef IOSTATS_H_
+#define IOSTATS_H_
+
+class IOStats {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	//Bucket 0 is under 1us, bucket k covers [2^(k-1), 2^k) us and the last one takes everything longer
+	static const size_t NUM_BUCKETS = 24;
+	//Values per operation from get: count, bytes, total time (ns) then the histogram buckets
+	static const size_t NUM_VALUES = 3 + NUM_BUCKETS;
+
+	IOStats();
+
+	void record(const IO_OP &, const size_t &, const uint64_t &);
+	//Latency from a start time taken with clock::now()
+	void record(const IO_OP & op, const size_t & numBytes, const clock::time_point & start) {
+		record(op, numBytes, std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+	}
+
+	uint64_t count(const IO_OP &) const;
+	uint64_t bytes(const IO_OP &) const;
+	uint64_t nanoseconds(const IO_OP &) const;
+	uint64_t bucket(const IO_OP &, const size_t &) const;
+	static size_t bucket_index(const uint64_t &);
+
+	//Copy up to NUM_VALUES values for an operation; returns how many were copied
+	size_t get(const IO_OP &, uint64_t *, const size_t &) const;
+	void reset();
+
+private:
+	IOStats(const IOStats&) = delete;
+	IOStats& operator=(const IOStats&) = delete;
+
+	struct Counters {
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> bytes;
+		std::atomic<uint64_t> nanoseconds;
+		std::atomic<uint64_t> histogram[NUM_BUCKETS];
+	};
+	Counters counters_[NUM_IO_OPS];
+};
+
+#endif /* IOSTATS_H_ */
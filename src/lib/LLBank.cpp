@@ -40,20 +40,26 @@ void LLBank::clear(){
 
 }
 
-WordVec LLBank::get_packed_data(const size_t & startIdx, const size_t & stopIdx){
-	//Pull out packed data starting at startIdx but not inclusive of stopIdx
-	WordVec vecOut;
+size_t LLBank::entry_words() const{
 	//If we are in IQ mode then we have an extra word for every entry
-	int lengthMult = IQMode ? 5 : 4;
+	return IQMode ? 5 : 4;
+}
+
+LLBank::PackedSpans LLBank::get_packed_data(const size_t & startIdx, const size_t & stopIdx) const{
+	//Point at the packed data starting at startIdx but not inclusive of stopIdx
+	const size_t lengthMult = entry_words();
+	const USHORT * base = packedData_.data();
 	//Handle wrapping around the top of the LL data
 	if (stopIdx < startIdx){
-		vecOut.assign(packedData_.begin()+lengthMult*startIdx, packedData_.end());
-		vecOut.insert(vecOut.end(), packedData_.begin(), packedData_.begin()+lengthMult*stopIdx);
+		return PackedSpans{{base + lengthMult*startIdx, packedData_.size() - lengthMult*startIdx}, {base, lengthMult*stopIdx}};
 	}
 	else{
-		vecOut.assign(packedData_.begin()+lengthMult*startIdx, packedData_.begin()+lengthMult*stopIdx);
+		return PackedSpans{{base + lengthMult*startIdx, lengthMult*(stopIdx - startIdx)}, {base, 0}};
 	}
-	return vecOut;
+}
+
+bool LLBank::same_data(const LLBank & other) const{
+	return length == other.length && IQMode == other.IQMode && packedData_ == other.packedData_;
 }
 
 int LLBank::write_state_to_file(std::fstream &file){
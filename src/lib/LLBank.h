@@ -14,6 +14,18 @@
 //An individual bank of a LL for a single channel
 class LLBank {
 public:
+	//A run of packed words inside the bank; valid until the bank is changed or replaced
+	struct PackedSpan {
+		const USHORT * data;
+		size_t size;
+	};
+	//A range of entries: one run, or the tail then the head of the bank when the range wraps
+	struct PackedSpans {
+		PackedSpan first;
+		PackedSpan second;
+		size_t size() const {return first.size + second.size;}
+	};
+
 	LLBank();
 	LLBank(const WordVec &, const WordVec &, const WordVec &, const WordVec &);
 	LLBank(const WordVec &, const WordVec &, const WordVec &, const WordVec &, const WordVec &);
@@ -27,7 +39,11 @@ public:
 	WordVec miniLLLengths;
 	WordVec miniLLStartIdx;
 
-	WordVec get_packed_data(const size_t &, const size_t &);
+	PackedSpans get_packed_data(const size_t &, const size_t &) const;
+	//Words per entry: 5 in IQ mode, otherwise 4
+	size_t entry_words() const;
+	//Whether the packed entries are the same, e.g. the IQ link lists of the two FPGAs
+	bool same_data(const LLBank &) const;
 
 	int write_state_to_file(std::fstream &);
 	int read_state_from_file(std::fstream &);
@@ -0,0 +1,463 @@
+/*
+ * SimAPS.cpp
+ *
+ * Decodes the byte stream the driver sends to an APS and answers reads the way the
+ * hardware does. Commands may be split across USB transfers so the decoder keeps the
+ * partially received command between writes.
+ */
+
+#include "headings.h"
+
+namespace {
+	//Link model applied to newly created units
+	std::atomic<double> defaultLatency{0};
+	std::atomic<double> defaultBandwidth{0};
+
+	const size_t NUM_CSR_REGS = 0x20;
+	const size_t PLL_ADDR_SPACE = 1 << 13;
+	const size_t DAC_ADDR_SPACE = 1 << 5;
+
+	//Reassemble the bytes serialized one bit per USB byte by FPGA::write_SPI
+	vector<UCHAR> deserialize_SPI(const vector<UCHAR> & bits) {
+		vector<UCHAR> bytes(bits.size()/8, 0);
+		for (size_t ct = 0; ct < bits.size(); ct++) {
+			bytes[ct/8] |= (bits[ct] & 1) << (7 - (ct % 8));
+		}
+		return bytes;
+	}
+}
+
+SimAPS::FPGAState::FPGAState() : csr(NUM_CSR_REGS, 0), programmed{false}, readAddr{0}, writeAddr{0},
+		writeCursor{0}, expectCount{false}, wordsRemaining{0} {
+	for (int ch = 0; ch < 2; ch++) {
+		waveforms[ch].assign(MAX_WF_LENGTH, 0);
+		linkLists[ch].assign(5*MAX_LL_LENGTH, 0);
+	}
+}
+
+SimAPS::SimAPS() : connected_{false}, pllRegs_(PLL_ADDR_SPACE, 0), vcxoRegs_{0, 0, 0, 0},
+		confStat_{0}, statusCtrl_{0}, serData_{0}, cmd_{0}, payloadNeeded_{0},
+		latency_{defaultLatency}, bandwidth_{defaultBandwidth}, modelDriverTimers_{false}, profile_(Transport::profile_settings(PROFILE_INTERACTIVE)),
+		numWrites_{0}, numReads_{0}, bytesWritten_{0}, bytesRead_{0} {
+	for (auto & regs : dacRegs_) {
+		regs.assign(DAC_ADDR_SPACE, 0);
+	}
+	//The PLL chip reports digital lock
+	pllRegs_[0x1F] = 0x1;
+}
+
+int SimAPS::connect(const int & deviceID) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	connected_ = true;
+	LOG(plog::debug) << "Connected to simulated APS for device " << deviceID;
+	return 0;
+}
+
+int SimAPS::disconnect() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	connected_ = false;
+	return 0;
+}
+
+FT_STATUS SimAPS::write(UCHAR * data, const DWORD & numBytes, DWORD * bytesWritten) {
+	*bytesWritten = 0;
+	if (!connected_) return FT_INVALID_HANDLE;
+	auto start = IOStats::clock::now();
+
+	//Like a D2XX write timing out we return FT_OK with what made it across
+	DWORD numSent = numBytes;
+	double transferTime = transfer_time(numBytes);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const double timeout = 1e-3*profile_.writeTimeout;
+		if (modelDriverTimers_ && transferTime > timeout) {
+			numSent = (bandwidth_ > 0) ? static_cast<DWORD>(std::max(0.0, (timeout - 1e-6*latency_) * bandwidth_)) : 0;
+			numSent = std::min(numSent, numBytes);
+			transferTime = timeout;
+		}
+	}
+	wait(transferTime);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (DWORD ct = 0; ct < numSent; ct++) {
+		process_byte(data[ct]);
+	}
+	numWrites_++;
+	bytesWritten_ += numSent;
+	*bytesWritten = numSent;
+	ioStats_.record(IO_WRITE, numSent, start);
+	return FT_OK;
+}
+
+FT_STATUS SimAPS::read(UCHAR * data, const DWORD & numBytes, DWORD * bytesRead) {
+	*bytesRead = 0;
+	if (!connected_) return FT_INVALID_HANDLE;
+	auto start = IOStats::clock::now();
+
+	//Less than a full USB packet sits in the chip until the latency timer expires
+	double transferTime = transfer_time(numBytes);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (modelDriverTimers_ && numBytes < 62) {
+			transferTime += 1e-3*profile_.latencyTimer;
+		}
+	}
+	wait(transferTime);
+
+	//Like a D2XX read timing out we return what is there
+	std::lock_guard<std::mutex> lock(mutex_);
+	DWORD ct = 0;
+	for (; ct < numBytes && !readQueue_.empty(); ct++) {
+		data[ct] = readQueue_.front();
+		readQueue_.pop_front();
+	}
+	numReads_++;
+	bytesRead_ += ct;
+	*bytesRead = ct;
+	ioStats_.record(IO_READ, ct, start);
+	return FT_OK;
+}
+
+FT_STATUS SimAPS::get_queue_status(DWORD * rxBytes) {
+	if (!connected_) return FT_INVALID_HANDLE;
+	std::lock_guard<std::mutex> lock(mutex_);
+	*rxBytes = readQueue_.size();
+	return FT_OK;
+}
+
+void SimAPS::set_link_model(const double & latency, const double & bandwidth) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	latency_ = latency;
+	bandwidth_ = bandwidth;
+}
+
+void SimAPS::set_default_link_model(const double & latency, const double & bandwidth) {
+	defaultLatency = latency;
+	defaultBandwidth = bandwidth;
+}
+
+void SimAPS::set_driver_timer_model(const bool & enable) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	modelDriverTimers_ = enable;
+}
+
+TransferProfile SimAPS::applied_profile() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return profile_;
+}
+
+int SimAPS::apply_profile(const TransferProfile & profile) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	profile_ = profile;
+	return 0;
+}
+
+size_t SimAPS::num_writes() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return numWrites_;
+}
+
+size_t SimAPS::num_reads() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return numReads_;
+}
+
+size_t SimAPS::bytes_written() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return bytesWritten_;
+}
+
+size_t SimAPS::bytes_read() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return bytesRead_;
+}
+
+void SimAPS::reset_counters() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	numWrites_ = numReads_ = bytesWritten_ = bytesRead_ = 0;
+}
+
+USHORT SimAPS::peek(const FPGASELECT & fpga, const ULONG & addr) const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return read_FPGA_word(fpgas_[fpga == FPGA2 ? 1 : 0], addr);
+}
+
+UCHAR SimAPS::peek_PLL(const ULONG & addr) const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return pllRegs_[addr % PLL_ADDR_SPACE];
+}
+
+UCHAR SimAPS::peek_DAC(const int & dac, const ULONG & addr) const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return dacRegs_[dac & 0x3][addr % DAC_ADDR_SPACE];
+}
+
+bool SimAPS::is_programmed(const FPGASELECT & fpga) const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return fpgas_[fpga == FPGA2 ? 1 : 0].programmed;
+}
+
+double SimAPS::transfer_time(const size_t & numBytes) const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return 1e-6*latency_ + ((bandwidth_ > 0) ? numBytes / bandwidth_ : 0);
+}
+
+void SimAPS::wait(const double & waitTime) const {
+	if (waitTime <= 0) return;
+
+	//Sleep for most of it and spin the rest since sleeps overshoot by tens of microseconds
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(waitTime);
+	if (waitTime > 200e-6) {
+		std::this_thread::sleep_until(deadline - std::chrono::microseconds(100));
+	}
+	while (std::chrono::steady_clock::now() < deadline) {}
+}
+
+void SimAPS::process_byte(const UCHAR & byte) {
+	if (payloadNeeded_ == 0) {
+		//Start of a new command: figure out how many bytes follow it
+		cmd_ = byte;
+		payload_.clear();
+		if (!(cmd_ & 0x80)) {
+			switch (cmd_ & APS_CMD) {
+			case APS_FPGA_IO:
+			case APS_FPGA_ADDR:
+				payloadNeeded_ = 1 << (cmd_ & 0x3);
+				break;
+			case APS_DAC_SPI:
+				payloadNeeded_ = 16;
+				break;
+			case APS_PLL_SPI:
+				payloadNeeded_ = 24;
+				break;
+			case APS_VCXO_SPI:
+				payloadNeeded_ = 32;
+				break;
+			case APS_CONF_DATA:
+				payloadNeeded_ = 61;
+				break;
+			default:
+				payloadNeeded_ = 1;
+				break;
+			}
+			return;
+		}
+	}
+	else {
+		payload_.push_back(byte);
+		if (--payloadNeeded_ > 0) return;
+	}
+	execute_command();
+}
+
+vector<SimAPS::FPGAState *> SimAPS::selected_fpgas(const UCHAR & cmd) {
+	vector<FPGAState *> fpgas;
+	if (cmd & (FPGA1 << 2)) fpgas.push_back(&fpgas_[0]);
+	if (cmd & (FPGA2 << 2)) fpgas.push_back(&fpgas_[1]);
+	return fpgas;
+}
+
+void SimAPS::execute_command() {
+	const bool isRead = cmd_ & 0x80;
+
+	switch (cmd_ & APS_CMD) {
+	case APS_FPGA_ADDR: {
+		ULONG addr = (payload_[0] << 24) | (payload_[1] << 16) | (payload_[2] << 8) | payload_[3];
+		for (auto fpga : selected_fpgas(cmd_)) {
+			write_FPGA_addr(*fpga, addr);
+		}
+		break;
+	}
+	case APS_FPGA_IO:
+		if (isRead) {
+			//Only one FPGA can drive the bus
+			FPGAState & fpga = (cmd_ & (FPGA1 << 2)) ? fpgas_[0] : fpgas_[1];
+			for (int ct = 0; ct < (1 << (cmd_ & 0x3))/2; ct++) {
+				USHORT word = read_FPGA_word(fpga, fpga.readAddr + ct);
+				readQueue_.push_back((word >> 8) & LSB_MASK);
+				readQueue_.push_back(word & LSB_MASK);
+			}
+		}
+		else {
+			for (size_t ct = 0; ct + 1 < payload_.size(); ct += 2) {
+				USHORT word = (payload_[ct] << 8) | payload_[ct+1];
+				for (auto fpga : selected_fpgas(cmd_)) {
+					write_FPGA_word(*fpga, word);
+				}
+			}
+		}
+		break;
+	case APS_DAC_SPI:
+	case APS_PLL_SPI:
+	case APS_VCXO_SPI:
+		if (isRead) {
+			readQueue_.push_back(serData_);
+		}
+		else {
+			write_SPI();
+		}
+		break;
+	case APS_CONF_DATA:
+		for (int ct = 0; ct < 2; ct++) {
+			if ((cmd_ & ((ct+1) << 2)) && (confStat_ & (ct == 0 ? APS_PGM01_BIT : APS_PGM23_BIT))) {
+				fpgas_[ct].programmed = true;
+			}
+		}
+		break;
+	case APS_CONF_STAT:
+		if (isRead) {
+			readQueue_.push_back(read_conf_stat());
+		}
+		else {
+			write_conf_stat(payload_[0]);
+		}
+		break;
+	case APS_STATUS_CTRL:
+		if (isRead) {
+			//The reference oscillator is always locked
+			readQueue_.push_back(statusCtrl_ | APS_LOCK_BIT);
+		}
+		else {
+			statusCtrl_ = payload_[0];
+		}
+		break;
+	}
+}
+
+void SimAPS::write_FPGA_addr(FPGAState & fpga, const ULONG & addr) {
+	if (addr & FPGA_ADDR_REGREAD) {
+		fpga.readAddr = addr & ~FPGA_ADDR_REGREAD;
+		return;
+	}
+	//A block write: the word count comes next
+	fpga.writeAddr = addr;
+	ULONG offset = addr & 0x0FFFFFFF;
+	switch (addr & (0x7 << 28)) {
+	case FPGA_BANKSEL_LL_CHA:
+	case FPGA_BANKSEL_LL_CHB:
+		//Link list addresses are entry indices
+		fpga.writeCursor = 5*offset;
+		break;
+	default:
+		fpga.writeCursor = offset;
+		break;
+	}
+	fpga.expectCount = true;
+	fpga.wordsRemaining = 0;
+}
+
+void SimAPS::write_FPGA_word(FPGAState & fpga, const USHORT & word) {
+	if (fpga.expectCount) {
+		fpga.wordsRemaining = word;
+		fpga.expectCount = false;
+		return;
+	}
+	if (fpga.wordsRemaining == 0) {
+		LOG(plog::warning) << "Simulated APS received a data word outside a block write";
+		return;
+	}
+	switch (fpga.writeAddr & (0x7 << 28)) {
+	case FPGA_BANKSEL_CSR:
+		fpga.csr[fpga.writeCursor % NUM_CSR_REGS] = word;
+		break;
+	case FPGA_BANKSEL_WF_CHA:
+	case FPGA_BANKSEL_WF_CHB:
+		fpga.waveforms[((fpga.writeAddr >> 28) & 0x7) - 1][fpga.writeCursor % MAX_WF_LENGTH] = word;
+		break;
+	case FPGA_BANKSEL_LL_CHA:
+	case FPGA_BANKSEL_LL_CHB:
+		fpga.linkLists[((fpga.writeAddr >> 28) & 0x7) - 3][fpga.writeCursor % (5*MAX_LL_LENGTH)] = word;
+		break;
+	}
+	fpga.writeCursor++;
+	fpga.wordsRemaining--;
+}
+
+USHORT SimAPS::read_FPGA_word(const FPGAState & fpga, const ULONG & addr) const {
+	ULONG offset = addr & 0x0FFFFFFF;
+	switch (addr & (0x7 << 28)) {
+	case FPGA_BANKSEL_CSR:
+		switch (offset) {
+		case FPGA_ADDR_VERSION:
+			return fpga.programmed ? FIRMWARE_VERSION : 0;
+		case FPGA_ADDR_PLL_STATUS:
+			//All PLLs locked and the clocks in phase
+			return fpga.programmed ? ((1 << PLL_02_LOCK_BIT) | (1 << PLL_13_LOCK_BIT) | (1 << REFERENCE_PLL_LOCK_BIT)) : 0;
+		case FPGA_ADDR_CHA_LL_CURADDR:
+		case FPGA_ADDR_CHB_LL_CURADDR:
+		case FPGA_ADDR_CHA_MINILLSTART:
+		case FPGA_ADDR_A_PHASE:
+		case FPGA_ADDR_B_PHASE:
+			return 0;
+		default:
+			return fpga.csr[offset % NUM_CSR_REGS];
+		}
+	case FPGA_BANKSEL_WF_CHA:
+	case FPGA_BANKSEL_WF_CHB:
+		return fpga.waveforms[((addr >> 28) & 0x7) - 1][offset % MAX_WF_LENGTH];
+	case FPGA_BANKSEL_LL_CHA:
+	case FPGA_BANKSEL_LL_CHB:
+		return fpga.linkLists[((addr >> 28) & 0x7) - 3][offset % (5*MAX_LL_LENGTH)];
+	default:
+		return 0;
+	}
+}
+
+void SimAPS::write_SPI() {
+	vector<UCHAR> bytes = deserialize_SPI(payload_);
+	const bool isRead = bytes[0] & 0x80;
+
+	switch (cmd_ & APS_CMD) {
+	case APS_DAC_SPI: {
+		vector<UCHAR> & regs = dacRegs_[(cmd_ >> 2) & 0x3];
+		ULONG addr = bytes[0] & 0x1F;
+		if (isRead) {
+			serData_ = regs[addr];
+		}
+		else {
+			regs[addr] = bytes[1];
+		}
+		break;
+	}
+	case APS_PLL_SPI: {
+		ULONG addr = ((bytes[0] & 0x1F) << 8) | bytes[1];
+		if (isRead) {
+			serData_ = pllRegs_[addr];
+		}
+		else {
+			//0x1F is the read-only status register
+			if (addr != 0x1F) pllRegs_[addr] = bytes[2];
+		}
+		break;
+	}
+	case APS_VCXO_SPI:
+		//The register address is in the low bits of the last byte
+		std::copy(bytes.begin(), bytes.end(), vcxoRegs_);
+		break;
+	}
+}
+
+void SimAPS::write_conf_stat(const UCHAR & data) {
+	const UCHAR pgmBits[2] = {APS_PGM01_BIT, APS_PGM23_BIT};
+	const UCHAR rstBits[2] = {APS_FRST01_BIT, APS_FRST23_BIT};
+	for (int ct = 0; ct < 2; ct++) {
+		//Pulling PROGRAMN low clears the configuration
+		if (!(data & pgmBits[ct])) {
+			fpgas_[ct].programmed = false;
+		}
+		//RESETN low resets the registers
+		if (!(data & rstBits[ct])) {
+			fpgas_[ct].csr.assign(NUM_CSR_REGS, 0);
+		}
+	}
+	confStat_ = data & 0xF;
+}
+
+UCHAR SimAPS::read_conf_stat() const {
+	UCHAR status = confStat_;
+	if (confStat_ & APS_PGM01_BIT) status |= APS_INIT01_BIT;
+	if (confStat_ & APS_PGM23_BIT) status |= APS_INIT23_BIT;
+	if (fpgas_[0].programmed) status |= APS_DONE01_BIT;
+	if (fpgas_[1].programmed) status |= APS_DONE23_BIT;
+	return status;
+}
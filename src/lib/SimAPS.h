@@ -0,0 +1,107 @@
+/*
+ * SimAPS.h
+ *
+ * An in-process stand-in for an APS unit on the other end of the USB link. It decodes the
+ * command byte protocol and keeps the CSR, waveform and link-list memories of both FPGAs along
+ * with the SPI registers of the PLL, DACs and VCXO. Programming the FPGAs sets the DONE bits and
+ * the PLLs report lock so the normal init sequence runs through.
+ *
+ * Each USB transfer costs a fixed latency plus its length at the link bandwidth so host-side
+ * init, upload and streaming throughput can be measured without hardware.
+ */
+
+#include "headings.h"
+
+#ifndef SIMAPS_H_
+#define SIMAPS_H_
+
+class SimAPS : public Transport {
+public:
+	SimAPS();
+
+	int connect(const int &);
+	int disconnect();
+
+	FT_STATUS write(UCHAR *, const DWORD &, DWORD *);
+	FT_STATUS read(UCHAR *, const DWORD &, DWORD *);
+	FT_STATUS get_queue_status(DWORD *);
+
+	//Link model: latency (us) per transfer plus transfer time at bandwidth (bytes/s, 0 = unlimited)
+	void set_link_model(const double &, const double &);
+	//Link model for units created afterwards
+	static void set_default_link_model(const double &, const double &);
+	//Also model the driver latency timer (short reads wait for it) and write timeout (long writes are cut short)
+	void set_driver_timer_model(const bool &);
+	TransferProfile applied_profile() const;
+
+	//Transfer counters
+	size_t num_writes() const;
+	size_t num_reads() const;
+	size_t bytes_written() const;
+	size_t bytes_read() const;
+	void reset_counters();
+
+	//Look at the simulated memories: addr is a full FPGA address (bank select + offset)
+	USHORT peek(const FPGASELECT &, const ULONG &) const;
+	UCHAR peek_PLL(const ULONG &) const;
+	UCHAR peek_DAC(const int &, const ULONG &) const;
+	bool is_programmed(const FPGASELECT &) const;
+
+protected:
+	int apply_profile(const TransferProfile &);
+
+private:
+	SimAPS(const SimAPS&) = delete;
+	SimAPS& operator=(const SimAPS&) = delete;
+
+	struct FPGAState {
+		WordVec csr;
+		WordVec waveforms[2];
+		WordVec linkLists[2];
+		bool programmed;
+		ULONG readAddr;
+		ULONG writeAddr;
+		size_t writeCursor;
+		bool expectCount;
+		size_t wordsRemaining;
+		FPGAState();
+	};
+
+	mutable std::mutex mutex_;
+	std::atomic<bool> connected_;
+	FPGAState fpgas_[2];
+	vector<UCHAR> pllRegs_;
+	vector<UCHAR> dacRegs_[4];
+	UCHAR vcxoRegs_[4];
+	UCHAR confStat_;
+	UCHAR statusCtrl_;
+	UCHAR serData_;
+
+	//Command currently being decoded
+	UCHAR cmd_;
+	vector<UCHAR> payload_;
+	size_t payloadNeeded_;
+
+	std::deque<UCHAR> readQueue_;
+
+	double latency_;
+	double bandwidth_;
+	bool modelDriverTimers_;
+	TransferProfile profile_;
+	size_t numWrites_, numReads_, bytesWritten_, bytesRead_;
+
+	double transfer_time(const size_t &) const;
+	void wait(const double &) const;
+	void process_byte(const UCHAR &);
+	void execute_command();
+	vector<FPGAState *> selected_fpgas(const UCHAR &);
+
+	void write_FPGA_addr(FPGAState &, const ULONG &);
+	void write_FPGA_word(FPGAState &, const USHORT &);
+	USHORT read_FPGA_word(const FPGAState &, const ULONG &) const;
+	void write_SPI();
+	void write_conf_stat(const UCHAR &);
+	UCHAR read_conf_stat() const;
+};
+
+#endif /* SIMAPS_H_ */
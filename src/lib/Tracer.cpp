@@ -0,0 +1,162 @@
+/*
+ * Tracer.cpp
+ */
+
+#include "Tracer.h"
+
+const size_t Tracer::RING_SIZE;
+const int Tracer::DRAIN_INTERVAL;
+
+std::atomic<bool> Tracer::enabled_{false};
+std::atomic<size_t> Tracer::numDropped_{0};
+
+namespace {
+	//Rings outlive their threads until they have been drained
+	std::mutex ringsMutex;
+	vector<std::shared_ptr<void>> ringOwners;
+	size_t nextThreadID = 1;
+
+	//The open trace; sessionMutex covers the file and the drain thread
+	std::mutex sessionMutex;
+	std::ofstream traceFile;
+	std::chrono::steady_clock::time_point traceStart;
+	size_t numWritten = 0;
+	bool firstEvent = true;
+	std::thread drainThread;
+	std::mutex drainMutex;
+	std::condition_variable drainWake;
+	bool stopDrain = false;
+}
+
+Tracer::Ring::Ring(const size_t & id) : spans(RING_SIZE), head{0}, tail{0}, threadID{id} {}
+
+Tracer::Ring & Tracer::thread_ring() {
+	thread_local std::shared_ptr<Ring> ring;
+	if (!ring) {
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		ring = std::make_shared<Ring>(nextThreadID++);
+		ringOwners.push_back(ring);
+	}
+	return *ring;
+}
+
+void Tracer::record(const char * name, const char * category, const int & device,
+		const std::chrono::steady_clock::time_point & start, const std::chrono::steady_clock::time_point & stop) {
+	Ring & ring = thread_ring();
+	size_t head = ring.head.load(std::memory_order_relaxed);
+	if (head - ring.tail.load(std::memory_order_acquire) >= RING_SIZE) {
+		numDropped_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	Span & span = ring.spans[head % RING_SIZE];
+	span.name = name;
+	span.category = category;
+	span.device = device;
+	span.start = start;
+	span.stop = stop;
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+size_t Tracer::num_dropped() {
+	return numDropped_.load(std::memory_order_relaxed);
+}
+
+size_t Tracer::drain() {
+	//Called with sessionMutex held
+	vector<std::shared_ptr<void>> owners;
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		owners = ringOwners;
+	}
+	size_t numDrained = 0;
+	for (auto & owner : owners) {
+		Ring & ring = *std::static_pointer_cast<Ring>(owner);
+		size_t tail = ring.tail.load(std::memory_order_relaxed);
+		size_t head = ring.head.load(std::memory_order_acquire);
+		for (; tail != head; tail++) {
+			const Span & span = ring.spans[tail % RING_SIZE];
+			//Spans that started before this trace are left out
+			if (span.start < traceStart) continue;
+			double ts = std::chrono::duration<double, std::micro>(span.start - traceStart).count();
+			double dur = std::chrono::duration<double, std::micro>(span.stop - span.start).count();
+			traceFile << (firstEvent ? "\n" : ",\n") << "{\"name\":\"" << span.name << "\",\"cat\":\"" << span.category
+				<< "\",\"ph\":\"X\",\"ts\":" << ts << ",\"dur\":" << dur << ",\"pid\":1,\"tid\":" << ring.threadID;
+			if (span.device >= 0) {
+				traceFile << ",\"args\":{\"device\":" << span.device << "}";
+			}
+			traceFile << "}";
+			firstEvent = false;
+			numDrained++;
+		}
+		ring.tail.store(tail, std::memory_order_release);
+	}
+
+	//Forget the rings of threads that have exited now they are empty: only ringOwners and owners still hold those
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	ringOwners.erase(std::remove_if(ringOwners.begin(), ringOwners.end(), [](const std::shared_ptr<void> & owner){
+		const Ring & ring = *std::static_pointer_cast<Ring>(owner);
+		return owner.use_count() <= 2 && ring.head.load(std::memory_order_acquire) == ring.tail.load(std::memory_order_relaxed);
+	}), ringOwners.end());
+	return numDrained;
+}
+
+void Tracer::drain_loop() {
+	std::unique_lock<std::mutex> lock(drainMutex);
+	while (!stopDrain) {
+		drainWake.wait_for(lock, std::chrono::milliseconds(DRAIN_INTERVAL));
+		lock.unlock();
+		{
+			std::lock_guard<std::mutex> sessionLock(sessionMutex);
+			numWritten += drain();
+		}
+		lock.lock();
+	}
+}
+
+int Tracer::start(const string & fileName) {
+	std::lock_guard<std::mutex> lock(sessionMutex);
+	if (traceFile.is_open()) {
+		LOG(plog::error) << "A trace is already being written";
+		return -1;
+	}
+	traceFile.open(fileName, std::ios::out | std::ios::trunc);
+	if (!traceFile.is_open()) {
+		LOG(plog::error) << "Unable to open trace file " << fileName;
+		return -1;
+	}
+	traceFile << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	traceStart = std::chrono::steady_clock::now();
+	numWritten = 0;
+	firstEvent = true;
+	numDropped_ = 0;
+	{
+		std::lock_guard<std::mutex> drainLock(drainMutex);
+		stopDrain = false;
+	}
+	drainThread = std::thread(drain_loop);
+	enabled_ = true;
+	LOG(plog::info) << "Tracing to " << fileName;
+	return 0;
+}
+
+int Tracer::stop() {
+	enabled_ = false;
+	{
+		std::lock_guard<std::mutex> drainLock(drainMutex);
+		stopDrain = true;
+	}
+	drainWake.notify_all();
+	if (drainThread.joinable()) drainThread.join();
+
+	std::lock_guard<std::mutex> lock(sessionMutex);
+	if (!traceFile.is_open()) return 0;
+	//Spans still open when tracing stopped land in the rings afterwards and are dropped by the next start
+	numWritten += drain();
+	traceFile << "\n]}" << endl;
+	traceFile.close();
+	if (num_dropped()) {
+		LOG(plog::warning) << "Trace dropped " << num_dropped() << " spans; the rings filled faster than they were drained";
+	}
+	LOG(plog::info) << "Wrote " << numWritten << " spans to the trace";
+	return numWritten;
+}
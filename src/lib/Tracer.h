@@ -0,0 +1,82 @@
+/*
+ * Tracer.h
+ *
+ * Optional timeline tracing in the Chrome trace event format (chrome://tracing, Perfetto).
+ * Spans go into a ring buffer per thread with no locks or allocation; a background thread
+ * drains the rings into the JSON trace file so traced code keeps its timing. When a ring
+ * fills faster than it is drained the newest spans are dropped and counted.
+ */
+
+#include "headings.h"
+
+#ifndef TRACER_H_
+#define TRACER_H_
+
+class Tracer {
+public:
+	//Spans each thread can hold between drains
+	static const size_t RING_SIZE = 1 << 14;
+	//How often the background thread drains the rings (ms)
+	static const int DRAIN_INTERVAL = 20;
+
+	//Start writing a trace file; returns 0 on success, -1 if it can not be opened or a trace is running
+	static int start(const string &);
+	//Drain everything and close the file; returns the number of spans written
+	static int stop();
+	static bool enabled() {return enabled_.load(std::memory_order_relaxed);}
+	static size_t num_dropped();
+
+	//Names and categories must outlive the trace (string literals, __func__)
+	static void record(const char *, const char *, const int &, const std::chrono::steady_clock::time_point &, const std::chrono::steady_clock::time_point &);
+
+private:
+	struct Span {
+		const char * name;
+		const char * category;
+		int device;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point stop;
+	};
+	//Single producer (its thread) and single consumer (the drain) ring
+	struct Ring {
+		vector<Span> spans;
+		std::atomic<size_t> head; //next slot the thread writes
+		std::atomic<size_t> tail; //next slot the drain reads
+		size_t threadID;
+		Ring(const size_t &);
+	};
+
+	static std::atomic<bool> enabled_;
+	static std::atomic<size_t> numDropped_;
+	static Ring & thread_ring();
+	static size_t drain();
+	static void drain_loop();
+};
+
+//Records the lifetime of the enclosing scope when tracing is on
+class TraceSpan {
+public:
+	TraceSpan(const char * name, const char * category, const int & device = -1) :
+		name_(name), category_(category), device_(device), active_(Tracer::enabled()) {
+		if (active_) start_ = std::chrono::steady_clock::now();
+	}
+	~TraceSpan() {
+		if (active_) Tracer::record(name_, category_, device_, start_, std::chrono::steady_clock::now());
+	}
+
+private:
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+	const char * name_;
+	const char * category_;
+	int device_;
+	bool active_;
+	std::chrono::steady_clock::time_point start_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+//Trace the rest of the enclosing scope: TRACE_SPAN("name", "category", deviceID)
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(traceSpan_, __LINE__)(__VA_ARGS__)
+
+#endif /* TRACER_H_ */
@@ -0,0 +1,88 @@
+/*
+ * Transport.cpp
+ */
+
+#include "Transport.h"
+
+namespace {
+	//Indexed by TRANSFER_PROFILE
+	const TransferProfile PROFILES[] = {
+		//Register access and setup: reads of a few bytes come back within a couple of ms
+		{"interactive", 2, APS_READTIMEOUT, APS_WRITETIMEOUT},
+		//Bitfiles and large waveform/link-list uploads: long writes must not time out
+		{"bulk upload", 16, APS_READTIMEOUT, 10*APS_WRITETIMEOUT},
+		//The streaming loop's frequent polls of the link-list address: lowest latency, short timeouts
+		{"streaming poll", 1, 100, 100}
+	};
+}
+
+Transport::Transport() : transferSize_{USB_DEFAULT_TRANSFER_SIZE}, baseProfile_{PROFILE_INTERACTIVE},
+		nextProfileID_{0}, appliedProfile_{PROFILE_INTERACTIVE} {}
+
+const TransferProfile & Transport::profile_settings(const TRANSFER_PROFILE & profile) {
+	return PROFILES[(profile >= PROFILE_INTERACTIVE && profile <= PROFILE_STREAMING_POLL) ? profile : PROFILE_INTERACTIVE];
+}
+
+UCHAR * Transport::write_buffer(const size_t & numBytes) {
+	if (writeBuffer_.size() < numBytes) {
+		writeBuffer_.resize(numBytes);
+	}
+	return writeBuffer_.data();
+}
+
+FT_STATUS Transport::wait_for_rx(const DWORD & numBytes, const ULONG & timeout, DWORD * rxBytes) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	std::chrono::microseconds backoff(10);
+	while (true) {
+		FT_STATUS ftStatus = get_queue_status(rxBytes);
+		if (!FT_SUCCESS(ftStatus) || *rxBytes >= numBytes || std::chrono::steady_clock::now() >= deadline) {
+			return ftStatus;
+		}
+		std::this_thread::sleep_for(backoff);
+		backoff = std::min(2*backoff, std::chrono::microseconds(1000));
+	}
+}
+
+int Transport::set_profile(const TRANSFER_PROFILE & profile) {
+	std::lock_guard<std::mutex> lock(profileMutex_);
+	baseProfile_ = profile;
+	return switch_profile();
+}
+
+TRANSFER_PROFILE Transport::get_profile() const {
+	std::lock_guard<std::mutex> lock(profileMutex_);
+	return pushedProfiles_.empty() ? baseProfile_ : pushedProfiles_.back().second;
+}
+
+size_t Transport::push_profile(const TRANSFER_PROFILE & profile) {
+	std::lock_guard<std::mutex> lock(profileMutex_);
+	size_t id = nextProfileID_++;
+	pushedProfiles_.push_back(std::make_pair(id, profile));
+	switch_profile();
+	return id;
+}
+
+void Transport::pop_profile(const size_t & id) {
+	std::lock_guard<std::mutex> lock(profileMutex_);
+	auto entry = std::find_if(pushedProfiles_.begin(), pushedProfiles_.end(),
+			[&id](const std::pair<size_t, TRANSFER_PROFILE> & pushed){ return pushed.first == id; });
+	if (entry != pushedProfiles_.end()) {
+		pushedProfiles_.erase(entry);
+		switch_profile();
+	}
+}
+
+int Transport::apply_active_profile() {
+	std::lock_guard<std::mutex> lock(profileMutex_);
+	appliedProfile_ = pushedProfiles_.empty() ? baseProfile_ : pushedProfiles_.back().second;
+	return apply_profile(profile_settings(appliedProfile_));
+}
+
+int Transport::switch_profile() {
+	//Only talk to the driver when the active profile actually changes
+	TRANSFER_PROFILE active = pushedProfiles_.empty() ? baseProfile_ : pushedProfiles_.back().second;
+	if (active == appliedProfile_) return 0;
+	appliedProfile_ = active;
+	LOG(plog::debug) << "Switching to the " << profile_settings(active).name << " transfer profile";
+	return apply_profile(profile_settings(active));
+}
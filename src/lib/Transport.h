@@ -0,0 +1,93 @@
+/*
+ * Transport.h
+ *
+ * The USB link to a single APS unit. All of the FPGA and FTDI level I/O goes through one
+ * of these so the D2XX driver (FTDITransport) can be swapped for the simulated unit (SimAPS).
+ * Status codes follow the D2XX FT_STATUS conventions.
+ */
+
+#include "headings.h"
+
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+//Driver latency timer (ms) and timeouts (ms) for a kind of traffic
+struct TransferProfile {
+	const char * name;
+	UCHAR latencyTimer;
+	ULONG readTimeout;
+	ULONG writeTimeout;
+};
+
+class Transport {
+public:
+	virtual ~Transport() {};
+
+	//Open/close the link to the device; returns 0 on success
+	virtual int connect(const int &) = 0;
+	virtual int disconnect() = 0;
+
+	//Blocking write/read of raw bytes
+	virtual FT_STATUS write(UCHAR *, const DWORD &, DWORD *) = 0;
+	virtual FT_STATUS read(UCHAR *, const DWORD &, DWORD *) = 0;
+
+	//Bytes waiting in the receive queue
+	virtual FT_STATUS get_queue_status(DWORD *) = 0;
+	//Wait until at least numBytes are waiting or the timeout (ms) passes; rxBytes gets what is waiting.
+	//The default polls the queue status; transports with driver notification wait on it instead.
+	virtual FT_STATUS wait_for_rx(const DWORD &, const ULONG &, DWORD *);
+
+	//Largest single write the link should see; the upload path splits its transfers to fit
+	virtual int set_transfer_size(const size_t & transferSize) {transferSize_ = transferSize; return 0;}
+	size_t get_transfer_size() const {return transferSize_;}
+
+	//Transfer profiles: the base profile applies unless a temporary one is pushed (see ProfileGuard).
+	//Pushed profiles can be popped in any order; the most recently pushed one still in place applies.
+	int set_profile(const TRANSFER_PROFILE &);
+	TRANSFER_PROFILE get_profile() const;
+	size_t push_profile(const TRANSFER_PROFILE &);
+	void pop_profile(const size_t &);
+	static const TransferProfile & profile_settings(const TRANSFER_PROFILE &);
+
+	//Scratch space for encoding a write, grown to at least numBytes and kept so repeated writes don't allocate.
+	//Writes on a link are serialized by their callers, which covers the encode into this buffer too.
+	UCHAR * write_buffer(const size_t &);
+
+	//Traffic counters; the transports record writes and reads, callers higher up record the rest
+	IOStats & io_stats() {return ioStats_;}
+	const IOStats & io_stats() const {return ioStats_;}
+
+protected:
+	Transport();
+	size_t transferSize_;
+	IOStats ioStats_;
+	vector<UCHAR> writeBuffer_;
+
+	//Push the settings of a profile down to the driver
+	virtual int apply_profile(const TransferProfile &) {return 0;}
+	//Re-apply the active profile, e.g. after reconnecting
+	int apply_active_profile();
+
+private:
+	mutable std::mutex profileMutex_;
+	TRANSFER_PROFILE baseProfile_;
+	vector<std::pair<size_t, TRANSFER_PROFILE>> pushedProfiles_;
+	size_t nextProfileID_;
+	TRANSFER_PROFILE appliedProfile_;
+	int switch_profile();
+};
+
+//Use a transfer profile for the lifetime of the guard
+class ProfileGuard {
+public:
+	ProfileGuard(Transport & transport, const TRANSFER_PROFILE & profile) : transport_(transport), id_{transport.push_profile(profile)} {}
+	~ProfileGuard() {transport_.pop_profile(id_);}
+
+private:
+	ProfileGuard(const ProfileGuard&) = delete;
+	ProfileGuard& operator=(const ProfileGuard&) = delete;
+	Transport & transport_;
+	size_t id_;
+};
+
+#endif /* TRANSPORT_H_ */
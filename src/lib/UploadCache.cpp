@@ -0,0 +1,142 @@
+/*
+ * UploadCache.cpp
+ */
+
+#include "UploadCache.h"
+
+//FPGA indices into regions_ as [first, last); a plain range so cache lookups don't allocate
+struct IndexRange {
+	int first;
+	int last;
+};
+
+static IndexRange fpga_indices(const FPGASELECT & fpga) {
+	switch (fpga) {
+	case FPGA1:
+		return {0, 1};
+	case FPGA2:
+		return {1, 2};
+	case ALL_FPGAS:
+		return {0, 2};
+	default:
+		return {0, 0};
+	}
+}
+
+//Address units covered by a block write: link list addresses count entries, everything else words
+static ULONG address_span(const ULONG & addr, const size_t & numWords, const size_t & entryWords) {
+	switch (addr & (0x7 << 28)) {
+	case FPGA_BANKSEL_LL_CHA:
+	case FPGA_BANKSEL_LL_CHB:
+		return ULONG((numWords + entryWords - 1) / std::max<size_t>(entryWords, 1));
+	default:
+		return ULONG(numWords);
+	}
+}
+
+bool UploadCache::cacheable(const ULONG & addr) {
+	switch (addr & (0x7 << 28)) {
+	case FPGA_BANKSEL_WF_CHA:
+	case FPGA_BANKSEL_WF_CHB:
+	case FPGA_BANKSEL_LL_CHA:
+	case FPGA_BANKSEL_LL_CHB:
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint64_t UploadCache::hash(const USHORT * data, const size_t & numWords) {
+	//Four words at a time through a multiply-rotate mix, then the tail and the length, then a final avalanche
+	const uint64_t prime1 = 0x9E3779B185EBCA87ULL, prime2 = 0xC2B2AE3D27D4EB4FULL;
+	uint64_t h = prime2 ^ numWords;
+	size_t ct = 0;
+	for (; ct + 4 <= numWords; ct += 4) {
+		uint64_t chunk = uint64_t(data[ct]) | (uint64_t(data[ct+1]) << 16) | (uint64_t(data[ct+2]) << 32) | (uint64_t(data[ct+3]) << 48);
+		h ^= chunk * prime2;
+		h = ((h << 31) | (h >> 33)) * prime1;
+	}
+	for (; ct < numWords; ct++) {
+		h ^= uint64_t(data[ct]) * prime1;
+		h = ((h << 23) | (h >> 41)) * prime2;
+	}
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	return h;
+}
+
+bool UploadCache::check_and_stage(const FPGASELECT & fpga, const ULONG & addr, const USHORT * data, const size_t & numWords, const size_t & entryWords) {
+	const IndexRange indices = fpga_indices(fpga);
+	if (!cacheable(addr) || numWords == 0) return false;
+	const uint64_t wordsHash = hash(data, numWords);
+	bool hit = true;
+	for (int idx = indices.first; idx < indices.last; idx++) {
+		hit = hit && holds(idx, addr, numWords, wordsHash);
+	}
+	if (!hit) {
+		//Whatever the write overlaps is gone whether or not it makes it out
+		const ULONG stop = addr + address_span(addr, numWords, entryWords);
+		for (int idx = indices.first; idx < indices.last; idx++) {
+			erase_overlapping(idx, addr, stop);
+			staged_[idx].push_back(std::make_pair(addr, Region{stop, numWords, wordsHash}));
+		}
+	}
+	return hit;
+}
+
+void UploadCache::commit_staged() {
+	for (int idx = 0; idx < 2; idx++) {
+		//In order so a later write replaces an earlier one it overlaps
+		for (auto & staged : staged_[idx]) {
+			erase_overlapping(idx, staged.first, staged.second.stop);
+			regions_[idx][staged.first] = staged.second;
+		}
+		staged_[idx].clear();
+	}
+}
+
+void UploadCache::drop_staged() {
+	for (int idx = 0; idx < 2; idx++) {
+		staged_[idx].clear();
+	}
+}
+
+bool UploadCache::holds(const int & idx, const ULONG & addr, const size_t & numWords, const uint64_t & wordsHash) const {
+	auto region = regions_[idx].find(addr);
+	return region != regions_[idx].end() && region->second.numWords == numWords && region->second.hash == wordsHash;
+}
+
+void UploadCache::erase_overlapping(const int & idx, const ULONG & addr, const ULONG & stop) {
+	map<ULONG, Region> & regions = regions_[idx];
+	//The region starting before the span if it reaches in, then those starting inside it
+	auto region = regions.lower_bound(addr);
+	if (region != regions.begin() && std::prev(region)->second.stop > addr) {
+		--region;
+	}
+	while (region != regions.end() && region->first < stop) {
+		region = regions.erase(region);
+	}
+}
+
+void UploadCache::invalidate(const FPGASELECT & fpga) {
+	const IndexRange indices = fpga_indices(fpga);
+	for (int idx = indices.first; idx < indices.last; idx++) {
+		regions_[idx].clear();
+		staged_[idx].clear();
+	}
+}
+
+void UploadCache::invalidate(const FPGASELECT & fpga, const ULONG & addr, const size_t & numWords, const size_t & entryWords) {
+	const IndexRange indices = fpga_indices(fpga);
+	if (!cacheable(addr)) return;
+	const ULONG stop = addr + address_span(addr, numWords, entryWords);
+	for (int idx = indices.first; idx < indices.last; idx++) {
+		erase_overlapping(idx, addr, stop);
+		//A staged write this one lands on must not be recorded after it
+		vector<std::pair<ULONG, Region>> & staged = staged_[idx];
+		staged.erase(std::remove_if(staged.begin(), staged.end(), [&](const std::pair<ULONG, Region> & write){
+			return write.first < stop && write.second.stop > addr;
+		}), staged.end());
+	}
+}
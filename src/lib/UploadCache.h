@@ -0,0 +1,48 @@
+/*
+ * UploadCache.h
+ *
+ * What the driver last wrote to each region of an APS's waveform and link list memory, kept as
+ * a hash of the words. A block write of the same words to the same region is a no-op. A write
+ * overlapping a region replaces it once the write has gone out; a reset or reprogram of an FPGA
+ * drops its regions.
+ */
+
+#include "headings.h"
+
+#ifndef UPLOADCACHE_H_
+#define UPLOADCACHE_H_
+
+class UploadCache {
+public:
+	//Whether every selected FPGA already holds these words from the address on. If not the regions they overlap are
+	//dropped and the write is staged until commit_staged. Link list memory is addressed by entry so the last argument
+	//is the words per entry (1 covers the most memory when it is not known). Writes outside the waveform and link
+	//list banks are never cached.
+	bool check_and_stage(const FPGASELECT &, const ULONG &, const USHORT *, const size_t &, const size_t & entryWords);
+	//Record the staged writes once they are on the device, or forget them when the flush fell short
+	void commit_staged();
+	void drop_staged();
+	//Forget what an FPGA (or ALL_FPGAS) holds
+	void invalidate(const FPGASELECT &);
+	//Only the regions a block write from the address overlaps; unlike recording the write this never allocates
+	void invalidate(const FPGASELECT &, const ULONG &, const size_t &, const size_t & entryWords);
+
+	static bool cacheable(const ULONG &);
+	static uint64_t hash(const USHORT *, const size_t &);
+
+private:
+	struct Region {
+		ULONG stop; //one past the last address
+		size_t numWords;
+		uint64_t hash;
+	};
+	//Non-overlapping regions by start address for each FPGA
+	map<ULONG, Region> regions_[2];
+	//Writes queued since the last flush, in order, for each FPGA
+	vector<std::pair<ULONG, Region>> staged_[2];
+
+	bool holds(const int &, const ULONG &, const size_t &, const uint64_t &) const;
+	void erase_overlapping(const int &, const ULONG &, const ULONG &);
+};
+
+#endif /* UPLOADCACHE_H_ */
@@ -0,0 +1,92 @@
+/*
+ * UploadEngine.cpp
+ */
+
+#include "UploadEngine.h"
+
+UploadEngine::UploadEngine(Transport & transport) :
+		transport_(transport), numQueuedWords_{0}, numQueuedBytes_{0} {
+	set_transfer_size(transport_.get_transfer_size());
+}
+
+void UploadEngine::set_transfer_size(const size_t & transferSize) {
+	buffer_.resize(std::max(transferSize, FPGA::BlockEncoder::MIN_BUFFER));
+	buffer_.shrink_to_fit();
+}
+
+size_t UploadEngine::get_transfer_size() const {
+	return buffer_.size();
+}
+
+void UploadEngine::queue(const FPGASELECT & fpga, const unsigned int & addr, const vector<USHORT> & data) {
+	queue(fpga, addr, data.data(), data.size());
+}
+
+void UploadEngine::queue(const FPGASELECT & fpga, const unsigned int & addr, const USHORT * data, const size_t & numWords) {
+	blocks_.push_back(Block{fpga, addr, words_.size(), numWords, nullptr});
+	words_.insert(words_.end(), data, data + numWords);
+	numQueuedWords_ += numWords;
+	numQueuedBytes_ += FPGA::format_length(numWords);
+}
+
+void UploadEngine::queue_view(const FPGASELECT & fpga, const unsigned int & addr, const USHORT * data, const size_t & numWords) {
+	blocks_.push_back(Block{fpga, addr, 0, numWords, data});
+	numQueuedWords_ += numWords;
+	numQueuedBytes_ += FPGA::format_length(numWords);
+}
+
+bool UploadEngine::empty() const {
+	return blocks_.empty();
+}
+
+size_t UploadEngine::queued_words() const {
+	return numQueuedWords_;
+}
+
+size_t UploadEngine::queued_bytes() const {
+	return numQueuedBytes_;
+}
+
+void UploadEngine::discard() {
+	blocks_.clear();
+	words_.clear();
+	numQueuedWords_ = 0;
+	numQueuedBytes_ = 0;
+}
+
+int UploadEngine::flush() {
+	if (blocks_.empty()) return 0;
+
+	//Fill the buffer with as many (pieces of) blocks as fit and send it each time it is full
+	size_t bytesWritten = 0;
+	size_t bufferUsed = 0;
+	bool sent = true;
+	for (auto & block : blocks_) {
+		FPGA::BlockEncoder encoder(block.fpga, block.addr, block.view ? block.view : words_.data() + block.start, block.numWords);
+		while (sent) {
+			bufferUsed += encoder.encode(buffer_.data() + bufferUsed, buffer_.size() - bufferUsed);
+			if (encoder.done()) break;
+			sent = send(bufferUsed, bytesWritten);
+			bufferUsed = 0;
+		}
+		if (!sent) break;
+	}
+	if (sent && bufferUsed > 0) {
+		send(bufferUsed, bytesWritten);
+	}
+
+	discard();
+	return int(bytesWritten);
+}
+
+bool UploadEngine::send(const size_t & length, size_t & bytesWritten) {
+	DWORD numWritten = 0;
+	FT_STATUS ftStatus = transport_.write(buffer_.data(), DWORD(length), &numWritten);
+	bytesWritten += numWritten;
+	if (!FT_SUCCESS(ftStatus) || numWritten != length) {
+		LOG(plog::error) << "Upload of " << length << " bytes failed with status = " << ftStatus << "; bytes written = " << numWritten
+			<< "; dropping the rest of the queue";
+		return false;
+	}
+	return true;
+}
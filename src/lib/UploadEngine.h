@@ -0,0 +1,62 @@
+/*
+ * UploadEngine.h
+ *
+ * Block writes to one APS unit. Writes are queued as words (copied, or viewed in the caller's
+ * buffer with queue_view) and on flush are encoded straight into one preallocated transfer
+ * buffer that is sent whenever it fills, so an upload makes no allocations of its own. A
+ * transfer that does not go through in full ends the flush and the rest of the queue is
+ * dropped, so a cut off command is never followed by more data.
+ */
+
+#include "headings.h"
+
+#ifndef UPLOADENGINE_H_
+#define UPLOADENGINE_H_
+
+class UploadEngine {
+public:
+	UploadEngine(Transport &);
+
+	//Resize the transfer buffer (between flushes); transfers end on command byte boundaries
+	void set_transfer_size(const size_t &);
+	size_t get_transfer_size() const;
+
+	//Add a block write to the queue
+	void queue(const FPGASELECT &, const unsigned int &, const vector<USHORT> &);
+	void queue(const FPGASELECT &, const unsigned int &, const USHORT *, const size_t &);
+	//Add a block write encoded straight from the caller's buffer, which must stay unchanged until the next flush
+	void queue_view(const FPGASELECT &, const unsigned int &, const USHORT *, const size_t &);
+	bool empty() const;
+	size_t queued_words() const;
+	//Bytes the queued blocks encode to, which is what flush returns when every transfer goes through
+	size_t queued_bytes() const;
+
+	//Encode and send everything queued; returns the number of bytes written
+	int flush();
+	//Drop everything queued without sending it
+	void discard();
+
+private:
+	UploadEngine(const UploadEngine&) = delete;
+	UploadEngine& operator=(const UploadEngine&) = delete;
+
+	struct Block {
+		FPGASELECT fpga;
+		unsigned int addr;
+		size_t start; //offset into words_
+		size_t numWords;
+		const USHORT * view; //caller owned words instead of words_ (nullptr if copied)
+	};
+
+	Transport & transport_;
+	vector<Block> blocks_;
+	WordVec words_;
+	size_t numQueuedWords_;
+	size_t numQueuedBytes_;
+	vector<UCHAR> buffer_;
+
+	//Send the first bytes of the buffer; false unless they all went through
+	bool send(const size_t &, size_t &);
+};
+
+#endif /* UPLOADENGINE_H_ */
@@ -0,0 +1,165 @@
+/*
+ * WaveformLibrary.cpp
+ */
+
+#include "WaveformLibrary.h"
+
+WaveformLibrary::WaveformLibrary(const size_t & capacity) : capacity_{capacity}, reserved_{0} {
+	clear();
+}
+
+int WaveformLibrary::place(const string & name, const size_t & numPts, Pulse & pulse) {
+	//What has to fit is the length padded to WF_MODULUS
+	const size_t span = WF_MODULUS * ((numPts + WF_MODULUS - 1) / WF_MODULUS);
+	if (numPts == 0 || span > capacity_) {
+		LOG(plog::error) << "Pulse " << name << " has " << numPts << " samples (" << span << " padded); must be between 1 and " << capacity_;
+		return -1;
+	}
+
+	Pulse previous = {0, 0, 0};
+	auto existing = pulses_.find(name);
+	if (existing != pulses_.end()) {
+		if (existing->second.span == span) {
+			existing->second.numPts = numPts;
+			pulse = existing->second;
+			return 0;
+		}
+		previous = existing->second;
+		remove(name);
+	}
+
+	//Best fit: the smallest free block it fits in
+	auto best = free_.end();
+	for (auto block = free_.begin(); block != free_.end(); ++block) {
+		if (block->second >= span && (best == free_.end() || block->second < best->second)) {
+			best = block;
+		}
+	}
+	if (best == free_.end()) {
+		//A pulse being resized keeps its old slot
+		if (previous.span > 0) {
+			take(previous.start, previous.span);
+			pulses_[name] = previous;
+			starts_[previous.start] = name;
+		}
+		return -2;
+	}
+
+	const size_t start = best->first;
+	take(start, span);
+	pulses_[name] = Pulse{start, numPts, span};
+	starts_[start] = name;
+	pulse = pulses_[name];
+	return 0;
+}
+
+void WaveformLibrary::take(const size_t & start, const size_t & span) {
+	//Split the free block holding [start, start + span) around it
+	auto block = std::prev(free_.upper_bound(start));
+	const size_t blockStart = block->first, blockStop = block->first + block->second;
+	free_.erase(block);
+	if (start > blockStart) {
+		free_[blockStart] = start - blockStart;
+	}
+	if (blockStop > start + span) {
+		free_[start + span] = blockStop - (start + span);
+	}
+}
+
+int WaveformLibrary::remove(const string & name) {
+	auto pulse = pulses_.find(name);
+	if (pulse == pulses_.end()) {
+		return -1;
+	}
+	release(pulse->second.start, pulse->second.span);
+	starts_.erase(pulse->second.start);
+	pulses_.erase(pulse);
+	return 0;
+}
+
+void WaveformLibrary::release(const size_t & start, const size_t & span) {
+	//Merge with the free blocks either side
+	size_t blockStart = start, blockSpan = span;
+	auto next = free_.lower_bound(start);
+	if (next != free_.end() && next->first == start + span) {
+		blockSpan += next->second;
+		next = free_.erase(next);
+	}
+	if (next != free_.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == start) {
+			blockStart = prev->first;
+			blockSpan += prev->second;
+			free_.erase(prev);
+		}
+	}
+	free_[blockStart] = blockSpan;
+}
+
+bool WaveformLibrary::find(const string & name, Pulse & pulse) const {
+	auto found = pulses_.find(name);
+	if (found == pulses_.end()) {
+		return false;
+	}
+	pulse = found->second;
+	return true;
+}
+
+vector<WaveformLibrary::Move> WaveformLibrary::compact() {
+	vector<Move> moves;
+	map<size_t, string> starts;
+	size_t nextStart = reserved_;
+	for (auto & entry : starts_) {
+		Pulse & pulse = pulses_[entry.second];
+		if (pulse.start != nextStart) {
+			moves.push_back(Move{pulse.start, nextStart, pulse.span});
+			pulse.start = nextStart;
+		}
+		starts[nextStart] = entry.second;
+		nextStart += pulse.span;
+	}
+	starts_.swap(starts);
+	free_.clear();
+	if (nextStart < capacity_) {
+		free_[nextStart] = capacity_ - nextStart;
+	}
+	return moves;
+}
+
+void WaveformLibrary::clear() {
+	reserve(0);
+}
+
+void WaveformLibrary::reserve(const size_t & numPts) {
+	pulses_.clear();
+	starts_.clear();
+	free_.clear();
+	reserved_ = std::min(WF_MODULUS * ((numPts + WF_MODULUS - 1) / WF_MODULUS), capacity_);
+	if (reserved_ < capacity_) {
+		free_[reserved_] = capacity_ - reserved_;
+	}
+}
+
+size_t WaveformLibrary::num_pulses() const {
+	return pulses_.size();
+}
+
+size_t WaveformLibrary::free_samples() const {
+	size_t total = 0;
+	for (auto & block : free_) {
+		total += block.second;
+	}
+	return total;
+}
+
+size_t WaveformLibrary::largest_free() const {
+	size_t largest = 0;
+	for (auto & block : free_) {
+		largest = std::max(largest, block.second);
+	}
+	return largest;
+}
+
+size_t WaveformLibrary::high_water() const {
+	return starts_.empty() ? reserved_ : starts_.rbegin()->first + pulses_.at(starts_.rbegin()->second).span;
+}
@@ -0,0 +1,66 @@
+/*
+ * WaveformLibrary.h
+ *
+ * Placement of named pulses in a channel's waveform memory. Pulses are padded to WF_MODULUS and
+ * put in the smallest free block they fit (lowest address first on a tie); freed blocks merge with
+ * their neighbours. When no single block is big enough but the free total is, compact() slides
+ * every pulse down to close the gaps and reports the moves so the samples can follow.
+ * A whole waveform set on the channel holds the start of memory; pulses only go after it.
+ * Only the placement is kept here; the samples live in the Channel.
+ */
+
+#include "headings.h"
+
+#ifndef WAVEFORMLIBRARY_H_
+#define WAVEFORMLIBRARY_H_
+
+class WaveformLibrary {
+public:
+	WaveformLibrary(const size_t & capacity = MAX_WF_LENGTH);
+
+	struct Pulse {
+		size_t start;  //first sample, a multiple of WF_MODULUS
+		size_t numPts; //samples as given
+		size_t span;   //samples reserved: numPts padded to WF_MODULUS
+		//Link list entry fields: address and count in WF_MODULUS units (count is 0 counted)
+		USHORT ll_addr() const {return USHORT(start / WF_MODULUS);}
+		USHORT ll_count() const {return USHORT(span / WF_MODULUS - 1);}
+	};
+	struct Move {
+		size_t from;
+		size_t to;
+		size_t span;
+	};
+
+	//Reserve room for a pulse; a name already placed keeps its slot if the padded length is unchanged.
+	//0 on success, -1 for a length of zero or one that padded runs past the capacity, -2 if there's no block big enough.
+	int place(const string &, const size_t &, Pulse &);
+	int remove(const string &);
+	bool find(const string &, Pulse &) const;
+	//Slide every pulse down to the lowest free address, in address order; the moves only ever go down
+	vector<Move> compact();
+	void clear();
+	//Drop every pulse and hold the first samples (padded to WF_MODULUS) for a waveform set outside the library
+	void reserve(const size_t &);
+
+	size_t num_pulses() const;
+	size_t free_samples() const;
+	size_t largest_free() const;
+	//One past the last sample in use
+	size_t high_water() const;
+
+private:
+	size_t capacity_;
+	//Samples from 0 held by a whole waveform; never moved by compact()
+	size_t reserved_;
+	map<string, Pulse> pulses_;
+	//Pulse names by start sample
+	map<size_t, string> starts_;
+	//Free blocks by start sample with their length; never adjacent
+	map<size_t, size_t> free_;
+
+	void take(const size_t &, const size_t &);
+	void release(const size_t &, const size_t &);
+};
+
+#endif /* WAVEFORMLIBRARY_H_ */
@@ -0,0 +1,307 @@
+/*
+ * WaveformPrep.cpp
+ *
+ * Kernels for Channel::prep_waveform: scale, offset and convert the float waveform to DAC
+ * counts, truncating toward zero as the driver always has and saturating at +/-MAX_WF_AMP,
+ * while counting the samples that had to be clipped, all in one pass. Values are clamped to one count past
+ * the range while still floats so the integer conversion can not overflow; NaNs end up at the
+ * negative limit. The vectorized versions are picked at runtime from the CPU features and
+ * produce identical output to the scalar one.
+ */
+
+#include "headings.h"
+#include "CPUFeatures.h"
+
+namespace {
+
+const float CLAMP_LIMIT = MAX_WF_AMP + 1;
+
+//Scaled, offset and clamped sample, truncated to DAC counts. Separate multiply and add to match the vector kernels;
+//the selects send NaNs to the negative limit.
+inline int prep_sample(const float & sample, const float scale, const float offset) {
+	float scaled = scale * sample;
+	scaled = scaled + offset;
+	scaled = scaled * float(MAX_WF_AMP);
+	scaled = (scaled > -CLAMP_LIMIT) ? scaled : -CLAMP_LIMIT;
+	scaled = (scaled < CLAMP_LIMIT) ? scaled : CLAMP_LIMIT;
+	return static_cast<int>(scaled);
+}
+
+//Written without branches so the compiler can vectorize it, as it did the loop it replaced. Clamping leaves samples
+//at most one count out of range, so saturating takes off -1, 0 or 1 and the clipped samples are counted from the sum
+//and the number of odd ones. Those are int16 like the samples to keep the vectors narrow, over chunks too short to overflow.
+WaveformPrep::ClipCounts prep_scalar(const float * in, const size_t & numPts, const float & scale, const float & offset, short * out) {
+	const size_t CHUNK_SIZE = 1 << 14;
+	const float scaleVal = scale, offsetVal = offset;
+	WaveformPrep::ClipCounts clips = {0, 0};
+	for (size_t start = 0; start < numPts; start += CHUNK_SIZE) {
+		const size_t stop = std::min(numPts, start + CHUNK_SIZE);
+		short sumExcess = 0, numClipped = 0;
+		for (size_t ct = start; ct < stop; ct++) {
+			const short value = static_cast<short>(prep_sample(in[ct], scaleVal, offsetVal));
+			const short clipped = std::max(std::min(value, short(MAX_WF_AMP)), short(-MAX_WF_AMP));
+			const short excess = value - clipped;
+			sumExcess += excess;
+			numClipped += excess & 1;
+			out[ct] = clipped;
+		}
+		clips.high += (numClipped + sumExcess) / 2;
+		clips.low += (numClipped - sumExcess) / 2;
+	}
+	return clips;
+}
+
+//Saturate int16 samples, widening the running extremes so clipped samples only need counting when there are some
+void clip_scalar(const short * in, const size_t & numPts, short * out, short & maxValue, short & minValue) {
+	for (size_t ct = 0; ct < numPts; ct++) {
+		const short value = in[ct];
+		maxValue = std::max(maxValue, value);
+		minValue = std::min(minValue, value);
+		out[ct] = std::max(std::min(value, short(MAX_WF_AMP)), short(-MAX_WF_AMP));
+	}
+}
+
+#ifdef SIMD_X86
+
+int popcount(unsigned mask) {
+	int count = 0;
+	for (; mask; mask &= mask - 1) count++;
+	return count;
+}
+
+// Four floats to four truncated, clamped int32s with the clip masks
+SIMD_TARGET("sse2")
+inline __m128i prep4_sse2(const float * in, const __m128 & scale, const __m128 & offset, unsigned & high, unsigned & low) {
+	const __m128 amp = _mm_set1_ps(float(MAX_WF_AMP));
+	const __m128 lo = _mm_set1_ps(-CLAMP_LIMIT);
+	const __m128 hi = _mm_set1_ps(CLAMP_LIMIT);
+	__m128 scaled = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(scale, _mm_loadu_ps(in)), offset), amp);
+	//max returns its second operand for NaN so they go to the negative limit
+	scaled = _mm_min_ps(_mm_max_ps(scaled, lo), hi);
+	__m128i values = _mm_cvttps_epi32(scaled);
+	high = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(values, _mm_set1_epi32(MAX_WF_AMP))));
+	low = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(values, _mm_set1_epi32(-MAX_WF_AMP))));
+	return values;
+}
+
+SIMD_TARGET("sse2")
+WaveformPrep::ClipCounts prep_sse2(const float * in, const size_t & numPts, const float & scale, const float & offset, short * out) {
+	const __m128 scaleVec = _mm_set1_ps(scale);
+	const __m128 offsetVec = _mm_set1_ps(offset);
+	const __m128i maxVal = _mm_set1_epi16(MAX_WF_AMP);
+	const __m128i minVal = _mm_set1_epi16(-MAX_WF_AMP);
+	size_t numHigh = 0, numLow = 0, ct = 0;
+	for (; ct + 8 <= numPts; ct += 8) {
+		unsigned high1, low1, high2, low2;
+		__m128i first = prep4_sse2(in + ct, scaleVec, offsetVec, high1, low1);
+		__m128i second = prep4_sse2(in + ct + 4, scaleVec, offsetVec, high2, low2);
+		__m128i packed = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(first, second), minVal), maxVal);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + ct), packed);
+		numHigh += popcount(high1 | (high2 << 4));
+		numLow += popcount(low1 | (low2 << 4));
+	}
+	WaveformPrep::ClipCounts clips = prep_scalar(in + ct, numPts - ct, scale, offset, out + ct);
+	clips.high += numHigh;
+	clips.low += numLow;
+	return clips;
+}
+
+SIMD_TARGET("sse2")
+void clip_sse2(const short * in, const size_t & numPts, short * out, short & maxValue, short & minValue) {
+	const __m128i maxVal = _mm_set1_epi16(MAX_WF_AMP);
+	const __m128i minVal = _mm_set1_epi16(-MAX_WF_AMP);
+	__m128i maxVec = _mm_set1_epi16(maxValue);
+	__m128i minVec = _mm_set1_epi16(minValue);
+	size_t ct = 0;
+	for (; ct + 8 <= numPts; ct += 8) {
+		__m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + ct));
+		maxVec = _mm_max_epi16(maxVec, values);
+		minVec = _mm_min_epi16(minVec, values);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + ct), _mm_min_epi16(_mm_max_epi16(values, minVal), maxVal));
+	}
+	short maxLanes[8], minLanes[8];
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(maxLanes), maxVec);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(minLanes), minVec);
+	maxValue = *std::max_element(maxLanes, maxLanes + 8);
+	minValue = *std::min_element(minLanes, minLanes + 8);
+	clip_scalar(in + ct, numPts - ct, out + ct, maxValue, minValue);
+}
+
+// Sixteen samples per iteration; packs works within 128-bit lanes so the result is permuted back in order
+SIMD_TARGET("avx2")
+WaveformPrep::ClipCounts prep_avx2(const float * in, const size_t & numPts, const float & scale, const float & offset, short * out) {
+	const __m256 scaleVec = _mm256_set1_ps(scale);
+	const __m256 offsetVec = _mm256_set1_ps(offset);
+	const __m256 amp = _mm256_set1_ps(float(MAX_WF_AMP));
+	const __m256 lo = _mm256_set1_ps(-CLAMP_LIMIT);
+	const __m256 hi = _mm256_set1_ps(CLAMP_LIMIT);
+	const __m256i maxVal32 = _mm256_set1_epi32(MAX_WF_AMP);
+	const __m256i minVal32 = _mm256_set1_epi32(-MAX_WF_AMP);
+	const __m256i maxVal = _mm256_set1_epi16(MAX_WF_AMP);
+	const __m256i minVal = _mm256_set1_epi16(-MAX_WF_AMP);
+	size_t numHigh = 0, numLow = 0, ct = 0;
+	for (; ct + 16 <= numPts; ct += 16) {
+		__m256i values[2];
+		unsigned high = 0, low = 0;
+		for (int half = 0; half < 2; half++) {
+			__m256 scaled = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(scaleVec, _mm256_loadu_ps(in + ct + 8*half)), offsetVec), amp);
+			scaled = _mm256_min_ps(_mm256_max_ps(scaled, lo), hi);
+			values[half] = _mm256_cvttps_epi32(scaled);
+			high |= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(values[half], maxVal32))) << (8*half);
+			low |= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(minVal32, values[half]))) << (8*half);
+		}
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(values[0], values[1]), 0xD8);
+		packed = _mm256_min_epi16(_mm256_max_epi16(packed, minVal), maxVal);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + ct), packed);
+		numHigh += popcount(high);
+		numLow += popcount(low);
+	}
+	WaveformPrep::ClipCounts clips = prep_sse2(in + ct, numPts - ct, scale, offset, out + ct);
+	clips.high += numHigh;
+	clips.low += numLow;
+	return clips;
+}
+
+#endif /* SIMD_X86 */
+
+#ifdef SIMD_NEON
+
+WaveformPrep::ClipCounts prep_neon(const float * in, const size_t & numPts, const float & scale, const float & offset, short * out) {
+	const float32x4_t scaleVec = vdupq_n_f32(scale);
+	const float32x4_t offsetVec = vdupq_n_f32(offset);
+	const float32x4_t amp = vdupq_n_f32(float(MAX_WF_AMP));
+	const float32x4_t lo = vdupq_n_f32(-CLAMP_LIMIT);
+	const float32x4_t hi = vdupq_n_f32(CLAMP_LIMIT);
+	const int16x8_t maxVal = vdupq_n_s16(MAX_WF_AMP);
+	const int16x8_t minVal = vdupq_n_s16(-MAX_WF_AMP);
+	size_t numHigh = 0, numLow = 0, ct = 0;
+	for (; ct + 8 <= numPts; ct += 8) {
+		int32x4_t values[2];
+		for (int half = 0; half < 2; half++) {
+			float32x4_t scaled = vmulq_f32(vaddq_f32(vmulq_f32(scaleVec, vld1q_f32(in + ct + 4*half)), offsetVec), amp);
+			//Compare and select so NaNs go to the negative limit like the other kernels
+			scaled = vbslq_f32(vcgeq_f32(scaled, lo), scaled, lo);
+			scaled = vbslq_f32(vcgtq_f32(scaled, hi), hi, scaled);
+			values[half] = vcvtq_s32_f32(scaled);
+		}
+		int16x8_t packed = vcombine_s16(vqmovn_s32(values[0]), vqmovn_s32(values[1]));
+		//Comparison lanes are all ones so subtracting them counts
+		int16x8_t highCount = vreinterpretq_s16_u16(vcgtq_s16(packed, maxVal));
+		int16x8_t lowCount = vreinterpretq_s16_u16(vcltq_s16(packed, minVal));
+		numHigh -= vaddvq_s16(highCount);
+		numLow -= vaddvq_s16(lowCount);
+		vst1q_s16(out + ct, vminq_s16(vmaxq_s16(packed, minVal), maxVal));
+	}
+	WaveformPrep::ClipCounts clips = prep_scalar(in + ct, numPts - ct, scale, offset, out + ct);
+	clips.high += numHigh;
+	clips.low += numLow;
+	return clips;
+}
+
+void clip_neon(const short * in, const size_t & numPts, short * out, short & maxValue, short & minValue) {
+	const int16x8_t maxVal = vdupq_n_s16(MAX_WF_AMP);
+	const int16x8_t minVal = vdupq_n_s16(-MAX_WF_AMP);
+	int16x8_t maxVec = vdupq_n_s16(maxValue);
+	int16x8_t minVec = vdupq_n_s16(minValue);
+	size_t ct = 0;
+	for (; ct + 8 <= numPts; ct += 8) {
+		int16x8_t values = vld1q_s16(in + ct);
+		maxVec = vmaxq_s16(maxVec, values);
+		minVec = vminq_s16(minVec, values);
+		vst1q_s16(out + ct, vminq_s16(vmaxq_s16(values, minVal), maxVal));
+	}
+	maxValue = vmaxvq_s16(maxVec);
+	minValue = vminvq_s16(minVec);
+	clip_scalar(in + ct, numPts - ct, out + ct, maxValue, minValue);
+}
+
+#endif /* SIMD_NEON */
+
+typedef WaveformPrep::ClipCounts (*PrepKernel)(const float *, const size_t &, const float &, const float &, short *);
+
+PrepKernel kernel_function(const WaveformPrep::PREP_KERNEL & kernel) {
+	switch (kernel) {
+	case WaveformPrep::PREP_SCALAR:
+		return prep_scalar;
+#ifdef SIMD_X86
+	case WaveformPrep::PREP_SSE2:
+		return CPUFeatures::has_sse2() ? prep_sse2 : nullptr;
+	case WaveformPrep::PREP_AVX2:
+		return CPUFeatures::has_avx2() ? prep_avx2 : nullptr;
+#endif
+#ifdef SIMD_NEON
+	case WaveformPrep::PREP_NEON:
+		return prep_neon;
+#endif
+	default:
+		return nullptr;
+	}
+}
+
+//Saturation has no prep kernel choice to follow; it takes the widest vector unit there is
+typedef void (*ClipKernel)(const short *, const size_t &, short *, short &, short &);
+
+ClipKernel clip_kernel() {
+#if defined(SIMD_X86)
+	static const ClipKernel kernel = CPUFeatures::has_sse2() ? clip_sse2 : clip_scalar;
+	return kernel;
+#elif defined(SIMD_NEON)
+	return clip_neon;
+#else
+	return clip_scalar;
+#endif
+}
+
+KernelDispatch<WaveformPrep::PREP_KERNEL, PrepKernel> & dispatch() {
+	static KernelDispatch<WaveformPrep::PREP_KERNEL, PrepKernel> choice(kernel_function,
+		{WaveformPrep::PREP_AVX2, WaveformPrep::PREP_SSE2, WaveformPrep::PREP_NEON}, WaveformPrep::PREP_SCALAR);
+	return choice;
+}
+
+} //end anonymous namespace
+
+WaveformPrep::ClipCounts WaveformPrep::prep_samples(const float * in, const size_t & numPts, const float & scale, const float & offset, short * out) {
+	return dispatch().function()(in, numPts, scale, offset, out);
+}
+
+WaveformPrep::ClipCounts WaveformPrep::clip_samples(const short * in, const size_t & numPts, short * out) {
+	//The int16 samples are already DAC counts so this only saturates; the clipped samples are counted
+	//in a second pass in the rare case something was out of range
+	short maxValue = 0, minValue = 0;
+	clip_kernel()(in, numPts, out, maxValue, minValue);
+	ClipCounts clips = {0, 0};
+	if (maxValue > MAX_WF_AMP || minValue < -MAX_WF_AMP) {
+		for (size_t ct = 0; ct < numPts; ct++) {
+			clips.high += (in[ct] > MAX_WF_AMP);
+			clips.low += (in[ct] < -MAX_WF_AMP);
+		}
+	}
+	return clips;
+}
+
+int WaveformPrep::set_prep_kernel(const PREP_KERNEL & kernel) {
+	if (!dispatch().select(kernel)) {
+		LOG(plog::warning) << "Waveform prep kernel " << prep_kernel_name(kernel) << " is not supported on this CPU";
+		return -1;
+	}
+	LOG(plog::debug) << "Using the " << prep_kernel_name(kernel) << " waveform prep kernel";
+	return 0;
+}
+
+WaveformPrep::PREP_KERNEL WaveformPrep::get_prep_kernel() {
+	return dispatch().kernel();
+}
+
+bool WaveformPrep::prep_kernel_supported(const PREP_KERNEL & kernel) {
+	return dispatch().supported(kernel);
+}
+
+const char * WaveformPrep::prep_kernel_name(const PREP_KERNEL & kernel) {
+	switch (kernel) {
+	case PREP_SCALAR: return "scalar";
+	case PREP_SSE2: return "SSE2";
+	case PREP_AVX2: return "AVX2";
+	case PREP_NEON: return "NEON";
+	default: return "unknown";
+	}
+}
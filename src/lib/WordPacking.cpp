@@ -0,0 +1,146 @@
+/*
+ * WordPacking.cpp
+ *
+ * Kernels for the inner loop of FPGA::format: groups of four 16-bit words are sent
+ * as an 8-byte write command byte followed by the words big-endian, i.e. a fixed 9-byte
+ * pattern per group. The vectorized versions byte-swap and interleave the command bytes
+ * with a single shuffle and are picked at runtime from the CPU features. All kernels
+ * produce identical output to the scalar one.
+ */
+
+#include "FPGA.h"
+#include "CPUFeatures.h"
+
+namespace {
+
+void pack_scalar(const USHORT * data, const size_t & numGroups, const UCHAR & cmd, UCHAR * out) {
+	for (size_t ct = 0; ct < numGroups; ct++, data += 4) {
+		*out++ = cmd;
+		for (int wordct = 0; wordct < 4; wordct++) {
+			*out++ = (data[wordct] >> 8) & LSB_MASK;
+			*out++ = data[wordct] & LSB_MASK;
+		}
+	}
+}
+
+#ifdef SIMD_X86
+
+// Shuffle two groups (8 words little-endian) into the first 16 of their 18 output bytes:
+// the command byte slots are zeroed (0x80) and filled in afterwards with an OR
+SIMD_TARGET("ssse3")
+void pack_ssse3(const USHORT * data, const size_t & numGroups, const UCHAR & cmd, UCHAR * out) {
+	const __m128i shuffle = _mm_setr_epi8(-128, 1, 0, 3, 2, 5, 4, 7, 6, -128, 9, 8, 11, 10, 13, 12);
+	const __m128i cmdBytes = _mm_setr_epi8(cmd, 0, 0, 0, 0, 0, 0, 0, 0, cmd, 0, 0, 0, 0, 0, 0);
+	size_t ct = 0;
+	for (; ct + 2 <= numGroups; ct += 2, data += 8, out += 18) {
+		__m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+		__m128i packed = _mm_or_si128(_mm_shuffle_epi8(words, shuffle), cmdBytes);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out), packed);
+		out[16] = (data[7] >> 8) & LSB_MASK;
+		out[17] = data[7] & LSB_MASK;
+	}
+	pack_scalar(data, numGroups - ct, cmd, out);
+}
+
+// Same shuffle on both 128-bit lanes so four groups (36 bytes) per iteration
+SIMD_TARGET("avx2")
+void pack_avx2(const USHORT * data, const size_t & numGroups, const UCHAR & cmd, UCHAR * out) {
+	const __m256i shuffle = _mm256_setr_epi8(-128, 1, 0, 3, 2, 5, 4, 7, 6, -128, 9, 8, 11, 10, 13, 12,
+											 -128, 1, 0, 3, 2, 5, 4, 7, 6, -128, 9, 8, 11, 10, 13, 12);
+	const __m256i cmdBytes = _mm256_setr_epi8(cmd, 0, 0, 0, 0, 0, 0, 0, 0, cmd, 0, 0, 0, 0, 0, 0,
+											  cmd, 0, 0, 0, 0, 0, 0, 0, 0, cmd, 0, 0, 0, 0, 0, 0);
+	size_t ct = 0;
+	for (; ct + 4 <= numGroups; ct += 4, data += 16, out += 36) {
+		__m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+		__m256i packed = _mm256_or_si256(_mm256_shuffle_epi8(words, shuffle), cmdBytes);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm256_castsi256_si128(packed));
+		out[16] = (data[7] >> 8) & LSB_MASK;
+		out[17] = data[7] & LSB_MASK;
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + 18), _mm256_extracti128_si256(packed, 1));
+		out[34] = (data[15] >> 8) & LSB_MASK;
+		out[35] = data[15] & LSB_MASK;
+	}
+	pack_ssse3(data, numGroups - ct, cmd, out);
+}
+
+#endif /* SIMD_X86 */
+
+#ifdef SIMD_NEON
+
+// Table lookups with out of range indices give zero, which leaves room for the command bytes
+void pack_neon(const USHORT * data, const size_t & numGroups, const UCHAR & cmd, UCHAR * out) {
+	static const UCHAR shuffleIdx[16] = {0xFF, 1, 0, 3, 2, 5, 4, 7, 6, 0xFF, 9, 8, 11, 10, 13, 12};
+	const UCHAR cmdIdx[16] = {cmd, 0, 0, 0, 0, 0, 0, 0, 0, cmd, 0, 0, 0, 0, 0, 0};
+	const uint8x16_t shuffle = vld1q_u8(shuffleIdx);
+	const uint8x16_t cmdBytes = vld1q_u8(cmdIdx);
+	size_t ct = 0;
+	for (; ct + 2 <= numGroups; ct += 2, data += 8, out += 18) {
+		uint8x16_t words = vld1q_u8(reinterpret_cast<const uint8_t *>(data));
+		vst1q_u8(out, vorrq_u8(vqtbl1q_u8(words, shuffle), cmdBytes));
+		out[16] = (data[7] >> 8) & LSB_MASK;
+		out[17] = data[7] & LSB_MASK;
+	}
+	pack_scalar(data, numGroups - ct, cmd, out);
+}
+
+#endif /* SIMD_NEON */
+
+typedef void (*PackKernel)(const USHORT *, const size_t &, const UCHAR &, UCHAR *);
+
+PackKernel kernel_function(const FPGA::PACK_KERNEL & kernel) {
+	switch (kernel) {
+	case FPGA::PACK_SCALAR:
+		return pack_scalar;
+#ifdef SIMD_X86
+	case FPGA::PACK_SSSE3:
+		return CPUFeatures::has_ssse3() ? pack_ssse3 : nullptr;
+	case FPGA::PACK_AVX2:
+		return CPUFeatures::has_avx2() ? pack_avx2 : nullptr;
+#endif
+#ifdef SIMD_NEON
+	case FPGA::PACK_NEON:
+		return pack_neon;
+#endif
+	default:
+		return nullptr;
+	}
+}
+
+KernelDispatch<FPGA::PACK_KERNEL, PackKernel> & dispatch() {
+	static KernelDispatch<FPGA::PACK_KERNEL, PackKernel> choice(kernel_function,
+		{FPGA::PACK_AVX2, FPGA::PACK_SSSE3, FPGA::PACK_NEON}, FPGA::PACK_SCALAR);
+	return choice;
+}
+
+} //end anonymous namespace
+
+void FPGA::pack_word_groups(const USHORT * data, const size_t & numGroups, const UCHAR & cmd, UCHAR * out) {
+	dispatch().function()(data, numGroups, cmd, out);
+}
+
+int FPGA::set_pack_kernel(const PACK_KERNEL & kernel) {
+	if (!dispatch().select(kernel)) {
+		LOG(plog::warning) << "Word packing kernel " << pack_kernel_name(kernel) << " is not supported on this CPU";
+		return -1;
+	}
+	LOG(plog::debug) << "Using the " << pack_kernel_name(kernel) << " word packing kernel";
+	return 0;
+}
+
+FPGA::PACK_KERNEL FPGA::get_pack_kernel() {
+	return dispatch().kernel();
+}
+
+bool FPGA::pack_kernel_supported(const PACK_KERNEL & kernel) {
+	return dispatch().supported(kernel);
+}
+
+const char * FPGA::pack_kernel_name(const PACK_KERNEL & kernel) {
+	switch (kernel) {
+	case PACK_SCALAR: return "scalar";
+	case PACK_SSSE3: return "SSSE3";
+	case PACK_AVX2: return "AVX2";
+	case PACK_NEON: return "NEON";
+	default: return "unknown";
+	}
+}
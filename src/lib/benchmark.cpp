@@ -0,0 +1,1400 @@
+/*
+ * benchmark.cpp
+ *
+ * Host-side benchmarks for the driver. None of these need an APS attached.
+ * They only time things; the checks that the new paths give the same output live in run_tests -sim (simtests.cpp).
+ */
+
+#include "headings.h"
+
+#include "libaps.h"
+#include "legacy.h"
+
+#include <random>
+
+namespace bench {
+	//Heap allocations made by each thread, for counting the buffers an upload goes through on the caller's thread
+	thread_local size_t numAllocs = 0, allocBytes = 0;
+}
+
+//Replace the whole set of global allocation functions so every new is paired with a matching delete.
+//GCC flags a free inlined next to a replaced operator new as mismatched, so the deletes stay out of line.
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+static void * counted_alloc(size_t size) {
+	bench::numAllocs++;
+	bench::allocBytes += size;
+	return std::malloc(size ? size : 1);
+}
+
+void * operator new(size_t size) {
+	void * ptr = counted_alloc(size);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void * operator new[](size_t size) {
+	void * ptr = counted_alloc(size);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept {
+	return counted_alloc(size);
+}
+
+void * operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return counted_alloc(size);
+}
+
+void NOINLINE operator delete(void * ptr) noexcept {
+	std::free(ptr);
+}
+
+void NOINLINE operator delete[](void * ptr) noexcept {
+	std::free(ptr);
+}
+
+void NOINLINE operator delete(void * ptr, const std::nothrow_t &) noexcept {
+	std::free(ptr);
+}
+
+void NOINLINE operator delete[](void * ptr, const std::nothrow_t &) noexcept {
+	std::free(ptr);
+}
+
+#ifdef __cpp_sized_deallocation
+void NOINLINE operator delete(void * ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+void NOINLINE operator delete[](void * ptr, size_t) noexcept {
+	std::free(ptr);
+}
+#endif
+
+namespace bench {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+//Waveform and link-list sized payloads we commonly upload
+WordVec build_payload(const size_t & numWords) {
+	WordVec data(numWords);
+	for (size_t ct = 0; ct < numWords; ct++) {
+		data[ct] = static_cast<USHORT>(ct*7919 + 13);
+	}
+	return data;
+}
+
+//Run a function repeatedly and return the mean time per call in seconds
+template <typename F>
+double time_it(F func, const int & numReps) {
+	func(); //warm up
+	auto start = Clock::now();
+	for (int ct = 0; ct < numReps; ct++) {
+		func();
+	}
+	std::chrono::duration<double> elapsed = Clock::now() - start;
+	return elapsed.count() / numReps;
+}
+
+void report(const string & name, const size_t & numBytes, const double & secs) {
+	cout << std::setw(40) << std::left << name << std::setw(12) << std::right << std::fixed << std::setprecision(1)
+		<< numBytes / secs / 1e6 << " MB/s" << std::setw(12) << secs*1e6 << " us/call" << endl;
+}
+
+//Compare the block-write encoder against the legacy path for waveform and link-list sized uploads
+void format() {
+	cout << endl << "FPGA block-write encoder" << endl;
+
+	const vector<std::pair<string, size_t>> payloads = {
+		{"waveform (32768 words)", MAX_WF_LENGTH},
+		{"IQ link list (8192 entries)", 5*MAX_LL_LENGTH},
+		{"short register write (2 words)", 2}
+	};
+
+	for (auto & payload : payloads) {
+		WordVec data = build_payload(payload.second);
+		const size_t numBytes = FPGA::format_length(data.size());
+
+		const int numReps = (payload.second > 100) ? 200 : 200000;
+		double legacyTime = time_it([&](){
+			vector<UCHAR> writeQueue;
+			vector<size_t> offsetQueue;
+			legacy::queue(FPGA1, FPGA_BANKSEL_WF_CHA, data, writeQueue, offsetQueue);
+		}, numReps);
+
+		//The encoder writes into buffers owned (and reused) by the caller
+		vector<UCHAR> writeQueue(numBytes);
+		vector<size_t> offsetQueue(FPGA::num_cmd_bytes(data.size()));
+		double newTime = time_it([&](){
+			FPGA::format(FPGA1, FPGA_BANKSEL_WF_CHA, data.data(), data.size(), writeQueue.data(), offsetQueue.data());
+		}, numReps);
+
+		cout << payload.first << ": " << numBytes << " bytes on the wire" << endl;
+		report("  legacy format + offsets + queue copy", numBytes, legacyTime);
+		report("  single-pass FPGA::format", numBytes, newTime);
+		cout << "  speedup: " << std::setprecision(2) << legacyTime / newTime << "x" << endl;
+	}
+}
+
+//Each supported waveform prep kernel against the legacy multi-pass prep_waveform
+void prep() {
+	cout << endl << "Waveform prep kernels (default: " << WaveformPrep::prep_kernel_name(WaveformPrep::get_prep_kernel()) << ")" << endl;
+	const WaveformPrep::PREP_KERNEL defaultKernel = WaveformPrep::get_prep_kernel();
+	const vector<WaveformPrep::PREP_KERNEL> kernels = {WaveformPrep::PREP_SCALAR, WaveformPrep::PREP_SSE2, WaveformPrep::PREP_AVX2, WaveformPrep::PREP_NEON};
+
+	//A full length waveform running 20% past full scale both ways, plus the awkward values
+	vector<float> waveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = 1.2f*std::sin(2*M_PI*ct/1000.0);
+	}
+	const vector<float> special = {0.0f, -0.0f, 0.5f/MAX_WF_AMP, 1.5f/MAX_WF_AMP, -0.5f/MAX_WF_AMP, 1.0f, -1.0f, 1.0f + 0.5f/MAX_WF_AMP,
+		-1.0f - 0.5f/MAX_WF_AMP, 1e30f, -1e30f, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+		std::numeric_limits<float>::quiet_NaN()};
+	std::copy(special.begin(), special.end(), waveform.begin() + 123);
+	const float scale = 0.9f, offset = 0.05f;
+
+	vector<short> legacyVec;
+	double legacyTime = time_it([&](){
+		legacyVec = legacy::prep_waveform(waveform, scale, offset);
+	}, 200);
+	report("  legacy multi-pass", 4*waveform.size(), legacyTime);
+
+	for (auto kernel : kernels) {
+		if (!WaveformPrep::prep_kernel_supported(kernel)) {
+			cout << "  " << WaveformPrep::prep_kernel_name(kernel) << " not supported on this CPU" << endl;
+			continue;
+		}
+		WaveformPrep::set_prep_kernel(kernel);
+		vector<short> prepVec(waveform.size());
+		double prepTime = time_it([&](){
+			WaveformPrep::prep_samples(waveform.data(), waveform.size(), scale, offset, prepVec.data());
+		}, 200);
+		report(string("  ") + WaveformPrep::prep_kernel_name(kernel), 4*waveform.size(), prepTime);
+		cout << "    speedup vs. legacy: " << std::setprecision(2) << legacyTime/prepTime << "x" << endl;
+	}
+	WaveformPrep::set_prep_kernel(defaultKernel);
+}
+
+//Each supported packing kernel for waveform and link-list uploads
+void pack() {
+	cout << endl << "Block-write word packing kernels (default: " << FPGA::pack_kernel_name(FPGA::get_pack_kernel()) << ")" << endl;
+	const FPGA::PACK_KERNEL defaultKernel = FPGA::get_pack_kernel();
+	const vector<FPGA::PACK_KERNEL> kernels = {FPGA::PACK_SCALAR, FPGA::PACK_SSSE3, FPGA::PACK_AVX2, FPGA::PACK_NEON};
+
+	const vector<std::pair<string, size_t>> payloads = {
+		{"waveform (32768 words)", MAX_WF_LENGTH},
+		{"IQ link list (8192 entries)", 5*MAX_LL_LENGTH}
+	};
+
+	for (auto & payload : payloads) {
+		cout << payload.first << ":" << endl;
+		WordVec data = build_payload(payload.second);
+
+		for (auto kernel : kernels) {
+			if (!FPGA::pack_kernel_supported(kernel)) {
+				cout << "  " << FPGA::pack_kernel_name(kernel) << " not supported on this CPU" << endl;
+				continue;
+			}
+			FPGA::set_pack_kernel(kernel);
+
+			vector<UCHAR> packet(FPGA::format_length(data.size()));
+			double packTime = time_it([&](){
+				FPGA::format(FPGA1, FPGA_BANKSEL_LL_CHA, data.data(), data.size(), packet.data(), nullptr);
+			}, 500);
+			report("  " + string(FPGA::pack_kernel_name(kernel)), packet.size(), packTime);
+		}
+	}
+
+	FPGA::set_pack_kernel(defaultKernel);
+}
+
+//Heap allocations and bytes allocated on this thread by one call after a warm up call
+template <typename F>
+std::pair<size_t, size_t> count_allocs(F func) {
+	func();
+	size_t startAllocs = numAllocs, startBytes = allocBytes;
+	func();
+	return {numAllocs - startAllocs, allocBytes - startBytes};
+}
+
+//A link that takes everything instantly so only the host side of an upload is timed
+class NullTransport : public Transport {
+public:
+	int connect(const int &) {return 0;}
+	int disconnect() {return 0;}
+	FT_STATUS write(UCHAR *, const DWORD & numBytes, DWORD * bytesWritten) {*bytesWritten = numBytes; return FT_OK;}
+	FT_STATUS read(UCHAR *, const DWORD &, DWORD * bytesRead) {*bytesRead = 0; return FT_OK;}
+	FT_STATUS get_queue_status(DWORD * rxBytes) {*rxBytes = 0; return FT_OK;}
+};
+
+template <typename F>
+void report_upload(const string & name, const size_t & numBytes, F func) {
+	auto allocs = count_allocs(func);
+	report(name, numBytes, time_it(func, 20));
+	cout << "    " << allocs.first << " allocations, " << allocs.second/1024 << " kB allocated per upload" << endl;
+}
+
+//Waveform uploads from the caller's buffer against the copying path they replaced
+void zerocopy() {
+	cout << endl << "Waveform upload buffers" << endl;
+
+	//In range samples so the uploads don't log clipping warnings
+	vector<short> waveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+	}
+	vector<float> floatWaveform(waveform.size());
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		floatWaveform[ct] = float(waveform[ct])/MAX_WF_AMP;
+	}
+
+	//The same steps as APS::set_waveform, minus the upload cache, for comparing like with like
+	Channel channel(0), legacyChannel(0);
+	vector<short> prepBuffer;
+	auto viewUpload = [&](UploadEngine & uploader){
+		channel.set_waveform(waveform.data(), waveform.size());
+		channel.prep_waveform(prepBuffer);
+		uploader.queue(FPGA1, FPGA_ADDR_CHA_WF_LENGTH, vector<USHORT>(1, USHORT(prepBuffer.size() / WF_MODULUS - 1)));
+		uploader.flush();
+		uploader.queue_view(FPGA1, FPGA_BANKSEL_WF_CHA, reinterpret_cast<const USHORT *>(prepBuffer.data()), prepBuffer.size());
+		uploader.flush();
+	};
+
+	//Host side only: into a link that costs nothing
+	NullTransport nullLink;
+	UploadEngine nullUploader(nullLink);
+	cout << "host side:" << endl;
+	report_upload("  legacy int16 copies", 2*waveform.size(), [&](){
+		legacy::upload_waveform(nullUploader, legacyChannel, waveform.data(), waveform.size());
+	});
+	report_upload("  int16 from the caller's buffer", 2*waveform.size(), [&](){ viewUpload(nullUploader); });
+
+	//Decoding the writes in the simulated APS dominates here so the host side gain is a small fraction
+	SimAPS legacyAPS, viewAPS;
+	for (auto aps : {&legacyAPS, &viewAPS}) {
+		aps->connect(0);
+		aps->set_link_model(0, 0);
+	}
+	UploadEngine legacyUploader(legacyAPS), viewUploader(viewAPS);
+
+	set_simulated_devices(1, 0, 0);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	if (deviceID < 0 || connect_by_ID(deviceID) != 0) {
+		cout << "FAILED to connect to the simulated APS" << endl;
+		set_simulated_devices(0, 0, 0);
+		return;
+	}
+	//Same data every time so keep the upload cache from skipping it; the API uploads also pay for hashing it
+	auto intUpload = [&](){
+		clear_upload_cache(deviceID);
+		set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+	};
+	auto floatUpload = [&](){
+		clear_upload_cache(deviceID);
+		set_waveform_float(deviceID, 1, floatWaveform.data(), floatWaveform.size());
+	};
+
+	cout << "simulated APS:" << endl;
+	report_upload("  legacy int16 copies", 2*waveform.size(), [&](){
+		legacy::upload_waveform(legacyUploader, legacyChannel, waveform.data(), waveform.size());
+	});
+	report_upload("  int16 from the caller's buffer", 2*waveform.size(), [&](){ viewUpload(viewUploader); });
+	report_upload("  set_waveform_int (upload cache on)", 2*waveform.size(), intUpload);
+	report_upload("  set_waveform_float (upload cache on)", 2*waveform.size(), floatUpload);
+
+	disconnect_by_ID(deviceID);
+	set_simulated_devices(0, 0, 0);
+}
+
+//Bytes written to a device so far
+unsigned long long bytes_written(const int & deviceID) {
+	vector<unsigned long long> values(IOStats::NUM_VALUES);
+	get_io_stats(deviceID, IO_WRITE, values.data(), values.size());
+	return values[1];
+}
+
+//Updating one pulse of the waveform library against re-uploading the whole channel
+void segment() {
+	cout << endl << "Waveform segment updates" << endl;
+
+	set_simulated_devices(1, 0, 0);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	if (deviceID < 0 || connect_by_ID(deviceID) != 0) {
+		cout << "FAILED to connect to the simulated APS" << endl;
+		set_simulated_devices(0, 0, 0);
+		return;
+	}
+
+	vector<short> waveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+	}
+	set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+
+	//A 100 sample pulse from an unaligned start
+	const size_t pulseStart = 1001;
+	vector<short> pulse(100);
+	size_t ampCt = 0;
+	auto update_pulse = [&](){
+		ampCt++;
+		for (size_t ct = 0; ct < pulse.size(); ct++) {
+			pulse[ct] = short((ampCt % 100)*ct);
+		}
+		std::copy(pulse.begin(), pulse.end(), waveform.begin() + pulseStart);
+	};
+
+	unsigned long long startBytes = bytes_written(deviceID);
+	double fullTime = time_it([&](){
+		update_pulse();
+		set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+	}, 20);
+	unsigned long long fullBytes = (bytes_written(deviceID) - startBytes) / 21;
+
+	startBytes = bytes_written(deviceID);
+	double segmentTime = time_it([&](){
+		update_pulse();
+		set_waveform_segment_int(deviceID, 0, pulseStart, pulse.data(), pulse.size());
+	}, 20);
+	unsigned long long segmentBytes = (bytes_written(deviceID) - startBytes) / 21;
+
+	cout << "  100 sample pulse in a " << waveform.size() << " sample channel:" << endl;
+	cout << "  full upload:    " << std::setw(8) << fullBytes << " bytes " << std::fixed << std::setprecision(1) << std::setw(10) << fullTime*1e6 << " us" << endl;
+	cout << "  segment update: " << std::setw(8) << segmentBytes << " bytes " << std::setw(10) << segmentTime*1e6 << " us" << endl;
+
+	disconnect_by_ID(deviceID);
+	set_simulated_devices(0, 0, 0);
+}
+
+//Writes, bytes written and flushes to a device so far
+vector<unsigned long long> io_counts(const int & deviceID) {
+	vector<unsigned long long> values(IOStats::NUM_VALUES), counts;
+	get_io_stats(deviceID, IO_WRITE, values.data(), values.size());
+	counts.push_back(values[0]);
+	counts.push_back(values[1]);
+	get_io_stats(deviceID, IO_FLUSH, values.data(), values.size());
+	counts.push_back(values[0]);
+	return counts;
+}
+
+//Applying a full settings dictionary as the Python set_all does, one call at a time and inside begin_update/commit
+void update() {
+	cout << endl << "Coalesced settings updates" << endl;
+
+	set_simulated_devices(1, 125, 8);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	if (deviceID < 0 || connect_by_ID(deviceID) != 0) {
+		cout << "FAILED to connect to the simulated APS" << endl;
+		set_simulated_devices(0, 0, 0);
+		return;
+	}
+
+	vector<short> waveform(4096);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(0.8*MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+	}
+	for (int dac = 0; dac < 4; dac++) {
+		set_waveform_int(deviceID, dac, waveform.data(), waveform.size());
+	}
+
+	float amplitude = 0.5f;
+	auto set_all = [&](){
+		amplitude = (amplitude == 0.5f) ? 0.75f : 0.5f;
+		for (int dac = 0; dac < 4; dac++) {
+			set_channel_scale(deviceID, dac, amplitude);
+			set_channel_offset(deviceID, dac, 0.1f);
+			set_channel_enabled(deviceID, dac, 1);
+			set_run_mode(deviceID, dac, RUN_WAVEFORM);
+		}
+		set_trigger_source(deviceID, INTERNAL);
+		set_trigger_interval(deviceID, 1e-3);
+	};
+
+	cout << "  4 channels of " << waveform.size() << " samples over a 125 us/transfer, 8 MB/s link:" << endl;
+	for (bool coalesce : {false, true}) {
+		vector<unsigned long long> startCounts = io_counts(deviceID);
+		auto start = Clock::now();
+		if (coalesce) begin_update(deviceID);
+		set_all();
+		if (coalesce) commit_update(deviceID);
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		vector<unsigned long long> counts = io_counts(deviceID);
+		cout << "  " << std::setw(20) << std::left << (coalesce ? "begin_update/commit" : "one call at a time") << std::right
+			<< std::setw(5) << counts[0] - startCounts[0] << " writes " << std::setw(8) << counts[1] - startCounts[1] << " bytes "
+			<< std::setw(4) << counts[2] - startCounts[2] << " flushes " << std::fixed << std::setprecision(1) << std::setw(8) << elapsed.count()*1e3 << " ms" << endl;
+	}
+	disconnect_by_ID(deviceID);
+	set_simulated_devices(0, 0, 0);
+}
+
+//Upload cache hits and misses on a device so far
+std::pair<unsigned long long, unsigned long long> cache_counts(const int & deviceID) {
+	vector<unsigned long long> values(IOStats::NUM_VALUES);
+	get_io_stats(deviceID, IO_CACHE_HIT, values.data(), values.size());
+	unsigned long long hits = values[0];
+	get_io_stats(deviceID, IO_CACHE_MISS, values.data(), values.size());
+	return {hits, values[0]};
+}
+
+//Loading the same waveforms and link list again with the upload cache
+void cache() {
+	cout << endl << "Upload cache" << endl;
+
+	vector<short> waveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(0.8*MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+	}
+	const size_t numEntries = 1000;
+	WordVec addr(numEntries), count(numEntries), trigger1(numEntries, 0), trigger2(numEntries, 0), repeat(numEntries, 0);
+	for (size_t ct = 0; ct < numEntries; ct++) {
+		addr[ct] = (ct*37) % 1024;
+		count[ct] = ct % 16;
+	}
+
+	set_simulated_devices(1, 125, 8);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	if (deviceID < 0 || connect_by_ID(deviceID) != 0) {
+		cout << "FAILED to connect to the simulated APS" << endl;
+		set_simulated_devices(0, 0, 0);
+		return;
+	}
+	cout << "  4 x " << waveform.size() << " sample waveforms and a " << numEntries << " entry link list over a 125 us/transfer, 8 MB/s link:" << endl;
+	for (string pass : {"first load", "same data again"}) {
+		vector<unsigned long long> startCounts = io_counts(deviceID);
+		auto start = Clock::now();
+		for (int dac = 0; dac < 4; dac++) {
+			set_waveform_int(deviceID, dac, waveform.data(), waveform.size());
+		}
+		set_LL_data_IQ(deviceID, 0, numEntries, addr.data(), count.data(), trigger1.data(), trigger2.data(), repeat.data());
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		vector<unsigned long long> counts = io_counts(deviceID);
+		cout << "  " << std::setw(16) << std::left << pass << std::right << std::setw(8) << counts[1] - startCounts[1] << " bytes "
+			<< std::fixed << std::setprecision(1) << std::setw(8) << elapsed.count()*1e3 << " ms" << endl;
+	}
+	auto hitsMisses = cache_counts(deviceID);
+	cout << "  hit rate: " << std::setprecision(2) << double(hitsMisses.first) / (hitsMisses.first + hitsMisses.second) << endl;
+	disconnect_by_ID(deviceID);
+	set_simulated_devices(0, 0, 0);
+}
+
+//Init and uploads through the transport layer against a simulated APS
+void sim() {
+	cout << endl << "Simulated APS over the USB transport" << endl;
+
+	//The simulated unit only frames the configuration data so any bytes will do for the bitfiles
+	const string bitFile = "bench_sim";
+	const size_t bitFileSize = 1 << 17;
+	for (auto suffix : {"_FPGA1.bit", "_FPGA2.bit"}) {
+		std::ofstream FID(bitFile + suffix, std::ios::out | std::ios::binary);
+		FID << string(bitFileSize, 0x5A);
+	}
+
+	WordVec payload = build_payload(MAX_WF_LENGTH);
+	vector<short> waveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(payload[ct] % (2*MAX_WF_AMP + 1)) - MAX_WF_AMP;
+	}
+
+	const size_t numEntries = MAX_LL_LENGTH - 1;
+	WordVec addr(numEntries), count(numEntries), trigger1(numEntries, 0), trigger2(numEntries, 0), repeat(numEntries, 0);
+	for (size_t ct = 0; ct < numEntries; ct++) {
+		addr[ct] = payload[ct] % 1024;
+		count[ct] = ct % 16;
+	}
+	const size_t numLLWords = 5*numEntries;
+
+	struct LinkModel {
+		string name;
+		double latency; //us per transfer
+		double bandwidth; //MB/s
+	};
+	const vector<LinkModel> links = {{"unlimited link", 0, 0}, {"125 us/transfer, 8 MB/s link", 125, 8}};
+
+	for (auto & link : links) {
+		cout << link.name << ":" << endl;
+		set_simulated_devices(1, link.latency, link.bandwidth);
+		char serial[] = "SIM0";
+		int deviceID = serial2ID(serial);
+		if (deviceID < 0 || connect_by_ID(deviceID) != 0) {
+			cout << "  FAILED to connect to the simulated APS" << endl;
+			continue;
+		}
+
+		auto start = Clock::now();
+		initAPS(deviceID, const_cast<char *>(bitFile.c_str()), 1);
+		std::chrono::duration<double> initTime = Clock::now() - start;
+		cout << "  init with " << 2*bitFileSize/1024 << " kB of bitfiles: " << std::fixed << std::setprecision(1) << initTime.count()*1e3 << " ms" << endl;
+
+		//Same data every time so keep the upload cache from skipping it
+		double wfTime = time_it([&](){
+			clear_upload_cache(deviceID);
+			set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+		}, 5);
+		report("  waveform upload (32768 words)", 2*waveform.size(), wfTime);
+
+		double llTime = time_it([&](){
+			clear_upload_cache(deviceID);
+			set_LL_data_IQ(deviceID, 0, numEntries, addr.data(), count.data(), trigger1.data(), trigger2.data(), repeat.data());
+		}, 5);
+		report("  IQ link list upload (8191 entries)", 2*numLLWords, llTime);
+		disconnect_by_ID(deviceID);
+	}
+
+	set_simulated_devices(0, 0, 0);
+	for (auto suffix : {"_FPGA1.bit", "_FPGA2.bit"}) {
+		std::remove((bitFile + suffix).c_str());
+	}
+}
+
+//Register reads one round trip at a time against a batch over a simulated USB link
+void reads() {
+	cout << endl << "Batched register reads (simulated APS, 125 us/transfer)" << endl;
+
+	SimAPS aps;
+	aps.connect(0);
+	for (USHORT ct = 0; ct < 16; ct++) {
+		FPGA::write_FPGA(aps, FPGA_BANKSEL_CSR | ct, USHORT(ct*0x1111), ALL_FPGAS);
+	}
+	aps.set_link_model(125, 0);
+
+	//The register sets the driver reads in one go
+	const vector<std::pair<string, vector<FPGA::RegAddr>>> regSets = {
+		{"check_cur_state (ALL_FPGAS)", {{FPGA_ADDR_CSR, FPGA1}, {FPGA_ADDR_CSR, FPGA2}}},
+		{"get_trigger_interval", {{FPGA_ADDR_TRIG_INTERVAL, FPGA1}, {FPGA_ADDR_TRIG_INTERVAL+1, FPGA1}}},
+		{"test_PLL_sync XOR/phase test", vector<FPGA::RegAddr>(20, FPGA::RegAddr(FPGA_ADDR_PLL_STATUS, FPGA2))},
+		{"all 16 CSRs of both FPGAs", {}}
+	};
+
+	for (auto regSet : regSets) {
+		auto & regs = regSet.second;
+		if (regs.empty()) {
+			for (ULONG ct = 0; ct < 16; ct++) {
+				regs.push_back(FPGA::RegAddr(FPGA_BANKSEL_CSR | ct, FPGA1));
+				regs.push_back(FPGA::RegAddr(FPGA_BANKSEL_CSR | ct, FPGA2));
+			}
+		}
+		else if (regSet.first.find("PLL") != string::npos) {
+			regs.push_back(FPGA::RegAddr(FPGA_ADDR_A_PHASE, FPGA2));
+			regs.push_back(FPGA::RegAddr(FPGA_ADDR_B_PHASE, FPGA2));
+		}
+
+		WordVec single(regs.size()), batched;
+		double singleTime = time_it([&](){
+			for (size_t ct = 0; ct < regs.size(); ct++) {
+				single[ct] = FPGA::read_FPGA(aps, regs[ct].first, regs[ct].second);
+			}
+		}, 20);
+		double batchTime = time_it([&](){
+			batched = FPGA::read_FPGA_batch(aps, regs);
+		}, 20);
+		cout << regSet.first << " (" << regs.size() << " registers): " << std::fixed << std::setprecision(1) << singleTime*1e6
+			<< " us one at a time, " << batchTime*1e6 << " us batched, speedup: " << std::setprecision(2) << singleTime/batchTime << "x" << endl;
+	}
+}
+
+//Run and repeat mode changes on all four channels: read-modify-write against the shadow registers
+void csr() {
+	cout << endl << "CSR bit updates (simulated APS, 125 us/transfer)" << endl;
+
+	//The FPGA layer reads the register for every update
+	SimAPS legacyAPS;
+	legacyAPS.connect(0);
+	legacyAPS.set_link_model(125, 0);
+	bool on = false;
+	double legacyTime = time_it([&](){
+		on = !on;
+		for (int dac = 0; dac < 4; dac++) {
+			for (int mask : {(dac % 2) ? CSRMSK_CHB_OUTMODE : CSRMSK_CHA_OUTMODE, (dac % 2) ? CSRMSK_CHB_REPMODE : CSRMSK_CHA_REPMODE}) {
+				if (on) FPGA::set_bit(legacyAPS, dac2fpga(dac), FPGA_ADDR_CSR, mask);
+				else FPGA::clear_bit(legacyAPS, dac2fpga(dac), FPGA_ADDR_CSR, mask);
+			}
+		}
+	}, 10);
+
+	set_simulated_devices(1, 125, 0);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	connect_by_ID(deviceID);
+	on = false;
+	double shadowTime = time_it([&](){
+		on = !on;
+		for (int dac = 0; dac < 4; dac++) {
+			set_run_mode(deviceID, dac, on);
+			set_repeat_mode(deviceID, dac, on);
+		}
+	}, 10);
+
+	disconnect_by_ID(deviceID);
+	set_simulated_devices(0, 0, 0);
+
+	cout << "run + repeat mode on 4 channels: " << std::fixed << std::setprecision(1) << legacyTime*1e3 << " ms reading the CSR each time, "
+		<< shadowTime*1e3 << " ms with shadow registers, speedup: " << std::setprecision(2) << legacyTime/shadowTime << "x" << endl;
+}
+
+//PLL programming and DAC register readback one SPI transaction per transfer vs. batched
+void spi() {
+	cout << endl << "SPI bit serialization" << endl;
+
+	//A PLL command (2 address + 1 data byte) at a time as in the PLL routines and DAC sweeps
+	const vector<UCHAR> pllCommand = {0x01, 0x93, 0x11};
+	const int numSerialReps = 1000000;
+	size_t checkSum = 0;
+	double legacySerialTime = time_it([&](){
+		checkSum += legacy::serialize_SPI(APS_PLL_SPI, pllCommand).size();
+	}, numSerialReps);
+	UCHAR packet[1 + 3*8];
+	double tableSerialTime = time_it([&](){
+		packet[0] = APS_PLL_SPI;
+		checkSum += 1 + FPGA::serialize_SPI_bits(pllCommand.data(), pllCommand.size(), packet + 1);
+	}, numSerialReps);
+	//Keep the compiler from dropping the serialization
+	if (checkSum == 0) cout << endl;
+	cout << "one PLL command: " << std::fixed << std::setprecision(1) << legacySerialTime*1e9 << " ns shift and mask, "
+		<< tableSerialTime*1e9 << " ns table driven, speedup: " << std::setprecision(2) << legacySerialTime/tableSerialTime << "x" << endl;
+
+	cout << endl << "SPI transactions over a 125us link" << endl;
+
+	//A PLL setup style routine
+	vector<PLLAddrData> routine;
+	for (ULONG addr = 0xF0; addr < 0xF0 + 24; addr++) {
+		routine.push_back(PLLAddrData(addr, static_cast<UCHAR>(addr*37)));
+	}
+
+	SimAPS singleAPS, batchAPS;
+	for (auto aps : {&singleAPS, &batchAPS}) {
+		aps->connect(0);
+		aps->set_link_model(125, 0);
+	}
+
+	double singleTime = time_it([&](){
+		for (auto & instr : routine) {
+			FPGA::write_SPI(singleAPS, APS_PLL_SPI, instr.first, {instr.second});
+		}
+	}, 10);
+
+	FPGA::SPIBatch batch;
+	double batchTime = time_it([&](){
+		batch.write(APS_PLL_SPI, routine);
+		batch.send(batchAPS);
+	}, 10);
+
+	cout << routine.size() << " PLL writes: " << std::fixed << std::setprecision(2) << singleTime*1e3 << " ms one at a time, "
+		<< batchTime*1e3 << " ms batched, speedup: " << singleTime/batchTime << "x" << endl;
+
+	//Readback of the same registers
+	vector<UCHAR> singleData(routine.size()), batchData;
+	singleTime = time_it([&](){
+		for (size_t ct = 0; ct < routine.size(); ct++) {
+			FPGA::read_SPI(singleAPS, APS_PLL_SPI, routine[ct].first, &singleData[ct]);
+		}
+	}, 10);
+	batchTime = time_it([&](){
+		for (auto & instr : routine) {
+			batch.read(APS_PLL_SPI, instr.first);
+		}
+		batch.send(batchAPS, &batchData);
+	}, 10);
+
+	cout << routine.size() << " PLL reads: " << std::fixed << std::setprecision(2) << singleTime*1e3 << " ms one at a time, "
+		<< batchTime*1e3 << " ms batched, speedup: " << singleTime/batchTime << "x" << endl;
+}
+
+//Bitfile programming one configuration packet per USB write vs. many packets per write
+void program() {
+	cout << endl << "FPGA bitfile programming over a 125us, 8 MB/s link" << endl;
+
+	vector<UCHAR> bitFile(128*1024 + 17);
+	for (size_t ct = 0; ct < bitFile.size(); ct++) {
+		bitFile[ct] = static_cast<UCHAR>(ct*131 + 7);
+	}
+
+	const vector<std::pair<string, FPGA::PROGRAM_MODE>> modes = {
+		{"  one packet per transfer", FPGA::PROGRAM_PER_PACKET},
+		{"  bulk", FPGA::PROGRAM_BULK}
+	};
+	vector<double> times;
+	for (auto & mode : modes) {
+		SimAPS aps;
+		aps.connect(0);
+		aps.set_link_model(125, 8e6);
+		times.push_back(time_it([&](){
+			FPGA::program_FPGA(aps, bitFile, ALL_FPGAS, mode.second);
+		}, 2));
+		//Count the USB writes of a single programming pass
+		aps.reset_counters();
+		FPGA::program_FPGA(aps, bitFile, ALL_FPGAS, mode.second);
+		cout << std::setw(40) << std::left << mode.first << std::setw(12) << std::right << std::fixed << std::setprecision(1)
+			<< times.back()*1e3 << " ms for " << bitFile.size()/1024 << " kB, " << aps.num_writes() << " USB writes" << endl;
+	}
+	cout << "  speedup: " << std::setprecision(2) << times[0]/times[1] << "x" << endl;
+}
+
+//Bitfile loading for every programming vs. the shared bitfile cache across a rack of simulated units
+void bitfiles() {
+	cout << endl << "Bitfile cache" << endl;
+
+	const string bitFile = "bench_cache";
+	const size_t bitFileSize = 1 << 17;
+	for (auto suffix : {"_FPGA1.bit", "_FPGA2.bit"}) {
+		std::ofstream FID(bitFile + suffix, std::ios::out | std::ios::binary);
+		FID << string(bitFileSize, 0x3C);
+	}
+	const string fileName = bitFile + "_FPGA1.bit";
+
+	//Host side cost per programming: read and frame the file vs. a cache hit
+	double loadTime = time_it([&](){
+		std::ifstream FID (fileName, std::ios::in|std::ios::binary);
+		vector<UCHAR> fileData((std::istreambuf_iterator<char>(FID)), std::istreambuf_iterator<char>());
+		FPGA::frame_bitfile(fileData, FPGA1);
+	}, 20);
+	BitfileCache::clear();
+	double cacheTime = time_it([&](){
+		BitfileCache::get(fileName, FPGA1);
+	}, 20);
+	cout << "128 kB bitfile: " << std::fixed << std::setprecision(1) << loadTime*1e6 << " us to read and frame, "
+		<< cacheTime*1e6 << " us from the cache" << endl;
+
+	//Init a rack of 10 units: each file should be read once
+	const int numDevices = 10;
+	BitfileCache::clear();
+	size_t startLoads = BitfileCache::num_loads(), startHits = BitfileCache::num_hits();
+	set_simulated_devices(numDevices, 0, 0);
+	auto start = Clock::now();
+	for (int ct = 0; ct < numDevices; ct++) {
+		string serial = "SIM" + std::to_string(ct);
+		int deviceID = serial2ID(const_cast<char *>(serial.c_str()));
+		connect_by_ID(deviceID);
+		initAPS(deviceID, const_cast<char *>(bitFile.c_str()), 1);
+	}
+	std::chrono::duration<double> rackTime = Clock::now() - start;
+	size_t numLoads = BitfileCache::num_loads() - startLoads, numHits = BitfileCache::num_hits() - startHits;
+	cout << "init of " << numDevices << " units: " << rackTime.count()*1e3 << " ms, " << numLoads << " bitfile loads, " << numHits << " cache hits" << endl;
+
+	for (int ct = 0; ct < numDevices; ct++) {
+		disconnect_by_ID(ct);
+	}
+	set_simulated_devices(0, 0, 0);
+}
+
+//Init of a rack of simulated units one after the other vs. all at once
+void rack() {
+	cout << endl << "Rack init over 125us, 8 MB/s links" << endl;
+
+	const string bitFile = "bench_rack";
+	for (auto suffix : {"_FPGA1.bit", "_FPGA2.bit"}) {
+		std::ofstream FID(bitFile + suffix, std::ios::out | std::ios::binary);
+		FID << string(1 << 17, 0x69);
+	}
+
+	const int numDevices = 8;
+	set_simulated_devices(numDevices, 125, 8);
+	for (int ct = 0; ct < numDevices; ct++) {
+		connect_by_ID(ct);
+	}
+
+	auto start = Clock::now();
+	for (int ct = 0; ct < numDevices; ct++) {
+		initAPS(ct, const_cast<char *>(bitFile.c_str()), 1);
+	}
+	std::chrono::duration<double> serialTime = Clock::now() - start;
+
+	vector<int> statuses(numDevices, -1);
+	vector<double> initTimes(numDevices, 0);
+	start = Clock::now();
+	init_all(const_cast<char *>(bitFile.c_str()), 1, statuses.data(), initTimes.data());
+	std::chrono::duration<double> parallelTime = Clock::now() - start;
+
+	cout << numDevices << " units: " << std::fixed << std::setprecision(1) << serialTime.count()*1e3 << " ms one at a time, "
+		<< parallelTime.count()*1e3 << " ms in parallel (slowest unit " << *std::max_element(initTimes.begin(), initTimes.end())*1e3
+		<< " ms), speedup: " << std::setprecision(2) << serialTime.count()/parallelTime.count() << "x" << endl;
+
+	for (int ct = 0; ct < numDevices; ct++) {
+		disconnect_by_ID(ct);
+	}
+	set_simulated_devices(0, 0, 0);
+}
+
+//Encode-then-send uploads against the upload engine encoding into one reused transfer buffer
+void upload() {
+	cout << endl << "Uploads through the block encoder over a 40 MB/s link" << endl;
+
+	const vector<std::pair<string, std::pair<unsigned int, size_t>>> payloads = {
+		{"waveform (32768 words)", {FPGA_BANKSEL_WF_CHA, MAX_WF_LENGTH}},
+		{"IQ link list (8192 entries)", {FPGA_BANKSEL_LL_CHA, 5*MAX_LL_LENGTH}}
+	};
+	for (auto & payload : payloads) {
+		WordVec data = build_payload(payload.second.second);
+		const unsigned int addr = payload.second.first;
+
+		SimAPS legacyAPS, engineAPS;
+		for (auto aps : {&legacyAPS, &engineAPS}) {
+			aps->connect(0);
+			aps->set_link_model(0, 40e6);
+		}
+		double legacyTime = time_it([&](){
+			legacy::write_all(legacyAPS, FPGA1, addr, data);
+		}, 10);
+
+		UploadEngine uploader(engineAPS);
+		double engineTime = time_it([&](){
+			uploader.queue(FPGA1, addr, data);
+			uploader.flush();
+		}, 10);
+
+		cout << payload.first << ":" << endl;
+		report("  encode then send", 2*data.size(), legacyTime);
+		report("  upload engine", 2*data.size(), engineTime);
+	}
+}
+
+//Waveform and link list upload throughput against the maximum USB transfer size
+void transfer() {
+	cout << endl << "Transfer size sweep over a 125us, 40 MB/s link" << endl;
+
+	WordVec waveform = build_payload(MAX_WF_LENGTH);
+	WordVec linkList = build_payload(5*MAX_LL_LENGTH);
+	cout << std::setw(16) << std::right << "transfer size" << std::setw(16) << "waveform" << std::setw(16) << "link list" << endl;
+	for (size_t transferSize : {1024, 4096, 16384, 65536, 262144}) {
+		SimAPS aps;
+		aps.connect(0);
+		aps.set_link_model(125, 40e6);
+		aps.set_transfer_size(transferSize);
+		UploadEngine uploader(aps);
+
+		double wfTime = time_it([&](){
+			uploader.queue(FPGA1, FPGA_BANKSEL_WF_CHA, waveform);
+			uploader.flush();
+		}, 5);
+		double llTime = time_it([&](){
+			uploader.queue(FPGA2, FPGA_BANKSEL_LL_CHB, linkList);
+			uploader.flush();
+		}, 5);
+
+		cout << std::setw(16) << transferSize << std::fixed << std::setprecision(1) << std::setw(11) << 2*waveform.size()/wfTime/1e6 << " MB/s"
+			<< std::setw(11) << 2*linkList.size()/llTime/1e6 << " MB/s" << endl;
+	}
+}
+
+//Status register reads with a fixed sleep vs. waiting for the reply, and how long the receive wait takes to give up
+void rxwait() {
+	cout << endl << "Status reads waiting on the receive queue (simulated APS, 125 us/transfer)" << endl;
+
+	SimAPS aps;
+	aps.connect(0);
+	aps.set_link_model(125, 8e6);
+
+	UCHAR legacyByte = 0, readByte = 0;
+	double legacyTime = time_it([&](){
+		legacy::read_status(aps, &legacyByte);
+	}, 200);
+	double waitTime = time_it([&](){
+		FPGA::read_register(aps, APS_CONF_STAT, 0, INVALID_FPGA, &readByte);
+	}, 200);
+	cout << "CONF_STAT read: " << std::fixed << std::setprecision(1) << legacyTime*1e6 << " us with a fixed sleep, "
+		<< waitTime*1e6 << " us waiting for the reply, speedup: " << std::setprecision(2) << legacyTime/waitTime << "x" << endl;
+
+	//Nothing is coming so the wait has to give up at its deadline
+	DWORD rxBytes = 1;
+	auto start = std::chrono::steady_clock::now();
+	aps.wait_for_rx(1, 5, &rxBytes);
+	double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	cout << "wait for a reply that never comes with a 5 ms deadline: " << std::setprecision(1) << waited*1e3 << " ms" << endl;
+}
+
+//Cost of recording into the I/O counters and what they show for an init and upload of a simulated unit
+void iostats() {
+	cout << endl << "Per-device I/O statistics" << endl;
+
+	//Relaxed atomics on the hot path: one thread and four threads sharing the counters
+	for (int numThreads : {1, 4}) {
+		IOStats stats;
+		const size_t numRecords = 1000000;
+		auto start = std::chrono::steady_clock::now();
+		vector<std::thread> threads;
+		for (int ct = 0; ct < numThreads; ct++) {
+			threads.emplace_back([&stats, numRecords, numThreads](){
+				for (size_t rec = 0; rec < numRecords/numThreads; rec++) {
+					stats.record(IO_WRITE, 64, IOStats::clock::now());
+				}
+			});
+		}
+		for (auto & thread : threads) thread.join();
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		cout << "  record from " << numThreads << " thread(s): " << std::fixed << std::setprecision(1) << elapsed/numRecords*1e9 << " ns each (timestamp included)" << endl;
+	}
+
+	const string bitFile = "bench_iostats";
+	for (auto suffix : {"_FPGA1.bit", "_FPGA2.bit"}) {
+		std::ofstream FID(bitFile + suffix, std::ios::out | std::ios::binary);
+		FID << string(1 << 17, 0x5A);
+	}
+	set_simulated_devices(1, 125, 8);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	if (deviceID < 0 || connect_by_ID(deviceID) != 0) {
+		cout << "FAILED to connect to the simulated APS" << endl;
+		return;
+	}
+	reset_io_stats(deviceID);
+	initAPS(deviceID, const_cast<char *>(bitFile.c_str()), 1);
+	vector<short> waveform(MAX_WF_LENGTH, 1000);
+	set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+
+	const vector<string> opNames = {"write", "read", "SPI", "flush", "stream refill", "cache hit", "cache miss"};
+	cout << "simulated init and waveform upload over a 125us, 8 MB/s link:" << endl;
+	cout << std::setw(16) << std::right << "operation" << std::setw(10) << "count" << std::setw(12) << "bytes" << std::setw(12) << "mean us" << "  histogram (us: count)" << endl;
+	vector<unsigned long long> values(IOStats::NUM_VALUES);
+	for (int op = IO_WRITE; op < NUM_IO_OPS; op++) {
+		get_io_stats(deviceID, op, values.data(), values.size());
+		cout << std::setw(16) << opNames[op] << std::setw(10) << values[0] << std::setw(12) << values[1] << std::setw(12) << std::setprecision(1)
+			<< (values[0] ? values[2]/1e3/values[0] : 0.0) << " ";
+		for (size_t bucket = 0; bucket < IOStats::NUM_BUCKETS; bucket++) {
+			if (values[3+bucket]) cout << " <" << (1 << bucket) << ": " << values[3+bucket];
+		}
+		cout << endl;
+	}
+	disconnect_by_ID(deviceID);
+}
+
+//Cost of a trace span off and on, and the trace of a simulated init and upload
+void trace() {
+	cout << endl << "Timeline tracing" << endl;
+
+	const size_t numSpans = 1000000;
+	double offTime = time_it([&](){
+		for (size_t ct = 0; ct < numSpans; ct++) {
+			TRACE_SPAN("bench span", "bench");
+		}
+	}, 1) / numSpans;
+
+	const string traceFile = "bench_trace.json";
+	Tracer::start(traceFile);
+	//time_it warms up with an extra call; stay within a ring between drains so nothing is dropped
+	const size_t numOnSpans = Tracer::RING_SIZE/4;
+	double onTime = time_it([&](){
+		for (size_t ct = 0; ct < numOnSpans; ct++) {
+			TRACE_SPAN("bench span", "bench");
+		}
+	}, 1) / numOnSpans;
+	cout << "  span with tracing off: " << std::fixed << std::setprecision(1) << offTime*1e9 << " ns, on: " << onTime*1e9 << " ns" << endl;
+
+	const string bitFile = "bench_trace";
+	for (auto suffix : {"_FPGA1.bit", "_FPGA2.bit"}) {
+		std::ofstream FID(bitFile + suffix, std::ios::out | std::ios::binary);
+		FID << string(1 << 17, 0x5A);
+	}
+	set_simulated_devices(1, 125, 8);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	connect_by_ID(deviceID);
+	initAPS(deviceID, const_cast<char *>(bitFile.c_str()), 1);
+	vector<short> waveform(MAX_WF_LENGTH, 1000);
+	set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+	disconnect_by_ID(deviceID);
+	int numWritten = stop_trace();
+
+	std::ifstream FID(traceFile);
+	string json((std::istreambuf_iterator<char>(FID)), std::istreambuf_iterator<char>());
+	cout << "  simulated init and upload: " << numWritten << " spans, " << json.size()/1024 << " kB of JSON" << endl;
+}
+
+//Register poll round trips and long uploads under each transfer profile with the driver timers modelled
+void profiles() {
+	cout << endl << "Transfer profiles with the FTDI latency timer and write timeout modelled" << endl;
+
+	//Short reads wait out the latency timer
+	cout << "register poll round trip over a 125us, 8 MB/s link:" << endl;
+	for (auto profile : {PROFILE_INTERACTIVE, PROFILE_BULK_UPLOAD, PROFILE_STREAMING_POLL}) {
+		SimAPS aps;
+		aps.connect(0);
+		aps.set_link_model(125, 8e6);
+		aps.set_driver_timer_model(true);
+		aps.set_profile(profile);
+		double pollTime = time_it([&](){
+			FPGA::read_FPGA(aps, FPGA_ADDR_CHA_LL_CURADDR, FPGA1);
+		}, 20);
+		cout << std::setw(40) << std::left << string("  ") + Transport::profile_settings(profile).name << std::setw(12) << std::right
+			<< std::fixed << std::setprecision(2) << pollTime*1e3 << " ms" << endl;
+	}
+
+	//A single 74 kB transfer over a 100 kB/s link outlasts the interactive write timeout but not the bulk one
+	cout << "waveform upload as one transfer over a 100 kB/s link:" << endl;
+	WordVec waveform = build_payload(MAX_WF_LENGTH);
+	const int numBytes = FPGA::format_length(waveform.size());
+	for (auto profile : {PROFILE_INTERACTIVE, PROFILE_BULK_UPLOAD}) {
+		SimAPS aps;
+		aps.connect(0);
+		aps.set_link_model(0, 100e3);
+		aps.set_driver_timer_model(true);
+		aps.set_transfer_size(1 << 17);
+		UploadEngine uploader(aps);
+		int bytesWritten = 0;
+		{
+			ProfileGuard guard(aps, profile);
+			uploader.queue(FPGA1, FPGA_BANKSEL_WF_CHA, waveform);
+			bytesWritten = uploader.flush();
+		}
+		cout << std::setw(40) << std::left << string("  ") + Transport::profile_settings(profile).name << std::setw(12) << std::right
+			<< bytesWritten << " of " << numBytes << " bytes written" << endl;
+	}
+}
+
+//Matching waveforms and link lists for both FPGAs sent once with ALL_FPGAS against a write per FPGA
+void broadcast() {
+	cout << endl << "Broadcast writes to both FPGAs" << endl;
+
+	set_simulated_devices(1, 125, 8);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	if (deviceID < 0 || connect_by_ID(deviceID) != 0) {
+		cout << "FAILED to connect to the simulated APS" << endl;
+		set_simulated_devices(0, 0, 0);
+		return;
+	}
+
+	//An IQ pair: I on DAC 0 and 2, Q on DAC 1 and 3, and the same link list on both FPGAs
+	vector<short> iWaveform(8192), qWaveform(8192);
+	for (size_t ct = 0; ct < iWaveform.size(); ct++) {
+		iWaveform[ct] = short(0.8*MAX_WF_AMP*std::cos(2*M_PI*ct/1000.0));
+		qWaveform[ct] = short(0.8*MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+	}
+	const size_t numEntries = 1000;
+	WordVec addr(numEntries), count(numEntries), trigger1(numEntries, 0), trigger2(numEntries, 0), repeat(numEntries, 0);
+	for (size_t ct = 0; ct < numEntries; ct++) {
+		addr[ct] = (ct*37) % 1024;
+		count[ct] = ct % 16;
+	}
+	auto load_all = [&](){
+		for (int dac = 0; dac < 4; dac++) {
+			vector<short> & waveform = (dac % 2) ? qWaveform : iWaveform;
+			set_waveform_int(deviceID, dac, waveform.data(), waveform.size());
+		}
+		for (int dac : {0, 2}) {
+			set_LL_data_IQ(deviceID, dac, numEntries, addr.data(), count.data(), trigger1.data(), trigger2.data(), repeat.data());
+		}
+	};
+
+	cout << "  2 x " << iWaveform.size() << " sample IQ waveforms and a " << numEntries << " entry link list on both FPGAs over a 125 us/transfer, 8 MB/s link:" << endl;
+	for (bool coalesce : {false, true}) {
+		clear_upload_cache(deviceID);
+		vector<unsigned long long> startCounts = io_counts(deviceID);
+		auto start = Clock::now();
+		if (coalesce) begin_update(deviceID);
+		load_all();
+		if (coalesce) commit_update(deviceID);
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		vector<unsigned long long> counts = io_counts(deviceID);
+		cout << "  " << std::setw(20) << std::left << (coalesce ? "broadcast on commit" : "one FPGA at a time") << std::right
+			<< std::setw(8) << counts[1] - startCounts[1] << " bytes " << std::fixed << std::setprecision(1) << std::setw(8) << elapsed.count()*1e3 << " ms" << endl;
+	}
+	disconnect_by_ID(deviceID);
+	set_simulated_devices(0, 0, 0);
+}
+
+//Adding a pulse to a packed waveform library against re-uploading the whole channel
+void library() {
+	cout << endl << "Waveform library allocator" << endl;
+
+	//Random adds, replacements and removes, with a compaction whenever the best fit fails
+	std::mt19937 rng(1234);
+	WaveformLibrary library;
+	size_t numCompactions = 0, numPlaced = 0;
+	for (int ct = 0; ct < 20000; ct++) {
+		string name = "pulse" + std::to_string(rng() % 200);
+		if (rng() % 3 == 0) {
+			library.remove(name);
+			continue;
+		}
+		const size_t numPts = 1 + rng() % 600;
+		WaveformLibrary::Pulse pulse;
+		int status = library.place(name, numPts, pulse);
+		if (status == -2 && library.free_samples() >= numPts + WF_MODULUS) {
+			library.remove(name);
+			library.compact();
+			numCompactions++;
+			status = library.place(name, numPts, pulse);
+		}
+		numPlaced += (status == 0);
+	}
+	cout << "  " << numPlaced << " pulses placed with " << numCompactions << " compactions" << endl;
+
+	set_simulated_devices(1, 125, 8);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	if (deviceID < 0 || connect_by_ID(deviceID) != 0) {
+		cout << "FAILED to connect to the simulated APS" << endl;
+		set_simulated_devices(0, 0, 0);
+		return;
+	}
+
+	//A calibration library of 30 pulses of 1000 samples, then one more
+	const size_t numPulses = 30, pulseLength = 1000;
+	vector<vector<short>> pulses(numPulses + 1, vector<short>(pulseLength));
+	for (size_t pulse = 0; pulse < pulses.size(); pulse++) {
+		for (size_t ct = 0; ct < pulseLength; ct++) {
+			pulses[pulse][ct] = short((pulse + 1) * 200 * std::sin(M_PI*ct/pulseLength));
+		}
+	}
+	unsigned short addr, count;
+	for (size_t pulse = 0; pulse < numPulses; pulse++) {
+		add_pulse_int(deviceID, 0, ("p" + std::to_string(pulse)).c_str(), pulses[pulse].data(), pulseLength, &addr, &count);
+	}
+	unsigned long long start = bytes_written(deviceID);
+	auto startTime = Clock::now();
+	add_pulse_int(deviceID, 0, "new", pulses[numPulses].data(), pulseLength, &addr, &count);
+	std::chrono::duration<double> pulseTime = Clock::now() - startTime;
+	unsigned long long pulseBytes = bytes_written(deviceID) - start;
+
+	//The same memory image loaded whole
+	vector<short> image;
+	for (auto & pulse : pulses) {
+		image.insert(image.end(), pulse.begin(), pulse.end());
+	}
+	start = bytes_written(deviceID);
+	startTime = Clock::now();
+	set_waveform_int(deviceID, 1, image.data(), image.size());
+	std::chrono::duration<double> fullTime = Clock::now() - startTime;
+	unsigned long long fullBytes = bytes_written(deviceID) - start;
+
+	cout << "  adding a " << pulseLength << " sample pulse to a " << numPulses << " pulse library over a 125 us/transfer, 8 MB/s link:" << endl;
+	cout << "  whole library:   " << std::setw(8) << fullBytes << " bytes " << std::fixed << std::setprecision(1) << std::setw(8) << fullTime.count()*1e6 << " us" << endl;
+	cout << "  one pulse:       " << std::setw(8) << pulseBytes << " bytes " << std::setw(8) << pulseTime.count()*1e6 << " us" << endl;
+	disconnect_by_ID(deviceID);
+	set_simulated_devices(0, 0, 0);
+}
+
+//Link list refills encoded straight from the bank against a copy of each range
+void llspans() {
+	cout << endl << "Link list spans" << endl;
+
+	const size_t numEntries = 3000;
+	WordVec addr(numEntries), count(numEntries), trigger1(numEntries), trigger2(numEntries), repeat(numEntries, 0);
+	for (size_t ct = 0; ct < numEntries; ct++) {
+		addr[ct] = (ct*37) % 1024;
+		count[ct] = ct % 16;
+		trigger1[ct] = ct % 3;
+		trigger2[ct] = ct % 5;
+	}
+	LLBank bank(addr, count, trigger1, trigger2, repeat);
+
+	//Steady state streaming: 256 entry refills walking around the bank, wrapping every so often
+	NullTransport nullLink;
+	UploadEngine uploader(nullLink);
+	const size_t refillEntries = 256;
+	size_t legacyIdx = 0, spanIdx = 0;
+	auto legacyRefill = [&](){
+		size_t stopIdx = (legacyIdx + refillEntries) % numEntries;
+		WordVec writeData = legacy::get_packed_data(bank, legacyIdx, stopIdx);
+		uploader.queue(FPGA1, FPGA_BANKSEL_LL_CHA, writeData);
+		uploader.flush();
+		legacyIdx = stopIdx;
+	};
+	auto spanRefill = [&](){
+		size_t stopIdx = (spanIdx + refillEntries) % numEntries;
+		LLBank::PackedSpans spans = bank.get_packed_data(spanIdx, stopIdx);
+		uploader.queue_view(FPGA1, FPGA_BANKSEL_LL_CHA, spans.first.data, spans.first.size);
+		if (spans.second.size) {
+			uploader.queue_view(FPGA1, FPGA_BANKSEL_LL_CHA | ULONG(spans.first.size / 5), spans.second.data, spans.second.size);
+		}
+		uploader.flush();
+		spanIdx = stopIdx;
+	};
+	//Enough refills to wrap several times
+	auto legacyRefills = [&](){ for (int ct = 0; ct < 50; ct++) legacyRefill(); };
+	auto spanRefills = [&](){ for (int ct = 0; ct < 50; ct++) spanRefill(); };
+	cout << "  50 refills of " << refillEntries << " entries around a " << numEntries << " entry bank, host side:" << endl;
+	report_upload("  copied ranges", 50*10*refillEntries, legacyRefills);
+	report_upload("  spans into the bank", 50*10*refillEntries, spanRefills);
+}
+
+//Int16 waveforms kept as DAC counts against the float storage they used to be converted to
+void native() {
+	cout << endl << "Native int16 waveform storage" << endl;
+
+	vector<short> waveform(MAX_WF_LENGTH - 5);
+	vector<float> asFloat(waveform.size());
+	Channel intChannel(0), floatChannel(1);
+	vector<short> intPrep, floatPrep;
+
+	//What the channel holds and what preparing it costs at unit scale, in range so nothing logs clipping
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+		asFloat[ct] = float(waveform[ct])/MAX_WF_AMP;
+	}
+	intChannel.set_waveform(waveform);
+	floatChannel.set_waveform(asFloat);
+	cout << "  held as float:  " << floatChannel.waveform_size()*sizeof(float)/1024 << " kB" << endl;
+	cout << "  held as int16:  " << intChannel.waveform_size()*sizeof(short)/1024 << " kB" << endl;
+
+	Channel legacyChannel(2);
+	vector<float> converted(waveform.size());
+	report("  legacy set_waveform_int + prep", 2*waveform.size(), time_it([&](){
+		for (size_t ct = 0; ct < waveform.size(); ct++) {
+			converted[ct] = float(waveform[ct])/MAX_WF_AMP;
+		}
+		legacyChannel.set_waveform(converted);
+		legacyChannel.prep_waveform(floatPrep);
+	}, 200));
+	report("  int16 set_waveform + prep", 2*waveform.size(), time_it([&](){
+		intChannel.set_waveform(waveform);
+		intChannel.prep_waveform(intPrep);
+	}, 200));
+}
+
+void printHelp(){
+	string spacing = "   ";
+	cout << "BBN APS host-side benchmarks" << endl;
+	cout << "Usage: run_benchmarks <options>" << endl;
+	cout << "With no options all benchmarks are run. Otherwise any of the following:" << endl;
+	cout << spacing << "-format  FPGA block-write encoder" << endl;
+	cout << spacing << "-pack    Block-write word packing kernels" << endl;
+	cout << spacing << "-sim     Init and upload against a simulated APS" << endl;
+	cout << spacing << "-reads   Batched register reads" << endl;
+	cout << spacing << "-csr     CSR bit updates with shadow registers" << endl;
+	cout << spacing << "-spi     SPI bit serialization and batched transactions" << endl;
+	cout << spacing << "-program FPGA bitfile programming" << endl;
+	cout << spacing << "-bitfile Bitfile cache across a rack" << endl;
+	cout << spacing << "-rack    Parallel init of a rack" << endl;
+	cout << spacing << "-upload  Block-write uploads through the upload engine" << endl;
+	cout << spacing << "-transfer USB transfer size sweep" << endl;
+	cout << spacing << "-profile Transfer profiles" << endl;
+	cout << spacing << "-rxwait  Status reads waiting on the receive queue" << endl;
+	cout << spacing << "-iostats Per-device I/O statistics" << endl;
+	cout << spacing << "-trace   Timeline tracing" << endl;
+	cout << spacing << "-prep    Waveform prep kernels" << endl;
+	cout << spacing << "-zerocopy Waveform uploads from the caller's buffer" << endl;
+	cout << spacing << "-segment Partial waveform updates" << endl;
+	cout << spacing << "-update  Settings updates coalesced into one flush" << endl;
+	cout << spacing << "-cache   Upload cache for repeated waveform and link list loads" << endl;
+	cout << spacing << "-native  Channels holding int16 waveforms as given" << endl;
+	cout << spacing << "-broadcast Matching uploads to both FPGAs in one write" << endl;
+	cout << spacing << "-library Waveform library allocator" << endl;
+	cout << spacing << "-llspans Link list refills without copies" << endl;
+	cout << spacing << "-h       Print This Help Message" << endl;
+}
+
+} //end namespace bench
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option)
+{
+	return std::find(begin, end, option) != end;
+}
+
+int main(int argc, char** argv) {
+
+	set_console_logging_level(plog::warning);
+	set_file_logging_level(plog::warning);
+
+	if (cmdOptionExists(argv, argv + argc, "-h")) {
+		bench::printHelp();
+		return 0;
+	}
+
+	bool runAll = (argc < 2);
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-format")) {
+		bench::format();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-pack")) {
+		bench::pack();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-sim")) {
+		bench::sim();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-reads")) {
+		bench::reads();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-csr")) {
+		bench::csr();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-spi")) {
+		bench::spi();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-program")) {
+		bench::program();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-bitfile")) {
+		bench::bitfiles();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-rack")) {
+		bench::rack();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-upload")) {
+		bench::upload();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-transfer")) {
+		bench::transfer();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-profile")) {
+		bench::profiles();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-rxwait")) {
+		bench::rxwait();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-iostats")) {
+		bench::iostats();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-trace")) {
+		bench::trace();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-prep")) {
+		bench::prep();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-zerocopy")) {
+		bench::zerocopy();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-segment")) {
+		bench::segment();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-update")) {
+		bench::update();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-cache")) {
+		bench::cache();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-native")) {
+		bench::native();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-broadcast")) {
+		bench::broadcast();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-library")) {
+		bench::library();
+	}
+
+	if (runAll || cmdOptionExists(argv, argv + argc, "-llspans")) {
+		bench::llspans();
+	}
+
+	return 0;
+}
@@ -23,6 +23,11 @@ static const size_t MAX_LL_LENGTH = 8192;
 static const int APS_READTIMEOUT = 1000;
 static const int APS_WRITETIMEOUT = 500;
 
+//Largest single USB write: the default is the FT_SetUSBParameters maximum transfer size
+static const size_t USB_DEFAULT_TRANSFER_SIZE = 65536;
+static const size_t USB_MIN_TRANSFER_SIZE = 64;
+static const size_t USB_MAX_TRANSFER_SIZE = 1 << 22;
+
 
 //FPGA programming bits
 static const int APS_PGM01_BIT = 1;
@@ -101,6 +106,9 @@ static const int FPGA_ADDR_CHA_ZERO = FPGA_BANKSEL_CSR | 0x7; // DAC0/2 zero off
 static const int FPGA_ADDR_CHB_ZERO = FPGA_BANKSEL_CSR | 0x8; // DAC1/3 zero offset register
 static const int FPGA_ADDR_LL_REPEAT = FPGA_BANKSEL_CSR | 0x9;
 
+// CSR bank registers below this are only written by the host so APS keeps shadow copies
+static const int NUM_SHADOW_REGS = 0xA;
+
 
 //Registers we read from
 static const int  FPGA_ADDR_VERSION  =   FPGA_BANKSEL_CSR | 0x10;
@@ -149,5 +157,10 @@ typedef enum {LED_PLL_SYNC=1, LED_RUNNING} LED_MODE;
 
 typedef enum {RUN_WAVEFORM=0, RUN_SEQUENCE} RUN_MODE;
 
+typedef enum {PROFILE_INTERACTIVE=0, PROFILE_BULK_UPLOAD, PROFILE_STREAMING_POLL} TRANSFER_PROFILE;
+
+//IO_CACHE_HIT/MISS count block writes the upload cache skipped or let through (bytes are the payload)
+typedef enum {IO_WRITE=0, IO_READ, IO_SPI, IO_FLUSH, IO_STREAM_REFILL, IO_CACHE_HIT, IO_CACHE_MISS, NUM_IO_OPS} IO_OP;
+
 
 #endif /* CONSTANTS_H_ */
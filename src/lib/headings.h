@@ -24,6 +24,9 @@
 #include <stdexcept>
 #include <algorithm>
 #include <queue>
+#include <deque>
+#include <memory>
+#include <cstring>
 using std::vector;
 using std::string;
 using std::cout;
@@ -33,9 +36,11 @@ using std::runtime_error;
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <utility>
 #include <chrono>
+#include <cstdint>
 
 //Logger IDs
 #define FILE_LOG 1
@@ -78,6 +83,12 @@ struct CheckSum {
 	WORD data;
 };
 
+//Host copy of a write-mostly FPGA register
+struct ShadowRegister {
+	USHORT value;
+	bool valid;
+};
+
 //PLL routines go through sets of address/data pairs
 typedef std::pair<ULONG, UCHAR> PLLAddrData;
 
@@ -87,10 +98,18 @@ typedef vector<unsigned short> WordVec;
 //Load all the constants
 #include "constants.h"
 
+#include "IOStats.h"
+#include "Tracer.h"
+#include "Transport.h"
 #include "FTDI.h"
+#include "SimAPS.h"
 #include "FPGA.h"
+#include "BitfileCache.h"
+#include "UploadEngine.h"
+#include "UploadCache.h"
 
 #include "LLBank.h"
+#include "WaveformLibrary.h"
 #include "Channel.h"
 #include "BankBouncerThread.h"
 #include "APS.h"
@@ -0,0 +1,192 @@
+/*
+ * legacy.h
+ *
+ * The code paths the driver used before they were rewritten, kept as references: the tests check
+ * the new paths produce the same output and the benchmarks time the two against each other.
+ * Not part of the library.
+ */
+
+#include "headings.h"
+
+#ifndef LEGACY_H_
+#define LEGACY_H_
+
+namespace legacy {
+	//The encoder as it was before FPGA::format wrote into a caller buffer: a push_back per byte,
+	//a second pass for the command byte offsets and a byte-by-byte copy into the APS write queue.
+	inline vector<UCHAR> format(const FPGASELECT & fpga, const unsigned int & addr, const WordVec & data) {
+		const UCHAR fpgaSelectMask = fpga << 2;
+		const UCHAR write2Bytes = APS_FPGA_IO | fpgaSelectMask | 1;
+		const UCHAR write4Bytes = APS_FPGA_IO | fpgaSelectMask | 2;
+		const UCHAR write8Bytes = APS_FPGA_IO | fpgaSelectMask | 3;
+		const UCHAR writeAddress = APS_FPGA_ADDR | fpgaSelectMask | 2;
+
+		vector<UCHAR> dataPacket(0);
+		dataPacket.reserve(5 + 3 + 2*data.size() + data.size()/3 + data.size()%3 );
+		dataPacket.push_back(writeAddress);
+		dataPacket.push_back((addr >> 24) & LSB_MASK);
+		dataPacket.push_back((addr >> 16) & LSB_MASK);
+		dataPacket.push_back((addr >> 8) & LSB_MASK);
+		dataPacket.push_back(addr & LSB_MASK);
+		if (data.size() > 0){
+			dataPacket.push_back(write2Bytes);
+			dataPacket.push_back((data.size() >> 8) & LSB_MASK);
+			dataPacket.push_back(data.size() & LSB_MASK);
+			int ptsRemaining = data.size();
+			int ptsToWrite = 0;
+			int wfIndex = 0;
+			while (ptsRemaining > 0) {
+				switch (ptsRemaining) {
+				case 1:
+					ptsToWrite = 1;
+					dataPacket.push_back(write2Bytes);
+					break;
+				case 2:
+				case 3:
+					ptsToWrite = 2;
+					dataPacket.push_back(write4Bytes);
+					break;
+				default:
+					ptsToWrite = 4;
+					dataPacket.push_back(write8Bytes);
+					break;
+				}
+				for (int ct = 0; ct < ptsToWrite; ct++, wfIndex++ ) {
+					dataPacket.push_back((data[wfIndex] >> 8) & LSB_MASK);
+					dataPacket.push_back(data[wfIndex] & LSB_MASK);
+				}
+				ptsRemaining -= ptsToWrite;
+			}
+		}
+		return dataPacket;
+	}
+
+	inline vector<size_t> computeCmdByteOffsets(const size_t & dataLength) {
+		vector<size_t> offsets(0);
+		offsets.reserve(2 + dataLength/3 + dataLength%3 );
+		offsets.push_back(0);
+		if (dataLength > 0){
+			offsets.push_back(5);
+			int currentIdx = 8;
+			int ptsRemaining = dataLength;
+			int ptsToWrite=0;
+			while (ptsRemaining > 0) {
+				switch (ptsRemaining) {
+				case 1:
+					ptsToWrite = 1;
+					break;
+				case 2:
+				case 3:
+					ptsToWrite = 2;
+					break;
+				default:
+					ptsToWrite = 4;
+					break;
+				}
+				offsets.push_back(currentIdx);
+				ptsRemaining -= ptsToWrite;
+				currentIdx += 1+2*ptsToWrite;
+			}
+		}
+		return offsets;
+	}
+
+	inline void queue(const FPGASELECT & fpga, const unsigned int & addr, const WordVec & data,
+			vector<UCHAR> & writeQueue, vector<size_t> & offsetQueue) {
+		vector<UCHAR> dataPacket = format(fpga, addr, data);
+		auto offsets = computeCmdByteOffsets(data.size());
+		for (auto tmpOffset : offsets){
+			offsetQueue.push_back(tmpOffset + writeQueue.size());
+		}
+		for (auto tmpByte : dataPacket){
+			writeQueue.push_back(tmpByte);
+		}
+	}
+
+	//SPI bit serialization as write_SPI did it: a temporary buffer and a shift and mask per bit
+	inline vector<UCHAR> serialize_SPI(const UCHAR & command, const vector<UCHAR> & data) {
+		vector<UCHAR> byteBuffer(data);
+		vector<UCHAR> packet(0);
+		packet.push_back(command);
+		for(size_t ct = 0; ct < 8*byteBuffer.size(); ct++)
+			packet.push_back( (byteBuffer[ct/8]>>(7-(ct%8))) & 1 );
+		return packet;
+	}
+
+	//Upload as APS::flush did it: encode everything, then send it in command aligned writes of up to 64kB
+	inline int write_all(Transport & transport, const FPGASELECT & fpga, const unsigned int & addr, const WordVec & data) {
+		vector<UCHAR> packet(FPGA::format_length(data.size()));
+		vector<size_t> offsets(FPGA::num_cmd_bytes(data.size()));
+		FPGA::format(fpga, addr, data.data(), data.size(), packet.data(), offsets.data());
+		int bytesWritten = 0;
+		size_t start = 0;
+		while (start < packet.size()) {
+			size_t stop = packet.size();
+			if (stop - start > 65536) {
+				stop = *(std::upper_bound(offsets.begin(), offsets.end(), start + 65536) - 1);
+			}
+			DWORD tmpBytesWritten = 0;
+			transport.write(&packet[start], stop - start, &tmpBytesWritten);
+			bytesWritten += tmpBytesWritten;
+			start = stop;
+		}
+		return bytesWritten;
+	}
+
+	//Status register read as read_register did it: a fixed 100us sleep between the command and the read
+	inline int read_status(Transport & transport, UCHAR * data) {
+		UCHAR commandPacket = 0x80 | APS_CONF_STAT;
+		DWORD bytesWritten = 0, bytesRead = 0;
+		transport.write(&commandPacket, 1, &bytesWritten);
+		usleep(100);
+		transport.read(data, 1, &bytesRead);
+		return bytesRead;
+	}
+
+	//Channel::prep_waveform as it was: a truncating conversion pass, then max/min passes and up to two clipping passes
+	inline vector<short> prep_waveform(const vector<float> & waveform, const float & scale, const float & offset) {
+		vector<short> prepVec(waveform.size());
+		for(size_t ct=0; ct<prepVec.size(); ct++){
+			prepVec[ct] = short(MAX_WF_AMP*(scale*waveform[ct]+offset));
+		}
+		if (*max_element(prepVec.begin(), prepVec.end()) > MAX_WF_AMP){
+			for(short & tmpVal : prepVec){
+				if (tmpVal > MAX_WF_AMP) tmpVal = MAX_WF_AMP;
+			}
+		}
+		if (*min_element(prepVec.begin(), prepVec.end()) < -MAX_WF_AMP){
+			for(short & tmpVal : prepVec){
+				if (tmpVal < -MAX_WF_AMP) tmpVal = -MAX_WF_AMP;
+			}
+		}
+		return prepVec;
+	}
+
+	//set_waveform_int as it was: copied into a vector by the C API, converted to float by the channel, prepared
+	//into a new vector, copied to USHORTs for write() and again into the upload queue before encoding
+	inline int upload_waveform(UploadEngine & uploader, Channel & channel, const short * data, const size_t & numPts) {
+		vector<short> wfData(data, data + numPts);
+		vector<float> floatData(numPts);
+		for(size_t ct=0; ct<numPts; ct++){
+			floatData[ct] = float(wfData[ct])/MAX_WF_AMP;
+		}
+		channel.set_waveform(floatData);
+		vector<short> prepVec = channel.prep_waveform();
+		uploader.queue(FPGA1, FPGA_ADDR_CHA_WF_LENGTH, vector<USHORT>(1, USHORT(prepVec.size() / WF_MODULUS - 1)));
+		uploader.flush();
+		uploader.queue(FPGA1, FPGA_BANKSEL_WF_CHA, vector<USHORT>(prepVec.begin(), prepVec.end()));
+		return uploader.flush();
+	}
+	//LLBank::get_packed_data as it was: a new vector per call, built by assign plus insert when the range wraps
+	inline WordVec get_packed_data(const LLBank & bank, const size_t & startIdx, const size_t & stopIdx) {
+		LLBank::PackedSpans spans = bank.get_packed_data(startIdx, stopIdx);
+		WordVec vecOut;
+		vecOut.assign(spans.first.data, spans.first.data + spans.first.size);
+		if (spans.second.size) {
+			vecOut.insert(vecOut.end(), spans.second.data, spans.second.data + spans.second.size);
+		}
+		return vecOut;
+	}
+} //end namespace legacy
+
+#endif /* LEGACY_H_ */
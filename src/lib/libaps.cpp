@@ -44,6 +44,7 @@ extern "C" {
 #endif
 
 int init(){
+	TRACE_SPAN(__func__, "api");
 
 	APSRack_.init();
 
@@ -51,10 +52,12 @@ int init(){
 }
 
 int get_numDevices(){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.get_num_devices();
 }
 
 void get_deviceSerial(int deviceID, char* deviceSerial){
+	TRACE_SPAN(__func__, "api");
 	//Assumes sufficient memory has been allocated
 	string serialStr = APSRack_.get_deviceSerial(deviceID);
 	size_t strLen = serialStr.copy(deviceSerial, serialStr.size());
@@ -63,25 +66,30 @@ void get_deviceSerial(int deviceID, char* deviceSerial){
 
 //Connect to a device specified by ID
 int connect_by_ID(int deviceID){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.connect(deviceID);
 }
 
 //Connect to a device specified by serial number string
 //Assumes null-terminated deviceSerial
 int connect_by_serial(char * deviceSerial){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.connect(string(deviceSerial));
 }
 
 int disconnect_by_ID(int deviceID){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.disconnect(deviceID);
 }
 
 //Assumes a null-terminated deviceSerial
 int disconnect_by_serial(char * deviceSerial){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.disconnect(string(deviceSerial));
 }
 
 int serial2ID(char * deviceSerial){
+	TRACE_SPAN(__func__, "api");
 	if ( !APSRack_.serial2dev.count(deviceSerial)) {
 		// serial number not in map of known devices
 		return -1;
@@ -93,42 +101,141 @@ int serial2ID(char * deviceSerial){
 //Initialize an APS unit
 //Assumes null-terminated bitFile
 int initAPS(int deviceID, char * bitFile, int forceReload){
+	TRACE_SPAN(__func__, "api");
 	try {
 		return APSRack_.initAPS(deviceID, string(bitFile), forceReload);
-	} catch (std::exception& e) {
-		string error = e.what();
-		if (error.compare("Unable to open bitfile.") == 0) {
-			return APS_FILE_ERROR;
-		} else {
-			return APS_UNKNOWN_ERROR;
-		}
+	} catch (FileError &) {
+		return APS_FILE_ERROR;
+	} catch (std::exception &) {
+		return APS_UNKNOWN_ERROR;
 	}
 
 }
 
+//Initialize all connected APS units at once
+//Assumes null-terminated bitFile
+//Returns APS_OK if every connected unit initialized or the first failing status
+int init_all(char * bitFile, int forceReload, int * statuses, double * initTimes){
+	TRACE_SPAN(__func__, "api");
+	int status = APS_OK;
+	for (auto & result : APSRack_.init_all(string(bitFile), forceReload)) {
+		int deviceStatus = result.status;
+		if (!result.connected) {
+			deviceStatus = APS_NOT_CONNECTED;
+		} else if (result.fileError) {
+			deviceStatus = APS_FILE_ERROR;
+		} else if (!result.error.empty()) {
+			deviceStatus = APS_UNKNOWN_ERROR;
+		}
+		if (result.connected && deviceStatus != APS_OK && status == APS_OK) {
+			status = deviceStatus;
+		}
+		if (statuses) statuses[result.deviceID] = deviceStatus;
+		if (initTimes) initTimes[result.deviceID] = result.initTime;
+	}
+	return status;
+}
+
 int read_bitfile_version(int deviceID) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.read_bitfile_version(deviceID);
 }
 
 int set_sampleRate(int deviceID, int freq){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.set_sampleRate(deviceID, freq);
 }
 
 int get_sampleRate(int deviceID){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.get_sampleRate(deviceID);
 }
 
 //Load the waveform library as floats
 int set_waveform_float(int deviceID, int channelNum, float* data, int numPts){
-	return APSRack_.set_waveform(deviceID, channelNum, vector<float>(data, data+numPts));
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.set_waveform(deviceID, channelNum, data, size_t(numPts));
 }
 
 //Load the waveform library as int16
 int set_waveform_int(int deviceID, int channelNum, short* data, int numPts){
-	return APSRack_.set_waveform(deviceID, channelNum, vector<short>(data, data+numPts));
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.set_waveform(deviceID, channelNum, data, size_t(numPts));
+}
+
+//Overwrite part of the waveform library from a start sample as floats
+int set_waveform_segment_float(int deviceID, int channelNum, int startSample, float* data, int numPts){
+	TRACE_SPAN(__func__, "api");
+	if (startSample < 0) return -1;
+	return APSRack_.set_waveform_segment(deviceID, channelNum, size_t(startSample), data, size_t(numPts));
+}
+
+//Overwrite part of the waveform library from a start sample as int16
+int set_waveform_segment_int(int deviceID, int channelNum, int startSample, short* data, int numPts){
+	TRACE_SPAN(__func__, "api");
+	if (startSample < 0) return -1;
+	return APSRack_.set_waveform_segment(deviceID, channelNum, size_t(startSample), data, size_t(numPts));
+}
+
+//Place a pulse in the waveform library as floats
+int add_pulse_float(int deviceID, int channelNum, const char * name, float* data, int numPts, unsigned short* addr, unsigned short* count){
+	TRACE_SPAN(__func__, "api");
+	WaveformLibrary::Pulse pulse;
+	int status = APSRack_.add_pulse(deviceID, channelNum, string(name), data, size_t(numPts), pulse);
+	if (status < 0) return status;
+	*addr = pulse.ll_addr();
+	*count = pulse.ll_count();
+	return status;
+}
+
+//Place a pulse in the waveform library as int16
+int add_pulse_int(int deviceID, int channelNum, const char * name, short* data, int numPts, unsigned short* addr, unsigned short* count){
+	TRACE_SPAN(__func__, "api");
+	WaveformLibrary::Pulse pulse;
+	int status = APSRack_.add_pulse(deviceID, channelNum, string(name), data, size_t(numPts), pulse);
+	if (status < 0) return status;
+	*addr = pulse.ll_addr();
+	*count = pulse.ll_count();
+	return status;
+}
+
+int remove_pulse(int deviceID, int channelNum, const char * name){
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.remove_pulse(deviceID, channelNum, string(name));
+}
+
+int get_pulse(int deviceID, int channelNum, const char * name, unsigned short* addr, unsigned short* count){
+	TRACE_SPAN(__func__, "api");
+	WaveformLibrary::Pulse pulse;
+	int status = APSRack_.find_pulse(deviceID, channelNum, string(name), pulse);
+	if (status < 0) return status;
+	*addr = pulse.ll_addr();
+	*count = pulse.ll_count();
+	return 0;
+}
+
+int compact_waveform_library(int deviceID, int channelNum){
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.compact_waveform_library(deviceID, channelNum);
+}
+
+int begin_update(int deviceID){
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.begin_update(deviceID);
+}
+
+int commit_update(int deviceID){
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.commit(deviceID);
+}
+
+int abandon_update(int deviceID){
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.abandon_update(deviceID);
 }
 
 int load_sequence_file(int deviceID, const char * seqFile){
+	TRACE_SPAN(__func__, "api");
 	try {
 		return APSRack_.load_sequence_file(deviceID, string(seqFile));
 	} catch (...) {
@@ -139,135 +246,234 @@ int load_sequence_file(int deviceID, const char * seqFile){
 }
 
 int clear_channel_data(int deviceID) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.clear_channel_data(deviceID);
 }
 
 int run(int deviceID) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.run(deviceID);
 }
 
 int stop(int deviceID) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.stop(deviceID);
 }
 
 int get_running(int deviceID){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.get_running(deviceID);
 }
 
 int set_file_logging_level(const plog::Severity severity){
+	TRACE_SPAN(__func__, "api");
 	plog::get<FILE_LOG>()->setMaxSeverity(severity);
   return 1;
 }
 
 int set_console_logging_level(const plog::Severity severity){
+	TRACE_SPAN(__func__, "api");
   plog::get<CONSOLE_LOG>()->setMaxSeverity(severity);
   return 1;
 }
 
 int set_trigger_source(int deviceID, int triggerSource) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.set_trigger_source(deviceID, TRIGGERSOURCE(triggerSource));
 }
 
 int get_trigger_source(int deviceID) {
+	TRACE_SPAN(__func__, "api");
 	return int(APSRack_.get_trigger_source(deviceID));
 }
 
 int set_trigger_interval(int deviceID, double interval){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.set_trigger_interval(deviceID, interval);
 }
 
 double get_trigger_interval(int deviceID){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.get_trigger_interval(deviceID);
 }
 
 int set_miniLL_repeat(int deviceID, unsigned short repeat){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.set_miniLL_repeat(deviceID, repeat);
 }
 
 int set_channel_offset(int deviceID, int channelNum, float offset){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.set_channel_offset(deviceID, channelNum, offset);
 }
 int set_channel_scale(int deviceID, int channelNum, float scale){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.set_channel_scale(deviceID, channelNum, scale);
 }
 int set_channel_enabled(int deviceID, int channelNum, int enable){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.set_channel_enabled(deviceID, channelNum, enable);
 }
 
 float get_channel_offset(int deviceID, int channelNum){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.get_channel_offset(deviceID, channelNum);
 }
 float get_channel_scale(int deviceID, int channelNum){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.get_channel_scale(deviceID, channelNum);
 }
 int get_channel_enabled(int deviceID, int channelNum){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.get_channel_enabled(deviceID, channelNum);
 }
 
 int set_LL_data_IQ(int deviceID, int channelNum, int length, unsigned short* addr, unsigned short* count,
 					unsigned short* trigger1, unsigned short * trigger2, unsigned short* repeat){
+	TRACE_SPAN(__func__, "api");
 	//Convert data pointers to vectors and passed through
 	return APSRack_.set_LL_data(deviceID, channelNum, WordVec(addr, addr+length), WordVec(count, count+length),
 			WordVec(trigger1, trigger1+length), WordVec(trigger2, trigger2+length), WordVec(repeat, repeat+length));
 }
 
 int set_run_mode(int deviceID, int channelNum, int mode) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.set_run_mode(deviceID, channelNum, RUN_MODE(mode));
 }
 
 int set_repeat_mode(int deviceID, int channelNum, int mode) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.set_repeat_mode(deviceID, channelNum, mode);
 }
 
 int read_PLL_chip_status(int deviceID) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.read_PLL_chip_status(deviceID);
 }
 
+//Re-read the host copies of the control registers from the device
+int resync_registers(int deviceID) {
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.resync_registers(deviceID);
+}
+
+//Check the host register copies against the device every so many bit updates (0 = never)
+int set_register_check_interval(int deviceID, int interval) {
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.set_register_check_interval(deviceID, interval);
+}
+
+//Largest USB write (bytes) used for block uploads; defaults to the 64kB maximum USB transfer size
+int set_transfer_size(int deviceID, int transferSize) {
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.set_transfer_size(deviceID, transferSize);
+}
+
+int get_transfer_size(int deviceID) {
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.get_transfer_size(deviceID);
+}
+
+int set_transfer_profile(int deviceID, int profile) {
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.set_transfer_profile(deviceID, profile);
+}
+
+int get_transfer_profile(int deviceID) {
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.get_transfer_profile(deviceID);
+}
+
+int get_io_stats(int deviceID, int op, unsigned long long * values, int numValues) {
+	TRACE_SPAN(__func__, "api");
+	static_assert(sizeof(unsigned long long) == sizeof(uint64_t), "IO stats are copied as 64 bit counters");
+	return APSRack_.get_io_stats(deviceID, op, reinterpret_cast<uint64_t *>(values), numValues);
+}
+
+int reset_io_stats(int deviceID) {
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.reset_io_stats(deviceID);
+}
+
+int clear_upload_cache(int deviceID) {
+	TRACE_SPAN(__func__, "api");
+	return APSRack_.clear_upload_cache(deviceID);
+}
+
 int save_state_files() {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.save_state_files();
 }
 
 int read_state_files() {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.read_state_files();
 }
 
 int save_bulk_state_file() {
+	TRACE_SPAN(__func__, "api");
 	string fileName = "";
 	return APSRack_.save_bulk_state_file(fileName);
 }
 int read_bulk_state_file() {
+	TRACE_SPAN(__func__, "api");
 	string fileName = "";
 	return APSRack_.read_bulk_state_file(fileName);
 }
 
 int raw_write(int deviceID, int numBytes, UCHAR* data){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.raw_write(deviceID, numBytes, data);
 }
 
 int raw_read(int deviceID, int fpga){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.raw_read(deviceID, FPGASELECT(fpga));
 }
 
 int read_register(int deviceID, int fpga, int addr){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.read_register(deviceID, FPGASELECT(fpga), addr);
 }
 
 int read_status_ctrl(int deviceID){
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.read_status_control(deviceID);
 }
 
 int enable_oscillator(int deviceID) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.enable_oscillator(deviceID);
 }
 
 int disable_oscillator(int deviceID) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.disable_oscillator(deviceID);
 }
 
 int program_FPGA(int deviceID, char* bitFile, int chipSelect, int expectedVersion) {
+	TRACE_SPAN(__func__, "api");
 	return APSRack_.program_FPGA(deviceID, string(bitFile), FPGASELECT(chipSelect), expectedVersion);
 }
 
+//Number of simulated units and their USB link: latency per transfer (us) and bandwidth (MB/s, 0 = unlimited)
+int set_simulated_devices(int numDevices, double latency, double bandwidth) {
+	TRACE_SPAN(__func__, "api");
+	FTDI::set_num_simulated_devices(numDevices);
+	SimAPS::set_default_link_model(latency, 1e6*bandwidth);
+	//Pick up the new device list
+	APSRack_.init();
+	return APS_OK;
+}
+
+int start_trace(char * fileName) {
+	return Tracer::start(string(fileName));
+}
+
+int stop_trace() {
+	return Tracer::stop();
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,7 +23,8 @@ enum APSErrorCode {
 	APS_OK,
 	APS_UNKNOWN_ERROR = -1,
 	APS_FILE_ERROR = -2,
-        APS_LOG_ERROR = -3
+        APS_LOG_ERROR = -3,
+	APS_NOT_CONNECTED = -4
 };
 
 
@@ -41,6 +42,8 @@ EXPORT int disconnect_by_serial(char *);
 EXPORT int serial2ID(char *);
 
 EXPORT int initAPS(int, char*, int);
+//Initialize all connected units in parallel; per-unit statuses and init times (s) go into arrays of get_numDevices() (either may be NULL)
+EXPORT int init_all(char*, int, int*, double*);
 EXPORT int read_bitfile_version(int);
 
 EXPORT int set_sampleRate(int, int);
@@ -62,6 +65,22 @@ EXPORT int set_miniLL_repeat(int, unsigned short);
 
 EXPORT int set_waveform_float(int, int, float*, int);
 EXPORT int set_waveform_int(int, int, short*, int);
+EXPORT int set_waveform_segment_float(int, int, int, float*, int);
+EXPORT int set_waveform_segment_int(int, int, int, short*, int);
+
+//Named pulses packed into a channel's waveform memory; addr and count are filled in for link list entries.
+//add_pulse returns 1 when other pulses were moved to make room (see APS::add_pulse)
+EXPORT int add_pulse_float(int, int, const char *, float*, int, unsigned short*, unsigned short*);
+EXPORT int add_pulse_int(int, int, const char *, short*, int, unsigned short*, unsigned short*);
+EXPORT int remove_pulse(int, int, const char *);
+EXPORT int get_pulse(int, int, const char *, unsigned short*, unsigned short*);
+EXPORT int compact_waveform_library(int, int);
+
+//Queue waveform and register changes until commit_update and send them in one flush (see APS::begin_update)
+EXPORT int begin_update(int);
+EXPORT int commit_update(int);
+//Drop everything queued since begin_update instead of sending it
+EXPORT int abandon_update(int);
 
 EXPORT int set_LL_data_IQ(int, int, int, unsigned short*, unsigned short*, unsigned short*, unsigned short*, unsigned short*);
 
@@ -91,11 +110,31 @@ EXPORT int raw_read(int, int);
 EXPORT int read_register(int, int, int);
 EXPORT int read_status_ctrl(int);
 EXPORT int read_PLL_chip_status(int);
+EXPORT int resync_registers(int);
+EXPORT int set_register_check_interval(int, int);
+EXPORT int set_transfer_size(int, int);
+EXPORT int get_transfer_size(int);
+EXPORT int set_transfer_profile(int, int);
+EXPORT int get_transfer_profile(int);
+//USB traffic counters for an operation (write, read, SPI, flush, streaming refill, upload cache hit, upload cache miss):
+//count, bytes, total time (ns) and a latency histogram in power of two microsecond buckets. Returns the number of values filled in.
+EXPORT int get_io_stats(int, int, unsigned long long*, int);
+EXPORT int reset_io_stats(int);
+//Waveform and link list uploads matching what the memory already holds are skipped; this forgets what it holds
+EXPORT int clear_upload_cache(int);
+
+//Timeline of C API calls, init phases, flushes and streaming cycles in the Chrome trace event format
+EXPORT int start_trace(char *);
+//Returns the number of spans written
+EXPORT int stop_trace();
 EXPORT int enable_oscillator(int);
 EXPORT int disable_oscillator(int);
 
 EXPORT int program_FPGA(int, char*, int, int);
 
+/* simulated units (serials SIM0, SIM1, ...) listed after any real ones */
+EXPORT int set_simulated_devices(int, double, double);
+
 
 
 #ifdef __cplusplus
@@ -0,0 +1,1319 @@
+/*
+ * simtests.cpp
+ *
+ * Checks of the driver against simulated APS units and the legacy code paths; none of these need
+ * an APS attached. Each returns the number of failed checks.
+ */
+
+#include "headings.h"
+
+#include "libaps.h"
+#include "legacy.h"
+
+#include "test.h"
+
+#include <numeric>
+#include <random>
+
+namespace {
+
+WordVec build_payload(const size_t & numWords) {
+	WordVec data(numWords);
+	for (size_t ct = 0; ct < numWords; ct++) {
+		data[ct] = static_cast<USHORT>(ct*7919 + 13);
+	}
+	return data;
+}
+
+//Connect to the only simulated unit; -1 if it isn't there
+int connect_sim(const double & latency, const double & bandwidth) {
+	set_simulated_devices(1, latency, bandwidth);
+	char serial[] = "SIM0";
+	int deviceID = serial2ID(serial);
+	if (deviceID < 0 || connect_by_ID(deviceID) != 0) {
+		cout << "FAILED to connect to the simulated APS" << endl;
+		set_simulated_devices(0, 0, 0);
+		return -1;
+	}
+	return deviceID;
+}
+
+void disconnect_sim(const int & deviceID) {
+	disconnect_by_ID(deviceID);
+	set_simulated_devices(0, 0, 0);
+}
+
+//The simulated units only frame the configuration data so any bytes will do for the bitfiles
+void write_bitfiles(const string & bitFile, const size_t & numBytes, const char & fill) {
+	for (auto suffix : {"_FPGA1.bit", "_FPGA2.bit"}) {
+		std::ofstream FID(bitFile + suffix, std::ios::out | std::ios::binary);
+		FID << string(numBytes, fill);
+	}
+}
+
+void remove_bitfiles(const string & bitFile) {
+	for (auto suffix : {"_FPGA1.bit", "_FPGA2.bit"}) {
+		std::remove((bitFile + suffix).c_str());
+	}
+}
+
+std::pair<unsigned long long, unsigned long long> cache_counts(const int & deviceID) {
+	vector<unsigned long long> values(IOStats::NUM_VALUES);
+	get_io_stats(deviceID, IO_CACHE_HIT, values.data(), values.size());
+	unsigned long long hits = values[0];
+	get_io_stats(deviceID, IO_CACHE_MISS, values.data(), values.size());
+	return {hits, values[0]};
+}
+
+//Waveform words of a DAC that differ from the samples, every stride-th one
+size_t waveform_mismatches(const int & deviceID, const int & dac, const vector<short> & samples, const size_t & stride = 1, const size_t & offset = 0) {
+	size_t mismatches = 0;
+	const ULONG bank = (dac % 2) ? FPGA_BANKSEL_WF_CHB : FPGA_BANKSEL_WF_CHA;
+	for (size_t ct = 0; ct < samples.size(); ct += stride) {
+		mismatches += USHORT(read_register(deviceID, dac2fpga(dac), bank | (offset + ct))) != USHORT(samples[ct]);
+	}
+	return mismatches;
+}
+
+//An APS1 binary sequence file with the same waveform on every channel. The link list flag for channel 1 without
+//IQ mode is something load_sequence_file can not read, which makes it fail after the channels were loaded.
+void write_sequence_file(const string & fileName, const vector<short> & waveform, const bool & unreadableLL) {
+	std::ofstream FID(fileName, std::ios::out | std::ios::binary);
+	const char header[8] = {0};
+	const bool channelDataFor[4] = {true, true, true, true};
+	const bool miniLLRepeat = false, isIQMode = false;
+	const bool hasLLs[2] = {unreadableLL, false};
+	const uint64_t length = waveform.size();
+	FID.write(header, sizeof(header));
+	FID.write(reinterpret_cast<const char *>(channelDataFor), sizeof(channelDataFor));
+	FID.write(reinterpret_cast<const char *>(&miniLLRepeat), sizeof(bool));
+	for (int chanct = 0; chanct < 4; chanct++) {
+		FID.write(reinterpret_cast<const char *>(&isIQMode), sizeof(bool));
+		FID.write(reinterpret_cast<const char *>(&length), sizeof(uint64_t));
+		FID.write(reinterpret_cast<const char *>(waveform.data()), waveform.size()*sizeof(int16_t));
+	}
+	FID.write(reinterpret_cast<const char *>(hasLLs), sizeof(hasLLs));
+}
+
+} //end anonymous namespace
+
+//The block-write encoder against the legacy encoder, whole and resumed across transfer buffers
+int test::encoderTests() {
+	int failures = 0;
+
+	//Every tail length of the 1/2/4 word chunking must match
+	vector<size_t> lengths(16);
+	std::iota(lengths.begin(), lengths.end(), 0);
+	lengths.push_back(5*MAX_LL_LENGTH);
+	for (size_t numWords : lengths) {
+		WordVec data = build_payload(numWords);
+		vector<UCHAR> legacyQueue, newQueue(FPGA::format_length(numWords));
+		vector<size_t> legacyOffsets, newOffsets(FPGA::num_cmd_bytes(numWords));
+		legacy::queue(ALL_FPGAS, FPGA_BANKSEL_LL_CHA | 17, data, legacyQueue, legacyOffsets);
+		size_t numBytes = FPGA::format(ALL_FPGAS, FPGA_BANKSEL_LL_CHA | 17, data.data(), numWords, newQueue.data(), newOffsets.data());
+		if (numBytes != newQueue.size() || legacyQueue != newQueue || legacyOffsets != newOffsets) {
+			cout << "MISMATCH between legacy and new encoder for " << numWords << " words" << endl;
+			failures++;
+		}
+	}
+
+	//The resumable encoder has to reproduce FPGA::format whatever the buffer size
+	for (size_t numWords : {0, 1, 2, 3, 4, 5, 7, 33, 1001}) {
+		WordVec data = build_payload(numWords);
+		vector<UCHAR> expected(FPGA::format_length(numWords));
+		FPGA::format(FPGA2, FPGA_BANKSEL_WF_CHB | 3, data.data(), numWords, expected.data(), nullptr);
+		for (size_t bufferSize : {9, 13, 64, 4096}) {
+			FPGA::BlockEncoder encoder(FPGA2, FPGA_BANKSEL_WF_CHB | 3, data.data(), numWords);
+			vector<UCHAR> encoded, buffer(bufferSize);
+			while (!encoder.done()) {
+				size_t numBytes = encoder.encode(buffer.data(), bufferSize);
+				encoded.insert(encoded.end(), buffer.begin(), buffer.begin() + numBytes);
+			}
+			if (encoded != expected) {
+				cout << "MISMATCH in the resumable encoder for " << numWords << " words in " << bufferSize << " byte buffers" << endl;
+				failures++;
+			}
+		}
+	}
+	return failures;
+}
+
+//Each supported word packing kernel against the scalar one
+int test::packTests() {
+	int failures = 0;
+	const FPGA::PACK_KERNEL defaultKernel = FPGA::get_pack_kernel();
+	WordVec data = build_payload(5*MAX_LL_LENGTH);
+
+	FPGA::set_pack_kernel(FPGA::PACK_SCALAR);
+	vector<UCHAR> reference(FPGA::format_length(data.size()));
+	FPGA::format(FPGA1, FPGA_BANKSEL_LL_CHA, data.data(), data.size(), reference.data(), nullptr);
+
+	for (auto kernel : {FPGA::PACK_SSSE3, FPGA::PACK_AVX2, FPGA::PACK_NEON}) {
+		if (!FPGA::pack_kernel_supported(kernel)) continue;
+		//Every length up to a few vector widths from an odd start, then the full payload
+		for (size_t numWords = 0; numWords < 64; numWords++) {
+			vector<UCHAR> expected(FPGA::format_length(numWords)), got(FPGA::format_length(numWords));
+			FPGA::set_pack_kernel(FPGA::PACK_SCALAR);
+			FPGA::format(FPGA2, 0, data.data() + 1, numWords, expected.data(), nullptr);
+			FPGA::set_pack_kernel(kernel);
+			FPGA::format(FPGA2, 0, data.data() + 1, numWords, got.data(), nullptr);
+			if (expected != got) {
+				cout << "MISMATCH for " << FPGA::pack_kernel_name(kernel) << " with " << numWords << " words" << endl;
+				failures++;
+			}
+		}
+		vector<UCHAR> packet(reference.size());
+		FPGA::format(FPGA1, FPGA_BANKSEL_LL_CHA, data.data(), data.size(), packet.data(), nullptr);
+		if (packet != reference) {
+			cout << "MISMATCH for " << FPGA::pack_kernel_name(kernel) << endl;
+			failures++;
+		}
+	}
+	FPGA::set_pack_kernel(defaultKernel);
+	return failures;
+}
+
+//Each supported waveform prep kernel against the scalar one and the legacy multi-pass prep_waveform
+int test::prepTests() {
+	int failures = 0;
+	const WaveformPrep::PREP_KERNEL defaultKernel = WaveformPrep::get_prep_kernel();
+
+	//A full length waveform running 20% past full scale both ways, plus the awkward values
+	vector<float> waveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = 1.2f*std::sin(2*M_PI*ct/1000.0);
+	}
+	const vector<float> special = {0.0f, -0.0f, 0.5f/MAX_WF_AMP, 1.5f/MAX_WF_AMP, -0.5f/MAX_WF_AMP, 1.0f, -1.0f, 1.0f + 0.5f/MAX_WF_AMP,
+		-1.0f - 0.5f/MAX_WF_AMP, 1e30f, -1e30f, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+		std::numeric_limits<float>::quiet_NaN()};
+	std::copy(special.begin(), special.end(), waveform.begin() + 123);
+	const float scale = 0.9f, offset = 0.05f;
+
+	WaveformPrep::set_prep_kernel(WaveformPrep::PREP_SCALAR);
+	vector<short> reference(waveform.size());
+	WaveformPrep::ClipCounts refClips = WaveformPrep::prep_samples(waveform.data(), waveform.size(), scale, offset, reference.data());
+
+	//Samples the old passes handled without overflowing the int16 conversion come out the same, truncated
+	vector<float> inRange(waveform.begin() + 200, waveform.end());
+	vector<short> legacyVec = legacy::prep_waveform(inRange, scale, offset);
+	vector<short> fusedVec(inRange.size());
+	WaveformPrep::prep_samples(inRange.data(), inRange.size(), scale, offset, fusedVec.data());
+	for (size_t ct = 0; ct < inRange.size(); ct++) {
+		if (legacyVec[ct] != fusedVec[ct]) {
+			cout << "MISMATCH against the legacy prep_waveform at " << ct << ": " << legacyVec[ct] << " vs. " << fusedVec[ct] << endl;
+			failures++;
+			break;
+		}
+	}
+	if (refClips.high == 0 || refClips.low == 0 || *std::max_element(reference.begin(), reference.end()) != MAX_WF_AMP
+			|| *std::min_element(reference.begin(), reference.end()) != -MAX_WF_AMP || reference[123+13] != -MAX_WF_AMP) {
+		cout << "FAILED to clip the out of range samples" << endl;
+		failures++;
+	}
+
+	for (auto kernel : {WaveformPrep::PREP_SSE2, WaveformPrep::PREP_AVX2, WaveformPrep::PREP_NEON}) {
+		if (!WaveformPrep::prep_kernel_supported(kernel)) continue;
+		//Every length up to a few vector widths from an odd start, then the full waveform
+		for (size_t numPts = 0; numPts < 64; numPts++) {
+			vector<short> expected(numPts), got(numPts);
+			WaveformPrep::set_prep_kernel(WaveformPrep::PREP_SCALAR);
+			WaveformPrep::ClipCounts expectedClips = WaveformPrep::prep_samples(waveform.data() + 117, numPts, scale, offset, expected.data());
+			WaveformPrep::set_prep_kernel(kernel);
+			WaveformPrep::ClipCounts gotClips = WaveformPrep::prep_samples(waveform.data() + 117, numPts, scale, offset, got.data());
+			if (expected != got || expectedClips.high != gotClips.high || expectedClips.low != gotClips.low) {
+				cout << "MISMATCH for " << WaveformPrep::prep_kernel_name(kernel) << " with " << numPts << " samples" << endl;
+				failures++;
+			}
+		}
+		vector<short> prepVec(waveform.size());
+		WaveformPrep::ClipCounts clips = WaveformPrep::prep_samples(waveform.data(), waveform.size(), scale, offset, prepVec.data());
+		if (prepVec != reference || clips.high != refClips.high || clips.low != refClips.low) {
+			cout << "MISMATCH for " << WaveformPrep::prep_kernel_name(kernel) << endl;
+			failures++;
+		}
+	}
+	WaveformPrep::set_prep_kernel(defaultKernel);
+
+	//At unit scale and zero offset clipping int16 samples has to agree with the float round trip
+	vector<short> intWaveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < intWaveform.size(); ct++) {
+		intWaveform[ct] = short(10000*std::sin(2*M_PI*ct/1000.0));
+	}
+	for (short extreme : {short(-32768), short(32767), short(MAX_WF_AMP), short(-MAX_WF_AMP), short(MAX_WF_AMP+1), short(-MAX_WF_AMP-1)}) {
+		intWaveform[extreme & 0x3FF] = extreme;
+	}
+	vector<float> asFloat(intWaveform.size());
+	for (size_t ct = 0; ct < intWaveform.size(); ct++) {
+		asFloat[ct] = float(intWaveform[ct])/MAX_WF_AMP;
+	}
+	vector<short> viaFloat(intWaveform.size()), clipped(intWaveform.size());
+	WaveformPrep::ClipCounts floatClips = WaveformPrep::prep_samples(asFloat.data(), asFloat.size(), 1.0f, 0.0f, viaFloat.data());
+	WaveformPrep::ClipCounts intClips = WaveformPrep::clip_samples(intWaveform.data(), intWaveform.size(), clipped.data());
+	if (viaFloat != clipped || floatClips.high != intClips.high || floatClips.low != intClips.low) {
+		cout << "MISMATCH between clipping int16 samples and the float prep" << endl;
+		failures++;
+	}
+	return failures;
+}
+
+//Int16 channels held as DAC counts against the same samples held as floats
+int test::channelTests() {
+	int failures = 0;
+
+	vector<short> waveform(MAX_WF_LENGTH - 5);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(10000*std::sin(2*M_PI*ct/1000.0));
+	}
+	vector<float> asFloat(waveform.size());
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		asFloat[ct] = float(waveform[ct])/MAX_WF_AMP;
+	}
+	vector<short> pulse(300, short(-12000));
+	vector<float> floatPulse(pulse.size(), 0.25f);
+
+	Channel intChannel(0), floatChannel(1);
+	vector<short> intPrep, floatPrep;
+	const vector<std::pair<float, float>> settings = {{1.0f, 0.0f}, {0.7f, 0.0f}, {1.0f, 0.1f}, {-1.3f, -0.05f}};
+	for (auto & setting : settings) {
+		for (Channel * channel : {&intChannel, &floatChannel}) {
+			channel->set_scale(setting.first);
+			channel->set_offset(setting.second);
+		}
+		intChannel.set_waveform(waveform);
+		floatChannel.set_waveform(asFloat);
+		intChannel.prep_waveform(intPrep);
+		floatChannel.prep_waveform(floatPrep);
+		if (!intChannel.holds_int() || intPrep != floatPrep) {
+			cout << "MISMATCH for scale " << setting.first << " offset " << setting.second << endl;
+			failures++;
+		}
+		//A partial span, an int16 segment and a growing one; then a float segment moves the channel to floats
+		intChannel.prep_waveform(intPrep, 1024, 3072);
+		floatChannel.prep_waveform(floatPrep, 1024, 3072);
+		failures += (intPrep != floatPrep);
+		for (Channel * channel : {&intChannel, &floatChannel}) {
+			channel->set_waveform_segment(5000, pulse.data(), pulse.size());
+			channel->set_waveform_segment(waveform.size() - 100, pulse.data(), pulse.size() - 190);
+		}
+		intChannel.prep_waveform(intPrep);
+		floatChannel.prep_waveform(floatPrep);
+		failures += (!intChannel.holds_int() || intPrep != floatPrep);
+		for (Channel * channel : {&intChannel, &floatChannel}) {
+			channel->set_waveform_segment(64, floatPulse.data(), floatPulse.size());
+		}
+		intChannel.prep_waveform(intPrep);
+		floatChannel.prep_waveform(floatPrep);
+		if (intChannel.holds_int() || intPrep != floatPrep) {
+			cout << "MISMATCH after segment updates for scale " << setting.first << " offset " << setting.second << endl;
+			failures++;
+		}
+	}
+	return failures;
+}
+
+//SPI bit expansion and batched SPI transactions against one at a time
+int test::spiTests() {
+	int failures = 0;
+
+	//Every byte value has to expand the same way as the shift and mask loop
+	for (unsigned byte = 0; byte < 256; byte++) {
+		UCHAR src = static_cast<UCHAR>(byte), bits[8];
+		FPGA::serialize_SPI_bits(&src, 1, bits);
+		vector<UCHAR> legacyBits = legacy::serialize_SPI(APS_PLL_SPI, {src});
+		if (!std::equal(bits, bits + 8, legacyBits.begin() + 1)) {
+			cout << "MISMATCH in SPI bit expansion of " << myhex << byte << endl;
+			failures++;
+		}
+	}
+
+	vector<PLLAddrData> routine;
+	for (ULONG addr = 0xF0; addr < 0xF0 + 24; addr++) {
+		routine.push_back(PLLAddrData(addr, static_cast<UCHAR>(addr*37)));
+	}
+	SimAPS singleAPS, batchAPS;
+	singleAPS.connect(0);
+	batchAPS.connect(0);
+	for (auto & instr : routine) {
+		FPGA::write_SPI(singleAPS, APS_PLL_SPI, instr.first, {instr.second});
+	}
+	FPGA::SPIBatch batch;
+	batch.write(APS_PLL_SPI, routine);
+	batch.send(batchAPS);
+	for (auto & instr : routine) {
+		if (singleAPS.peek_PLL(instr.first) != instr.second || batchAPS.peek_PLL(instr.first) != instr.second) {
+			cout << "MISMATCH in PLL register " << myhex << instr.first << endl;
+			failures++;
+		}
+	}
+
+	vector<UCHAR> singleData(routine.size()), batchData;
+	for (size_t ct = 0; ct < routine.size(); ct++) {
+		FPGA::read_SPI(singleAPS, APS_PLL_SPI, routine[ct].first, &singleData[ct]);
+	}
+	for (auto & instr : routine) {
+		batch.read(APS_PLL_SPI, instr.first);
+	}
+	batch.send(batchAPS, &batchData);
+	if (batchData != singleData) {
+		cout << "MISMATCH between batched and single SPI reads" << endl;
+		failures++;
+	}
+	for (size_t ct = 0; ct < routine.size(); ct++) {
+		if (singleData[ct] != routine[ct].second) {
+			cout << "MISMATCH in PLL readback of " << myhex << routine[ct].first << endl;
+			failures++;
+		}
+	}
+	return failures;
+}
+
+//Batched register reads, waiting on the receive queue and bitfile programming against a simulated unit
+int test::transportTests() {
+	int failures = 0;
+
+	SimAPS aps;
+	aps.connect(0);
+	for (USHORT ct = 0; ct < 16; ct++) {
+		FPGA::write_FPGA(aps, FPGA_BANKSEL_CSR | ct, USHORT(ct*0x1111), ALL_FPGAS);
+	}
+	vector<FPGA::RegAddr> regs = {{FPGA_ADDR_TRIG_INTERVAL, FPGA1}, {FPGA_ADDR_TRIG_INTERVAL+1, FPGA1}};
+	regs.insert(regs.end(), 20, FPGA::RegAddr(FPGA_ADDR_PLL_STATUS, FPGA2));
+	for (ULONG ct = 0; ct < 16; ct++) {
+		regs.push_back(FPGA::RegAddr(FPGA_BANKSEL_CSR | ct, FPGA1));
+		regs.push_back(FPGA::RegAddr(FPGA_BANKSEL_CSR | ct, FPGA2));
+	}
+	WordVec single(regs.size());
+	for (size_t ct = 0; ct < regs.size(); ct++) {
+		single[ct] = FPGA::read_FPGA(aps, regs[ct].first, regs[ct].second);
+	}
+	if (single != FPGA::read_FPGA_batch(aps, regs)) {
+		cout << "MISMATCH between single and batched register reads" << endl;
+		failures++;
+	}
+
+	UCHAR legacyByte = 0, readByte = 0;
+	legacy::read_status(aps, &legacyByte);
+	FPGA::read_register(aps, APS_CONF_STAT, 0, INVALID_FPGA, &readByte);
+	if (legacyByte != readByte) {
+		cout << "MISMATCH in the CONF_STAT read: " << int(legacyByte) << " vs. " << int(readByte) << endl;
+		failures++;
+	}
+	//Nothing is coming so the wait has to give up at its deadline
+	DWORD rxBytes = 1;
+	auto start = std::chrono::steady_clock::now();
+	FT_STATUS ftStatus = aps.wait_for_rx(1, 5, &rxBytes);
+	double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (!FT_SUCCESS(ftStatus) || rxBytes != 0 || waited < 5e-3 || waited > 50e-3) {
+		cout << "FAILED: the receive wait did not time out at its deadline" << endl;
+		failures++;
+	}
+
+	vector<UCHAR> bitFile(128*1024 + 17);
+	for (size_t ct = 0; ct < bitFile.size(); ct++) {
+		bitFile[ct] = static_cast<UCHAR>(ct*131 + 7);
+	}
+	for (auto mode : {FPGA::PROGRAM_PER_PACKET, FPGA::PROGRAM_BULK}) {
+		SimAPS programAPS;
+		programAPS.connect(0);
+		int bytesProgrammed = FPGA::program_FPGA(programAPS, bitFile, ALL_FPGAS, mode);
+		if (bytesProgrammed != static_cast<int>(bitFile.size()) || !programAPS.is_programmed(FPGA1) || !programAPS.is_programmed(FPGA2)) {
+			cout << "FAILED to program the simulated FPGAs in mode " << mode << endl;
+			failures++;
+		}
+	}
+	return failures;
+}
+
+//The upload engine and block writes split across transfers of each size
+int test::uploadTests() {
+	int failures = 0;
+
+	WordVec waveform = build_payload(MAX_WF_LENGTH);
+	for (size_t transferSize : {1024, 65536, 262144}) {
+		SimAPS aps;
+		aps.connect(0);
+		aps.set_transfer_size(transferSize);
+		UploadEngine uploader(aps);
+		uploader.queue(FPGA1, FPGA_BANKSEL_WF_CHA, waveform);
+		int bytesWritten = uploader.flush();
+
+		aps.reset_counters();
+		FPGA::write_block(aps, FPGA1, FPGA_BANKSEL_WF_CHB, waveform.data(), waveform.size());
+		size_t mismatches = 0;
+		for (size_t ct = 0; ct < waveform.size(); ct++) {
+			mismatches += (aps.peek(FPGA1, FPGA_BANKSEL_WF_CHA | ct) != waveform[ct]) + (aps.peek(FPGA1, FPGA_BANKSEL_WF_CHB | ct) != waveform[ct]);
+		}
+		const size_t numBytes = FPGA::format_length(waveform.size());
+		if (mismatches || bytesWritten != static_cast<int>(numBytes) || aps.bytes_written() != numBytes
+				|| aps.num_writes() < (numBytes + transferSize - 1) / transferSize) {
+			cout << "MISMATCH in uploads with " << transferSize << " byte transfers" << endl;
+			failures++;
+		}
+	}
+
+	//A transfer cut short by the write timeout ends the flush: nothing follows the partial command
+	SimAPS slowAPS;
+	slowAPS.connect(0);
+	slowAPS.set_link_model(0, 200e3);
+	slowAPS.set_driver_timer_model(true);
+	slowAPS.set_profile(PROFILE_STREAMING_POLL);
+	UploadEngine slowUploader(slowAPS);
+	slowUploader.queue(FPGA1, FPGA_BANKSEL_WF_CHA, waveform);
+	const int bytesWritten = slowUploader.flush();
+	if (bytesWritten >= static_cast<int>(slowUploader.get_transfer_size()) || slowAPS.num_writes() != 1 || !slowUploader.empty()) {
+		cout << "FAILED to stop an upload after a short write: " << slowAPS.num_writes() << " writes, " << bytesWritten << " bytes" << endl;
+		failures++;
+	}
+	return failures;
+}
+
+//Transfer profile write timeouts and the nesting of profile guards
+int test::profileTests() {
+	int failures = 0;
+
+	//A single 74 kB transfer over a 100 kB/s link outlasts the interactive write timeout but not the bulk one
+	WordVec waveform = build_payload(MAX_WF_LENGTH);
+	const int numBytes = FPGA::format_length(waveform.size());
+	for (auto profile : {PROFILE_INTERACTIVE, PROFILE_BULK_UPLOAD}) {
+		SimAPS aps;
+		aps.connect(0);
+		aps.set_link_model(0, 100e3);
+		aps.set_driver_timer_model(true);
+		aps.set_transfer_size(1 << 17);
+		UploadEngine uploader(aps);
+		int bytesWritten = 0;
+		{
+			ProfileGuard guard(aps, profile);
+			uploader.queue(FPGA1, FPGA_BANKSEL_WF_CHA, waveform);
+			bytesWritten = uploader.flush();
+		}
+		if ((profile == PROFILE_BULK_UPLOAD) != (bytesWritten == numBytes)) {
+			cout << "FAILED: the " << Transport::profile_settings(profile).name << " profile write timeout was not applied" << endl;
+			failures++;
+		}
+	}
+
+	//Guards nest, pop in any order and only reach the driver when the active profile changes
+	SimAPS aps;
+	aps.connect(0);
+	bool ok = true;
+	{
+		ProfileGuard bulk(aps, PROFILE_BULK_UPLOAD);
+		ok &= aps.applied_profile().latencyTimer == Transport::profile_settings(PROFILE_BULK_UPLOAD).latencyTimer;
+		size_t poll = aps.push_profile(PROFILE_STREAMING_POLL);
+		ok &= aps.get_profile() == PROFILE_STREAMING_POLL;
+		ok &= aps.applied_profile().latencyTimer == Transport::profile_settings(PROFILE_STREAMING_POLL).latencyTimer;
+		aps.set_profile(PROFILE_INTERACTIVE);
+		ok &= aps.get_profile() == PROFILE_STREAMING_POLL;
+		aps.pop_profile(poll);
+		ok &= aps.get_profile() == PROFILE_BULK_UPLOAD;
+	}
+	ok &= aps.get_profile() == PROFILE_INTERACTIVE;
+	ok &= aps.applied_profile().latencyTimer == Transport::profile_settings(PROFILE_INTERACTIVE).latencyTimer;
+	if (!ok) {
+		cout << "FAILED: transfer profile guards did not restore the profile" << endl;
+		failures++;
+	}
+	return failures;
+}
+
+//Init of a simulated unit and a full waveform and link list upload read back through the register path
+int test::simInitTests() {
+	int failures = 0;
+
+	const string bitFile = "test_sim";
+	write_bitfiles(bitFile, 1 << 17, 0x5A);
+
+	WordVec payload = build_payload(MAX_WF_LENGTH);
+	vector<short> waveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(payload[ct] % (2*MAX_WF_AMP + 1)) - MAX_WF_AMP;
+	}
+	const size_t numEntries = MAX_LL_LENGTH - 1;
+	WordVec addr(numEntries), count(numEntries), trigger1(numEntries, 0), trigger2(numEntries, 0), repeat(numEntries, 0);
+	for (size_t ct = 0; ct < numEntries; ct++) {
+		addr[ct] = payload[ct] % 1024;
+		count[ct] = ct % 16;
+	}
+	WordVec expectedLL = legacy::get_packed_data(LLBank(addr, count, trigger1, trigger2, repeat), 0, numEntries);
+
+	int deviceID = connect_sim(0, 0);
+	if (deviceID < 0) return 1;
+	if (initAPS(deviceID, const_cast<char *>(bitFile.c_str()), 1) != 0 || read_bitfile_version(deviceID) != FIRMWARE_VERSION) {
+		cout << "FAILED to init the simulated APS" << endl;
+		failures++;
+	}
+	set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+	set_LL_data_IQ(deviceID, 0, numEntries, addr.data(), count.data(), trigger1.data(), trigger2.data(), repeat.data());
+	size_t mismatches = waveform_mismatches(deviceID, 0, waveform);
+	for (size_t ct = 0; ct < expectedLL.size(); ct++) {
+		mismatches += USHORT(read_register(deviceID, FPGA1, FPGA_BANKSEL_LL_CHA | ct)) != expectedLL[ct];
+	}
+	//A float waveform on the other channel goes through the float prep
+	vector<float> floatWaveform(waveform.size());
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		floatWaveform[ct] = float(waveform[ct])/MAX_WF_AMP;
+	}
+	set_waveform_float(deviceID, 1, floatWaveform.data(), floatWaveform.size());
+	mismatches += waveform_mismatches(deviceID, 1, waveform, 3);
+	if (mismatches) {
+		cout << "MISMATCH in " << mismatches << " words read back from the simulated APS" << endl;
+		failures++;
+	}
+	disconnect_sim(deviceID);
+	remove_bitfiles(bitFile);
+	return failures;
+}
+
+//Shadowed CSR bit updates against read-modify-writes in the FPGA layer
+int test::shadowTests() {
+	int failures = 0;
+
+	SimAPS legacyAPS;
+	legacyAPS.connect(0);
+	int deviceID = connect_sim(0, 0);
+	if (deviceID < 0) return 1;
+	for (bool on : {true, false, true}) {
+		for (int dac = 0; dac < 4; dac++) {
+			for (int mask : {(dac % 2) ? CSRMSK_CHB_OUTMODE : CSRMSK_CHA_OUTMODE, (dac % 2) ? CSRMSK_CHB_REPMODE : CSRMSK_CHA_REPMODE}) {
+				if (on) FPGA::set_bit(legacyAPS, dac2fpga(dac), FPGA_ADDR_CSR, mask);
+				else FPGA::clear_bit(legacyAPS, dac2fpga(dac), FPGA_ADDR_CSR, mask);
+			}
+			set_run_mode(deviceID, dac, on);
+			set_repeat_mode(deviceID, dac, on);
+		}
+	}
+	for (auto fpga : {FPGA1, FPGA2}) {
+		if (read_register(deviceID, fpga, FPGA_ADDR_CSR) != legacyAPS.peek(fpga, FPGA_ADDR_CSR)) {
+			cout << "MISMATCH in the CSR of FPGA " << fpga << endl;
+			failures++;
+		}
+	}
+
+	//Checking every bit update inside an update has to wait for the commit to send the writes; checking
+	//the queued writes would take the stale hardware values and the next update would build on them
+	set_register_check_interval(deviceID, 1);
+	for (bool on : {true, false}) {
+		begin_update(deviceID);
+		for (int dac = 0; dac < 4; dac++) {
+			for (int mask : {(dac % 2) ? CSRMSK_CHB_OUTMODE : CSRMSK_CHA_OUTMODE, (dac % 2) ? CSRMSK_CHB_REPMODE : CSRMSK_CHA_REPMODE}) {
+				if (on) FPGA::set_bit(legacyAPS, dac2fpga(dac), FPGA_ADDR_CSR, mask);
+				else FPGA::clear_bit(legacyAPS, dac2fpga(dac), FPGA_ADDR_CSR, mask);
+			}
+			set_run_mode(deviceID, dac, on);
+			set_repeat_mode(deviceID, dac, on);
+		}
+		vector<unsigned long long> values(IOStats::NUM_VALUES);
+		get_io_stats(deviceID, IO_READ, values.data(), values.size());
+		const unsigned long long numReads = values[0];
+		if (commit_update(deviceID) != 0) failures++;
+		get_io_stats(deviceID, IO_READ, values.data(), values.size());
+		if (values[0] == numReads) {
+			cout << "FAILED: no register check after committing an update" << endl;
+			failures++;
+		}
+		for (auto fpga : {FPGA1, FPGA2}) {
+			if (read_register(deviceID, fpga, FPGA_ADDR_CSR) != legacyAPS.peek(fpga, FPGA_ADDR_CSR)) {
+				cout << "MISMATCH in the CSR of FPGA " << fpga << " after an update with register checks" << endl;
+				failures++;
+			}
+		}
+	}
+	set_register_check_interval(deviceID, 0);
+
+	//A raw write behind the driver's back leaves the shadow unknown so the next bit update reads the CSR again
+	set_run_mode(deviceID, 0, 1);
+	const USHORT cleared = 0;
+	vector<UCHAR> packet(FPGA::format_length(1));
+	FPGA::format(FPGA1, FPGA_ADDR_CSR, &cleared, 1, packet.data(), nullptr);
+	raw_write(deviceID, int(packet.size()), packet.data());
+	set_repeat_mode(deviceID, 0, 1);
+	if (read_register(deviceID, FPGA1, FPGA_ADDR_CSR) != CSRMSK_CHA_REPMODE) {
+		cout << "MISMATCH in the CSR after a raw write" << endl;
+		failures++;
+	}
+	disconnect_sim(deviceID);
+	return failures;
+}
+
+//The shared bitfile cache across a rack and parallel init of it
+int test::rackTests() {
+	int failures = 0;
+
+	const string bitFile = "test_rack";
+	const size_t bitFileSize = 1 << 17;
+	write_bitfiles(bitFile, bitFileSize, 0x3C);
+	const string fileName = bitFile + "_FPGA1.bit";
+
+	//Init a rack of units one at a time and then all at once: each file should be read once
+	const int numDevices = 8;
+	BitfileCache::clear();
+	size_t startLoads = BitfileCache::num_loads(), startHits = BitfileCache::num_hits();
+	set_simulated_devices(numDevices, 0, 0);
+	for (int ct = 0; ct < numDevices; ct++) {
+		string serial = "SIM" + std::to_string(ct);
+		int deviceID = serial2ID(const_cast<char *>(serial.c_str()));
+		if (deviceID < 0 || connect_by_ID(deviceID) != 0 || initAPS(deviceID, const_cast<char *>(bitFile.c_str()), 1) != 0) {
+			cout << "FAILED to init simulated APS " << serial << endl;
+			failures++;
+		}
+	}
+	size_t numLoads = BitfileCache::num_loads() - startLoads, numHits = BitfileCache::num_hits() - startHits;
+	if (numLoads != 2 || numHits != 2*numDevices - 2) {
+		cout << "MISMATCH in bitfile cache use: " << numLoads << " loads, " << numHits << " hits" << endl;
+		failures++;
+	}
+
+	vector<int> statuses(numDevices, -1);
+	vector<double> initTimes(numDevices, 0);
+	if (init_all(const_cast<char *>(bitFile.c_str()), 1, statuses.data(), initTimes.data()) != 0) failures++;
+	for (int ct = 0; ct < numDevices; ct++) {
+		if (statuses[ct] != 0 || read_bitfile_version(ct) != FIRMWARE_VERSION) {
+			cout << "FAILED to init simulated APS " << ct << " in parallel" << endl;
+			failures++;
+		}
+	}
+	//Units that are not connected are skipped and reported as such
+	disconnect_by_ID(numDevices-1);
+	init_all(const_cast<char *>(bitFile.c_str()), 0, statuses.data(), nullptr);
+	if (statuses[numDevices-1] != APS_NOT_CONNECTED || statuses[0] != 0) {
+		cout << "MISMATCH in init_all statuses with a disconnected unit" << endl;
+		failures++;
+	}
+	//A bitfile that can't be read is a file error on every connected unit
+	const string missingFile = bitFile + ".missing";
+	if (init_all(const_cast<char *>(missingFile.c_str()), 1, statuses.data(), nullptr) != APS_FILE_ERROR
+			|| statuses[0] != APS_FILE_ERROR || statuses[numDevices-1] != APS_NOT_CONNECTED) {
+		cout << "MISMATCH in init_all statuses with a missing bitfile" << endl;
+		failures++;
+	}
+
+	//A changed file has to be picked up again
+	{
+		std::ofstream FID(fileName, std::ios::out | std::ios::binary);
+		FID << string(bitFileSize + 1, 0x3C);
+	}
+	auto image = BitfileCache::get(fileName, FPGA1);
+	if (!image || image->numBytes != bitFileSize + 1 || BitfileCache::num_loads() - startLoads != 3) {
+		cout << "FAILED to reload a changed bitfile" << endl;
+		failures++;
+	}
+
+	for (int ct = 0; ct < numDevices; ct++) {
+		disconnect_by_ID(ct);
+	}
+	set_simulated_devices(0, 0, 0);
+	remove_bitfiles(bitFile);
+	return failures;
+}
+
+//I/O counters: histogram buckets, concurrent recording and what an init and upload records
+int test::ioStatsTests() {
+	int failures = 0;
+
+	for (auto check : vector<std::pair<uint64_t, size_t>>{{0, 0}, {999, 0}, {1000, 1}, {1999, 1}, {2000, 2}, {3999, 2}, {4000, 3}, {uint64_t(1) << 62, IOStats::NUM_BUCKETS-1}}) {
+		if (IOStats::bucket_index(check.first) != check.second) {
+			cout << "MISMATCH in the histogram bucket for " << check.first << " ns" << endl;
+			failures++;
+		}
+	}
+
+	IOStats stats;
+	const size_t numRecords = 100000, numThreads = 4;
+	vector<std::thread> threads;
+	for (size_t ct = 0; ct < numThreads; ct++) {
+		threads.emplace_back([&stats, numRecords](){
+			for (size_t rec = 0; rec < numRecords; rec++) {
+				stats.record(IO_WRITE, 64, IOStats::clock::now());
+			}
+		});
+	}
+	for (auto & thread : threads) thread.join();
+	if (stats.count(IO_WRITE) != numThreads*numRecords || stats.bytes(IO_WRITE) != 64*stats.count(IO_WRITE)) {
+		cout << "MISMATCH in the I/O counters recorded from " << numThreads << " threads" << endl;
+		failures++;
+	}
+
+	const string bitFile = "test_iostats";
+	write_bitfiles(bitFile, 1 << 17, 0x5A);
+	int deviceID = connect_sim(0, 0);
+	if (deviceID < 0) return failures + 1;
+	reset_io_stats(deviceID);
+	initAPS(deviceID, const_cast<char *>(bitFile.c_str()), 1);
+	vector<short> waveform(MAX_WF_LENGTH, 1000);
+	set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+
+	vector<unsigned long long> values(IOStats::NUM_VALUES);
+	for (int op = IO_WRITE; op < NUM_IO_OPS; op++) {
+		if (get_io_stats(deviceID, op, values.data(), values.size()) != int(IOStats::NUM_VALUES)) {
+			cout << "FAILED to get the I/O statistics for operation " << op << endl;
+			failures++;
+			continue;
+		}
+		uint64_t histTotal = 0;
+		for (size_t bucket = 0; bucket < IOStats::NUM_BUCKETS; bucket++) {
+			histTotal += values[3+bucket];
+		}
+		if (histTotal != values[0]) {
+			cout << "MISMATCH between the count of operation " << op << " and its histogram" << endl;
+			failures++;
+		}
+	}
+	//Everything above the link went over it as writes and reads
+	get_io_stats(deviceID, IO_SPI, values.data(), values.size());
+	uint64_t numSPI = values[0];
+	get_io_stats(deviceID, IO_FLUSH, values.data(), values.size());
+	uint64_t flushBytes = values[1];
+	get_io_stats(deviceID, IO_WRITE, values.data(), values.size());
+	if (numSPI == 0 || flushBytes < FPGA::format_length(waveform.size()) || values[1] < flushBytes) {
+		cout << "FAILED: the I/O statistics missed SPI or flush traffic" << endl;
+		failures++;
+	}
+	reset_io_stats(deviceID);
+	get_io_stats(deviceID, IO_WRITE, values.data(), values.size());
+	if (values[0] != 0) {
+		cout << "FAILED to reset the I/O statistics" << endl;
+		failures++;
+	}
+	disconnect_sim(deviceID);
+	remove_bitfiles(bitFile);
+	return failures;
+}
+
+//The trace file of a simulated init and upload
+int test::traceTests() {
+	int failures = 0;
+
+	const string traceFile = "test_trace.json";
+	const string bitFile = "test_trace";
+	write_bitfiles(bitFile, 1 << 17, 0x5A);
+	Tracer::start(traceFile);
+	int deviceID = connect_sim(0, 0);
+	if (deviceID < 0) {
+		stop_trace();
+		return 1;
+	}
+	initAPS(deviceID, const_cast<char *>(bitFile.c_str()), 1);
+	vector<short> waveform(MAX_WF_LENGTH, 1000);
+	set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+	disconnect_sim(deviceID);
+	int numWritten = stop_trace();
+
+	std::ifstream FID(traceFile);
+	string json((std::istreambuf_iterator<char>(FID)), std::istreambuf_iterator<char>());
+	FID.close();
+	size_t numEvents = 0;
+	for (size_t pos = json.find("\"ph\":\"X\""); pos != string::npos; pos = json.find("\"ph\":\"X\"", pos+1)) {
+		numEvents++;
+	}
+	if (numEvents != size_t(numWritten) || json.compare(0, 2, "{\"") != 0 || json.find("\n]}") == string::npos || Tracer::num_dropped()) {
+		cout << "FAILED: the trace file is incomplete" << endl;
+		failures++;
+	}
+	for (auto name : {"\"initAPS\"", "\"APS::init\"", "\"APS::program_FPGA\"", "\"APS::test_PLL_sync\"", "\"APS::setup_DAC\"", "\"APS::flush\"", "\"set_waveform_int\""}) {
+		if (json.find(name) == string::npos) {
+			cout << "FAILED: no " << name << " span in the trace" << endl;
+			failures++;
+		}
+	}
+	remove_bitfiles(bitFile);
+	std::remove(traceFile.c_str());
+	return failures;
+}
+
+//Waveform segment updates, coalesced settings updates and broadcasts to both FPGAs read back
+int test::updateTests() {
+	int failures = 0;
+	int deviceID = connect_sim(0, 0);
+	if (deviceID < 0) return 1;
+
+	//A pulse from an unaligned start in a full channel
+	vector<short> waveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+	}
+	set_waveform_int(deviceID, 0, waveform.data(), waveform.size());
+	vector<short> pulse(100);
+	for (size_t ct = 0; ct < pulse.size(); ct++) {
+		pulse[ct] = short(37*ct);
+	}
+	set_waveform_segment_int(deviceID, 0, 1001, pulse.data(), pulse.size());
+	std::copy(pulse.begin(), pulse.end(), waveform.begin() + 1001);
+
+	//Growing a short waveform zero fills the gap and moves the length register
+	vector<short> shortWF(100, 1234), tail(10, -4321);
+	set_waveform_int(deviceID, 1, shortWF.data(), shortWF.size());
+	set_waveform_segment_int(deviceID, 1, 203, tail.data(), tail.size());
+	vector<short> expectedB(216, 0);
+	std::copy(shortWF.begin(), shortWF.end(), expectedB.begin());
+	std::copy(tail.begin(), tail.end(), expectedB.begin() + 203);
+
+	size_t mismatches = waveform_mismatches(deviceID, 0, waveform) + waveform_mismatches(deviceID, 1, expectedB);
+	if (mismatches || read_register(deviceID, FPGA1, FPGA_ADDR_CHB_WF_LENGTH) != int(expectedB.size()/WF_MODULUS - 1)) {
+		cout << "MISMATCH in " << mismatches << " waveform words read back after segment updates" << endl;
+		failures++;
+	}
+	if (set_waveform_segment_int(deviceID, 1, MAX_WF_LENGTH - 4, tail.data(), tail.size()) == 0) {
+		cout << "FAILED to reject a segment past the end of waveform memory" << endl;
+		failures++;
+	}
+
+	//A settings dictionary applied inside begin_update/commit has to leave the same memory as one call at a time
+	vector<short> settingsWF(4096);
+	for (size_t ct = 0; ct < settingsWF.size(); ct++) {
+		settingsWF[ct] = short(0.8*MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+	}
+	for (int dac = 0; dac < 4; dac++) {
+		set_waveform_int(deviceID, dac, settingsWF.data(), settingsWF.size());
+	}
+	begin_update(deviceID);
+	for (int dac = 0; dac < 4; dac++) {
+		set_channel_scale(deviceID, dac, 0.75f);
+		set_channel_offset(deviceID, dac, 0.1f);
+		set_channel_enabled(deviceID, dac, 1);
+		set_run_mode(deviceID, dac, RUN_WAVEFORM);
+	}
+	set_trigger_source(deviceID, INTERNAL);
+	set_trigger_interval(deviceID, 1e-3);
+	if (commit_update(deviceID) != 0) {
+		cout << "FAILED to commit the update" << endl;
+		failures++;
+	}
+	Channel channel(0);
+	channel.set_waveform(settingsWF);
+	channel.set_scale(0.75f);
+	channel.set_offset(0.1f);
+	vector<short> expected = channel.prep_waveform();
+	mismatches = 0;
+	for (int dac = 0; dac < 4; dac++) {
+		mismatches += waveform_mismatches(deviceID, dac, expected, 5);
+	}
+	if (mismatches) {
+		cout << "MISMATCH in " << mismatches << " waveform words read back after a coalesced update" << endl;
+		failures++;
+	}
+
+	//An IQ pair and the same link list on both FPGAs, broadcast on commit; then a Q channel that differs on FPGA2
+	vector<short> iWaveform(8192), qWaveform(8192), otherQ(8192);
+	for (size_t ct = 0; ct < iWaveform.size(); ct++) {
+		iWaveform[ct] = short(0.8*MAX_WF_AMP*std::cos(2*M_PI*ct/1000.0));
+		qWaveform[ct] = short(0.8*MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+		otherQ[ct] = short(-qWaveform[ct]);
+	}
+	const size_t numEntries = 1000;
+	WordVec addr(numEntries), count(numEntries), trigger1(numEntries, 0), trigger2(numEntries, 0), repeat(numEntries, 0);
+	for (size_t ct = 0; ct < numEntries; ct++) {
+		addr[ct] = (ct*37) % 1024;
+		count[ct] = ct % 16;
+	}
+	WordVec packed = legacy::get_packed_data(LLBank(addr, count, trigger1, trigger2, repeat), 0, numEntries);
+	clear_upload_cache(deviceID);
+	begin_update(deviceID);
+	for (int dac = 0; dac < 4; dac++) {
+		vector<short> & samples = (dac % 2) ? qWaveform : iWaveform;
+		set_channel_scale(deviceID, dac, 1.0f);
+		set_channel_offset(deviceID, dac, 0.0f);
+		set_waveform_int(deviceID, dac, samples.data(), samples.size());
+	}
+	for (int dac : {0, 2}) {
+		set_LL_data_IQ(deviceID, dac, numEntries, addr.data(), count.data(), trigger1.data(), trigger2.data(), repeat.data());
+	}
+	commit_update(deviceID);
+	begin_update(deviceID);
+	set_waveform_int(deviceID, 3, otherQ.data(), otherQ.size());
+	commit_update(deviceID);
+	mismatches = 0;
+	for (int dac = 0; dac < 4; dac++) {
+		mismatches += waveform_mismatches(deviceID, dac, (dac == 3) ? otherQ : (dac % 2) ? qWaveform : iWaveform, 3);
+	}
+	for (auto fpga : {FPGA1, FPGA2}) {
+		for (size_t ct = 0; ct < packed.size(); ct++) {
+			mismatches += USHORT(read_register(deviceID, fpga, FPGA_BANKSEL_LL_CHA | ct)) != packed[ct];
+		}
+	}
+	if (mismatches) {
+		cout << "MISMATCH in " << mismatches << " words read back after broadcast writes" << endl;
+		failures++;
+	}
+
+	//A sequence file that fails part way is abandoned and leaves the device as it was; a good one goes out
+	const string seqFile = "test_update.seq";
+	vector<short> seqWF(1000, 777);
+	write_sequence_file(seqFile, seqWF, true);
+	if (load_sequence_file(deviceID, seqFile.c_str()) == 0) {
+		cout << "FAILED to report an unreadable sequence file" << endl;
+		failures++;
+	}
+	if (waveform_mismatches(deviceID, 3, otherQ, 3) || waveform_mismatches(deviceID, 0, iWaveform, 3)) {
+		cout << "FAILED: a sequence file that failed to load still changed waveform memory" << endl;
+		failures++;
+	}
+	write_sequence_file(seqFile, seqWF, false);
+	if (load_sequence_file(deviceID, seqFile.c_str()) != 0) {
+		cout << "FAILED to load a sequence file" << endl;
+		failures++;
+	}
+	mismatches = 0;
+	for (int dac = 0; dac < 4; dac++) {
+		mismatches += waveform_mismatches(deviceID, dac, seqWF, 7);
+	}
+	//Nothing of an abandoned update goes out, and it leaves no update open
+	begin_update(deviceID);
+	set_waveform_int(deviceID, 0, shortWF.data(), shortWF.size());
+	abandon_update(deviceID);
+	mismatches += waveform_mismatches(deviceID, 0, seqWF, 7);
+	if (mismatches || commit_update(deviceID) == 0) {
+		cout << "MISMATCH in " << mismatches << " waveform words read back after loading a sequence file and abandoning an update" << endl;
+		failures++;
+	}
+	std::remove(seqFile.c_str());
+
+	//run waits for the commit, and the streaming threads' refills can't be held back by an update
+	begin_update(deviceID);
+	if (run(deviceID) == 0) {
+		cout << "FAILED to refuse run inside an update" << endl;
+		failures++;
+	}
+	abandon_update(deviceID);
+	const size_t numStreamed = 2*MAX_LL_LENGTH;
+	WordVec streamAddr(numStreamed, 0), streamCount(numStreamed, 0), streamTrigger(numStreamed, 0), streamRepeat(numStreamed, 0);
+	for (size_t ct = 0; ct < numStreamed; ct++) {
+		//miniLLs of 100 entries
+		streamRepeat[ct] = ((ct % 100 == 0) ? (1 << 15) : 0) | ((ct % 100 == 99 || ct == numStreamed - 1) ? (1 << 14) : 0);
+	}
+	set_channel_enabled(deviceID, 0, 1);
+	set_LL_data_IQ(deviceID, 0, numStreamed, streamAddr.data(), streamCount.data(), streamTrigger.data(), streamTrigger.data(), streamRepeat.data());
+	if (run(deviceID) != 0 || begin_update(deviceID) == 0) {
+		cout << "FAILED to refuse an update while streaming" << endl;
+		failures++;
+	}
+	stop(deviceID);
+	disconnect_sim(deviceID);
+	return failures;
+}
+
+//The upload cache skips only what the device holds and forgets it on overlaps and reprogramming
+int test::cacheTests() {
+	int failures = 0;
+
+	const string bitFile = "test_cache";
+	write_bitfiles(bitFile, 1 << 12, 0x5A);
+
+	vector<short> waveform(MAX_WF_LENGTH);
+	for (size_t ct = 0; ct < waveform.size(); ct++) {
+		waveform[ct] = short(0.8*MAX_WF_AMP*std::sin(2*M_PI*ct/1000.0));
+	}
+	const size_t numEntries = 1000;
+	WordVec addr(numEntries), count(numEntries), trigger1(numEntries, 0), trigger2(numEntries, 0), repeat(numEntries, 0);
+	for (size_t ct = 0; ct < numEntries; ct++) {
+		addr[ct] = (ct*37) % 1024;
+		count[ct] = ct % 16;
+	}
+
+	int deviceID = connect_sim(0, 0);
+	if (deviceID < 0) return 1;
+	auto load_all = [&](){
+		for (int dac = 0; dac < 4; dac++) {
+			set_waveform_int(deviceID, dac, waveform.data(), waveform.size());
+		}
+		set_LL_data_IQ(deviceID, 0, numEntries, addr.data(), count.data(), trigger1.data(), trigger2.data(), repeat.data());
+	};
+
+	load_all();
+	auto before = cache_counts(deviceID);
+	load_all();
+	auto after = cache_counts(deviceID);
+	if (after.first - before.first != 5 || after.second != before.second) {
+		cout << "FAILED: expected 5 hits loading the same data again, got " << after.first - before.first << endl;
+		failures++;
+	}
+
+	//Channel 0 overlaps the segment; the other three and the link list still match
+	vector<short> pulse(100, 1234);
+	set_waveform_segment_int(deviceID, 0, 1001, pulse.data(), pulse.size());
+	before = cache_counts(deviceID);
+	load_all();
+	after = cache_counts(deviceID);
+	if (after.first - before.first != 4 || after.second - before.second != 1) {
+		cout << "FAILED: expected 4 hits and 1 miss after an overlapping segment, got " << after.first - before.first
+			<< " and " << after.second - before.second << endl;
+		failures++;
+	}
+	size_t mismatches = 0;
+	for (size_t ct = 1000; ct < 1104; ct++) {
+		mismatches += USHORT(read_register(deviceID, FPGA1, FPGA_BANKSEL_WF_CHA | ct)) != USHORT(waveform[ct]);
+	}
+
+	initAPS(deviceID, const_cast<char *>(bitFile.c_str()), 1);
+	before = cache_counts(deviceID);
+	load_all();
+	after = cache_counts(deviceID);
+	if (after.first != before.first) {
+		cout << "FAILED: " << after.first - before.first << " upload(s) skipped after reprogramming" << endl;
+		failures++;
+	}
+	mismatches += waveform_mismatches(deviceID, 3, waveform, 7);
+	if (mismatches) {
+		cout << "MISMATCH in " << mismatches << " waveform words read back with the upload cache" << endl;
+		failures++;
+	}
+	disconnect_sim(deviceID);
+	remove_bitfiles(bitFile);
+
+	//Non-IQ link lists are 4 words an entry so a refill of the last entries overlaps the whole bank upload
+	UploadCache cache;
+	WordVec words = build_payload(4*numEntries);
+	auto reload = [&](){ return cache.check_and_stage(FPGA1, FPGA_BANKSEL_LL_CHA, words.data(), words.size(), 4); };
+	reload();
+	cache.commit_staged();
+	if (!reload()) {
+		cout << "FAILED: the upload cache missed a committed link list" << endl;
+		failures++;
+	}
+	cache.invalidate(FPGA1, FPGA_BANKSEL_LL_CHA | (numEntries - 10), 40, 4);
+	if (reload()) {
+		cout << "FAILED: the upload cache kept a link list a refill of its last entries overwrote" << endl;
+		failures++;
+	}
+	//Nothing is recorded until the flush has gone out
+	cache.drop_staged();
+	if (reload()) {
+		cout << "FAILED: the upload cache recorded a link list before its flush" << endl;
+		failures++;
+	}
+	cache.commit_staged();
+	if (!reload()) failures++;
+	return failures;
+}
+
+//Placement invariants of a waveform library: aligned, in range, no overlaps and every sample accounted for
+static int check_library(const WaveformLibrary & library, const map<string, size_t> & names) {
+	vector<std::pair<size_t, size_t>> spans;
+	size_t used = 0;
+	for (auto & entry : names) {
+		WaveformLibrary::Pulse pulse;
+		if (!library.find(entry.first, pulse) || pulse.numPts != entry.second || pulse.start % WF_MODULUS
+				|| pulse.span % WF_MODULUS || pulse.span < pulse.numPts || pulse.start + pulse.span > size_t(MAX_WF_LENGTH)) {
+			return 1;
+		}
+		spans.push_back({pulse.start, pulse.start + pulse.span});
+		used += pulse.span;
+	}
+	std::sort(spans.begin(), spans.end());
+	for (size_t ct = 1; ct < spans.size(); ct++) {
+		if (spans[ct].first < spans[ct-1].second) return 1;
+	}
+	return (library.num_pulses() != names.size() || used + library.free_samples() != size_t(MAX_WF_LENGTH)) ? 1 : 0;
+}
+
+//Random library operations keep the placement invariants; pulses added through the API read back after compaction
+int test::libraryTests() {
+	int failures = 0;
+
+	//Random adds, replacements and removes, with a compaction whenever the best fit fails
+	std::mt19937 rng(1234);
+	WaveformLibrary library;
+	map<string, size_t> names;
+	for (int ct = 0; ct < 20000; ct++) {
+		string name = "pulse" + std::to_string(rng() % 200);
+		if (rng() % 3 == 0) {
+			failures += (library.remove(name) == 0) != (names.erase(name) == 1);
+			continue;
+		}
+		const size_t numPts = 1 + rng() % 600;
+		WaveformLibrary::Pulse pulse;
+		int status = library.place(name, numPts, pulse);
+		if (status == -2 && library.free_samples() >= numPts + WF_MODULUS) {
+			library.remove(name);
+			names.erase(name);
+			auto moves = library.compact();
+			for (size_t move = 1; move < moves.size(); move++) {
+				failures += (moves[move].to < moves[move-1].to + moves[move-1].span || moves[move].to > moves[move].from);
+			}
+			status = library.place(name, numPts, pulse);
+		}
+		if (status == 0) {
+			names[name] = numPts;
+		}
+		if (check_library(library, names)) {
+			cout << "FAILED: waveform library placement broken after " << ct << " operations" << endl;
+			return failures + 1;
+		}
+	}
+
+	int deviceID = connect_sim(0, 0);
+	if (deviceID < 0) return failures + 1;
+
+	//30 pulses of 1000 samples and one more; then free every other one and add one that only fits once the gaps are closed
+	const size_t numPulses = 30, pulseLength = 1000;
+	vector<vector<short>> pulses(numPulses + 1, vector<short>(pulseLength));
+	for (size_t pulse = 0; pulse < pulses.size(); pulse++) {
+		for (size_t ct = 0; ct < pulseLength; ct++) {
+			pulses[pulse][ct] = short((pulse + 1) * 200 * std::sin(M_PI*ct/pulseLength));
+		}
+	}
+	unsigned short addr, count;
+	for (size_t pulse = 0; pulse < numPulses; pulse++) {
+		failures += add_pulse_int(deviceID, 0, ("p" + std::to_string(pulse)).c_str(), pulses[pulse].data(), pulseLength, &addr, &count) != 0;
+	}
+	failures += add_pulse_int(deviceID, 0, "new", pulses[numPulses].data(), pulseLength, &addr, &count) != 0;
+	for (size_t pulse = 0; pulse < numPulses; pulse += 2) {
+		remove_pulse(deviceID, 0, ("p" + std::to_string(pulse)).c_str());
+	}
+	vector<short> big(MAX_WF_LENGTH - (numPulses/2 + 1)*pulseLength - 16, 321);
+	int status = add_pulse_int(deviceID, 0, "big", big.data(), big.size(), &addr, &count);
+	if (status != 1) {
+		cout << "FAILED: expected the library to compact to fit a large pulse, got " << status << endl;
+		failures++;
+	}
+	size_t mismatches = 0;
+	auto check_pulse = [&](const string & name, const vector<short> & samples){
+		if (get_pulse(deviceID, 0, name.c_str(), &addr, &count) != 0 || count != (samples.size() + WF_MODULUS - 1) / WF_MODULUS - 1) {
+			mismatches++;
+			return;
+		}
+		mismatches += waveform_mismatches(deviceID, 0, samples, 7, size_t(addr) * WF_MODULUS);
+	};
+	for (size_t pulse = 1; pulse < numPulses; pulse += 2) {
+		check_pulse("p" + std::to_string(pulse), pulses[pulse]);
+	}
+	check_pulse("new", pulses[numPulses]);
+	check_pulse("big", big);
+	if (mismatches) {
+		cout << "MISMATCH in " << mismatches << " pulse samples read back after compaction" << endl;
+		failures++;
+	}
+
+	//A compaction whose upload fails puts the library and the samples back; the pulses are packed from 0 with
+	//the big one last, so freeing it and the first pulse leaves room that only a compaction makes one block of
+	remove_pulse(deviceID, 0, "big");
+	remove_pulse(deviceID, 0, "p1");
+	map<string, unsigned short> addresses;
+	for (size_t pulse = 3; pulse < numPulses; pulse += 2) {
+		const string name = "p" + std::to_string(pulse);
+		get_pulse(deviceID, 0, name.c_str(), &addr, &count);
+		addresses[name] = addr;
+	}
+	vector<short> huge(big.size() + 16 + pulseLength/2, -321);
+	disconnect_by_ID(deviceID);
+	if (add_pulse_int(deviceID, 0, "huge", huge.data(), huge.size(), &addr, &count) >= 0) {
+		cout << "FAILED: a pulse upload to a disconnected unit succeeded" << endl;
+		failures++;
+	}
+	connect_by_ID(deviceID);
+	size_t moved = (get_pulse(deviceID, 0, "huge", &addr, &count) == 0);
+	for (auto & entry : addresses) {
+		moved += (get_pulse(deviceID, 0, entry.first.c_str(), &addr, &count) != 0 || addr != entry.second);
+	}
+	if (moved) {
+		cout << "FAILED: " << moved << " pulse(s) moved or added by a failed upload" << endl;
+		failures++;
+	}
+	//Connected again the same pulse compacts and goes out with the others intact
+	if (add_pulse_int(deviceID, 0, "huge", huge.data(), huge.size(), &addr, &count) != 1) {
+		cout << "FAILED: expected the retried pulse to compact the library" << endl;
+		failures++;
+	}
+	for (size_t pulse = 3; pulse < numPulses; pulse += 2) {
+		check_pulse("p" + std::to_string(pulse), pulses[pulse]);
+	}
+	check_pulse("huge", huge);
+	if (mismatches) {
+		cout << "MISMATCH in " << mismatches << " pulse samples read back after a failed upload" << endl;
+		failures++;
+	}
+
+	//A whole waveform set on a channel holds its memory: pulses go after it and never get compacted into it
+	vector<short> loaded(1001);
+	for (size_t ct = 0; ct < loaded.size(); ct++) {
+		loaded[ct] = short(ct % 2000 - 1000);
+	}
+	set_waveform_int(deviceID, 1, loaded.data(), loaded.size());
+	add_pulse_int(deviceID, 1, "first", pulses[0].data(), pulseLength, &addr, &count);
+	add_pulse_int(deviceID, 1, "second", pulses[1].data(), pulseLength, &addr, &count);
+	remove_pulse(deviceID, 1, "first");
+	compact_waveform_library(deviceID, 1);
+	get_pulse(deviceID, 1, "second", &addr, &count);
+	if (size_t(addr) * WF_MODULUS != 1004 || waveform_mismatches(deviceID, 1, loaded) || waveform_mismatches(deviceID, 1, pulses[1], 1, 1004)) {
+		cout << "FAILED: a pulse added after a whole waveform landed at " << addr * WF_MODULUS << " or overwrote it" << endl;
+		failures++;
+	}
+
+	//Capacities that are not a multiple of WF_MODULUS have to take the padding into account
+	WaveformLibrary small(1002);
+	WaveformLibrary::Pulse pulse;
+	if (small.place("padded", 1001, pulse) != -1 || small.place("fits", 1000, pulse) != 0) {
+		cout << "FAILED: a padded pulse past the capacity of the waveform library was not rejected" << endl;
+		failures++;
+	}
+	disconnect_sim(deviceID);
+	return failures;
+}
+
+//Link list ranges as spans into the bank, wrapping or not
+int test::linkListTests() {
+	int failures = 0;
+
+	const size_t numEntries = 3000;
+	WordVec addr(numEntries), count(numEntries), trigger1(numEntries), trigger2(numEntries), repeat(numEntries, 0);
+	for (size_t ct = 0; ct < numEntries; ct++) {
+		addr[ct] = (ct*37) % 1024;
+		count[ct] = ct % 16;
+		trigger1[ct] = ct % 3;
+		trigger2[ct] = ct % 5;
+	}
+	LLBank bank(addr, count, trigger1, trigger2, repeat);
+	const WordVec whole = legacy::get_packed_data(bank, 0, numEntries);
+	if (whole.size() != 5*numEntries) {
+		cout << "FAILED: packed " << whole.size() << " words for " << numEntries << " IQ entries" << endl;
+		return 1;
+	}
+	size_t mismatches = 0;
+	for (size_t startIdx : {size_t(0), size_t(1), size_t(1234), numEntries - 1}) {
+		for (size_t stopIdx : {size_t(0), size_t(1), size_t(777), size_t(2999), numEntries}) {
+			if (stopIdx == startIdx) continue;
+			LLBank::PackedSpans spans = bank.get_packed_data(startIdx, stopIdx);
+			const size_t expectedEntries = (stopIdx > startIdx) ? stopIdx - startIdx : numEntries - startIdx + stopIdx;
+			mismatches += (spans.size() != 5*expectedEntries) || (stopIdx > startIdx && spans.second.size != 0);
+			WordVec words = legacy::get_packed_data(bank, startIdx, stopIdx);
+			for (size_t ct = 0; ct < words.size() && ct < 5*expectedEntries; ct++) {
+				mismatches += words[ct] != whole[(5*startIdx + ct) % whole.size()];
+			}
+		}
+	}
+	if (mismatches) {
+		cout << "MISMATCH in " << mismatches << " link list words from get_packed_data spans" << endl;
+		failures++;
+	}
+	return failures;
+}
+
+int test::runSimTests() {
+	const vector<std::pair<string, int (*)()>> tests = {
+		{"block-write encoder", encoderTests},
+		{"word packing kernels", packTests},
+		{"waveform prep kernels", prepTests},
+		{"int16 channels", channelTests},
+		{"SPI", spiTests},
+		{"transport", transportTests},
+		{"upload engine", uploadTests},
+		{"transfer profiles", profileTests},
+		{"simulated init and upload", simInitTests},
+		{"shadow registers", shadowTests},
+		{"bitfile cache and rack init", rackTests},
+		{"I/O statistics", ioStatsTests},
+		{"tracing", traceTests},
+		{"segment, coalesced and broadcast updates", updateTests},
+		{"upload cache", cacheTests},
+		{"waveform library", libraryTests},
+		{"link list spans", linkListTests}
+	};
+	int failures = 0;
+	for (auto & test : tests) {
+		int testFailures = test.second();
+		cout << (testFailures ? "FAILED " : "passed ") << test.first << endl;
+		failures += testFailures;
+	}
+	cout << endl << (failures ? std::to_string(failures) + " check(s) FAILED" : string("All checks passed")) << endl;
+	return failures;
+}
@@ -218,6 +218,7 @@ void test::printHelp(){
 	cout << spacing << "-trig Get/Set trigger interval" << endl;
 	cout << spacing << "-seq Load sequence file" << endl;
 	cout << spacing << "-offset Set offset and scale" << endl;
+	cout << "Or with no device: test -sim to run the checks against simulated units" << endl;
 }
 
 // command options functions taken from:
@@ -250,6 +251,13 @@ int main(int argc, char** argv) {
 		return 0;
 	}
 
+	if (cmdOptionExists(argv, argv + argc, "-sim")) {
+		//Quiet enough to see the results; debug logging reads back every upload
+		set_console_logging_level(plog::warning);
+		set_file_logging_level(plog::warning);
+		return test::runSimTests() ? -1 : 0;
+	}
+
 	int device_id = atoi(argv[1]);
 
 	string bitFile = getCmdOption(argv, argv + argc, "-b");
@@ -18,6 +18,26 @@ namespace test {
 
 	void printHelp();
 
+	//Checks against simulated units; no APS needed (see simtests.cpp). Each returns the number of failures.
+	int encoderTests();
+	int packTests();
+	int prepTests();
+	int channelTests();
+	int spiTests();
+	int transportTests();
+	int uploadTests();
+	int profileTests();
+	int simInitTests();
+	int shadowTests();
+	int rackTests();
+	int ioStatsTests();
+	int traceTests();
+	int updateTests();
+	int cacheTests();
+	int libraryTests();
+	int linkListTests();
+	int runSimTests();
+
 	enum PULSE_TYPE {INT_TYPE, FLOAT_TYPE};
 
 }; // name space test
@@ -15,6 +15,7 @@
 # limitations under the License.
 
 import ctypes
+from contextlib import contextmanager
 from ctypes.util import find_library
 import numpy.ctypeslib as npct
 import sys
@@ -74,6 +75,10 @@ libaps.set_file_logging_level.argtype = [PlogSeverity]
 libaps.set_file_logging_level.restype = ctypes.c_int
 libaps.set_console_logging_level.argtype = [PlogSeverity]
 libaps.set_console_logging_level.restype = ctypes.c_int
+libaps.set_simulated_devices.argtypes = [ctypes.c_int, ctypes.c_double, ctypes.c_double]
+libaps.init_all.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_double)]
+libaps.get_io_stats.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_ulonglong), ctypes.c_int]
+libaps.start_trace.argtypes = [ctypes.c_char_p]
 
 # initialize the library
 libaps.init()
@@ -96,6 +101,40 @@ def set_logging_level(file_log_level=PlogSeverity.info, console_log_level=PlogSe
             raise TypeError(f"Unknown libaps console logging level: {console_log_level}.")
         libaps.set_console_logging_level(console_log_level)
 
+def set_simulated_devices(num_devices, latency=0, bandwidth=0):
+    """Add simulated APS units (serials SIM0, SIM1, ...) after any real ones.
+    latency is per USB transfer in us and bandwidth in MB/s (0 for unlimited)."""
+    libaps.set_simulated_devices(num_devices, latency, bandwidth)
+
+def start_trace(filename):
+    """Record a timeline of library calls, init phases, flushes and streaming cycles to filename
+    in the Chrome trace event format (open it in chrome://tracing or Perfetto)."""
+    if libaps.start_trace(str(filename).encode()) != 0:
+        raise IOError(f"Unable to start a trace in {filename}.")
+
+def stop_trace():
+    """Finish the trace file. Returns the number of spans written."""
+    return libaps.stop_trace()
+
+def init_all(filename=None, force=False):
+    """Initialize all connected APS units in parallel with the same bitfile.
+
+    Args:
+        - filename: Optional bitfile name. If None loads the APS (not DACII) default from
+            libaps/bitfiles/ directory.
+        - force: Optional, if True forces every APS to reload the bitfile from disk.
+    Returns:
+        - (status, statuses, init_times): 0 if every connected unit initialized, then the
+            status and init time in seconds of each device ID (-4 for units not connected).
+    """
+    if filename is None:
+        filename = os.path.join(APS_ROOT, 'bitfiles/mqco_aps_latest')
+    num_devices = libaps.get_numDevices()
+    statuses = (ctypes.c_int * num_devices)()
+    init_times = (ctypes.c_double * num_devices)()
+    status = libaps.init_all(str(filename).encode(), force, statuses, init_times)
+    return status, list(statuses), list(init_times)
+
 
 class APS(object):
     """Implements an interface to the BBN APS unit via the libaps C library."""
@@ -117,6 +156,13 @@ class APS(object):
     # trigger modes
     TRIGGER_INTERNAL = 0
     TRIGGER_EXTERNAL = 1
+    # USB transfer profiles
+    PROFILE_INTERACTIVE = 0
+    PROFILE_BULK_UPLOAD = 1
+    PROFILE_STREAMING_POLL = 2
+    # USB traffic counters: operations in IO_OP order and the count, bytes, time and 24 histogram buckets of each
+    IO_OPS = ('write', 'read', 'spi', 'flush', 'stream_refill', 'cache_hit', 'cache_miss')
+    IO_STATS_LENGTH = 27
     VALID_FREQUENCIES = (1200, 600, 300, 100, 40)
 
     def __init__(self):
@@ -228,8 +274,9 @@ class APS(object):
 
         Waveform data type must be int16, int32, float32 or float64. Integers must be in
         range (-8191, 8191) and will be cast to int16. Floats must be in range (-1, 1) and
-        will be cast to float32. The casts are done using numpy.ndarray.astype(casting='unsafe')
-        so data conversions may be done, and ranges are unchecked.
+        will be cast to float32. The casts are done using numpy.ascontiguousarray (unsafe casting)
+        so data conversions may be done, and ranges are unchecked. Contiguous int16 and float32
+        arrays are passed to the driver without a copy.
 
         The channel will also be enabled.
 
@@ -242,13 +289,14 @@ class APS(object):
         if not self.is_open:
             return -1
         if waveform.dtype == np.dtype('int16') or waveform.dtype == np.dtype('int32'):
-            waveform = waveform.astype('int16')
+            # passed to the driver in place when it is already contiguous int16
+            waveform = np.ascontiguousarray(waveform, dtype='int16')
             c_int_p = ctypes.POINTER(ctypes.c_int16)
             waveform_p = waveform.ctypes.data_as(c_int_p)
             val = self.librarycall('set_waveform_int', ch-1, waveform_p, waveform.size)
         elif waveform.dtype == np.dtype('float32') or waveform.dtype == np.dtype('float64'):
             # libaps-cpp expects float rather than double
-            waveform = waveform.astype('float32')
+            waveform = np.ascontiguousarray(waveform, dtype='float32')
             c_float_p = ctypes.POINTER(ctypes.c_float)
             waveform_p = waveform.ctypes.data_as(c_float_p)
             val = self.librarycall('set_waveform_float', ch-1, waveform_p, waveform.size)
@@ -257,6 +305,85 @@ class APS(object):
         self.set_enabled(ch, True)
         return val
 
+    def load_waveform_segment(self, ch, start, waveform):
+        """Overwrite part of a channel's waveform starting at sample start.
+
+        Only the samples around the segment (rounded out to multiples of 4) are written to
+        the APS so small edits to a large waveform library are cheap. Writing past the end of
+        the current waveform extends it. Data types are handled as in load_waveform.
+
+        Args:
+            - ch: Channel, integer 1-4
+            - start: First sample to overwrite
+            - waveform: Numpy array of waveform data.
+        Returns:
+            - Status code: negative for failure, 0 for success.
+        """
+        if not self.is_open:
+            return -1
+        if waveform.dtype == np.dtype('int16') or waveform.dtype == np.dtype('int32'):
+            waveform = np.ascontiguousarray(waveform, dtype='int16')
+            c_int_p = ctypes.POINTER(ctypes.c_int16)
+            waveform_p = waveform.ctypes.data_as(c_int_p)
+            return self.librarycall('set_waveform_segment_int', ch-1, start, waveform_p, waveform.size)
+        elif waveform.dtype == np.dtype('float32') or waveform.dtype == np.dtype('float64'):
+            waveform = np.ascontiguousarray(waveform, dtype='float32')
+            c_float_p = ctypes.POINTER(ctypes.c_float)
+            waveform_p = waveform.ctypes.data_as(c_float_p)
+            return self.librarycall('set_waveform_segment_float', ch-1, start, waveform_p, waveform.size)
+        else:
+            raise NameError('Unhandled waveform data type. Use int16 or float64')
+
+    def add_pulse(self, ch, name, waveform):
+        """Place a named pulse in a channel's waveform library and upload only its samples.
+
+        Pulses are packed into the 32K sample waveform memory on 4 sample boundaries. Adding a
+        name again replaces that pulse. When memory is fragmented the library is compacted, which
+        moves other pulses: fetch their addresses again with pulse(). Loading a whole waveform
+        with load_waveform drops the library; pulses added after it are placed past its samples.
+
+        Args:
+            - ch: Channel, integer 1-4
+            - name: Pulse name
+            - waveform: Numpy array of waveform data, int16 or float as in load_waveform.
+        Returns:
+            - (addr, count, compacted): link list address and count for the pulse and whether
+              other pulses were moved to make room.
+        """
+        if not self.is_open:
+            raise IOError('APS is not open.')
+        addr = ctypes.c_uint16()
+        count = ctypes.c_uint16()
+        if waveform.dtype == np.dtype('int16') or waveform.dtype == np.dtype('int32'):
+            waveform = np.ascontiguousarray(waveform, dtype='int16')
+            waveform_p = waveform.ctypes.data_as(ctypes.POINTER(ctypes.c_int16))
+            val = self.librarycall('add_pulse_int', ch-1, name.encode(), waveform_p, waveform.size, ctypes.byref(addr), ctypes.byref(count))
+        elif waveform.dtype == np.dtype('float32') or waveform.dtype == np.dtype('float64'):
+            waveform = np.ascontiguousarray(waveform, dtype='float32')
+            waveform_p = waveform.ctypes.data_as(ctypes.POINTER(ctypes.c_float))
+            val = self.librarycall('add_pulse_float', ch-1, name.encode(), waveform_p, waveform.size, ctypes.byref(addr), ctypes.byref(count))
+        else:
+            raise NameError('Unhandled waveform data type. Use int16 or float64')
+        if val < 0:
+            raise IOError('Unable to place pulse {0}. Returned error code: {1}'.format(name, val))
+        return addr.value, count.value, val == 1
+
+    def pulse(self, ch, name):
+        """Link list (addr, count) of a pulse in a channel's waveform library."""
+        addr = ctypes.c_uint16()
+        count = ctypes.c_uint16()
+        if self.librarycall('get_pulse', ch-1, name.encode(), ctypes.byref(addr), ctypes.byref(count)) < 0:
+            raise KeyError(name)
+        return addr.value, count.value
+
+    def remove_pulse(self, ch, name):
+        """Free a pulse's space in the waveform library; nothing is written to the APS."""
+        return self.librarycall('remove_pulse', ch-1, name.encode())
+
+    def compact_library(self, ch):
+        """Close the gaps between pulses in the waveform library. Returns the number of pulses moved."""
+        return self.librarycall('compact_waveform_library', ch-1)
+
     def load_config(self, filename):
         """Load a complete 4 channel configuration file.
 
@@ -377,6 +504,62 @@ class APS(object):
     def trigger_interval(self, interval):
         self.librarycall('set_trigger_interval', interval)
 
+    @property
+    def transfer_size(self):
+        """Largest USB write, in bytes, used for waveform and link list uploads."""
+        return self.librarycall('get_transfer_size')
+
+    @transfer_size.setter
+    def transfer_size(self, size):
+        self.librarycall('set_transfer_size', size)
+
+    @property
+    def transfer_profile(self):
+        """USB latency/timeout profile used outside of bulk uploads and streaming address polls. One of 'interactive', 'bulk upload' or 'streaming poll'."""
+        valueMap = {self.PROFILE_INTERACTIVE: 'interactive', self.PROFILE_BULK_UPLOAD: 'bulk upload', self.PROFILE_STREAMING_POLL: 'streaming poll'}
+        return valueMap[self.librarycall('get_transfer_profile')]
+
+    @transfer_profile.setter
+    def transfer_profile(self, profile):
+        allowedValues = {'interactive': self.PROFILE_INTERACTIVE, 'bulk upload': self.PROFILE_BULK_UPLOAD, 'streaming poll': self.PROFILE_STREAMING_POLL}
+        if profile.lower() not in allowedValues:
+            raise ValueError('Unrecognized transfer profile: {}'.format(profile))
+        self.librarycall('set_transfer_profile', allowedValues[profile.lower()])
+
+    def io_stats(self):
+        """USB traffic counters since connecting or the last reset_io_stats.
+
+        Returns:
+            - dict keyed by operation ('write', 'read', 'spi', 'flush', 'stream_refill', 'cache_hit',
+                'cache_miss') of dicts with the operation 'count', 'bytes', total 'time' in seconds and
+                the latency 'histogram'. Histogram bucket 0 counts operations under 1 us and bucket k
+                those in [2^(k-1), 2^k) us. 'cache_hit' and 'cache_miss' count the waveform and link
+                list writes the upload cache skipped and let through.
+        """
+        stats = {}
+        for op, name in enumerate(self.IO_OPS):
+            values = (ctypes.c_ulonglong * self.IO_STATS_LENGTH)()
+            if self.librarycall('get_io_stats', op, values, self.IO_STATS_LENGTH) != self.IO_STATS_LENGTH:
+                return {}
+            stats[name] = {'count': values[0], 'bytes': values[1], 'time': values[2]*1e-9, 'histogram': list(values[3:])}
+        return stats
+
+    def reset_io_stats(self):
+        """Zero the USB traffic counters."""
+        self.librarycall('reset_io_stats')
+
+    def upload_cache_hit_rate(self):
+        """Fraction of waveform and link list writes skipped because the memory already held them."""
+        stats = self.io_stats()
+        if not stats:
+            return 0.0
+        numWrites = stats['cache_hit']['count'] + stats['cache_miss']['count']
+        return float(stats['cache_hit']['count']) / numWrites if numWrites else 0.0
+
+    def clear_upload_cache(self):
+        """Forget what waveform and link list memory holds so the next uploads are all sent."""
+        self.librarycall('clear_upload_cache')
+
     def set_offset(self, ch, offset):
         """Set channel offset.
 
@@ -434,6 +617,40 @@ class APS(object):
         with h5py.File(filename, 'r') as FID:
             self.loadWaveform(ch-1, FID['WFVec'].value)
 
+    def begin_update(self):
+        """Start queuing waveform and register changes instead of sending each one.
+
+        Repeated changes to a channel's waveform (e.g. new amplitude and offset) are merged and
+        everything goes out in one flush on commit. Updates nest. Register reads still go to the
+        hardware so they do not see queued changes. Loading the same waveform on channels 1 and 3
+        (or 2 and 4), or the same IQ link list on both FPGAs, within one update sends it only once.
+        Not available while link lists stream; run and stop are refused inside an update.
+        """
+        return self.librarycall('begin_update')
+
+    def commit(self):
+        """Send everything queued since begin_update."""
+        return self.librarycall('commit_update')
+
+    def abandon_update(self):
+        """Drop everything queued since begin_update without sending it."""
+        return self.librarycall('abandon_update')
+
+    @contextmanager
+    def update(self):
+        """Context manager for begin_update/commit: `with aps.update(): ...`
+
+        If the block raises, the update is abandoned rather than committed.
+        """
+        if self.begin_update() < 0:
+            raise IOError('Unable to begin an update; link lists may be streaming.')
+        try:
+            yield self
+        except:
+            self.abandon_update()
+            raise
+        self.commit()
+
     def set_all(self, settings):
         """ Load all settings from dictionary, similar to MATLAB driver.
 
@@ -442,21 +659,23 @@ class APS(object):
         """
         #TODO: Describe required settings in docstring.
 
-        #First load all the channel offsets, scalings, enabled
-        CHANNELNAMES = ('chan_1','chan_2','chan_3','chan_4')
-        for ch, channelName in enumerate(CHANNELNAMES):
-            self.set_amplitude(ch+1, settings[channelName]['amplitude'])
-            self.set_offset(ch+1, settings[channelName]['offset'])
-            self.set_enabled(ch+1, settings[channelName]['enabled'])
-            self.setRunMode(ch+1, settings['runMode'])
-            if 'seqfile' in settings[channelName] and settings[channelName]['seqfile']:
-                self.load_waveform_from_file(ch+1, settings[channelName]['seqfile'])
-        #Load the sequence file information
-        if 'chAll' in settings and settings['chAll']['seqfile']:
-            self.load_config(settings['chAll']['seqfile'])
-        self.samplingRate = settings['frequency']
-        self.triggerSource = settings['triggerSource']
-        self.triggerInterval = settings['triggerInterval']
+        #Queue everything and send it together; each channel's waveform is rewritten at most once
+        with self.update():
+            #First load all the channel offsets, scalings, enabled
+            CHANNELNAMES = ('chan_1','chan_2','chan_3','chan_4')
+            for ch, channelName in enumerate(CHANNELNAMES):
+                self.set_amplitude(ch+1, settings[channelName]['amplitude'])
+                self.set_offset(ch+1, settings[channelName]['offset'])
+                self.set_enabled(ch+1, settings[channelName]['enabled'])
+                self.set_run_mode(ch+1, settings['runMode'])
+                if 'seqfile' in settings[channelName] and settings[channelName]['seqfile']:
+                    self.load_waveform_from_file(ch+1, settings[channelName]['seqfile'])
+            #Load the sequence file information
+            if 'chAll' in settings and settings['chAll']['seqfile']:
+                self.load_config(settings['chAll']['seqfile'])
+            self.sampling_rate = settings['frequency']
+            self.trigger_source = settings['triggerSource']
+            self.trigger_interval = settings['triggerInterval']
 
     def librarycall(self, functionName, *args):
         """Call a function from the C library.